@@ -0,0 +1,67 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "request_trace.h"
+
+// Binary access log, one fixed 64-byte record per request, for billing and
+// analytics. The I/O loop pushes records into a ring without formatting or
+// syscalls; a background thread copies them every
+// access_log.flush_interval_ms into access_log.path, which is mapped into
+// memory at access_log.max_bytes. A full file is cut to its used length and
+// rotated to path.1, path.2, ... keeping access_log.max_files files in all.
+// A file that is still being written, or was left by a crash, ends in zeroed
+// records.
+//
+// build/access_log_decode (`make access_log_decode`) turns the files into
+// text, CSV or JSON lines.
+//
+// Records are in host byte order; the header's byte_order field reads
+// ACCESS_LOG_BYTE_ORDER when that matches the reader's.
+
+#define ACCESS_LOG_MAGIC "HTTPACC"
+#define ACCESS_LOG_VERSION 1
+#define ACCESS_LOG_BYTE_ORDER 0x01020304u
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t byte_order;
+  uint32_t reserved[11];
+} AccessLogHeader;
+
+typedef struct {
+  uint64_t timestamp_us; // Accepted at, since the epoch. 0 ends the file.
+  uint8_t addr[16];      // IPv4 in the first 4 bytes
+  uint16_t port;
+  uint8_t family; // 4 or 6, 0 if unknown
+  uint8_t method; // MethodId
+  uint16_t route; // RouteId
+  uint16_t status;
+  uint32_t bytes_in;
+  uint32_t reserved;
+  uint64_t bytes_out;
+  uint32_t phase_us[PHASE_COUNT]; // See RequestPhase
+} AccessLogRecord;
+
+_Static_assert(sizeof(AccessLogHeader) == 64, "access log header layout");
+_Static_assert(sizeof(AccessLogRecord) == 64, "access log record layout");
+
+typedef struct {
+  uint64_t written;
+  uint64_t dropped; // Found the ring full
+  uint64_t rotations;
+  uint64_t failures;
+} AccessLogStats;
+
+// Does nothing when access_log.path is empty
+bool access_log_start();
+void access_log_stop();
+bool access_log_enabled();
+// I/O loop only
+void access_log_write(const AccessLogRecord *record);
+AccessLogStats access_log_stats();
+
+#endif // ACCESS_LOG_H
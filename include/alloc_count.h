@@ -0,0 +1,15 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <stdint.h>
+
+// Counts the heap allocations each thread makes. malloc, calloc and realloc
+// are replaced in the server binary by versions that bump a thread-local
+// counter and call glibc's own, so counting costs one increment and needs no
+// preloading. Memory from json_arena's chunks is counted once per chunk.
+// Without glibc nothing is replaced and the count stays 0.
+
+// Allocations made so far by the calling thread
+uint64_t alloc_count();
+
+#endif // ALLOC_COUNT_H
@@ -0,0 +1,25 @@
+#ifndef AUTH_H
+#define AUTH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "work_pool.h"
+
+// Credential hashing. Passwords are stored as yescrypt hashes (memory hard,
+// tens of milliseconds per hash), so hashing and verification run on their
+// own pool instead of the I/O loop or the database threads. The pool queue
+// is small on purpose: when it is full, callers shed load with a 503 rather
+// than letting an auth burst build an unbounded backlog.
+
+bool auth_start(CompletionQueue *completions);
+void auth_stop();
+
+// Queues the job with a deadline of auth.deadline_ms from now. Returns false
+// if the queue is full.
+bool auth_submit(WorkJob *job);
+
+// Only call these from auth pool jobs
+bool auth_hash_password(const char *password, char *hash, size_t hash_size);
+bool auth_verify_password(const char *password, const char *hash);
+
+#endif // AUTH_H
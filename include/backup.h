@@ -0,0 +1,37 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Online backup of the SQLite database to db.backup_path, run on a background
+// thread with sqlite3_backup_step(). Pages are copied db.backup_step_pages at
+// a time with a pause of db.backup_step_sleep_ms between steps, so writers
+// never wait on the backup for long. The copy is written next to the
+// destination and renamed over it once complete, so db.backup_path is always
+// a whole database.
+//
+// A backup runs every db.backup_interval_s seconds (if not 0) and whenever
+// one is requested with backup_request().
+
+typedef struct {
+  bool running;
+  int pages_done;
+  int pages_total;
+  uint64_t completed;
+  uint64_t failed;
+  bool last_ok;
+  double last_duration_ms;
+  time_t last_finished_at;
+} BackupStats;
+
+bool backup_start();
+void backup_stop();
+
+// Returns false if a backup is already running or the storage engine is not
+// SQLite
+bool backup_request();
+BackupStats backup_stats();
+
+#endif // BACKUP_H
@@ -0,0 +1,28 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bloom filter over strings. Bits are set with atomic ORs, so adding and
+// querying are safe from any thread without a lock. A negative answer is
+// definite, a positive one is only probable. A filter that was never
+// initialized, or was freed, holds nothing and answers yes to everything.
+
+typedef struct {
+  uint64_t *bits;
+  size_t bit_count;
+  unsigned int hash_count;
+  uint64_t inserted;
+} BloomFilter;
+
+// Sized for `capacity` items with bits_per_item bits each (10 bits per item
+// gives a false positive rate around 1%)
+bool bloom_init(BloomFilter *filter, size_t capacity, unsigned int bits_per_item);
+void bloom_free(BloomFilter *filter);
+
+void bloom_add(BloomFilter *filter, const char *key);
+bool bloom_maybe_contains(const BloomFilter *filter, const char *key);
+
+#endif // BLOOM_H
@@ -120,6 +120,9 @@ typedef struct cJSON
 
     /* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
     char *string;
+
+    /* Hash index over an object's keys, built by the first lookup that walks past CJSON_INDEX_MIN_KEYS items and dropped by any change made through the cJSON API. Internal, don't touch. Code that edits the child list or a key directly must call cJSON_DropIndex on the object. */
+    struct cJSON_Index *index;
 } cJSON;
 
 typedef struct cJSON_Hooks
@@ -143,12 +146,32 @@ typedef int cJSON_bool;
 #define CJSON_CIRCULAR_LIMIT 10000
 #endif
 
+/* How many items a lookup walks before the object gets a hash index of its keys. Building one makes the first lookup on a shared object a write, so index objects read from several threads up front (see cJSON_DropIndex). */
+#ifndef CJSON_INDEX_MIN_KEYS
+#define CJSON_INDEX_MIN_KEYS 32
+#endif
+
 /* returns the version of cJSON as a string */
 CJSON_PUBLIC(const char*) cJSON_Version(void);
 
 /* Supply malloc, realloc and free functions to cJSON */
 CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks);
 
+/* Routines the parser scans whitespace, strings and numbers with. cJSON_ScanAuto, picked at startup, uses the fastest the CPU supports. cJSON_ScanScalar is the byte-at-a-time reference that parses every number with strtod. Returns false if the CPU can't run the one asked for. Not thread safe, switch before parsing. */
+typedef enum
+{
+    cJSON_ScanAuto,
+    cJSON_ScanScalar,
+    cJSON_ScanWord,
+    cJSON_ScanSSE2,
+    cJSON_ScanAVX2
+} cJSON_ScanBackend;
+CJSON_PUBLIC(cJSON_bool) cJSON_SetScanBackend(cJSON_ScanBackend backend);
+CJSON_PUBLIC(const char*) cJSON_GetScanBackend(void);
+
+/* Supply a check for memory that is released in bulk (e.g. by an arena). cJSON_Delete returns straight away for items it claims, so a tree must come entirely from one such allocator. NULL turns the check off. */
+CJSON_PUBLIC(void) cJSON_InitBulkFreeCheck(cJSON_bool (*owns)(const void *ptr));
+
 /* Memory Management: the caller is always responsible to free the results from all variants of cJSON_Parse (with cJSON_Delete) and cJSON_Print (with stdlib free, cJSON_Hooks.free_fn, or cJSON_free as appropriate). The exception is cJSON_PrintPreallocated, where the caller has full responsibility of the buffer. */
 /* Supply a block of JSON, and this returns a cJSON object you can interrogate. */
 CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value);
@@ -178,6 +201,9 @@ CJSON_PUBLIC(cJSON *) cJSON_GetArrayItem(const cJSON *array, int index);
 CJSON_PUBLIC(cJSON *) cJSON_GetObjectItem(const cJSON * const object, const char * const string);
 CJSON_PUBLIC(cJSON *) cJSON_GetObjectItemCaseSensitive(const cJSON * const object, const char * const string);
 CJSON_PUBLIC(cJSON_bool) cJSON_HasObjectItem(const cJSON *object, const char *string);
+/* Builds the key index of object now (regardless of size) or frees it. Returns false if object can't be indexed: not an object, a reference, an item without a key, or out of memory. */
+CJSON_PUBLIC(cJSON_bool) cJSON_BuildIndex(cJSON *object);
+CJSON_PUBLIC(void) cJSON_DropIndex(cJSON *object);
 /* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when cJSON_Parse() succeeds. */
 CJSON_PUBLIC(const char *) cJSON_GetErrorPtr(void);
 
@@ -0,0 +1,93 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CONFIG_PATH "./server.conf"
+
+typedef struct {
+  int port;
+
+  // Storage engine (see storage.h) and where each engine keeps its data
+  char db_engine[16];
+  char db_path[256];
+  char db_log_path[256];
+  long long db_log_compact_min_bytes;
+
+  // Online backups of the SQLite database
+  char db_backup_path[256];
+  int db_backup_interval_s;
+  int db_backup_step_pages;
+  int db_backup_step_sleep_ms;
+
+  // SQLite tuning profile, applied to every connection on open
+  char db_journal_mode[16];
+  char db_synchronous[16];
+  long long db_mmap_size;
+  int db_cache_size;
+  char db_temp_store[16];
+  int db_busy_timeout_ms;
+
+  // Group-commit writer
+  int db_writer_queue_size;
+  int db_writer_batch_size;
+  int db_writer_flush_ms;
+  bool db_writer_ack_before_durable;
+
+  // Pool running database reads off the I/O loop
+  int db_executor_threads;
+  int db_executor_queue_size;
+
+  // Password hashing pool
+  int auth_threads;
+  int auth_queue_size;
+  int auth_deadline_ms;
+  int auth_hash_cost;
+
+  // Sessions
+  int session_ttl_s;
+  char session_snapshot_path[256];
+  int session_snapshot_interval_s;
+
+  // Caches
+  int cache_users_capacity;
+  int cache_users_negative_ttl_s;
+  int cache_username_filter_bits;
+  int cache_username_filter_min_capacity;
+  int cache_responses_capacity;
+  int cache_responses_ttl_ms;
+  int cache_responses_stale_ms;
+
+  // Logging
+  char log_levels[128];
+  bool log_async;
+  int log_ring_records;
+  int log_flush_interval_ms;
+  int log_shutdown_flush_ms;
+  int log_slow_request_ms;
+
+  // Access log
+  char access_log_path[256];
+  long long access_log_max_bytes;
+  int access_log_max_files;
+  int access_log_queue_records;
+  int access_log_flush_interval_ms;
+
+  // Latency histogram snapshots
+  char latency_snapshot_path[256];
+  int latency_snapshot_interval_ms;
+} ServerConfig;
+
+extern ServerConfig server_config;
+
+// Loads `key = value` lines from path on top of the defaults. Lines starting
+// with '#' are comments. Returns false if the file can't be read or contains
+// an unknown key or an invalid value.
+bool config_load(const char *path);
+// Re-reads the options that can change while the server runs, only
+// log.levels for now, from the file last given to config_load()
+bool config_reload(void);
+void config_print(void);
+
+#endif // CONFIG_H
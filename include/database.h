@@ -1,6 +1,12 @@
+#ifndef DATABASE_H
+#define DATABASE_H
+
 #include <sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-#define DB_PATH "./db/sqlite3.db"
+#define DB_USERNAME_MAX 64
+#define DB_PASSWORD_MAX 256
 
 typedef struct {
     int id;
@@ -16,12 +22,54 @@ typedef struct {
     long timestamp;
 } UserScore;
 
+// Prepared statements kept alive for the lifetime of a connection.
+// Each entry has its SQL in `statement_sql` (database.c).
+typedef enum {
+    STMT_SEARCH_USER = 0,
+    STMT_USER_ID,
+    STMT_ADD_USER,
+    STMT_ADD_SCORE,
+    STMT_BEGIN,
+    STMT_COMMIT,
+    STMT_ROLLBACK,
+    STMT_COUNT
+} StatementId;
+
 bool create_database();
 void create_table(const char *table, const char *columns);
 bool sql_execute(const char* sql);
 
-bool sql_search_username(const char *username, const char *password);
+// Connection handling. Every thread lazily opens its own connection on first
+// use and keeps it (and its prepared statements) until db_close_connection().
+sqlite3 *db_connection();
+sqlite3_stmt *db_statement(StatementId id);
+void db_reset_statement(sqlite3_stmt *stmt);
+void db_close_connection();
+
+// Copies the id and stored password hash of the user, false if there is no
+// such user
+bool sql_get_credentials(const char *username, int *user_id, char *password, size_t password_size);
 bool sql_add_user(const char *username, const char *password);
+bool sql_add_score(int user_id, const char *username, int score, long timestamp);
+
+// Returns the id of the user or -1 if there is no such user
+int sql_get_user_id(const char *username);
+
+// Calls fn for every username in User, returns the number of users or -1
+typedef void (*UsernameRowFn)(void *ctx, const char *username);
+long sql_for_each_username(UsernameRowFn fn, void *ctx);
+long sql_count_users();
+
+// Calls fn for every row of UserScore
+typedef void (*ScoreRowFn)(void *ctx, const char *username, int score, long timestamp);
+bool sql_for_each_score(ScoreRowFn fn, void *ctx);
+
+// Explicit transactions on the calling thread's connection
+bool sql_begin();
+bool sql_commit();
+bool sql_rollback();
 
 // bool sql_insert(const char* table, const char* values);
-// bool sql_select(const char* table, const char* columns);
\ No newline at end of file
+// bool sql_select(const char* table, const char* columns);
+
+#endif // DATABASE_H
@@ -0,0 +1,17 @@
+#ifndef DB_EXECUTOR_H
+#define DB_EXECUTOR_H
+
+#include <stdbool.h>
+#include "work_pool.h"
+
+// Pool of threads running database reads off the I/O loop. Every thread owns
+// its own connection (see db_connection()). A job's continuation runs on the
+// I/O loop once the query has finished.
+
+bool db_executor_start(CompletionQueue *completions);
+void db_executor_stop();
+
+// Returns false if the executor queue is full
+bool db_executor_submit(WorkJob *job);
+
+#endif // DB_EXECUTOR_H
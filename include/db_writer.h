@@ -0,0 +1,50 @@
+#ifndef DB_WRITER_H
+#define DB_WRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "database.h"
+
+// Background writer thread that owns all inserts. Requests are queued on a
+// bounded multi-producer queue and committed in batches: one transaction per
+// db.writer_batch_size rows or per db.writer_flush_ms, whichever comes first.
+// Callbacks run on the writer thread once the batch has been committed, use
+// completion_queue_push() from there to get back to the I/O loop.
+
+typedef enum {
+    DB_WRITE_ADD_USER = 0,
+    DB_WRITE_ADD_SCORE,
+} DbWriteType;
+
+// row_id is the rowid of the inserted row, 0 if it failed or is not known yet
+typedef void (*DbWriteCallback)(void *ctx, bool ok, int64_t row_id);
+
+typedef struct {
+    DbWriteType type;
+    union {
+        struct {
+            char username[DB_USERNAME_MAX];
+            char password[DB_PASSWORD_MAX];
+        } user;
+        struct {
+            int user_id;
+            char username[DB_USERNAME_MAX];
+            int score;
+            long timestamp;
+        } score;
+    };
+    DbWriteCallback done;
+    void *ctx;
+} DbWrite;
+
+bool db_writer_start();
+void db_writer_stop();
+
+// Both return false if the queue is full or the values don't fit. When
+// db.writer_ack_before_durable is set, scores are acknowledged as soon as
+// they are queued and `done` runs before returning.
+bool db_writer_add_user(const char *username, const char *password, DbWriteCallback done, void *ctx);
+bool db_writer_add_score(int user_id, const char *username, int score, long timestamp,
+                         DbWriteCallback done, void *ctx);
+
+#endif // DB_WRITER_H
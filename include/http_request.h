@@ -1,14 +1,26 @@
+#ifndef HTTP_REQUEST_H
+#define HTTP_REQUEST_H
+
 #include "cJSON.h"
+#include "request_trace.h"
+#include "work_pool.h"
+#include <stdbool.h>
 #include <stdlib.h>
 
 #define GET "GET"
 #define POST "POST"
 #define INITIAL_CAPACITY 10
 #define RES_DIR "./resources"
+#define LEADERBOARD_EXPORT_PAGE 256
+// A leaderboard export gives up on a client that takes longer than this to
+// accept one send, or to read the whole export
+#define LEADERBOARD_EXPORT_SEND_TIMEOUT_S 5
+#define LEADERBOARD_EXPORT_DEADLINE_S 60
 
 typedef struct {
   char *path;
   char *file_name;
+  char *query;
 } Target;
 
 typedef struct {
@@ -31,7 +43,9 @@ typedef struct {
 typedef struct {
   StartLine start_line;
   Headers headers;
-  cJSON *body;
+  // Points into the buffer the request was parsed from, NULL without a body
+  const char *body;
+  size_t body_len;
 } HttpRequest;
 
 typedef enum {
@@ -59,36 +73,63 @@ typedef struct {
 typedef enum {
   HTTP_200_OK = 0,
   HTTP_201_CREATED,
+  HTTP_202_ACCEPTED,
   HTTP_400_BAD_REQUEST,
+  HTTP_401_UNAUTHORIZED,
+  HTTP_403_FORBIDDEN,
   HTTP_404_NOT_FOUND,
+  HTTP_409_CONFLICT,
   HTTP_415_UNSUPPORTED,
-  HTTP_500_INTERNAL_ERROR
+  HTTP_500_INTERNAL_ERROR,
+  HTTP_503_UNAVAILABLE
 } HttpStatusCode;
 
+// Whether the response has been sent, or the connection is parked waiting
+// for a background job whose continuation will answer and close it
+typedef enum {
+  REQUEST_DONE = 0,
+  REQUEST_PENDING
+} RequestStatus;
+
+// Continuations of parked requests, drained by the I/O loop
+extern CompletionQueue io_completions;
+
 // HttpRequest
 void init_http_request(HttpRequest *hr);
 void parse_request(HttpRequest *hr, char *request);
-void process_request(HttpRequest *hr, int client_socket);
-void print_http_request(HttpRequest *hr);
+// Dispatches on the route from request_route()
+RequestStatus process_request(HttpRequest *hr, int client_socket, RouteId route);
+void close_connection(int client_socket);
+RouteId request_route(const HttpRequest *hr);
 void free_http_request(HttpRequest *hr);
 char *resolve_path(const char *path);
+bool get_query_param(const char *query, const char *key, char *value, size_t value_size);
+
+// Responses
+const char *get_status_text(HttpStatusCode http_sc);
+int get_status_number(HttpStatusCode http_sc);
+void handle_response(int client_socket, HttpStatusCode http_sc);
+// extra_headers is a list of "Name: value\r\n" lines
+void handle_response_headers(int client_socket, HttpStatusCode http_sc, const char *extra_headers);
+void handle_json_response(int client_socket, HttpStatusCode http_sc, cJSON *json);
+void handle_json_body(int client_socket, HttpStatusCode http_sc, const char *body, size_t body_len);
+void handle_body(int client_socket, HttpStatusCode http_sc, const char *content_type, const char *body,
+                 size_t body_len);
 
 // Headers
 void parse_header_line(const char *line, Headers *headers);
 void add_header(Headers *hs, const char *key, const char *value);
 char *get_header(Headers *hs, const char *key);
-void print_headers(Headers *hs);
+bool get_cookie(Headers *hs, const char *name, char *value, size_t value_size);
 void free_headers(Headers *hs);
 
 // StartLine
-void print_start_line(StartLine *sl);
 void free_start_line(StartLine *sl);
 
-// Body
-void print_body(cJSON *body);
-
 // MimeType
 const char *get_mime_type(MimeType type);
 MimePreference parse_mime_type(const char *entry);
 MimeType get_mime_type_from_string(const char *mime_string);
 const char *determine_best_mime(const char *accept_header);
+
+#endif // HTTP_REQUEST_H
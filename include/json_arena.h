@@ -0,0 +1,40 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <stdint.h>
+#include "cJSON.h"
+
+// Per-thread bump arena behind cJSON's allocation hooks. Between
+// json_arena_begin() and json_arena_end() every cJSON node, key and printed
+// string made on the calling thread is carved out of the arena,
+// cJSON_Delete() of those is a no-op, and json_arena_end() drops the whole
+// lot at once. Outside a scope cJSON falls back to malloc/free.
+//
+// Nothing allocated inside a scope may be used after it ends, use
+// json_arena_print() for text that has to outlive the request.
+
+typedef struct {
+  uint64_t scopes;            // Outermost scopes ended
+  uint64_t arena_allocations; // Served from an arena
+  uint64_t arena_bytes;
+  uint64_t heap_allocations;  // Made outside a scope, one malloc each
+  uint64_t chunk_allocations; // mallocs done by the arenas themselves
+} JsonArenaStats;
+
+// Points cJSON at the arena, call once before any cJSON use
+void json_arena_init();
+
+// Scopes nest, only the outermost end releases
+void json_arena_begin();
+void json_arena_end();
+
+// Prints json unformatted into a malloc'd string that outlives the scope
+char *json_arena_print(const cJSON *json);
+
+// Frees the calling thread's retained chunk, threads that exit do this on
+// their own
+void json_arena_thread_free();
+
+JsonArenaStats json_arena_stats();
+
+#endif // JSON_ARENA_H
@@ -0,0 +1,62 @@
+#ifndef JSON_SCHEMA_H
+#define JSON_SCHEMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Extracts the fields of a flat JSON object straight into a C struct in one
+// pass over the text, without building a cJSON tree or allocating. The shape
+// of the object is declared up front as a table of fields:
+//
+//   typedef struct {
+//     char username[DB_USERNAME_MAX];
+//     int score;
+//   } Body;
+//
+//   static const JsonField body_fields[] = {
+//       JSON_STRING_FIELD(Body, username, 1),
+//       JSON_INT_FIELD(Body, score, 0, INT_MAX),
+//   };
+//
+//   Body body;
+//   if (json_extract(body_fields, ARRAY_LEN(body_fields), text, len, &body) != JSON_EXTRACT_OK)
+//     ...
+//
+// Every declared field is required and may appear once. Strings are
+// unescaped and must fit their buffer, including the terminator. Members
+// that aren't declared are skipped. Anything that isn't well-formed JSON is
+// rejected as soon as it is seen.
+
+typedef enum {
+  JSON_FIELD_STRING = 0,
+  JSON_FIELD_INT,
+} JsonFieldType;
+
+typedef struct {
+  const char *name;
+  JsonFieldType type;
+  size_t offset;
+  size_t size;
+  // Bounds on the value of an int, or on the length of a string
+  long long min;
+  long long max;
+} JsonField;
+
+#define JSON_STRING_FIELD(type, member, min_len) \
+  {#member, JSON_FIELD_STRING, offsetof(type, member), sizeof(((type *)0)->member), min_len, sizeof(((type *)0)->member) - 1}
+#define JSON_INT_FIELD(type, member, min, max) \
+  {#member, JSON_FIELD_INT, offsetof(type, member), sizeof(((type *)0)->member), min, max}
+
+typedef enum {
+  JSON_EXTRACT_OK = 0,
+  JSON_EXTRACT_MALFORMED,   // Not a JSON object
+  JSON_EXTRACT_WRONG_TYPE,  // A declared field has a value of another type
+  JSON_EXTRACT_OUT_OF_RANGE,
+  JSON_EXTRACT_DUPLICATE,
+  JSON_EXTRACT_MISSING,
+} JsonExtractResult;
+
+JsonExtractResult json_extract(const JsonField *fields, size_t field_count, const char *json, size_t len, void *out);
+const char *json_extract_error(JsonExtractResult result);
+
+#endif // JSON_SCHEMA_H
@@ -0,0 +1,66 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "http_request.h"
+
+// Streaming JSON writer for responses too large to build as a cJSON tree.
+// Values are written straight into a fixed buffer that is sent as an HTTP
+// chunk (Transfer-Encoding: chunked) whenever it fills up, so an export
+// needs JSON_WRITER_CHUNK bytes no matter how many entries it has.
+//
+//   JsonWriter w;
+//   json_writer_begin(&w, client_socket, HTTP_200_OK);
+//   json_object_begin(&w);
+//   json_key(&w, "total");
+//   json_int(&w, 42);
+//   json_object_end(&w);
+//   json_writer_end(&w);
+//
+// Commas are inserted automatically. After a send fails, or once
+// deadline_ns has passed, the writer drops everything and json_writer_end()
+// returns false.
+//
+// Sends block, so a large body is written from a pool thread rather than the
+// I/O loop. The writer doesn't touch the request trace, which belongs to the
+// I/O loop; the caller reports bytes_sent and write_ns once it is done.
+
+#define JSON_WRITER_CHUNK 16384
+#define JSON_WRITER_MAX_DEPTH 64
+
+typedef struct {
+  int client_socket;
+  char buffer[JSON_WRITER_CHUNK];
+  size_t len;
+  // Bit n is set once the container at depth n has a member
+  uint64_t has_member;
+  unsigned int depth;
+  bool after_key;
+  bool failed;
+  size_t bytes_sent;
+  // Time spent in send()
+  uint64_t write_ns;
+  // monotonic_ns() after which sends fail, 0 for none
+  uint64_t deadline_ns;
+} JsonWriter;
+
+// Sends the status line and headers. deadline_ns is 0 for no deadline.
+void json_writer_begin(JsonWriter *w, int client_socket, HttpStatusCode http_sc, uint64_t deadline_ns);
+// Flushes what is left and terminates the chunked body
+bool json_writer_end(JsonWriter *w);
+
+void json_object_begin(JsonWriter *w);
+void json_object_end(JsonWriter *w);
+void json_array_begin(JsonWriter *w);
+void json_array_end(JsonWriter *w);
+
+void json_key(JsonWriter *w, const char *key);
+void json_string(JsonWriter *w, const char *value);
+void json_int(JsonWriter *w, long long value);
+void json_double(JsonWriter *w, double value);
+void json_bool(JsonWriter *w, bool value);
+void json_null(JsonWriter *w);
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,55 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "request_trace.h"
+
+// High dynamic range latency histograms, one per route and phase. Values are
+// nanoseconds from monotonic_ns(), counted in log-linear buckets: exact below
+// 128ns, then 64 buckets per power of two, so any value from 1ns to about
+// 137s is known within 1.6%. Only the I/O loop records, with plain relaxed
+// stores, and readers walk the buckets without locking.
+//
+// With latency.snapshot_path set a background thread appends one JSON line
+// every latency.snapshot_interval_ms with the percentiles of just that
+// interval, so a spike isn't averaged away by everything before it.
+
+typedef enum {
+  LATENCY_TOTAL = 0,  // Accept to close
+  LATENCY_FIRST_BYTE, // Accept until the request could be read
+  LATENCY_READ,
+  LATENCY_PARSE,
+  LATENCY_HANDLER,    // Routing and handling on the I/O loop, writes excluded
+  LATENCY_DB_WAIT,    // Parked on a background job, writes excluded
+  LATENCY_WRITE,      // Inside send()
+  LATENCY_PHASE_COUNT
+} LatencyPhase;
+
+static inline const char *latency_phase_name(unsigned phase)
+{
+  static const char *const names[] = {"total", "first_byte", "read", "parse", "handler", "db_wait", "write"};
+  return phase < LATENCY_PHASE_COUNT ? names[phase] : "?";
+}
+
+// In nanoseconds, each value the highest one its bucket stands for
+typedef struct {
+  uint64_t count;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+} LatencySummary;
+
+// I/O loop only
+void latency_record(RouteId route, LatencyPhase phase, uint64_t ns);
+// Since the server started
+LatencySummary latency_summary(RouteId route, LatencyPhase phase);
+
+// Do nothing when latency.snapshot_path is empty. Stopping writes the last,
+// partial interval.
+bool latency_start();
+void latency_stop();
+
+#endif // LATENCY_H
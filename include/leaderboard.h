@@ -0,0 +1,44 @@
+#ifndef LEADERBOARD_H
+#define LEADERBOARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "database.h"
+
+// In-memory leaderboard holding the best score of every user, ordered by
+// score (highest first), then by the time it was achieved (earliest first).
+// Backed by an indexable skip list, so inserts, rank lookups and seeking to
+// an offset are all O(log n). Safe to use from several threads.
+
+// Bounds of GET /leaderboard?limit=&offset=, anything outside them is a 400
+#define LEADERBOARD_PAGE_DEFAULT 10
+#define LEADERBOARD_PAGE_MAX 100
+#define LEADERBOARD_OFFSET_MAX 1000000000
+
+typedef struct {
+  char username[DB_USERNAME_MAX];
+  int score;
+  long timestamp;
+} LeaderboardEntry;
+
+// Builds the index from the UserScore table
+bool leaderboard_init();
+void leaderboard_free();
+
+// Records a score, returns true if it became the user's best
+bool leaderboard_submit(const char *username, int score, long timestamp);
+
+// Copies up to `limit` entries starting at `offset` (0 based) into out and
+// returns how many were copied
+size_t leaderboard_range(size_t offset, size_t limit, LeaderboardEntry *out);
+
+// 1 based rank of the user's best score, false if the user has no score
+bool leaderboard_rank(const char *username, size_t *rank, LeaderboardEntry *entry);
+
+size_t leaderboard_size();
+
+// Parses the limit and offset of a page request, NULL for one that was not
+// given. False unless each is a plain decimal number within the bounds above.
+bool leaderboard_parse_page(const char *limit, const char *offset, size_t *limit_out, size_t *offset_out);
+
+#endif // LEADERBOARD_H
@@ -0,0 +1,33 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Asynchronous back end for log_message(). Every thread that logs gets its
+// own single-producer ring of fixed-size records holding the level, the
+// format pointer and the raw arguments, with strings copied in. A background
+// thread drains the rings every log.flush_interval_ms, formats the records
+// and writes them to stdout in batches, so logging on a request thread is a
+// few stores with no formatting, locking or syscalls.
+//
+// A record that finds its ring full is dropped and counted, and the writer
+// reports drops with a line of its own. logger_stop() keeps draining for at
+// most log.shutdown_flush_ms and counts whatever is left as dropped. Before
+// logger_start() and after logger_stop() log_message() writes synchronously.
+
+typedef struct {
+  uint64_t written;
+  uint64_t dropped;
+  uint64_t truncated; // Arguments that didn't fit in a record
+  uint64_t batches;
+  uint64_t bytes;
+  size_t threads;
+} LoggerStats;
+
+bool logger_start();
+void logger_stop();
+LoggerStats logger_stats();
+
+#endif // LOGGER_H
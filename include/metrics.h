@@ -0,0 +1,49 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "request_trace.h"
+
+// Counters, gauges and histograms for GET /metrics. Every thread that records
+// a metric gets its own cache-line-aligned block of slots, written with plain
+// relaxed stores since no other thread writes it. Nothing is summed until a
+// scrape walks the blocks, so recording never contends with a scrape or with
+// other threads. A thread's values are folded into a shared block when it
+// exits.
+
+typedef enum {
+  DB_OP_BEGIN = 0,
+  DB_OP_COMMIT,
+  DB_OP_ROLLBACK,
+  DB_OP_ADD_USER,
+  DB_OP_ADD_SCORE,
+  DB_OP_GET_CREDENTIALS,
+  DB_OP_GET_USER_ID,
+  DB_OP_COUNT_USERS,
+  DB_OP_FOR_EACH_USERNAME,
+  DB_OP_FOR_EACH_SCORE,
+  DB_OP_COUNT
+} DbOp;
+
+typedef enum {
+  PARSE_ERROR_REQUEST = 0, // No usable request line
+  PARSE_ERROR_BODY,        // Body doesn't match the route's schema
+  PARSE_ERROR_COUNT
+} ParseErrorKind;
+
+void metrics_connection_opened();
+void metrics_connection_closed();
+void metrics_request(RouteId route, int status, uint64_t duration_ns, uint64_t bytes_in, uint64_t bytes_out);
+void metrics_parse_error(ParseErrorKind kind);
+void metrics_db_query(DbOp op, uint64_t duration_ns);
+
+// Writes every metric in the Prometheus text exposition format
+void metrics_write(FILE *out);
+// For values kept elsewhere, e.g. the caches' own counters
+void metrics_write_value(FILE *out, const char *name, const char *type, const char *help, double value);
+
+// Frees every thread's slots, once no other thread records anymore
+void metrics_free();
+
+#endif // METRICS_H
@@ -0,0 +1,34 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes on the request lifecycle, under the provider "httpserver", for
+// bpftrace and friends (see tools/bpftrace). With <sys/sdt.h> available, which
+// the Makefile detects and signals with HAVE_SYS_SDT_H, each probe is a single
+// nop in the code plus a note telling a tracer where to patch it, so they cost
+// nothing until attached. Without it they compile to nothing at all.
+//
+// Probes and their arguments, `__` is shown as `-` by the tracers:
+//   accept(fd)
+//   request__parsed(fd, bytes_in, method)           method is a string
+//   route__dispatched(fd, route)                    RouteId, see route_name()
+//   file__served(fd, file_name, size)
+//   db__query__start(op)                            DbOp, on the calling thread
+//   db__query__end(op, duration_ns)
+//   response__written(fd, status, bytes)            once per send()
+//   connection__closed(fd, route, status, bytes_in, bytes_out, total_ns)
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE1(name, a) DTRACE_PROBE1(httpserver, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(httpserver, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(httpserver, name, a, b, c)
+#define PROBE6(name, a, b, c, d, e, f) DTRACE_PROBE6(httpserver, name, a, b, c, d, e, f)
+#else
+#define PROBE1(name, a) do {} while (0)
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#define PROBE6(name, a, b, c, d, e, f) do {} while (0)
+#endif
+
+#endif // PROBES_H
@@ -0,0 +1,119 @@
+#ifndef REQUEST_TRACE_H
+#define REQUEST_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Follows each request from accept to close: when every phase ended, which
+// route handled it, the status and the bytes each way. Traces are kept in a
+// table indexed by the connection's fd and only touched by the I/O loop, so
+// recording a step is a couple of stores. When the connection is closed the
+// finished trace is counted in the metrics and the latency histograms and goes
+// to the access log, and a request slower than log.slow_request_ms gets a
+// line in the log with its breakdown.
+
+// Route and method ids are stored in the access log, so only ever append
+typedef enum {
+  ROUTE_UNKNOWN = 0,
+  ROUTE_FILE,
+  ROUTE_REGISTER,
+  ROUTE_LOGIN,
+  ROUTE_SCORE,
+  ROUTE_USERNAME_AVAILABLE,
+  ROUTE_LEADERBOARD,
+  ROUTE_LEADERBOARD_EXPORT,
+  ROUTE_RANK,
+  ROUTE_STATS,
+  ROUTE_ADMIN,
+  ROUTE_METRICS,
+  ROUTE_COUNT
+} RouteId;
+
+typedef enum {
+  METHOD_OTHER = 0,
+  METHOD_GET,
+  METHOD_POST,
+  METHOD_COUNT
+} MethodId;
+
+// Where the time between accept and close went:
+// - read: waiting for the request to arrive and reading it
+// - parse: parsing the request line, headers and body
+// - handle: routing and handling it on the I/O loop
+// - wait: parked on a background job until its continuation answered
+typedef enum {
+  PHASE_READ = 0,
+  PHASE_PARSE,
+  PHASE_HANDLE,
+  PHASE_WAIT,
+  PHASE_COUNT
+} RequestPhase;
+
+// Parts of handling timed on their own for the slow request log
+typedef enum {
+  STEP_MIME = 0, // Negotiating the response type from Accept
+  STEP_FILE,     // Finding and reading a static file
+  STEP_COUNT
+} TraceStep;
+
+static inline const char *route_name(unsigned route)
+{
+  static const char *const names[] = {
+      "unknown", "file", "register", "login", "score", "username-available", "leaderboard",
+      "leaderboard-export", "rank", "stats", "admin", "metrics",
+  };
+  return route < ROUTE_COUNT ? names[route] : "unknown";
+}
+
+static inline const char *method_name(unsigned method)
+{
+  static const char *const names[] = {"OTHER", "GET", "POST"};
+  return method < METHOD_COUNT ? names[method] : "OTHER";
+}
+
+static inline const char *phase_name(unsigned phase)
+{
+  static const char *const names[] = {"read", "parse", "handle", "wait"};
+  return phase < PHASE_COUNT ? names[phase] : "?";
+}
+
+typedef struct {
+  bool active;
+  uint64_t wall_us; // When it was accepted, since the epoch
+  uint64_t accepted_ns;
+  uint64_t read_start_ns;
+  uint64_t phase_end_ns[PHASE_COUNT];
+  uint64_t write_ns;         // Spent in send()
+  uint64_t handler_write_ns; // Of which before the handler returned
+  uint64_t step_ns[STEP_COUNT];
+  uint64_t resumed_ns; // When a parked request's continuation started
+  bool parked;
+  uint64_t allocations; // On the I/O loop, for this request
+  uint64_t allocations_since;
+  uint8_t family; // 4, 6 or 0 if unknown
+  uint8_t addr[16];
+  uint16_t port;
+  uint8_t method;
+  uint16_t route;
+  uint16_t status; // Numeric, 0 until a response is sent
+  uint32_t bytes_in;
+  uint64_t bytes_out;
+} RequestTrace;
+
+void request_trace_begin(int fd, const struct sockaddr *peer);
+void request_trace_read(int fd, uint64_t started_ns, size_t bytes);
+void request_trace_parsed(int fd, const char *method, RouteId route);
+void request_trace_step(int fd, TraceStep step, uint64_t started_ns);
+void request_trace_handled(int fd, bool parked);
+// First thing a parked request's continuation calls
+void request_trace_resumed(int fd);
+void request_trace_status(int fd, int status);
+void request_trace_sent(int fd, size_t bytes, uint64_t started_ns);
+// Called when the connection is closed, hands the trace to the metrics, the
+// latency histograms and the access log
+void request_trace_end(int fd);
+void request_trace_free();
+
+#endif // REQUEST_TRACE_H
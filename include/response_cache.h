@@ -0,0 +1,47 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "http_request.h"
+
+// Micro-cache of GET JSON responses, keyed on the normalized path and query
+// (e.g. "/leaderboard?limit=10&offset=0"). A body is fresh for
+// cache.responses_ttl_ms and may still be served for cache.responses_stale_ms
+// after that while a single background render replaces it. Requests that
+// find no usable body park on the render already in flight instead of
+// starting their own.
+//
+// Only ever used from the I/O loop, so it takes no locks. Rendering happens
+// on the database executor.
+
+// Builds the body for key, runs on an executor thread inside a JSON arena
+// scope, so body must come from json_arena_print() or plain malloc. Only 200
+// responses are cached.
+typedef HttpStatusCode (*ResponseRenderFn)(const char *key, char **body);
+
+typedef struct {
+  uint64_t hits;
+  uint64_t stale_hits;
+  uint64_t misses;
+  uint64_t coalesced;
+  uint64_t renders;
+  uint64_t invalidations;
+  size_t size;
+  size_t capacity;
+} ResponseCacheStats;
+
+bool response_cache_init();
+void response_cache_free();
+
+// Answers from the cache, or parks the connection until the body for key has
+// been rendered
+RequestStatus response_cache_serve(int client_socket, const char *key, ResponseRenderFn render);
+
+// Marks every body stale, e.g. after a score changes the leaderboard
+void response_cache_invalidate();
+
+ResponseCacheStats response_cache_stats();
+
+#endif // RESPONSE_CACHE_H
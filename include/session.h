@@ -0,0 +1,41 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <time.h>
+#include "database.h"
+
+// In-memory sessions handed out by /login as an opaque cookie. The store is
+// split into lock-striped shards, each a hash table keyed by token plus a
+// timer wheel that expires sessions once their TTL has passed, so resolving
+// a request's session is O(1) and never touches the database.
+
+#define SESSION_COOKIE "session"
+#define SESSION_TOKEN_LEN 32
+
+typedef struct {
+  int user_id;
+  char username[DB_USERNAME_MAX];
+  time_t expires_at;
+} SessionInfo;
+
+// Restores the snapshot in session.snapshot_path if there is one. A damaged
+// snapshot is moved aside to "<path>.bad" and the store starts empty.
+bool session_init();
+// Writes the snapshot if enabled and frees every session
+void session_free();
+
+// Creates a session valid for session.ttl_s and writes its token
+// (SESSION_TOKEN_LEN characters plus the terminator) into token
+bool session_create(int user_id, const char *username, char *token);
+bool session_lookup(const char *token, SessionInfo *info);
+void session_destroy(const char *token);
+
+// Expires the sessions whose TTL has passed, called once a second
+void session_tick();
+// Copies the sessions under the shard locks, then writes them to a temporary
+// file renamed over path, so it can run on any thread
+bool session_snapshot(const char *path);
+size_t session_count();
+
+#endif // SESSION_H
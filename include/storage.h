@@ -0,0 +1,63 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "database.h"
+
+// Storage engine interface. Everything the server persists (users, scores,
+// and the rows the leaderboard is rebuilt from) goes through `storage`, which
+// points at the engine selected by db.engine:
+//
+//   sqlite  the User and UserScore tables in db.path (database.c)
+//   log     an append-only, checksummed, memory-mapped log in db.log_path
+//           with an in-memory index rebuilt on startup (log_storage.c)
+//
+// Writes only ever come from one thread (the group-commit writer) and always
+// inside begin/commit; reads may come from any thread at any time and only
+// see committed data.
+typedef struct {
+    const char *name;
+
+    // Called once at startup, before any thread uses the engine, and once at
+    // shutdown after they are all gone
+    bool (*open)(void);
+    void (*close)(void);
+    // Releases whatever the calling thread holds (e.g. its connection)
+    void (*close_thread)(void);
+
+    bool (*begin)(void);
+    bool (*commit)(void);
+    bool (*rollback)(void);
+
+    // Fails if the username is taken. row_id receives the new user's id.
+    bool (*add_user)(const char *username, const char *password, int64_t *row_id);
+    bool (*add_score)(int user_id, const char *username, int score, long timestamp, int64_t *row_id);
+
+    // Same contracts as the sql_* functions in database.h
+    bool (*get_credentials)(const char *username, int *user_id, char *password, size_t password_size);
+    int (*get_user_id)(const char *username);
+    long (*count_users)(void);
+    long (*for_each_username)(UsernameRowFn fn, void *ctx);
+    bool (*for_each_score)(ScoreRowFn fn, void *ctx);
+
+    // Background upkeep (e.g. compaction), run by the writer between batches
+    void (*maintain)(void);
+} StorageEngine;
+
+extern const StorageEngine sqlite_storage;
+extern const StorageEngine log_storage;
+
+// The engine in use, valid after storage_open(). Its reads and writes are
+// timed for the metrics (db_query_duration_seconds).
+extern const StorageEngine *storage;
+
+// Returns NULL if there is no engine with that name
+const StorageEngine *storage_find(const char *name);
+
+// Opens the engine named by server_config.db_engine and makes it `storage`
+bool storage_open(void);
+void storage_close(void);
+void storage_close_thread(void);
+
+#endif // STORAGE_H
@@ -0,0 +1,42 @@
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded cache of user credentials (id and password hash) keyed by
+// username, in front of sql_get_credentials(). Eviction uses the CLOCK
+// algorithm. Usernames known not to exist are cached too, for
+// cache.users_negative_ttl_s seconds, so repeated logins for unknown users
+// don't reach the database either.
+
+typedef enum {
+  USER_CACHE_MISS = 0,
+  USER_CACHE_HIT,
+  USER_CACHE_NEGATIVE,
+} UserCacheResult;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t negative_hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t invalidations;
+  size_t size;
+  size_t capacity;
+} UserCacheStats;
+
+bool user_cache_init();
+void user_cache_free();
+
+UserCacheResult user_cache_get(const char *username, int *user_id, char *password, size_t password_size);
+void user_cache_put(const char *username, int user_id, const char *password);
+void user_cache_put_negative(const char *username);
+// Drops whatever is cached for username, e.g. a negative entry once the
+// user has registered
+void user_cache_invalidate(const char *username);
+
+UserCacheStats user_cache_stats();
+
+#endif // USER_CACHE_H
@@ -0,0 +1,28 @@
+#ifndef USERNAME_FILTER_H
+#define USERNAME_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bloom filter of every registered username, built from the User table at
+// startup and sized by cache.username_filter_*. False from
+// username_maybe_taken() means the name is definitely free, so registrations
+// and availability checks for new names skip the database. If the filter
+// could not be built every name is maybe taken, so nothing skips it.
+
+typedef struct {
+  size_t bits;
+  unsigned int hashes;
+  uint64_t usernames;
+  uint64_t definitely_free;
+  uint64_t maybe_taken;
+} UsernameFilterStats;
+
+bool username_filter_init();
+void username_filter_free();
+void username_filter_add(const char *username);
+bool username_maybe_taken(const char *username);
+UsernameFilterStats username_filter_stats();
+
+#endif // USERNAME_FILTER_H
@@ -28,11 +28,49 @@ Options:
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+// Log levels, from most to least verbose
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARNING 2
+#define LOG_ERROR 3
+#define LOG_OFF 4
+
+// Levels below this are compiled out, arguments and all, e.g.
+// `make LOG_COMPILE_LEVEL=1` drops every debug message from the build
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+// Parts of the server whose level can be set on its own at runtime. A file
+// picks its subsystem by defining LOG_SUBSYSTEM before including this header.
+typedef enum {
+  LOG_SUBSYSTEM_SERVER = 0,
+  LOG_SUBSYSTEM_HTTP,
+  LOG_SUBSYSTEM_STORAGE,
+  LOG_SUBSYSTEM_AUTH,
+  LOG_SUBSYSTEM_COUNT,
+} LogSubsystem;
+
+#ifndef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_SERVER
+#endif
+
+// Runtime level of each subsystem, read without locking on every call
+extern unsigned char log_thresholds[LOG_SUBSYSTEM_COUNT];
+
+#define log_enabled(subsystem, level)                                          \
+  ((level) >= LOG_COMPILE_LEVEL &&                                             \
+   (level) >= __atomic_load_n(&log_thresholds[subsystem], __ATOMIC_RELAXED))
 
-// Log levels
-#define LOG_INFO "INFO"
-#define LOG_WARNING "WARNING"
-#define LOG_ERROR "ERROR"
+// Checks the level before anything is evaluated or formatted, so a disabled
+// message costs a load and a compare
+#define log_message(level, ...)                                                \
+  do {                                                                         \
+    if (log_enabled(LOG_SUBSYSTEM, level))                                     \
+      log_write(level, __VA_ARGS__);                                           \
+  } while (0)
 
 // Macro for logging
 #define LOG(level, ...) log_message(level, __VA_ARGS__)
@@ -61,8 +99,23 @@ Options:
 
 // Function declarations
 
-// Logging
-UTILS_DEF void log_message(const char *level, const char *format, ...);
+// Logging, use log_message() so disabled levels are skipped
+UTILS_DEF void log_write(int level, const char *format, ...);
+// Formats and writes one line to stdout right away
+UTILS_DEF void log_vwrite(int level, const char *format, va_list args);
+
+// Takes over log_write() when set, e.g. the asynchronous logger. The format
+// pointer must stay valid, which string literals do. NULL goes back to
+// writing synchronously.
+typedef void (*LogSink)(int level, const char *format, va_list args);
+UTILS_DEF void log_set_sink(LogSink sink);
+
+// Sets runtime levels from a list such as "info,http=debug,storage=error":
+// a bare level applies to every subsystem, later entries win. Entries may be
+// separated by ',' or '&'. Nothing changes if any entry is invalid.
+UTILS_DEF bool log_set_levels(const char *spec);
+UTILS_DEF const char *log_level_name(int level);
+UTILS_DEF const char *log_subsystem_name(LogSubsystem subsystem);
 
 // File I/O
 UTILS_DEF unsigned char * read_entire_file(const char *directory, const char *file_path, long *file_size);
@@ -72,29 +125,126 @@ UTILS_DEF bool write_file(const char *file_path, const unsigned char *data, long
 // CLI Utilities
 UTILS_DEF char* shift_args(int *argc, char ***argv);
 
+// Time
+UTILS_DEF uint64_t monotonic_ns(void);
+
 #ifdef UTILS_LOG_IMPLEMENTATION
 
 #include <dirent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 
+static LogSink utils_log_sink = NULL;
+
+unsigned char log_thresholds[LOG_SUBSYSTEM_COUNT] = {
+    LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO,
+};
+
+static const char *const utils_level_names[] = {"DEBUG", "INFO", "WARNING",
+                                                "ERROR", "OFF"};
+static const char *const utils_subsystem_names[] = {"server", "http",
+                                                    "storage", "auth"};
+
 // Function implementation
-UTILS_DEF void log_message(const char *level, const char *format, ...) {
-  time_t now = time(NULL);
-  struct tm *t = localtime(&now);
-  char time_str[20];
-  strftime(time_str, sizeof(time_str), "%H:%M:%S", t);
+UTILS_DEF const char *log_level_name(int level) {
+  return level >= LOG_DEBUG && level <= LOG_OFF ? utils_level_names[level]
+                                                 : "?";
+}
+
+UTILS_DEF const char *log_subsystem_name(LogSubsystem subsystem) {
+  return (unsigned)subsystem < LOG_SUBSYSTEM_COUNT
+             ? utils_subsystem_names[subsystem]
+             : "?";
+}
+
+static int utils_parse_level(const char *name, size_t len) {
+  for (int level = LOG_DEBUG; level <= LOG_OFF; level++) {
+    if (strlen(utils_level_names[level]) == len &&
+        strncasecmp(utils_level_names[level], name, len) == 0)
+      return level;
+  }
+  return -1;
+}
+
+UTILS_DEF bool log_set_levels(const char *spec) {
+  unsigned char levels[LOG_SUBSYSTEM_COUNT];
+  for (int i = 0; i < LOG_SUBSYSTEM_COUNT; i++)
+    levels[i] = __atomic_load_n(&log_thresholds[i], __ATOMIC_RELAXED);
+
+  // Parse everything before applying anything
+  const char *entry = spec;
+  while (*entry) {
+    size_t len = strcspn(entry, ",&");
+    const char *equals = memchr(entry, '=', len);
+    if (len == 0) {
+      entry++;
+      continue;
+    }
+
+    if (!equals) {
+      int level = utils_parse_level(entry, len);
+      if (level < 0)
+        return false;
+      memset(levels, level, sizeof(levels));
+    } else {
+      size_t name_len = equals - entry;
+      int level = utils_parse_level(equals + 1, len - name_len - 1);
+      int subsystem = -1;
+      for (int i = 0; i < LOG_SUBSYSTEM_COUNT; i++) {
+        if (strlen(utils_subsystem_names[i]) == name_len &&
+            strncasecmp(utils_subsystem_names[i], entry, name_len) == 0)
+          subsystem = i;
+      }
+      if (level < 0 || subsystem < 0)
+        return false;
+      levels[subsystem] = (unsigned char)level;
+    }
 
-  printf("[%s] [%s] ", time_str, level);
+    entry += len;
+    if (*entry)
+      entry++;
+  }
 
+  for (int i = 0; i < LOG_SUBSYSTEM_COUNT; i++)
+    __atomic_store_n(&log_thresholds[i], levels[i], __ATOMIC_RELAXED);
+  return true;
+}
+
+UTILS_DEF void log_set_sink(LogSink sink) {
+  __atomic_store_n(&utils_log_sink, sink, __ATOMIC_RELEASE);
+}
+
+UTILS_DEF void log_vwrite(int level, const char *format, va_list args) {
+  time_t now = time(NULL);
+  struct tm t;
+  localtime_r(&now, &t);
+
+  // One write per line so lines from different threads don't interleave
+  char line[1024];
+  int len = (int)strftime(line, sizeof(line), "[%H:%M:%S] ", &t);
+  len += snprintf(line + len, sizeof(line) - len, "[%s] ",
+                  log_level_name(level));
+  int msg = vsnprintf(line + len, sizeof(line) - len, format, args);
+  len = msg < 0 || len + msg >= (int)sizeof(line) - 1 ? (int)sizeof(line) - 2 : len + msg;
+  line[len++] = '\n';
+
+  fwrite(line, 1, len, stdout);
+}
+
+UTILS_DEF void log_write(int level, const char *format, ...) {
   va_list args;
   va_start(args, format);
-  vprintf(format, args);
-  va_end(args);
 
-  printf("\n");
+  LogSink sink = __atomic_load_n(&utils_log_sink, __ATOMIC_ACQUIRE);
+  if (sink)
+    sink(level, format, args);
+  else
+    log_vwrite(level, format, args);
+
+  va_end(args);
 }
 
 UTILS_DEF bool write_file(const char *file_path, const unsigned char *data,
@@ -148,7 +298,7 @@ char *find_file_in_directory(const char *target_dir, const char *target_file) {
   DIR *directory;
   struct dirent *entry;
 
-  log_message(LOG_INFO, "Reading file %s from directory %s", target_file,
+  log_message(LOG_DEBUG, "Reading file %s from directory %s", target_file,
               target_dir);
 
   directory = opendir(target_dir);
@@ -181,6 +331,12 @@ UTILS_DEF char* shift_args(int *argc, char ***argv) {
   return arg;
 }
 
+UTILS_DEF uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
 #endif // UTILS_LOG_IMPLEMENTATION
 
 #endif // UTILS_H
@@ -0,0 +1,76 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Thread pool with a bounded job queue. Jobs run on a pool thread and are
+// then handed back to the I/O loop through a CompletionQueue, whose eventfd
+// the loop polls, so the job's continuation runs on the I/O thread.
+//
+// WorkJob is meant to be embedded as the first member of a larger struct
+// holding the job's arguments and results.
+
+typedef struct WorkJob WorkJob;
+
+// Runs on a pool thread. Returns true if the job is finished, or false if it
+// handed itself to someone else (e.g. the db writer) who will push it to the
+// completion queue later.
+typedef bool (*WorkFn)(WorkJob *job);
+
+// Runs on the I/O thread once the job is finished
+typedef void (*WorkDoneFn)(WorkJob *job);
+
+struct WorkJob {
+  WorkFn run;
+  WorkDoneFn done;
+  WorkJob *next;
+  // monotonic_ns() after which the job is not worth running anymore, 0 for
+  // none. Expired jobs skip `run` and complete with `expired` set.
+  uint64_t deadline_ns;
+  bool expired;
+};
+
+typedef struct {
+  int eventfd;
+  pthread_mutex_t lock;
+  WorkJob *head;
+  WorkJob *tail;
+} CompletionQueue;
+
+typedef struct {
+  const char *name;
+  pthread_t *threads;
+  size_t thread_count;
+  // Called by every pool thread before it exits, may be NULL
+  void (*thread_exit)(void);
+
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  WorkJob **queue;
+  size_t capacity;
+  size_t head;
+  size_t count;
+  bool stopping;
+
+  CompletionQueue *completions;
+} WorkPool;
+
+bool completion_queue_init(CompletionQueue *cq);
+void completion_queue_free(CompletionQueue *cq);
+// Safe to call from any thread
+void completion_queue_push(CompletionQueue *cq, WorkJob *job);
+// Runs the continuation of every finished job, called by the I/O loop when
+// the eventfd is readable
+void completion_queue_drain(CompletionQueue *cq);
+
+bool work_pool_start(WorkPool *pool, const char *name, size_t thread_count, size_t capacity,
+                     CompletionQueue *completions, void (*thread_exit)(void));
+// Finishes the queued jobs and joins the threads
+void work_pool_stop(WorkPool *pool);
+// Returns false if the queue is full
+bool work_pool_submit(WorkPool *pool, WorkJob *job);
+
+#endif // WORK_POOL_H
@@ -592,7 +592,7 @@ function login() {
       if (response.ok) {
         document.getElementById("authContainer").style.display = "none";
         document.getElementById("gameContainer").classList.remove("hidden");
-        loggedIn = true; loggedIn = true;
+        loggedIn = true;
         startGame();
       } else if (response.status == 404) {
         alert(`User "${username}" not found or password is incorrect`);
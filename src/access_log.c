@@ -0,0 +1,295 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_HTTP
+#include "access_log.h"
+#include "config.h"
+#include "utils.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Smallest file worth mapping, whatever access_log.max_bytes says
+#define ACCESS_LOG_MIN_BYTES 4096
+
+static struct
+{
+  pthread_t thread;
+  pthread_mutex_t lock; // Guards stopping
+  pthread_cond_t wake;
+  bool enabled;
+  bool stopping;
+
+  AccessLogRecord *ring;
+  size_t mask;
+  // Written by the I/O loop only
+  _Alignas(64) atomic_size_t head;
+  // Written by the access log thread only
+  _Alignas(64) atomic_size_t tail;
+
+  // The file being written, owned by the access log thread once started
+  int fd;
+  unsigned char *map;
+  size_t map_size;
+  size_t used;
+
+  atomic_uint_fast64_t written;
+  atomic_uint_fast64_t dropped;
+  atomic_uint_fast64_t rotations;
+  atomic_uint_fast64_t failures;
+} access_log = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .fd = -1,
+};
+
+// Name of the n-th file, path itself for 0
+static void rotated_path(char *out, size_t size, int n)
+{
+  if (n == 0)
+    snprintf(out, size, "%s", server_config.access_log_path);
+  else
+    snprintf(out, size, "%s.%d", server_config.access_log_path, n);
+}
+
+// path becomes path.1, path.1 becomes path.2 and so on, the oldest is dropped
+static void shift_files()
+{
+  char from[sizeof(server_config.access_log_path) + 16];
+  char to[sizeof(server_config.access_log_path) + 16];
+
+  if (server_config.access_log_max_files <= 1)
+  {
+    rotated_path(from, sizeof(from), 0);
+    unlink(from);
+    return;
+  }
+
+  for (int n = server_config.access_log_max_files - 1; n >= 1; n--)
+  {
+    rotated_path(from, sizeof(from), n - 1);
+    rotated_path(to, sizeof(to), n);
+    if (rename(from, to) == -1 && errno != ENOENT)
+      log_message(LOG_ERROR, "Can't rotate access log %s: %s", from, strerror(errno));
+  }
+}
+
+static bool open_file()
+{
+  const char *path = server_config.access_log_path;
+  size_t size = (size_t)server_config.access_log_max_bytes;
+  if (size < ACCESS_LOG_MIN_BYTES)
+    size = ACCESS_LOG_MIN_BYTES;
+  size -= size % sizeof(AccessLogRecord);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    log_message(LOG_ERROR, "Can't open access log %s: %s", path, strerror(errno));
+    return false;
+  }
+
+  // Sized up front so records are plain stores into the mapping
+  void *map = MAP_FAILED;
+  if (ftruncate(fd, (off_t)size) == 0)
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    log_message(LOG_ERROR, "Can't map access log %s: %s", path, strerror(errno));
+    close(fd);
+    unlink(path);
+    return false;
+  }
+
+  AccessLogHeader header = {
+      .magic = ACCESS_LOG_MAGIC,
+      .version = ACCESS_LOG_VERSION,
+      .record_size = sizeof(AccessLogRecord),
+      .byte_order = ACCESS_LOG_BYTE_ORDER,
+  };
+  memcpy(map, &header, sizeof(header));
+
+  access_log.fd = fd;
+  access_log.map = map;
+  access_log.map_size = size;
+  access_log.used = sizeof(header);
+  return true;
+}
+
+// Unmaps the file and cuts it to the records written
+static void close_file()
+{
+  if (!access_log.map)
+    return;
+
+  munmap(access_log.map, access_log.map_size);
+  if (ftruncate(access_log.fd, (off_t)access_log.used) == -1)
+    log_message(LOG_ERROR, "Can't truncate access log: %s", strerror(errno));
+  close(access_log.fd);
+  access_log.map = NULL;
+  access_log.fd = -1;
+}
+
+static void rotate()
+{
+  close_file();
+  shift_files();
+  atomic_fetch_add_explicit(&access_log.rotations, 1, memory_order_relaxed);
+  open_file();
+}
+
+static void append(const AccessLogRecord *record)
+{
+  if (access_log.map && access_log.used + sizeof(*record) > access_log.map_size)
+    rotate();
+  if (!access_log.map)
+  {
+    atomic_fetch_add_explicit(&access_log.failures, 1, memory_order_relaxed);
+    return;
+  }
+
+  memcpy(access_log.map + access_log.used, record, sizeof(*record));
+  access_log.used += sizeof(*record);
+  atomic_fetch_add_explicit(&access_log.written, 1, memory_order_relaxed);
+}
+
+static void drain()
+{
+  size_t tail = atomic_load_explicit(&access_log.tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&access_log.head, memory_order_acquire);
+
+  // After a failed rotation, try again once per round
+  if (!access_log.map && tail != head)
+    open_file();
+
+  for (; tail != head; tail++)
+    append(&access_log.ring[tail & access_log.mask]);
+
+  atomic_store_explicit(&access_log.tail, tail, memory_order_release);
+}
+
+static void *access_log_main(void *arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&access_log.lock);
+  while (!access_log.stopping)
+  {
+    pthread_mutex_unlock(&access_log.lock);
+    drain();
+    pthread_mutex_lock(&access_log.lock);
+
+    if (access_log.stopping)
+      break;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)server_config.access_log_flush_interval_ms * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&access_log.wake, &access_log.lock, &deadline);
+  }
+  pthread_mutex_unlock(&access_log.lock);
+
+  // The I/O loop has stopped, so this is everything
+  drain();
+  return NULL;
+}
+
+bool access_log_start()
+{
+  if (server_config.access_log_path[0] == '\0')
+    return true;
+
+  size_t capacity = 64;
+  while (capacity < (size_t)server_config.access_log_queue_records)
+    capacity *= 2;
+  access_log.ring = calloc(capacity, sizeof(AccessLogRecord));
+  assert(access_log.ring != NULL && "Buy more RAM lol");
+  access_log.mask = capacity - 1;
+  atomic_store(&access_log.head, 0);
+  atomic_store(&access_log.tail, 0);
+
+  // Whatever an earlier run left behind is rotated, not overwritten
+  struct stat st;
+  if (stat(server_config.access_log_path, &st) == 0 && st.st_size > 0)
+    shift_files();
+
+  if (!open_file())
+  {
+    free(access_log.ring);
+    access_log.ring = NULL;
+    return false;
+  }
+
+  access_log.stopping = false;
+  if (pthread_create(&access_log.thread, NULL, access_log_main, NULL) != 0)
+  {
+    log_message(LOG_ERROR, "Failed to start access log thread");
+    close_file();
+    free(access_log.ring);
+    access_log.ring = NULL;
+    return false;
+  }
+
+  access_log.enabled = true;
+  log_message(LOG_INFO, "Writing access log to %s", server_config.access_log_path);
+  return true;
+}
+
+void access_log_stop()
+{
+  if (!access_log.enabled)
+    return;
+
+  pthread_mutex_lock(&access_log.lock);
+  access_log.stopping = true;
+  pthread_cond_signal(&access_log.wake);
+  pthread_mutex_unlock(&access_log.lock);
+  pthread_join(access_log.thread, NULL);
+
+  close_file();
+  free(access_log.ring);
+  access_log.ring = NULL;
+  access_log.enabled = false;
+}
+
+bool access_log_enabled()
+{
+  return access_log.enabled;
+}
+
+void access_log_write(const AccessLogRecord *record)
+{
+  size_t head = atomic_load_explicit(&access_log.head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&access_log.tail, memory_order_acquire);
+  size_t queued = head - tail;
+  if (queued > access_log.mask)
+  {
+    atomic_fetch_add_explicit(&access_log.dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  access_log.ring[head & access_log.mask] = *record;
+  atomic_store_explicit(&access_log.head, head + 1, memory_order_release);
+
+  // Only wake the thread early when the ring is filling up
+  if (queued == (access_log.mask + 1) / 2)
+    pthread_cond_signal(&access_log.wake);
+}
+
+AccessLogStats access_log_stats()
+{
+  AccessLogStats stats = {
+      .written = atomic_load_explicit(&access_log.written, memory_order_relaxed),
+      .dropped = atomic_load_explicit(&access_log.dropped, memory_order_relaxed),
+      .rotations = atomic_load_explicit(&access_log.rotations, memory_order_relaxed),
+      .failures = atomic_load_explicit(&access_log.failures, memory_order_relaxed),
+  };
+  return stats;
+}
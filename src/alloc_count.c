@@ -0,0 +1,34 @@
+#include "alloc_count.h"
+#include <stddef.h>
+
+static __thread uint64_t thread_allocations;
+
+uint64_t alloc_count()
+{
+  return thread_allocations;
+}
+
+#ifdef __GLIBC__
+// glibc supports replacing these, its own entry points stay reachable
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+  thread_allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  thread_allocations++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  thread_allocations++;
+  return __libc_realloc(ptr, size);
+}
+#endif
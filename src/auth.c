@@ -0,0 +1,93 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_AUTH
+#include "auth.h"
+#include "config.h"
+#include "utils.h"
+#include "work_pool.h"
+#include <crypt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AUTH_HASH_PREFIX "$y$"
+
+static WorkPool auth_pool;
+
+// Scratch space for crypt_ra(), allocated on first use by every pool thread
+static _Thread_local void *crypt_buffer = NULL;
+static _Thread_local int crypt_buffer_size = 0;
+
+static void auth_thread_exit(void)
+{
+  free(crypt_buffer);
+  crypt_buffer = NULL;
+  crypt_buffer_size = 0;
+}
+
+bool auth_start(CompletionQueue *completions)
+{
+  if (server_config.auth_threads <= 0 || server_config.auth_queue_size <= 0)
+    return false;
+
+  return work_pool_start(&auth_pool, "auth", (size_t)server_config.auth_threads,
+                         (size_t)server_config.auth_queue_size, completions, auth_thread_exit);
+}
+
+void auth_stop()
+{
+  work_pool_stop(&auth_pool);
+}
+
+bool auth_submit(WorkJob *job)
+{
+  job->deadline_ns = monotonic_ns() + (uint64_t)server_config.auth_deadline_ms * 1000000ULL;
+  job->expired = false;
+  return work_pool_submit(&auth_pool, job);
+}
+
+bool auth_hash_password(const char *password, char *hash, size_t hash_size)
+{
+  char salt[CRYPT_GENSALT_OUTPUT_SIZE];
+
+  // NULL entropy lets libcrypt read it from the OS
+  if (!crypt_gensalt_rn(AUTH_HASH_PREFIX, (unsigned long)server_config.auth_hash_cost, NULL, 0, salt,
+                        sizeof(salt)))
+  {
+    log_message(LOG_ERROR, "Could not generate password salt");
+    return false;
+  }
+
+  const char *result = crypt_ra(password, salt, &crypt_buffer, &crypt_buffer_size);
+  if (!result || result[0] == '*' || strlen(result) >= hash_size)
+  {
+    log_message(LOG_ERROR, "Could not hash password");
+    return false;
+  }
+
+  strcpy(hash, result);
+  return true;
+}
+
+static bool constant_time_equals(const char *a, const char *b)
+{
+  size_t len_a = strlen(a);
+  size_t len_b = strlen(b);
+  unsigned char diff = len_a != len_b;
+  size_t len = len_a < len_b ? len_a : len_b;
+
+  for (size_t i = 0; i < len; i++)
+    diff |= (unsigned char)a[i] ^ (unsigned char)b[i];
+
+  return diff == 0;
+}
+
+bool auth_verify_password(const char *password, const char *hash)
+{
+  // Accounts created before passwords were hashed still hold plaintext
+  if (hash[0] != '$')
+    return constant_time_equals(password, hash);
+
+  const char *result = crypt_ra(password, hash, &crypt_buffer, &crypt_buffer_size);
+  if (!result || result[0] == '*')
+    return false;
+
+  return constant_time_equals(result, hash);
+}
@@ -0,0 +1,228 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_STORAGE
+#include <errno.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "backup.h"
+#include "config.h"
+#include "storage.h"
+#include "utils.h"
+
+static struct
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool started;
+    bool stopping;
+    bool requested;
+    BackupStats stats;
+} backup = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+static bool backup_stopping()
+{
+    pthread_mutex_lock(&backup.lock);
+    bool stopping = backup.stopping;
+    pthread_mutex_unlock(&backup.lock);
+    return stopping;
+}
+
+static bool backup_run()
+{
+    sqlite3 *source = db_connection();
+    if (!source)
+        return false;
+
+    char tmp_path[sizeof(server_config.db_backup_path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", server_config.db_backup_path);
+    unlink(tmp_path);
+
+    sqlite3 *dest;
+    if (sqlite3_open(tmp_path, &dest) != SQLITE_OK)
+    {
+        log_message(LOG_ERROR, "Can't open backup %s: %s", tmp_path, sqlite3_errmsg(dest));
+        sqlite3_close(dest);
+        return false;
+    }
+
+    // A backup step restarts from scratch whenever another connection writes
+    // to the source, which under constant score traffic means never
+    // finishing. In WAL mode a read transaction pins a snapshot without
+    // blocking writers, so the whole copy comes from that snapshot instead.
+    bool snapshot = strcasecmp(server_config.db_journal_mode, "WAL") == 0 &&
+                    sqlite3_exec(source, "BEGIN; SELECT COUNT(*) FROM sqlite_master;", NULL, NULL, NULL) == SQLITE_OK;
+
+    sqlite3_backup *step = sqlite3_backup_init(dest, "main", source, "main");
+    int rc = step ? SQLITE_OK : sqlite3_errcode(dest);
+
+    while (step && !backup_stopping())
+    {
+        rc = sqlite3_backup_step(step, server_config.db_backup_step_pages);
+
+        pthread_mutex_lock(&backup.lock);
+        backup.stats.pages_total = sqlite3_backup_pagecount(step);
+        backup.stats.pages_done = backup.stats.pages_total - sqlite3_backup_remaining(step);
+        pthread_mutex_unlock(&backup.lock);
+
+        if (rc != SQLITE_OK && rc != SQLITE_BUSY && rc != SQLITE_LOCKED)
+            break;
+
+        sleep_ms(server_config.db_backup_step_sleep_ms);
+    }
+
+    if (step)
+        sqlite3_backup_finish(step);
+    if (snapshot)
+        sqlite3_exec(source, "COMMIT;", NULL, NULL, NULL);
+    sqlite3_close(dest);
+
+    if (rc != SQLITE_DONE)
+    {
+        if (!backup_stopping())
+            log_message(LOG_ERROR, "Backup failed: %s", sqlite3_errstr(rc));
+        unlink(tmp_path);
+        return false;
+    }
+
+    if (rename(tmp_path, server_config.db_backup_path) == -1)
+    {
+        log_message(LOG_ERROR, "Failed to move backup to %s: %s", server_config.db_backup_path, strerror(errno));
+        unlink(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+static void *backup_main(void *arg)
+{
+    (void)arg;
+    int interval = server_config.db_backup_interval_s;
+    time_t next_due = interval > 0 ? time(NULL) + interval : 0;
+
+    pthread_mutex_lock(&backup.lock);
+    while (true)
+    {
+        while (!backup.stopping && !backup.requested && (next_due == 0 || time(NULL) < next_due))
+        {
+            if (next_due == 0)
+            {
+                pthread_cond_wait(&backup.wake, &backup.lock);
+            }
+            else
+            {
+                struct timespec deadline = {.tv_sec = next_due};
+                pthread_cond_timedwait(&backup.wake, &backup.lock, &deadline);
+            }
+        }
+
+        if (backup.stopping)
+            break;
+
+        backup.requested = false;
+        backup.stats.running = true;
+        backup.stats.pages_done = 0;
+        backup.stats.pages_total = 0;
+        pthread_mutex_unlock(&backup.lock);
+
+        log_message(LOG_INFO, "Backing up database to %s", server_config.db_backup_path);
+        uint64_t start = monotonic_ns();
+        bool ok = backup_run();
+        double duration_ms = (double)(monotonic_ns() - start) / 1e6;
+        if (ok)
+            log_message(LOG_INFO, "Backup finished in %.1f ms", duration_ms);
+
+        pthread_mutex_lock(&backup.lock);
+        backup.stats.running = false;
+        backup.stats.last_ok = ok;
+        backup.stats.last_duration_ms = duration_ms;
+        backup.stats.last_finished_at = time(NULL);
+        if (ok)
+            backup.stats.completed++;
+        else
+            backup.stats.failed++;
+
+        if (interval > 0)
+            next_due = time(NULL) + interval;
+    }
+    pthread_mutex_unlock(&backup.lock);
+
+    db_close_connection();
+    return NULL;
+}
+
+bool backup_start()
+{
+    // Only the SQLite engine has a database to back up
+    if (strcmp(storage->name, sqlite_storage.name) != 0)
+        return true;
+
+    if (server_config.db_backup_step_pages <= 0 || server_config.db_backup_step_sleep_ms < 0)
+    {
+        log_message(LOG_ERROR, "Backup step pages must be positive and step sleep not negative");
+        return false;
+    }
+
+    backup.stopping = false;
+    if (pthread_create(&backup.thread, NULL, backup_main, NULL) != 0)
+    {
+        log_message(LOG_ERROR, "Could not start backup thread: %s", strerror(errno));
+        return false;
+    }
+
+    backup.started = true;
+    return true;
+}
+
+void backup_stop()
+{
+    if (!backup.started)
+        return;
+
+    pthread_mutex_lock(&backup.lock);
+    backup.stopping = true;
+    pthread_cond_signal(&backup.wake);
+    pthread_mutex_unlock(&backup.lock);
+
+    // A running backup notices between steps and is abandoned
+    pthread_join(backup.thread, NULL);
+    backup.started = false;
+}
+
+bool backup_request()
+{
+    if (!backup.started)
+        return false;
+
+    pthread_mutex_lock(&backup.lock);
+    bool accepted = !backup.stats.running && !backup.requested;
+    if (accepted)
+    {
+        backup.requested = true;
+        pthread_cond_signal(&backup.wake);
+    }
+    pthread_mutex_unlock(&backup.lock);
+
+    return accepted;
+}
+
+BackupStats backup_stats()
+{
+    pthread_mutex_lock(&backup.lock);
+    BackupStats stats = backup.stats;
+    pthread_mutex_unlock(&backup.lock);
+    return stats;
+}
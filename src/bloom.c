@@ -0,0 +1,86 @@
+#include "bloom.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Two independent 64 bit hashes, combined as h1 + i * h2 to derive every
+// probe (Kirsch-Mitzenmacher)
+static void hash_key(const char *key, uint64_t *h1, uint64_t *h2)
+{
+  // FNV-1a
+  uint64_t a = 1469598103934665603ULL;
+  for (const unsigned char *c = (const unsigned char *)key; *c; c++)
+  {
+    a ^= *c;
+    a *= 1099511628211ULL;
+  }
+
+  // splitmix64 finalizer of the first hash, forced odd so probes don't
+  // collapse when the bit count is a power of two
+  uint64_t b = a + 0x9E3779B97F4A7C15ULL;
+  b = (b ^ (b >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  b = (b ^ (b >> 27)) * 0x94D049BB133111EBULL;
+  b ^= b >> 31;
+
+  *h1 = a;
+  *h2 = b | 1;
+}
+
+bool bloom_init(BloomFilter *filter, size_t capacity, unsigned int bits_per_item)
+{
+  if (capacity == 0 || bits_per_item == 0)
+    return false;
+
+  size_t words = (capacity * bits_per_item + 63) / 64;
+  filter->bits = calloc(words, sizeof(uint64_t));
+  if (!filter->bits)
+    return false;
+
+  filter->bit_count = words * 64;
+  // k = bits per item * ln 2 minimizes the false positive rate
+  filter->hash_count = (unsigned int)(bits_per_item * 0.6931 + 0.5);
+  if (filter->hash_count == 0)
+    filter->hash_count = 1;
+  filter->inserted = 0;
+  return true;
+}
+
+void bloom_free(BloomFilter *filter)
+{
+  free(filter->bits);
+  filter->bits = NULL;
+  filter->bit_count = 0;
+}
+
+void bloom_add(BloomFilter *filter, const char *key)
+{
+  if (!filter->bits)
+    return;
+
+  uint64_t h1, h2;
+  hash_key(key, &h1, &h2);
+
+  for (unsigned int i = 0; i < filter->hash_count; i++)
+  {
+    size_t bit = (h1 + i * h2) % filter->bit_count;
+    __atomic_fetch_or(&filter->bits[bit / 64], 1ULL << (bit % 64), __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&filter->inserted, 1, __ATOMIC_RELAXED);
+}
+
+bool bloom_maybe_contains(const BloomFilter *filter, const char *key)
+{
+  if (!filter->bits)
+    return true;
+
+  uint64_t h1, h2;
+  hash_key(key, &h1, &h2);
+
+  for (unsigned int i = 0; i < filter->hash_count; i++)
+  {
+    size_t bit = (h1 + i * h2) % filter->bit_count;
+    uint64_t word = __atomic_load_n(&filter->bits[bit / 64], __ATOMIC_RELAXED);
+    if (!(word & (1ULL << (bit % 64))))
+      return false;
+  }
+  return true;
+}
@@ -185,6 +185,8 @@ static void * CJSON_CDECL internal_realloc(void *pointer, size_t size)
 
 static internal_hooks global_hooks = { internal_malloc, internal_free, internal_realloc };
 
+static cJSON_bool (*bulk_free_check)(const void *ptr) = NULL;
+
 static unsigned char* cJSON_strdup(const unsigned char* string, const internal_hooks * const hooks)
 {
     size_t length = 0;
@@ -237,6 +239,117 @@ CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks)
     }
 }
 
+CJSON_PUBLIC(void) cJSON_InitBulkFreeCheck(cJSON_bool (*owns)(const void *ptr))
+{
+    bulk_free_check = owns;
+}
+
+/* Open addressing table over an object's items, hashed on the lowercased key
+ * so that case sensitive and insensitive lookups can share it. Items with
+ * equal keys sit along the probe sequence in list order, so the first match
+ * is the one a walk of the list would find. */
+typedef struct cJSON_Index
+{
+    size_t mask;
+    /* NULL when the index is released in bulk together with its object */
+    void (CJSON_CDECL *deallocate)(void *pointer);
+    cJSON *slots[1];
+} cJSON_Index;
+
+static size_t key_hash(const unsigned char *key)
+{
+    /* FNV-1a */
+    unsigned long long hash = 1469598103934665603ULL;
+    for (; *key != '\0'; key++)
+    {
+        hash ^= (unsigned long long)tolower(*key);
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+CJSON_PUBLIC(void) cJSON_DropIndex(cJSON *object)
+{
+    if ((object == NULL) || (object->index == NULL))
+    {
+        return;
+    }
+
+    if (object->index->deallocate != NULL)
+    {
+        object->index->deallocate(object->index);
+    }
+    object->index = NULL;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_BuildIndex(cJSON *object)
+{
+    void *(CJSON_CDECL *allocate)(size_t size) = global_hooks.allocate;
+    void (CJSON_CDECL *deallocate)(void *pointer) = global_hooks.deallocate;
+    cJSON_Index *index = NULL;
+    cJSON *child = NULL;
+    size_t count = 0;
+    size_t capacity = 1;
+    size_t slot = 0;
+
+    if ((object == NULL) || ((object->type & 0xFF) != cJSON_Object) || (object->type & cJSON_IsReference))
+    {
+        return false;
+    }
+
+    cJSON_DropIndex(object);
+    for (child = object->child; child != NULL; child = child->next)
+    {
+        if (child->string == NULL)
+        {
+            return false;
+        }
+        count++;
+    }
+    while (capacity < (count * 2))
+    {
+        capacity *= 2;
+    }
+
+    /* The index has to live and die with its object: in the bulk allocator
+     * if the object is there, otherwise on the heap even if bulk allocation
+     * is what the hooks would do right now. */
+    if (bulk_free_check != NULL)
+    {
+        if (bulk_free_check(object))
+        {
+            deallocate = NULL;
+        }
+        else
+        {
+            allocate = malloc;
+            deallocate = free;
+        }
+    }
+
+    index = (cJSON_Index*)allocate(sizeof(cJSON_Index) + ((capacity - 1) * sizeof(cJSON*)));
+    if (index == NULL)
+    {
+        return false;
+    }
+    index->mask = capacity - 1;
+    index->deallocate = deallocate;
+    memset(index->slots, '\0', capacity * sizeof(cJSON*));
+
+    for (child = object->child; child != NULL; child = child->next)
+    {
+        slot = key_hash((const unsigned char*)child->string) & index->mask;
+        while (index->slots[slot] != NULL)
+        {
+            slot = (slot + 1) & index->mask;
+        }
+        index->slots[slot] = child;
+    }
+
+    object->index = index;
+    return true;
+}
+
 /* Internal constructor. */
 static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
 {
@@ -253,6 +366,10 @@ static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
 CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
 {
     cJSON *next = NULL;
+    if ((item != NULL) && (bulk_free_check != NULL) && bulk_free_check(item))
+    {
+        return;
+    }
     while (item != NULL)
     {
         next = item->next;
@@ -270,6 +387,7 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
             global_hooks.deallocate(item->string);
             item->string = NULL;
         }
+        cJSON_DropIndex(item);
         global_hooks.deallocate(item);
         item = next;
     }
@@ -303,6 +421,228 @@ typedef struct
 /* get a pointer to the buffer at the position */
 #define buffer_at_offset(buffer) ((buffer)->content + (buffer)->offset)
 
+/* Scanning routines behind the parser's hot loops. Each returns how many of
+ * the first length bytes belong to the run: whitespace (any byte <= 32) or
+ * plain string content (anything but a quote or a backslash). cJSON takes raw
+ * control characters inside strings as they are, so they don't end a run. */
+typedef size_t (*span_function)(const unsigned char *input, size_t length);
+
+static size_t whitespace_span_scalar(const unsigned char *input, size_t length)
+{
+    size_t i = 0;
+    while ((i < length) && (input[i] <= 32))
+    {
+        i++;
+    }
+    return i;
+}
+
+static size_t string_span_scalar(const unsigned char *input, size_t length)
+{
+    size_t i = 0;
+    while ((i < length) && (input[i] != '\"') && (input[i] != '\\'))
+    {
+        i++;
+    }
+    return i;
+}
+
+/* Eight bytes at a time in a general purpose register. A word with a hit is
+ * finished byte by byte, which keeps this independent of endianness. */
+#define WORD_ONES ((unsigned long long)0x0101010101010101ULL)
+#define WORD_HIGHS (WORD_ONES * 0x80)
+#define WORD_LOWS (WORD_ONES * 0x7F)
+
+/* high bit set in every byte of word that is not zero */
+#define word_nonzero_bytes(word) ((((word) & WORD_LOWS) + WORD_LOWS) | (word))
+
+static size_t whitespace_span_word(const unsigned char *input, size_t length)
+{
+    size_t i = 0;
+    unsigned long long word = 0;
+    for (; (i + sizeof(word)) <= length; i += sizeof(word))
+    {
+        memcpy(&word, input + i, sizeof(word));
+        /* 95 + byte carries into the high bit exactly when the byte is > 32 */
+        if (((((word & WORD_LOWS) + WORD_ONES * 95) | word) & WORD_HIGHS) != 0)
+        {
+            break;
+        }
+    }
+    return i + whitespace_span_scalar(input + i, length - i);
+}
+
+static size_t string_span_word(const unsigned char *input, size_t length)
+{
+    size_t i = 0;
+    unsigned long long word = 0;
+    for (; (i + sizeof(word)) <= length; i += sizeof(word))
+    {
+        memcpy(&word, input + i, sizeof(word));
+        if ((~(word_nonzero_bytes(word ^ (WORD_ONES * '\"')) & word_nonzero_bytes(word ^ (WORD_ONES * '\\'))) & WORD_HIGHS) != 0)
+        {
+            break;
+        }
+    }
+    return i + string_span_scalar(input + i, length - i);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CJSON_X86_SIMD
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static size_t whitespace_span_sse2(const unsigned char *input, size_t length)
+{
+    const __m128i space = _mm_set1_epi8(32);
+    size_t i = 0;
+    for (; (i + 16) <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(const void *)(input + i));
+        /* a byte is whitespace when max(byte, 32) is 32 */
+        unsigned int other = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chunk, space), space)) ^ 0xFFFFu;
+        if (other != 0)
+        {
+            return i + (size_t)__builtin_ctz(other);
+        }
+    }
+    return i + whitespace_span_scalar(input + i, length - i);
+}
+
+__attribute__((target("sse2")))
+static size_t string_span_sse2(const unsigned char *input, size_t length)
+{
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    size_t i = 0;
+    for (; (i + 16) <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(const void *)(input + i));
+        unsigned int special = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+        if (special != 0)
+        {
+            return i + (size_t)__builtin_ctz(special);
+        }
+    }
+    return i + string_span_scalar(input + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t whitespace_span_avx2(const unsigned char *input, size_t length)
+{
+    const __m256i space = _mm256_set1_epi8(32);
+    size_t i = 0;
+    for (; (i + 32) <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(const void *)(input + i));
+        unsigned int other = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(chunk, space), space));
+        if (other != 0)
+        {
+            return i + (size_t)__builtin_ctz(other);
+        }
+    }
+    return i + whitespace_span_scalar(input + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t string_span_avx2(const unsigned char *input, size_t length)
+{
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    size_t i = 0;
+    for (; (i + 32) <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(const void *)(input + i));
+        unsigned int special = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)));
+        if (special != 0)
+        {
+            return i + (size_t)__builtin_ctz(special);
+        }
+    }
+    return i + string_span_scalar(input + i, length - i);
+}
+#endif
+
+static struct
+{
+    span_function whitespace_span;
+    span_function string_span;
+    /* parse integers without strtod, off for the scalar reference */
+    cJSON_bool integer_fast_path;
+    const char *name;
+} scanner = { whitespace_span_scalar, string_span_scalar, false, "scalar" };
+
+CJSON_PUBLIC(cJSON_bool) cJSON_SetScanBackend(cJSON_ScanBackend backend)
+{
+    if (backend == cJSON_ScanAuto)
+    {
+#ifdef CJSON_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return cJSON_SetScanBackend(cJSON_ScanAVX2);
+        }
+        return cJSON_SetScanBackend(cJSON_ScanSSE2);
+#else
+        return cJSON_SetScanBackend(cJSON_ScanWord);
+#endif
+    }
+
+    switch (backend)
+    {
+        case cJSON_ScanScalar:
+            scanner.whitespace_span = whitespace_span_scalar;
+            scanner.string_span = string_span_scalar;
+            scanner.name = "scalar";
+            break;
+
+        case cJSON_ScanWord:
+            scanner.whitespace_span = whitespace_span_word;
+            scanner.string_span = string_span_word;
+            scanner.name = "word";
+            break;
+
+#ifdef CJSON_X86_SIMD
+        case cJSON_ScanSSE2:
+            scanner.whitespace_span = whitespace_span_sse2;
+            scanner.string_span = string_span_sse2;
+            scanner.name = "sse2";
+            break;
+
+        case cJSON_ScanAVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2"))
+            {
+                return false;
+            }
+            scanner.whitespace_span = whitespace_span_avx2;
+            scanner.string_span = string_span_avx2;
+            scanner.name = "avx2";
+            break;
+#endif
+
+        default:
+            return false;
+    }
+
+    scanner.integer_fast_path = (backend != cJSON_ScanScalar);
+    return true;
+}
+
+CJSON_PUBLIC(const char*) cJSON_GetScanBackend(void)
+{
+    return scanner.name;
+}
+
+#if defined(__GNUC__)
+/* Pick the backend before main so the parser never races on the choice */
+__attribute__((constructor))
+static void scanner_init(void)
+{
+    cJSON_SetScanBackend(cJSON_ScanAuto);
+}
+#endif
+
 /* Parse the input text to generate a number, and populate the result into item. */
 static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_buffer)
 {
@@ -311,12 +651,37 @@ static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_bu
     unsigned char number_c_string[64];
     unsigned char decimal_point = get_decimal_point();
     size_t i = 0;
+    size_t consumed = 0;
 
     if ((input_buffer == NULL) || (input_buffer->content == NULL))
     {
         return false;
     }
 
+    /* Integers of up to 15 digits are exact as doubles, so scores and ids
+     * skip the copy and strtod. Anything with a fraction or exponent, or
+     * longer, takes the general path below. */
+    if (scanner.integer_fast_path && can_access_at_index(input_buffer, 0))
+    {
+        const unsigned char *digits = buffer_at_offset(input_buffer);
+        size_t available = input_buffer->length - input_buffer->offset;
+        size_t first_digit = (digits[0] == '-') ? 1 : 0;
+        unsigned long long value = 0;
+
+        for (i = first_digit; (i < available) && (i - first_digit < 16) && (digits[i] >= '0') && (digits[i] <= '9'); i++)
+        {
+            value = (value * 10) + (unsigned long long)(digits[i] - '0');
+        }
+
+        if ((i > first_digit) && (i - first_digit <= 15)
+            && ((i == available) || ((digits[i] != '.') && (digits[i] != 'e') && (digits[i] != 'E') && ((digits[i] < '0') || (digits[i] > '9')))))
+        {
+            number = (first_digit == 1) ? -(double)value : (double)value;
+            consumed = i;
+            goto store_number;
+        }
+    }
+
     /* copy the number into a temporary buffer and replace '.' with the decimal point
      * of the current locale (for strtod)
      * This also takes care of '\0' not necessarily being available for marking the end of the input */
@@ -357,7 +722,9 @@ loop_end:
     {
         return false; /* parse_error */
     }
+    consumed = (size_t)(after_end - number_c_string);
 
+store_number:
     item->valuedouble = number;
 
     /* use saturation in case of overflow */
@@ -376,7 +743,7 @@ loop_end:
 
     item->type = cJSON_Number;
 
-    input_buffer->offset += (size_t)(after_end - number_c_string);
+    input_buffer->offset += consumed;
     return true;
 }
 
@@ -806,20 +1173,24 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
         /* calculate approximate size of the output (overestimate) */
         size_t allocation_length = 0;
         size_t skipped_bytes = 0;
-        while (((size_t)(input_end - input_buffer->content) < input_buffer->length) && (*input_end != '\"'))
+        const unsigned char *content_end = input_buffer->content + input_buffer->length;
+        while (input_end < content_end)
         {
-            /* is escape sequence */
-            if (input_end[0] == '\\')
+            /* jump to the next quote or backslash */
+            input_end += scanner.string_span(input_end, (size_t)(content_end - input_end));
+            if ((input_end >= content_end) || (*input_end == '\"'))
             {
-                if ((size_t)(input_end + 1 - input_buffer->content) >= input_buffer->length)
-                {
-                    /* prevent buffer overflow when last input character is a backslash */
-                    goto fail;
-                }
-                skipped_bytes++;
-                input_end++;
+                break;
             }
-            input_end++;
+
+            /* escape sequence */
+            if ((input_end + 1) >= content_end)
+            {
+                /* prevent buffer overflow when last input character is a backslash */
+                goto fail;
+            }
+            skipped_bytes++;
+            input_end += 2;
         }
         if (((size_t)(input_end - input_buffer->content) >= input_buffer->length) || (*input_end != '\"'))
         {
@@ -841,7 +1212,11 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
     {
         if (*input_pointer != '\\')
         {
-            *output_pointer++ = *input_pointer++;
+            /* copy everything up to the next escape in one go */
+            size_t run = 1 + scanner.string_span(input_pointer + 1, (size_t)(input_end - input_pointer - 1));
+            memcpy(output_pointer, input_pointer, run);
+            output_pointer += run;
+            input_pointer += run;
         }
         /* escape sequence */
         else
@@ -1067,10 +1442,12 @@ static parse_buffer *buffer_skip_whitespace(parse_buffer * const buffer)
         return buffer;
     }
 
-    while (can_access_at_index(buffer, 0) && (buffer_at_offset(buffer)[0] <= 32))
+    /* most values are preceded by no or a single whitespace byte */
+    if (buffer_at_offset(buffer)[0] > 32)
     {
-       buffer->offset++;
+        return buffer;
     }
+    buffer->offset += scanner.whitespace_span(buffer_at_offset(buffer), buffer->length - buffer->offset);
 
     if (buffer->offset == buffer->length)
     {
@@ -1906,21 +2283,64 @@ CJSON_PUBLIC(cJSON *) cJSON_GetArrayItem(const cJSON *array, int index)
     return get_array_item(array, (size_t)index);
 }
 
+static cJSON *index_lookup(const cJSON_Index * const index, const char * const name, const cJSON_bool case_sensitive)
+{
+    size_t slot = key_hash((const unsigned char*)name) & index->mask;
+    cJSON *item = NULL;
+
+    for (; index->slots[slot] != NULL; slot = (slot + 1) & index->mask)
+    {
+        item = index->slots[slot];
+        if (case_sensitive ? (strcmp(name, item->string) == 0) : (case_insensitive_strcmp((const unsigned char*)name, (const unsigned char*)item->string) == 0))
+        {
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+#if defined(__clang__) || (defined(__GNUC__)  && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ > 5))))
+    #pragma GCC diagnostic push
+#endif
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wcast-qual"
+#endif
+/* the index is a cache, lookups on a const object may still build it */
+static cJSON_bool index_object(const cJSON * const object)
+{
+    return cJSON_BuildIndex((cJSON*)object);
+}
+#if defined(__clang__) || (defined(__GNUC__)  && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ > 5))))
+    #pragma GCC diagnostic pop
+#endif
+
 static cJSON *get_object_item(const cJSON * const object, const char * const name, const cJSON_bool case_sensitive)
 {
     cJSON *current_element = NULL;
+    size_t walked = 0;
 
     if ((object == NULL) || (name == NULL))
     {
         return NULL;
     }
 
+    if (object->index != NULL)
+    {
+        return index_lookup(object->index, name, case_sensitive);
+    }
+
+    /* a lookup that has to walk far enough indexes the object on the way */
     current_element = object->child;
     if (case_sensitive)
     {
         while ((current_element != NULL) && (current_element->string != NULL) && (strcmp(name, current_element->string) != 0))
         {
             current_element = current_element->next;
+            if ((++walked == CJSON_INDEX_MIN_KEYS) && (current_element != NULL) && index_object(object))
+            {
+                return index_lookup(object->index, name, case_sensitive);
+            }
         }
     }
     else
@@ -1928,6 +2348,10 @@ static cJSON *get_object_item(const cJSON * const object, const char * const nam
         while ((current_element != NULL) && (case_insensitive_strcmp((const unsigned char*)name, (const unsigned char*)(current_element->string)) != 0))
         {
             current_element = current_element->next;
+            if ((++walked == CJSON_INDEX_MIN_KEYS) && (current_element != NULL) && index_object(object))
+            {
+                return index_lookup(object->index, name, case_sensitive);
+            }
         }
     }
 
@@ -1977,6 +2401,7 @@ static cJSON *create_reference(const cJSON *item, const internal_hooks * const h
 
     memcpy(reference, item, sizeof(cJSON));
     reference->string = NULL;
+    reference->index = NULL;
     reference->type |= cJSON_IsReference;
     reference->next = reference->prev = NULL;
     return reference;
@@ -1991,6 +2416,7 @@ static cJSON_bool add_item_to_array(cJSON *array, cJSON *item)
         return false;
     }
 
+    cJSON_DropIndex(array);
     child = array->child;
     /*
      * To find the last item in array quickly, we use prev in array
@@ -2219,6 +2645,7 @@ CJSON_PUBLIC(cJSON *) cJSON_DetachItemViaPointer(cJSON *parent, cJSON * const it
     {
         return NULL;
     }
+    cJSON_DropIndex(parent);
 
     if (item != parent->child)
     {
@@ -2309,6 +2736,7 @@ CJSON_PUBLIC(cJSON_bool) cJSON_InsertItemInArray(cJSON *array, int which, cJSON
         return false;
     }
 
+    cJSON_DropIndex(array);
     newitem->next = after_inserted;
     newitem->prev = after_inserted->prev;
     after_inserted->prev = newitem;
@@ -2335,6 +2763,7 @@ CJSON_PUBLIC(cJSON_bool) cJSON_ReplaceItemViaPointer(cJSON * const parent, cJSON
         return true;
     }
 
+    cJSON_DropIndex(parent);
     replacement->next = item->next;
     replacement->prev = item->prev;
 
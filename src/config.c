@@ -0,0 +1,339 @@
+#include "config.h"
+#include "utils.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+ServerConfig server_config = {
+    .port = 8080,
+
+    .db_engine = "sqlite",
+    .db_path = "./db/sqlite3.db",
+    .db_log_path = "./db/scores.log",
+    .db_log_compact_min_bytes = 4 * 1024 * 1024,
+
+    .db_backup_path = "./db/backup.db",
+    .db_backup_interval_s = 0,
+    .db_backup_step_pages = 64,
+    .db_backup_step_sleep_ms = 5,
+
+    .db_journal_mode = "WAL",
+    .db_synchronous = "NORMAL",
+    .db_mmap_size = 64 * 1024 * 1024,
+    .db_cache_size = -8192, // Negative means KiB, so 8 MiB
+    .db_temp_store = "MEMORY",
+    .db_busy_timeout_ms = 5000,
+
+    .db_writer_queue_size = 4096,
+    .db_writer_batch_size = 256,
+    .db_writer_flush_ms = 5,
+    .db_writer_ack_before_durable = false,
+
+    .db_executor_threads = 2,
+    .db_executor_queue_size = 1024,
+
+    .auth_threads = 2,
+    .auth_queue_size = 64,
+    .auth_deadline_ms = 2000,
+    .auth_hash_cost = 5,
+
+    .session_ttl_s = 24 * 60 * 60,
+    .session_snapshot_path = "",
+    .session_snapshot_interval_s = 300,
+
+    .cache_users_capacity = 4096,
+    .cache_users_negative_ttl_s = 10,
+    .cache_username_filter_bits = 10,
+    .cache_username_filter_min_capacity = 65536,
+    .cache_responses_capacity = 1024,
+    .cache_responses_ttl_ms = 1000,
+    .cache_responses_stale_ms = 5000,
+
+    .log_levels = "info",
+    .log_async = true,
+    .log_ring_records = 512,
+    .log_flush_interval_ms = 20,
+    .log_shutdown_flush_ms = 500,
+    .log_slow_request_ms = 1000,
+
+    .access_log_path = "",
+    .access_log_max_bytes = 64 * 1024 * 1024,
+    .access_log_max_files = 4,
+    .access_log_queue_records = 4096,
+    .access_log_flush_interval_ms = 100,
+
+    .latency_snapshot_path = "",
+    .latency_snapshot_interval_ms = 10000,
+};
+
+typedef enum
+{
+  CONFIG_INT = 0,
+  CONFIG_LONG,
+  CONFIG_STRING,
+  CONFIG_BOOL,
+} ConfigType;
+
+typedef struct
+{
+  const char *key;
+  ConfigType type;
+  size_t offset;
+  size_t size;
+  // NULL terminated list of accepted values for CONFIG_STRING, NULL for any
+  const char *const *choices;
+} ConfigOption;
+
+static const char *const storage_engines[] = {"sqlite", "log", NULL};
+static const char *const journal_modes[] = {"DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF", NULL};
+static const char *const synchronous_modes[] = {"OFF", "NORMAL", "FULL", "EXTRA", NULL};
+static const char *const temp_stores[] = {"DEFAULT", "FILE", "MEMORY", NULL};
+
+#define OPTION(key, type, field, choices) \
+  {key, type, offsetof(ServerConfig, field), sizeof(((ServerConfig *)0)->field), choices}
+
+static const ConfigOption config_options[] = {
+    OPTION("server.port", CONFIG_INT, port, NULL),
+
+    OPTION("db.engine", CONFIG_STRING, db_engine, storage_engines),
+    OPTION("db.path", CONFIG_STRING, db_path, NULL),
+    OPTION("db.log_path", CONFIG_STRING, db_log_path, NULL),
+    OPTION("db.log_compact_min_bytes", CONFIG_LONG, db_log_compact_min_bytes, NULL),
+
+    OPTION("db.backup_path", CONFIG_STRING, db_backup_path, NULL),
+    OPTION("db.backup_interval_s", CONFIG_INT, db_backup_interval_s, NULL),
+    OPTION("db.backup_step_pages", CONFIG_INT, db_backup_step_pages, NULL),
+    OPTION("db.backup_step_sleep_ms", CONFIG_INT, db_backup_step_sleep_ms, NULL),
+
+    OPTION("db.journal_mode", CONFIG_STRING, db_journal_mode, journal_modes),
+    OPTION("db.synchronous", CONFIG_STRING, db_synchronous, synchronous_modes),
+    OPTION("db.mmap_size", CONFIG_LONG, db_mmap_size, NULL),
+    OPTION("db.cache_size", CONFIG_INT, db_cache_size, NULL),
+    OPTION("db.temp_store", CONFIG_STRING, db_temp_store, temp_stores),
+    OPTION("db.busy_timeout_ms", CONFIG_INT, db_busy_timeout_ms, NULL),
+
+    OPTION("db.writer_queue_size", CONFIG_INT, db_writer_queue_size, NULL),
+    OPTION("db.writer_batch_size", CONFIG_INT, db_writer_batch_size, NULL),
+    OPTION("db.writer_flush_ms", CONFIG_INT, db_writer_flush_ms, NULL),
+    OPTION("db.writer_ack_before_durable", CONFIG_BOOL, db_writer_ack_before_durable, NULL),
+
+    OPTION("db.executor_threads", CONFIG_INT, db_executor_threads, NULL),
+    OPTION("db.executor_queue_size", CONFIG_INT, db_executor_queue_size, NULL),
+
+    OPTION("auth.threads", CONFIG_INT, auth_threads, NULL),
+    OPTION("auth.queue_size", CONFIG_INT, auth_queue_size, NULL),
+    OPTION("auth.deadline_ms", CONFIG_INT, auth_deadline_ms, NULL),
+    OPTION("auth.hash_cost", CONFIG_INT, auth_hash_cost, NULL),
+
+    OPTION("session.ttl_s", CONFIG_INT, session_ttl_s, NULL),
+    OPTION("session.snapshot_path", CONFIG_STRING, session_snapshot_path, NULL),
+    OPTION("session.snapshot_interval_s", CONFIG_INT, session_snapshot_interval_s, NULL),
+
+    OPTION("cache.users_capacity", CONFIG_INT, cache_users_capacity, NULL),
+    OPTION("cache.users_negative_ttl_s", CONFIG_INT, cache_users_negative_ttl_s, NULL),
+    OPTION("cache.username_filter_bits", CONFIG_INT, cache_username_filter_bits, NULL),
+    OPTION("cache.username_filter_min_capacity", CONFIG_INT, cache_username_filter_min_capacity, NULL),
+    OPTION("cache.responses_capacity", CONFIG_INT, cache_responses_capacity, NULL),
+    OPTION("cache.responses_ttl_ms", CONFIG_INT, cache_responses_ttl_ms, NULL),
+    OPTION("cache.responses_stale_ms", CONFIG_INT, cache_responses_stale_ms, NULL),
+
+    OPTION("log.levels", CONFIG_STRING, log_levels, NULL),
+    OPTION("log.async", CONFIG_BOOL, log_async, NULL),
+    OPTION("log.ring_records", CONFIG_INT, log_ring_records, NULL),
+    OPTION("log.flush_interval_ms", CONFIG_INT, log_flush_interval_ms, NULL),
+    OPTION("log.shutdown_flush_ms", CONFIG_INT, log_shutdown_flush_ms, NULL),
+    OPTION("log.slow_request_ms", CONFIG_INT, log_slow_request_ms, NULL),
+
+    OPTION("access_log.path", CONFIG_STRING, access_log_path, NULL),
+    OPTION("access_log.max_bytes", CONFIG_LONG, access_log_max_bytes, NULL),
+    OPTION("access_log.max_files", CONFIG_INT, access_log_max_files, NULL),
+    OPTION("access_log.queue_records", CONFIG_INT, access_log_queue_records, NULL),
+    OPTION("access_log.flush_interval_ms", CONFIG_INT, access_log_flush_interval_ms, NULL),
+
+    OPTION("latency.snapshot_path", CONFIG_STRING, latency_snapshot_path, NULL),
+    OPTION("latency.snapshot_interval_ms", CONFIG_INT, latency_snapshot_interval_ms, NULL),
+};
+
+static char *trim(char *s)
+{
+  while (isspace((unsigned char)*s))
+    s++;
+
+  char *end = s + strlen(s);
+  while (end > s && isspace((unsigned char)end[-1]))
+    end--;
+  *end = '\0';
+
+  return s;
+}
+
+static bool set_option(const ConfigOption *option, const char *value)
+{
+  char *field = (char *)&server_config + option->offset;
+  char *end = NULL;
+
+  switch (option->type)
+  {
+  case CONFIG_INT:
+  {
+    long v = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0')
+      return false;
+    *(int *)field = (int)v;
+  }
+  break;
+  case CONFIG_LONG:
+  {
+    long long v = strtoll(value, &end, 10);
+    if (*value == '\0' || *end != '\0')
+      return false;
+    *(long long *)field = v;
+  }
+  break;
+  case CONFIG_STRING:
+  {
+    if (strlen(value) >= option->size)
+      return false;
+
+    if (option->choices)
+    {
+      bool valid = false;
+      for (const char *const *c = option->choices; *c; c++)
+      {
+        if (strcasecmp(*c, value) == 0)
+        {
+          value = *c;
+          valid = true;
+          break;
+        }
+      }
+      if (!valid)
+        return false;
+    }
+    strcpy(field, value);
+  }
+  break;
+  case CONFIG_BOOL:
+  {
+    if (strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0)
+      *(bool *)field = true;
+    else if (strcasecmp(value, "false") == 0 || strcmp(value, "0") == 0)
+      *(bool *)field = false;
+    else
+      return false;
+  }
+  break;
+  }
+
+  return true;
+}
+
+static char loaded_path[256];
+
+// Sets the options in path, or only the one named only_key
+static bool load_file(const char *path, const char *only_key)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+  {
+    log_message(LOG_ERROR, "Could not open config file %s", path);
+    return false;
+  }
+
+  char line[512];
+  int line_number = 0;
+  bool ok = true;
+
+  while (fgets(line, sizeof(line), f))
+  {
+    line_number++;
+    char *entry = trim(line);
+    if (*entry == '\0' || *entry == '#')
+      continue;
+
+    char *equals = strchr(entry, '=');
+    if (!equals)
+    {
+      log_message(LOG_ERROR, "%s:%d: expected `key = value`", path, line_number);
+      ok = false;
+      continue;
+    }
+    *equals = '\0';
+    char *key = trim(entry);
+    char *value = trim(equals + 1);
+    if (only_key && strcmp(key, only_key) != 0)
+      continue;
+
+    const ConfigOption *option = NULL;
+    for (size_t i = 0; i < ARRAY_LEN(config_options); i++)
+    {
+      if (strcmp(config_options[i].key, key) == 0)
+      {
+        option = &config_options[i];
+        break;
+      }
+    }
+
+    if (!option)
+    {
+      log_message(LOG_ERROR, "%s:%d: unknown option %s", path, line_number, key);
+      ok = false;
+      continue;
+    }
+
+    if (!set_option(option, value))
+    {
+      log_message(LOG_ERROR, "%s:%d: invalid value \"%s\" for %s", path, line_number, value, key);
+      ok = false;
+    }
+  }
+
+  fclose(f);
+
+  if (!log_set_levels(server_config.log_levels))
+  {
+    log_message(LOG_ERROR, "%s: invalid log.levels \"%s\"", path, server_config.log_levels);
+    ok = false;
+  }
+  return ok;
+}
+
+bool config_load(const char *path)
+{
+  snprintf(loaded_path, sizeof(loaded_path), "%s", path);
+  return load_file(path, NULL);
+}
+
+bool config_reload(void)
+{
+  if (loaded_path[0] == '\0')
+    return true;
+  return load_file(loaded_path, "log.levels");
+}
+
+void config_print(void)
+{
+  for (size_t i = 0; i < ARRAY_LEN(config_options); i++)
+  {
+    const ConfigOption *option = &config_options[i];
+    const char *field = (const char *)&server_config + option->offset;
+
+    switch (option->type)
+    {
+    case CONFIG_INT:
+      log_message(LOG_INFO, "%s = %d", option->key, *(const int *)field);
+      break;
+    case CONFIG_LONG:
+      log_message(LOG_INFO, "%s = %lld", option->key, *(const long long *)field);
+      break;
+    case CONFIG_STRING:
+      log_message(LOG_INFO, "%s = %s", option->key, field);
+      break;
+    case CONFIG_BOOL:
+      log_message(LOG_INFO, "%s = %s", option->key, *(const bool *)field ? "true" : "false");
+      break;
+    }
+  }
+}
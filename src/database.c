@@ -1,23 +1,127 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_STORAGE
 #include <stdio.h>
 #include <stdbool.h>
 #include <sqlite3.h>
 #include <string.h>
 #include "utils.h"
 #include "database.h"
+#include "config.h"
+#include "storage.h"
 
-bool create_database()
+// One connection per thread: SQLite connections must not be shared between
+// threads without serialization, and opening one costs a schema parse.
+static _Thread_local sqlite3 *thread_db = NULL;
+static _Thread_local sqlite3_stmt *thread_statements[STMT_COUNT] = {0};
+
+static const char *statement_sql[STMT_COUNT] = {
+    [STMT_SEARCH_USER] = "SELECT id, password FROM User WHERE username = ?1;",
+    [STMT_USER_ID] = "SELECT id FROM User WHERE username = ?1;",
+    [STMT_ADD_USER] = "INSERT INTO User (username, password) VALUES (?1, ?2);",
+    [STMT_ADD_SCORE] = "INSERT INTO UserScore (user_id, username, score, timestamp) VALUES (?1, ?2, ?3, ?4);",
+    [STMT_BEGIN] = "BEGIN IMMEDIATE;",
+    [STMT_COMMIT] = "COMMIT;",
+    [STMT_ROLLBACK] = "ROLLBACK;",
+};
+
+// Applies the tuning profile from server_config. The string options are
+// validated against a fixed list when the config is loaded, so they are safe
+// to paste into the pragmas.
+static bool db_apply_tuning(sqlite3 *db)
 {
-    sqlite3 *db;
-    int rc = sqlite3_open(DB_PATH, &db);
+    char sql[512];
+    snprintf(sql, sizeof(sql),
+             "PRAGMA journal_mode = %s;"
+             "PRAGMA synchronous = %s;"
+             "PRAGMA mmap_size = %lld;"
+             "PRAGMA cache_size = %d;"
+             "PRAGMA temp_store = %s;",
+             server_config.db_journal_mode,
+             server_config.db_synchronous,
+             server_config.db_mmap_size,
+             server_config.db_cache_size,
+             server_config.db_temp_store);
 
-    if (rc)
+    sqlite3_busy_timeout(db, server_config.db_busy_timeout_ms);
+
+    char *err_msg = 0;
+    if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK)
     {
-        log_message(LOG_ERROR, "Can't open database: %s", sqlite3_errmsg(db));
+        log_message(LOG_ERROR, "Failed to tune database: %s", err_msg);
+        sqlite3_free(err_msg);
         return false;
     }
+
     return true;
 }
 
+sqlite3 *db_connection()
+{
+    if (thread_db)
+        return thread_db;
+
+    int rc = sqlite3_open(server_config.db_path, &thread_db);
+    if (rc != SQLITE_OK)
+    {
+        log_message(LOG_ERROR, "Can't open database: %s", sqlite3_errmsg(thread_db));
+        sqlite3_close(thread_db);
+        thread_db = NULL;
+        return NULL;
+    }
+
+    if (!db_apply_tuning(thread_db))
+    {
+        sqlite3_close(thread_db);
+        thread_db = NULL;
+        return NULL;
+    }
+
+    return thread_db;
+}
+
+sqlite3_stmt *db_statement(StatementId id)
+{
+    if (thread_statements[id])
+        return thread_statements[id];
+
+    sqlite3 *db = db_connection();
+    if (!db)
+        return NULL;
+
+    int rc = sqlite3_prepare_v3(db, statement_sql[id], -1, SQLITE_PREPARE_PERSISTENT,
+                                &thread_statements[id], NULL);
+    if (rc != SQLITE_OK)
+    {
+        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
+        thread_statements[id] = NULL;
+        return NULL;
+    }
+
+    return thread_statements[id];
+}
+
+void db_reset_statement(sqlite3_stmt *stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+void db_close_connection()
+{
+    for (int i = 0; i < STMT_COUNT; i++)
+    {
+        sqlite3_finalize(thread_statements[i]);
+        thread_statements[i] = NULL;
+    }
+
+    sqlite3_close(thread_db);
+    thread_db = NULL;
+}
+
+bool create_database()
+{
+    return db_connection() != NULL;
+}
+
 void create_table(const char *table, const char *columns)
 {
     char sql[1024];
@@ -35,17 +139,13 @@ void create_table(const char *table, const char *columns)
 
 bool sql_execute(const char *sql)
 {
-    sqlite3 *db;
     char *err_msg = 0;
-    int rc = sqlite3_open(DB_PATH, &db);
+    sqlite3 *db = db_connection();
 
-    if (rc)
-    {
-        log_message(LOG_ERROR, "Can't open database: %s", sqlite3_errmsg(db));
+    if (!db)
         return false;
-    }
 
-    rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+    int rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
 
     if (rc != SQLITE_OK)
     {
@@ -54,86 +154,261 @@ bool sql_execute(const char *sql)
         return false;
     }
 
-    sqlite3_close(db);
     return true;
 }
 
-bool sql_search_username(const char *username, const char *password)
+bool sql_get_credentials(const char *username, int *user_id, char *password, size_t password_size)
 {
-    sqlite3 *db;
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_open(DB_PATH, &db);
+    sqlite3_stmt *stmt = db_statement(STMT_SEARCH_USER);
+    if (!stmt)
+        return false;
+
+    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
 
-    if (rc)
+    bool found = false;
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
     {
-        log_message(LOG_ERROR, "Can't open database: %s", sqlite3_errmsg(db));
+        const unsigned char *db_password = sqlite3_column_text(stmt, 1);
+        *user_id = sqlite3_column_int(stmt, 0);
+        found = db_password && snprintf(password, password_size, "%s", db_password) < (int)password_size;
+    }
+    else if (rc != SQLITE_DONE)
+    {
+        log_message(LOG_ERROR, "Failed to fetch data: %s", sqlite3_errmsg(db_connection()));
+    }
+
+    db_reset_statement(stmt);
+    return found;
+}
+
+bool sql_add_user(const char *username, const char *password)
+{
+    sqlite3_stmt *stmt = db_statement(STMT_ADD_USER);
+    if (!stmt)
         return false;
+
+    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, password, -1, SQLITE_STATIC);
+
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE)
+    {
+        log_message(LOG_ERROR, "SQL error: %s", sqlite3_errmsg(db_connection()));
     }
 
-    char sql[1024];
-    snprintf(sql, sizeof(sql), "SELECT * FROM User WHERE username = '%s';", username);
+    db_reset_statement(stmt);
+    return rc == SQLITE_DONE;
+}
+
+bool sql_add_score(int user_id, const char *username, int score, long timestamp)
+{
+    sqlite3_stmt *stmt = db_statement(STMT_ADD_SCORE);
+    if (!stmt)
+        return false;
+
+    sqlite3_bind_int(stmt, 1, user_id);
+    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, score);
+    sqlite3_bind_int64(stmt, 4, timestamp);
+
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE)
+    {
+        log_message(LOG_ERROR, "SQL error: %s", sqlite3_errmsg(db_connection()));
+    }
+
+    db_reset_statement(stmt);
+    return rc == SQLITE_DONE;
+}
+
+int sql_get_user_id(const char *username)
+{
+    sqlite3_stmt *stmt = db_statement(STMT_USER_ID);
+    if (!stmt)
+        return -1;
+
+    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
+
+    int id = -1;
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+    {
+        id = sqlite3_column_int(stmt, 0);
+    }
+    else if (rc != SQLITE_DONE)
+    {
+        log_message(LOG_ERROR, "Failed to fetch data: %s", sqlite3_errmsg(db_connection()));
+    }
+
+    db_reset_statement(stmt);
+    return id;
+}
 
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+long sql_count_users()
+{
+    sqlite3 *db = db_connection();
+    sqlite3_stmt *stmt;
+
+    if (!db || sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM User;", -1, &stmt, NULL) != SQLITE_OK)
+        return -1;
 
+    long count = sqlite3_step(stmt) == SQLITE_ROW ? (long)sqlite3_column_int64(stmt, 0) : -1;
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+long sql_for_each_username(UsernameRowFn fn, void *ctx)
+{
+    sqlite3 *db = db_connection();
+    sqlite3_stmt *stmt;
+
+    if (!db)
+        return -1;
+
+    // Only run at startup, so it is not worth keeping prepared
+    int rc = sqlite3_prepare_v2(db, "SELECT username FROM User;", -1, &stmt, NULL);
     if (rc != SQLITE_OK)
     {
         log_message(LOG_ERROR, "Failed to fetch data: %s", sqlite3_errmsg(db));
-        sqlite3_close(db);
-        return false;
+        return -1;
     }
 
-    bool found = false;
-    while (sqlite3_step(stmt) == SQLITE_ROW)
+    long count = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
     {
-        found = true;
-        const unsigned char *db_username = sqlite3_column_text(stmt, 1);
-        const unsigned char *db_password = sqlite3_column_text(stmt, 2);
-
-        if (strcmp((char*)db_username, username) == 0 && strcmp((char*)db_password, password) == 0)
-        {
-            break;
-        }
-        else
-        {
-            found = false;
-        }
+        const unsigned char *username = sqlite3_column_text(stmt, 0);
+        if (!username)
+            continue;
+        fn(ctx, (const char *)username);
+        count++;
+    }
 
-        break;
+    if (rc != SQLITE_DONE)
+    {
+        log_message(LOG_ERROR, "Failed to fetch data: %s", sqlite3_errmsg(db));
+        count = -1;
     }
 
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    return found;
+    return count;
 }
 
-bool sql_add_user(const char *username, const char *password)
+bool sql_for_each_score(ScoreRowFn fn, void *ctx)
 {
-    sqlite3 *db;
-    char *err_msg = 0;
-    int rc = sqlite3_open(DB_PATH, &db);
+    sqlite3 *db = db_connection();
+    sqlite3_stmt *stmt;
+
+    if (!db)
+        return false;
 
-    if (rc)
+    // Only run at startup, so it is not worth keeping prepared
+    int rc = sqlite3_prepare_v2(db, "SELECT username, score, timestamp FROM UserScore;", -1, &stmt, NULL);
+    if (rc != SQLITE_OK)
     {
-        log_message(LOG_ERROR, "Can't open database: %s", sqlite3_errmsg(db));
+        log_message(LOG_ERROR, "Failed to fetch data: %s", sqlite3_errmsg(db));
         return false;
     }
 
-    char sql[1024];
-    snprintf(sql, sizeof(sql), "INSERT INTO User (username, password) VALUES ('%s', '%s');", username, password);
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        const unsigned char *username = sqlite3_column_text(stmt, 0);
+        if (!username)
+            continue;
+        fn(ctx, (const char *)username, sqlite3_column_int(stmt, 1), (long)sqlite3_column_int64(stmt, 2));
+    }
 
-    rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+    if (rc != SQLITE_DONE)
+        log_message(LOG_ERROR, "Failed to fetch data: %s", sqlite3_errmsg(db));
 
-    if (rc != SQLITE_OK)
-    {
-        log_message(LOG_ERROR, "SQL error: %s", err_msg);
-        sqlite3_free(err_msg);
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE;
+}
+
+static bool sql_step_once(StatementId id)
+{
+    sqlite3_stmt *stmt = db_statement(id);
+    if (!stmt)
         return false;
+
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE)
+    {
+        log_message(LOG_ERROR, "SQL error: %s", sqlite3_errmsg(db_connection()));
     }
 
-    sqlite3_close(db);
+    db_reset_statement(stmt);
+    return rc == SQLITE_DONE;
+}
+
+bool sql_begin()
+{
+    return sql_step_once(STMT_BEGIN);
+}
+
+bool sql_commit()
+{
+    return sql_step_once(STMT_COMMIT);
+}
+
+bool sql_rollback()
+{
+    return sql_step_once(STMT_ROLLBACK);
+}
+
+// SQLite storage engine
+
+static bool sqlite_open(void)
+{
+    if (!create_database())
+        return false;
+
+    create_table("User", "id INTEGER PRIMARY KEY AUTOINCREMENT, username TEXT UNIQUE, password TEXT");
+    create_table("UserScore", "user_id INTEGER, username TEXT, score INTEGER, timestamp INTEGER");
+    return true;
+}
+
+static bool sqlite_add_user(const char *username, const char *password, int64_t *row_id)
+{
+    if (!sql_add_user(username, password))
+        return false;
+
+    *row_id = sqlite3_last_insert_rowid(db_connection());
+    return true;
+}
+
+static bool sqlite_add_score(int user_id, const char *username, int score, long timestamp, int64_t *row_id)
+{
+    if (!sql_add_score(user_id, username, score, timestamp))
+        return false;
+
+    *row_id = sqlite3_last_insert_rowid(db_connection());
     return true;
 }
 
+static void sqlite_maintain(void)
+{
+    // SQLite checkpoints the WAL on its own
+}
+
+const StorageEngine sqlite_storage = {
+    .name = "sqlite",
+    .open = sqlite_open,
+    .close = db_close_connection,
+    .close_thread = db_close_connection,
+    .begin = sql_begin,
+    .commit = sql_commit,
+    .rollback = sql_rollback,
+    .add_user = sqlite_add_user,
+    .add_score = sqlite_add_score,
+    .get_credentials = sql_get_credentials,
+    .get_user_id = sql_get_user_id,
+    .count_users = sql_count_users,
+    .for_each_username = sql_for_each_username,
+    .for_each_score = sql_for_each_score,
+    .maintain = sqlite_maintain,
+};
+
 // char *sql_select(const char *table, const char *columns)
 // {
 //     sqlite3_stmt *stmt;
@@ -0,0 +1,28 @@
+#include <stdbool.h>
+#include "config.h"
+#include "storage.h"
+#include "db_executor.h"
+#include "work_pool.h"
+
+static WorkPool db_executor;
+
+bool db_executor_start(CompletionQueue *completions)
+{
+    if (server_config.db_executor_threads <= 0 || server_config.db_executor_queue_size <= 0)
+        return false;
+
+    return work_pool_start(&db_executor, "database",
+                           (size_t)server_config.db_executor_threads,
+                           (size_t)server_config.db_executor_queue_size,
+                           completions, storage_close_thread);
+}
+
+void db_executor_stop()
+{
+    work_pool_stop(&db_executor);
+}
+
+bool db_executor_submit(WorkJob *job)
+{
+    return work_pool_submit(&db_executor, job);
+}
@@ -0,0 +1,264 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_STORAGE
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utils.h"
+#include "config.h"
+#include "storage.h"
+#include "db_writer.h"
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+
+    DbWrite *items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+
+    bool running;
+    bool stopping;
+} DbWriter;
+
+static DbWriter writer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+};
+
+static bool db_writer_push(const DbWrite *w)
+{
+    pthread_mutex_lock(&writer.lock);
+
+    if (!writer.running || writer.stopping || writer.count == writer.capacity)
+    {
+        pthread_mutex_unlock(&writer.lock);
+        return false;
+    }
+
+    writer.items[(writer.head + writer.count) % writer.capacity] = *w;
+    writer.count++;
+
+    // The writer only needs waking up to start a batch or to flush a full one
+    if (writer.count == 1 || writer.count == (size_t)server_config.db_writer_batch_size)
+        pthread_cond_signal(&writer.not_empty);
+
+    pthread_mutex_unlock(&writer.lock);
+    return true;
+}
+
+static bool db_writer_apply(const DbWrite *w, int64_t *row_id)
+{
+    switch (w->type)
+    {
+    case DB_WRITE_ADD_USER:
+        return storage->add_user(w->user.username, w->user.password, row_id);
+    case DB_WRITE_ADD_SCORE:
+        return storage->add_score(w->score.user_id, w->score.username, w->score.score, w->score.timestamp, row_id);
+    }
+    return false;
+}
+
+static void db_writer_commit(const DbWrite *batch, bool *results, int64_t *row_ids, size_t n)
+{
+    // A failed row (e.g. a taken username) only rolls back its own statement,
+    // the rest of the batch still commits.
+    bool in_transaction = storage->begin();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        row_ids[i] = 0;
+        results[i] = db_writer_apply(&batch[i], &row_ids[i]);
+    }
+
+    if (in_transaction && !storage->commit())
+    {
+        log_message(LOG_ERROR, "Failed to commit batch of %zu writes", n);
+        storage->rollback();
+        for (size_t i = 0; i < n; i++)
+            results[i] = false;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (batch[i].done)
+            batch[i].done(batch[i].ctx, results[i], results[i] ? row_ids[i] : 0);
+    }
+}
+
+static void deadline_after_ms(struct timespec *ts, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+// Without a batch to commit into, refuses new writes and fails the queued
+// ones so their requests are still answered
+static void db_writer_fail_queued()
+{
+    pthread_mutex_lock(&writer.lock);
+    writer.stopping = true;
+    while (writer.count > 0)
+    {
+        DbWrite w = writer.items[writer.head];
+        writer.head = (writer.head + 1) % writer.capacity;
+        writer.count--;
+
+        pthread_mutex_unlock(&writer.lock);
+        if (w.done)
+            w.done(w.ctx, false, 0);
+        pthread_mutex_lock(&writer.lock);
+    }
+    pthread_mutex_unlock(&writer.lock);
+}
+
+static void *db_writer_main(void *arg)
+{
+    (void)arg;
+    size_t batch_size = (size_t)server_config.db_writer_batch_size;
+    DbWrite *batch = malloc(batch_size * sizeof(DbWrite));
+    bool *results = malloc(batch_size * sizeof(bool));
+    int64_t *row_ids = malloc(batch_size * sizeof(int64_t));
+
+    if (!batch || !results || !row_ids)
+    {
+        log_message(LOG_ERROR, "Database writer could not allocate a batch of %zu writes", batch_size);
+        db_writer_fail_queued();
+    }
+
+    while (batch && results && row_ids)
+    {
+        pthread_mutex_lock(&writer.lock);
+
+        while (writer.count == 0 && !writer.stopping)
+            pthread_cond_wait(&writer.not_empty, &writer.lock);
+
+        if (writer.count == 0 && writer.stopping)
+        {
+            pthread_mutex_unlock(&writer.lock);
+            break;
+        }
+
+        // Give the batch a chance to fill up before paying for the commit
+        struct timespec deadline;
+        deadline_after_ms(&deadline, server_config.db_writer_flush_ms);
+        while (writer.count < batch_size && !writer.stopping)
+        {
+            if (pthread_cond_timedwait(&writer.not_empty, &writer.lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        size_t n = 0;
+        while (n < batch_size && writer.count > 0)
+        {
+            batch[n++] = writer.items[writer.head];
+            writer.head = (writer.head + 1) % writer.capacity;
+            writer.count--;
+        }
+
+        pthread_mutex_unlock(&writer.lock);
+
+        db_writer_commit(batch, results, row_ids, n);
+        storage->maintain();
+    }
+
+    free(batch);
+    free(results);
+    free(row_ids);
+    storage->close_thread();
+    return NULL;
+}
+
+bool db_writer_start()
+{
+    if (server_config.db_writer_queue_size <= 0 || server_config.db_writer_batch_size <= 0)
+    {
+        log_message(LOG_ERROR, "Writer queue and batch sizes must be positive");
+        return false;
+    }
+
+    writer.capacity = (size_t)server_config.db_writer_queue_size;
+    writer.items = malloc(writer.capacity * sizeof(DbWrite));
+    writer.head = 0;
+    writer.count = 0;
+    writer.stopping = false;
+
+    if (!writer.items)
+        return false;
+
+    if (pthread_create(&writer.thread, NULL, db_writer_main, NULL) != 0)
+    {
+        log_message(LOG_ERROR, "Could not start database writer: %s", strerror(errno));
+        free(writer.items);
+        writer.items = NULL;
+        return false;
+    }
+
+    writer.running = true;
+    return true;
+}
+
+void db_writer_stop()
+{
+    if (!writer.running)
+        return;
+
+    pthread_mutex_lock(&writer.lock);
+    writer.stopping = true;
+    pthread_cond_signal(&writer.not_empty);
+    pthread_mutex_unlock(&writer.lock);
+
+    // The writer drains whatever is still queued before exiting
+    pthread_join(writer.thread, NULL);
+
+    writer.running = false;
+    free(writer.items);
+    writer.items = NULL;
+}
+
+bool db_writer_add_user(const char *username, const char *password, DbWriteCallback done, void *ctx)
+{
+    if (strlen(username) >= DB_USERNAME_MAX || strlen(password) >= DB_PASSWORD_MAX)
+        return false;
+
+    DbWrite w = {.type = DB_WRITE_ADD_USER, .done = done, .ctx = ctx};
+    strcpy(w.user.username, username);
+    strcpy(w.user.password, password);
+
+    return db_writer_push(&w);
+}
+
+bool db_writer_add_score(int user_id, const char *username, int score, long timestamp,
+                         DbWriteCallback done, void *ctx)
+{
+    if (strlen(username) >= DB_USERNAME_MAX)
+        return false;
+
+    DbWrite w = {.type = DB_WRITE_ADD_SCORE, .done = done, .ctx = ctx};
+    w.score.user_id = user_id;
+    strcpy(w.score.username, username);
+    w.score.score = score;
+    w.score.timestamp = timestamp;
+
+    if (!server_config.db_writer_ack_before_durable)
+        return db_writer_push(&w);
+
+    // Fire and forget: acknowledge now, a failed commit is only logged
+    w.done = NULL;
+    w.ctx = NULL;
+    if (!db_writer_push(&w))
+        return false;
+
+    if (done)
+        done(ctx, true, 0);
+    return true;
+}
@@ -1,11 +1,38 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_HTTP
 #include "http_request.h"
 #include "utils.h"
-#include "database.h"
+#include "config.h"
+#include "storage.h"
+#include "db_writer.h"
+#include "leaderboard.h"
+#include "db_executor.h"
+#include "auth.h"
+#include "session.h"
+#include "user_cache.h"
+#include "username_filter.h"
+#include "backup.h"
+#include "response_cache.h"
+#include "json_writer.h"
+#include "json_schema.h"
+#include "json_arena.h"
+#include "logger.h"
+#include "request_trace.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "latency.h"
+#include "probes.h"
+#include <arpa/inet.h>
+#include <assert.h>
 #include <ctype.h>
+#include <limits.h>
+#include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
 const char *supported_mime_types[] = {
     "text/html",       // MIME_TEXT_HTML
@@ -40,6 +67,36 @@ char *resolve_path(const char *path)
   return resolved_path;
 }
 
+bool get_query_param(const char *query, const char *key, char *value, size_t value_size)
+{
+  if (!query)
+    return false;
+
+  size_t key_len = strlen(key);
+  const char *param = query;
+  while (*param)
+  {
+    const char *end = strchr(param, '&');
+    size_t param_len = end ? (size_t)(end - param) : strlen(param);
+
+    if (param_len > key_len && strncmp(param, key, key_len) == 0 && param[key_len] == '=')
+    {
+      size_t len = param_len - key_len - 1;
+      if (len >= value_size)
+        return false;
+      memcpy(value, param + key_len + 1, len);
+      value[len] = '\0';
+      return true;
+    }
+
+    if (!end)
+      break;
+    param = end + 1;
+  }
+
+  return false;
+}
+
 void parse_request(HttpRequest *hr, char *request)
 {
   const char *del = "\r\n";
@@ -72,6 +129,13 @@ void parse_request(HttpRequest *hr, char *request)
   hr->start_line.method = strdup(method);
   hr->start_line.version = strdup(version);
 
+  char *query = strchr(target, '?');
+  if (query)
+  {
+    *query = '\0';
+    hr->start_line.target.query = strdup(query + 1);
+  }
+
   char *last_slash = strrchr(target, '/');
   if (last_slash)
   {
@@ -121,10 +185,11 @@ void parse_request(HttpRequest *hr, char *request)
   *headers_end = '\r';
   char *body_start = headers_end + 4; // Skip \r\n\r\n
 
-  // Store body if present
+  // Keep the body in place, handlers extract what they need from it
   if (body_start && *body_start != '\0')
   {
-    hr->body = cJSON_Parse(body_start);
+    hr->body = request + (body_start - request_copy);
+    hr->body_len = strlen(hr->body);
   }
 
   free(request_copy);
@@ -160,8 +225,112 @@ void parse_header_line(const char *line, Headers *headers)
   }
 }
 
+const char *get_status_text(HttpStatusCode http_sc)
+{
+  switch (http_sc)
+  {
+  case HTTP_200_OK:
+    return "200 OK";
+  case HTTP_201_CREATED:
+    return "201 Created";
+  case HTTP_202_ACCEPTED:
+    return "202 Accepted";
+  case HTTP_400_BAD_REQUEST:
+    return "400 Bad Request";
+  case HTTP_401_UNAUTHORIZED:
+    return "401 Unauthorized";
+  case HTTP_403_FORBIDDEN:
+    return "403 Forbidden";
+  case HTTP_404_NOT_FOUND:
+    return "404 Not Found";
+  case HTTP_409_CONFLICT:
+    return "409 Conflict";
+  case HTTP_415_UNSUPPORTED:
+    return "415 Unsupported Media Type";
+  case HTTP_500_INTERNAL_ERROR:
+    return "500 Internal Server Error";
+  case HTTP_503_UNAVAILABLE:
+    return "503 Service Unavailable";
+  default:
+    return "500 Internal Server Error";
+  }
+}
+
+int get_status_number(HttpStatusCode http_sc)
+{
+  return atoi(get_status_text(http_sc));
+}
+
+// send() that counts what went out towards the request's trace
+static ssize_t send_response(int client_socket, const void *data, size_t len)
+{
+  uint64_t start = monotonic_ns();
+  ssize_t sent = send(client_socket, data, len, 0);
+  if (sent > 0)
+    request_trace_sent(client_socket, (size_t)sent, start);
+  return sent;
+}
+
+void handle_response_headers(int client_socket, HttpStatusCode http_sc, const char *extra_headers)
+{
+  const char *status_text = get_status_text(http_sc);
+  char response[1024];
+  int len = snprintf(response, sizeof(response),
+                     "HTTP/1.1 %s\r\n"
+                     "Content-Type: text/plain\r\n"
+                     "%s"
+                     "Content-Length: %zu\r\n"
+                     "\r\n"
+                     "%s",
+                     status_text, extra_headers, strlen(status_text), status_text);
+
+  if (len < 0 || (size_t)len >= sizeof(response))
+  {
+    handle_response(client_socket, HTTP_500_INTERNAL_ERROR);
+    return;
+  }
+
+  request_trace_status(client_socket, get_status_number(http_sc));
+  send_response(client_socket, response, (size_t)len);
+}
+
+void handle_json_response(int client_socket, HttpStatusCode http_sc, cJSON *json)
+{
+  char *body = cJSON_PrintUnformatted(json);
+  if (!body)
+  {
+    handle_response(client_socket, HTTP_500_INTERNAL_ERROR);
+    return;
+  }
+
+  handle_json_body(client_socket, http_sc, body, strlen(body));
+  cJSON_free(body);
+}
+
+void handle_json_body(int client_socket, HttpStatusCode http_sc, const char *body, size_t body_len)
+{
+  handle_body(client_socket, http_sc, "application/json", body, body_len);
+}
+
+void handle_body(int client_socket, HttpStatusCode http_sc, const char *content_type, const char *body,
+                 size_t body_len)
+{
+  char header[256];
+  snprintf(header, sizeof(header),
+           "HTTP/1.1 %s\r\n"
+           "Content-Type: %s\r\n"
+           "Content-Length: %zu\r\n"
+           "\r\n",
+           get_status_text(http_sc), content_type, body_len);
+
+  request_trace_status(client_socket, get_status_number(http_sc));
+  if (send_response(client_socket, header, strlen(header)) >= 0)
+    send_response(client_socket, body, body_len);
+}
+
 void handle_response(int client_socket, HttpStatusCode http_sc)
 {
+  request_trace_status(client_socket, get_status_number(http_sc));
   const char *response = NULL;
   switch (http_sc)
   {
@@ -172,7 +341,7 @@ void handle_response(int client_socket, HttpStatusCode http_sc)
               "Content-Length: 6\r\n"
               "\r\n"
               "200 OK";
-    send(client_socket, response, strlen(response), 0);
+    send_response(client_socket, response, strlen(response));
   }
     break;
   case HTTP_201_CREATED:
@@ -182,7 +351,7 @@ void handle_response(int client_socket, HttpStatusCode http_sc)
                "Content-Length: 11\r\n"
                "\r\n"
                "201 Created";
-    send(client_socket, response, strlen(response), 0);
+    send_response(client_socket, response, strlen(response));
   }
   break;
   case HTTP_400_BAD_REQUEST:
@@ -192,7 +361,17 @@ void handle_response(int client_socket, HttpStatusCode http_sc)
                "Content-Length: 15\r\n"
                "\r\n"
                "400 Bad Request";
-    send(client_socket, response, strlen(response), 0);
+    send_response(client_socket, response, strlen(response));
+  }
+  break;
+  case HTTP_401_UNAUTHORIZED:
+  {
+    response = "HTTP/1.1 401 Unauthorized\r\n"
+               "Content-Type: text/plain\r\n"
+               "Content-Length: 16\r\n"
+               "\r\n"
+               "401 Unauthorized";
+    send_response(client_socket, response, strlen(response));
   }
   break;
   case HTTP_404_NOT_FOUND:
@@ -202,7 +381,37 @@ void handle_response(int client_socket, HttpStatusCode http_sc)
                "Content-Length: 13\r\n"
                "\r\n"
                "404 Not Found";
-    send(client_socket, response, strlen(response), 0);
+    send_response(client_socket, response, strlen(response));
+  }
+  break;
+  case HTTP_202_ACCEPTED:
+  {
+    response = "HTTP/1.1 202 Accepted\r\n"
+               "Content-Type: text/plain\r\n"
+               "Content-Length: 12\r\n"
+               "\r\n"
+               "202 Accepted";
+    send_response(client_socket, response, strlen(response));
+  }
+  break;
+  case HTTP_403_FORBIDDEN:
+  {
+    response = "HTTP/1.1 403 Forbidden\r\n"
+               "Content-Type: text/plain\r\n"
+               "Content-Length: 13\r\n"
+               "\r\n"
+               "403 Forbidden";
+    send_response(client_socket, response, strlen(response));
+  }
+  break;
+  case HTTP_409_CONFLICT:
+  {
+    response = "HTTP/1.1 409 Conflict\r\n"
+               "Content-Type: text/plain\r\n"
+               "Content-Length: 12\r\n"
+               "\r\n"
+               "409 Conflict";
+    send_response(client_socket, response, strlen(response));
   }
   break;
   case HTTP_415_UNSUPPORTED:
@@ -213,7 +422,7 @@ void handle_response(int client_socket, HttpStatusCode http_sc)
                "\r\n"
                "415 Unsupported Media Type. Supported types are: text/html, image/png, image/jpeg.";
 
-    send(client_socket, response, strlen(response), 0);
+    send_response(client_socket, response, strlen(response));
   }
   break;
   case HTTP_500_INTERNAL_ERROR:
@@ -223,7 +432,17 @@ void handle_response(int client_socket, HttpStatusCode http_sc)
                "Content-Length: 24\r\n"
                "\r\n"
                "500 Internal Server Error";
-    send(client_socket, response, strlen(response), 0);
+    send_response(client_socket, response, strlen(response));
+  }
+  break;
+  case HTTP_503_UNAVAILABLE:
+  {
+    response = "HTTP/1.1 503 Service Unavailable\r\n"
+               "Content-Type: text/plain\r\n"
+               "Content-Length: 23\r\n"
+               "\r\n"
+               "503 Service Unavailable";
+    send_response(client_socket, response, strlen(response));
   }
   break;
   default:
@@ -234,9 +453,13 @@ void handle_response(int client_socket, HttpStatusCode http_sc)
 
 void handle_file(int client_socket, Target *target, MimeType mime_type)
 {
-  log_message(LOG_INFO, "Handling file %s with type %d", target->file_name, mime_type);
+  log_message(LOG_DEBUG, "Handling file %s with type %d", target->file_name, mime_type);
+  uint64_t lookup_start = monotonic_ns();
   const char *resources_path = resolve_path(target->path);
   const char *file = find_file_in_directory(resources_path, target->file_name);
+  long file_size = 0;
+  unsigned char *data = file ? read_entire_file(resources_path, target->file_name, &file_size) : NULL;
+  request_trace_step(client_socket, STEP_FILE, lookup_start);
 
   if (file == NULL)
   {
@@ -245,9 +468,7 @@ void handle_file(int client_socket, Target *target, MimeType mime_type)
     return;
   }
 
-  long file_size;
-  unsigned char *data = read_entire_file(resources_path, target->file_name, &file_size);
-  log_message(LOG_INFO, "Read file with size %ld", file_size);
+  log_message(LOG_DEBUG, "Read file with size %ld", file_size);
 
   if (data == NULL)
   {
@@ -266,7 +487,8 @@ void handle_file(int client_socket, Target *target, MimeType mime_type)
            get_mime_type(mime_type), (int)file_size);
 
   // Send header
-  if (send(client_socket, header, strlen(header), 0) < 0)
+  request_trace_status(client_socket, get_status_number(HTTP_200_OK));
+  if (send_response(client_socket, header, strlen(header)) < 0)
   {
     log_message(LOG_ERROR, "Sending image header");
     free((void *)file);
@@ -274,70 +496,990 @@ void handle_file(int client_socket, Target *target, MimeType mime_type)
   }
 
   // Send data
-  send(client_socket, data, file_size, 0);
+  send_response(client_socket, data, file_size);
+  PROBE3(file__served, client_socket, target->file_name, file_size);
   free((void *)file);
   free(data);
 }
 
-void handle_post(int client_socket, cJSON *body, HttpStatusCode http_sc)
+// State of a POST request waiting on the database. Its connection is parked
+// until the job comes back to the I/O loop, which sends the response and
+// closes it.
+typedef struct
 {
-  if (body == NULL)
+  WorkJob job;
+  int client_socket;
+  HttpStatusCode status;
+  int user_id;
+  char username[DB_USERNAME_MAX];
+  char password[DB_PASSWORD_MAX];
+  char password_hash[DB_PASSWORD_MAX];
+  int score;
+  long timestamp;
+} DbRequest;
+
+CompletionQueue io_completions;
+
+void close_connection(int client_socket)
+{
+  request_trace_end(client_socket);
+  shutdown(client_socket, SHUT_WR);
+  close(client_socket);
+}
+
+// Request bodies, see json_schema.h. The buffers are sized so that anything
+// that fits can be stored.
+typedef struct
+{
+  char username[DB_USERNAME_MAX];
+  char password[DB_PASSWORD_MAX];
+} CredentialsBody;
+
+static const JsonField credentials_fields[] = {
+    JSON_STRING_FIELD(CredentialsBody, username, 1),
+    JSON_STRING_FIELD(CredentialsBody, password, 1),
+};
+
+typedef struct
+{
+  int score;
+} ScoreBody;
+
+static const JsonField score_fields[] = {
+    JSON_INT_FIELD(ScoreBody, score, 0, INT_MAX),
+};
+
+static bool extract_body(HttpRequest *hr, const JsonField *fields, size_t field_count, void *out)
+{
+  JsonExtractResult result = json_extract(fields, field_count, hr->body, hr->body_len, out);
+  if (result != JSON_EXTRACT_OK)
   {
-    log_message(LOG_ERROR, "Invalid body");
-    handle_response(client_socket, HTTP_400_BAD_REQUEST);
+    log_message(LOG_ERROR, "Invalid body: %s", json_extract_error(result));
+    metrics_parse_error(PARSE_ERROR_BODY);
+    return false;
+  }
+  return true;
+}
+
+static DbRequest *create_db_request(int client_socket, HttpStatusCode status, const char *username,
+                                    const char *password)
+{
+  if (strlen(username) >= DB_USERNAME_MAX || (password && strlen(password) >= DB_PASSWORD_MAX))
+    return NULL;
+
+  DbRequest *req = calloc(1, sizeof(DbRequest));
+  assert(req != NULL && "Buy more RAM lol");
+  req->client_socket = client_socket;
+  req->status = status;
+  strcpy(req->username, username);
+  if (password)
+    strcpy(req->password, password);
+
+  return req;
+}
+
+static void finish_db_request(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+  request_trace_resumed(req->client_socket);
+  if (job->expired)
+  {
+    log_message(LOG_WARNING, "Request for user %s timed out in the queue", req->username);
+    req->status = HTTP_503_UNAVAILABLE;
+  }
+
+  handle_response(req->client_socket, req->status);
+  close_connection(req->client_socket);
+  free(req);
+}
+
+// Writer callback, runs on the writer thread once the batch is committed
+static void db_request_written(void *ctx, bool ok, int64_t row_id)
+{
+  DbRequest *req = ctx;
+  if (ok && req->user_id == 0)
+    req->user_id = (int)row_id;
+  if (!ok)
+  {
+    log_message(LOG_ERROR, "Failed to insert for user %s", req->username);
+    req->status = HTTP_500_INTERNAL_ERROR;
+  }
+  completion_queue_push(&io_completions, &req->job);
+}
+
+// Writer callback for a registration. A failed insert is almost always a
+// username taken by a concurrent registration, which the client hears as 409
+// rather than as a server error.
+static void user_written(void *ctx, bool ok, int64_t row_id)
+{
+  DbRequest *req = ctx;
+  if (!ok && storage->get_user_id(req->username) >= 0)
+  {
+    log_message(LOG_ERROR, "Username %s is taken", req->username);
+    req->status = HTTP_409_CONFLICT;
+    completion_queue_push(&io_completions, &req->job);
     return;
   }
+  // A failed login may have cached the name as unknown, drop that before
+  // the user hears back
+  if (ok)
+    user_cache_invalidate(req->username);
+  db_request_written(ctx, ok, row_id);
+}
+
+// Runs on the auth pool, then hands the hashed credentials to the writer
+static bool run_register(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+
+  if (!auth_hash_password(req->password, req->password_hash, sizeof(req->password_hash)))
+  {
+    req->status = HTTP_500_INTERNAL_ERROR;
+    return true;
+  }
+
+  // The response is sent once the writer has committed the batch, so a
+  // taken username is still reported to the client
+  if (!db_writer_add_user(req->username, req->password_hash, user_written, req))
+  {
+    log_message(LOG_WARNING, "Database writer queue is full");
+    req->status = HTTP_503_UNAVAILABLE;
+    return true;
+  }
+
+  return false;
+}
+
+// Runs on the database executor when the username filter says the name is
+// probably taken: an indexed lookup is much cheaper than hashing the password
+// and failing the insert on the UNIQUE constraint
+static bool run_register_check(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+  if (storage->get_user_id(req->username) >= 0)
+  {
+    log_message(LOG_ERROR, "Username %s is taken", req->username);
+    req->status = HTTP_409_CONFLICT;
+    return true;
+  }
+
+  job->run = run_register;
+  if (!auth_submit(job))
+  {
+    log_message(LOG_WARNING, "Auth queue is full");
+    req->status = HTTP_503_UNAVAILABLE;
+    return true;
+  }
+
+  return false;
+}
+
+// Remembers the new user so their first login skips the database
+static void finish_register(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+  request_trace_resumed(req->client_socket);
+  if (!job->expired && req->status == HTTP_201_CREATED)
+  {
+    username_filter_add(req->username);
+    user_cache_put(req->username, req->user_id, req->password_hash);
+  }
+
+  finish_db_request(job);
+}
+
+RequestStatus handle_post(HttpRequest *hr, int client_socket, HttpStatusCode http_sc)
+{
+  CredentialsBody body;
+  if (!extract_body(hr, credentials_fields, ARRAY_LEN(credentials_fields), &body))
+  {
+    handle_response(client_socket, HTTP_400_BAD_REQUEST);
+    return REQUEST_DONE;
+  }
   else
   {
-    cJSON *username = cJSON_GetObjectItemCaseSensitive(body, "username");
-    cJSON *password = cJSON_GetObjectItemCaseSensitive(body, "password");
+    DbRequest *req = create_db_request(client_socket, http_sc, body.username, body.password);
+    req->job.done = finish_register;
 
-    if (!cJSON_IsString(username) || !cJSON_IsString(password))
+    if (username_maybe_taken(req->username))
     {
-      log_message(LOG_ERROR, "Invalid body");
-      handle_response(client_socket, HTTP_400_BAD_REQUEST);
-      return;
+      int user_id;
+      switch (user_cache_get(req->username, &user_id, req->password_hash, sizeof(req->password_hash)))
+      {
+      case USER_CACHE_HIT:
+        handle_response(client_socket, HTTP_409_CONFLICT);
+        free(req);
+        return REQUEST_DONE;
+      case USER_CACHE_MISS:
+        req->job.run = run_register_check;
+        if (!db_executor_submit(&req->job))
+        {
+          log_message(LOG_WARNING, "Database executor queue is full");
+          handle_response(client_socket, HTTP_503_UNAVAILABLE);
+          free(req);
+          return REQUEST_DONE;
+        }
+        return REQUEST_PENDING;
+      case USER_CACHE_NEGATIVE:
+        // A false positive of the filter that we already looked up
+        break;
+      }
     }
 
-    if (strcmp(username->valuestring, "") == 0 || strcmp(password->valuestring, "") == 0)
+    req->job.run = run_register;
+    if (!auth_submit(&req->job))
     {
-      log_message(LOG_ERROR, "Invalid body");
-      handle_response(client_socket, HTTP_400_BAD_REQUEST);
-      return;
+      log_message(LOG_WARNING, "Auth queue is full");
+      handle_response(client_socket, HTTP_503_UNAVAILABLE);
+      free(req);
+      return REQUEST_DONE;
+    }
+
+    return REQUEST_PENDING;
+  }
+}
+
+// Runs on the auth pool
+static bool run_verify_password(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+  if (!auth_verify_password(req->password, req->password_hash))
+  {
+    log_message(LOG_ERROR, "Wrong password for user %s", req->username);
+    req->status = HTTP_404_NOT_FOUND;
+  }
+  return true;
+}
+
+// Runs on the database executor, then moves on to the auth pool to check the
+// password against the stored hash
+static bool run_login(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+  if (!storage->get_credentials(req->username, &req->user_id, req->password_hash, sizeof(req->password_hash)))
+  {
+    log_message(LOG_ERROR, "User %s not found", req->username);
+    user_cache_put_negative(req->username);
+    req->status = HTTP_404_NOT_FOUND;
+    return true;
+  }
+  user_cache_put(req->username, req->user_id, req->password_hash);
+
+  job->run = run_verify_password;
+  if (!auth_submit(job))
+  {
+    log_message(LOG_WARNING, "Auth queue is full");
+    req->status = HTTP_503_UNAVAILABLE;
+    return true;
+  }
+
+  return false;
+}
+
+// Opens a session for a successful login and hands it out as a cookie
+static void finish_login(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+  request_trace_resumed(req->client_socket);
+  char token[SESSION_TOKEN_LEN + 1];
+
+  if (job->expired || req->status != HTTP_200_OK)
+  {
+    finish_db_request(job);
+    return;
+  }
+
+  if (!session_create(req->user_id, req->username, token))
+  {
+    req->status = HTTP_500_INTERNAL_ERROR;
+    finish_db_request(job);
+    return;
+  }
+
+  char cookie[256];
+  snprintf(cookie, sizeof(cookie),
+           "Set-Cookie: " SESSION_COOKIE "=%s; Path=/; Max-Age=%d; HttpOnly; SameSite=Strict\r\n",
+           token, server_config.session_ttl_s);
+
+  handle_response_headers(req->client_socket, HTTP_200_OK, cookie);
+  close_connection(req->client_socket);
+  free(req);
+}
+
+// POST /login
+RequestStatus handle_login(HttpRequest *hr, int client_socket)
+{
+  CredentialsBody body;
+  if (!extract_body(hr, credentials_fields, ARRAY_LEN(credentials_fields), &body))
+  {
+    handle_response(client_socket, HTTP_400_BAD_REQUEST);
+    return REQUEST_DONE;
+  }
+
+  DbRequest *req = create_db_request(client_socket, HTTP_200_OK, body.username, body.password);
+  req->job.done = finish_login;
+
+  switch (user_cache_get(req->username, &req->user_id, req->password_hash, sizeof(req->password_hash)))
+  {
+  case USER_CACHE_HIT:
+    req->job.run = run_verify_password;
+    if (!auth_submit(&req->job))
+    {
+      log_message(LOG_WARNING, "Auth queue is full");
+      handle_response(client_socket, HTTP_503_UNAVAILABLE);
+      free(req);
+      return REQUEST_DONE;
+    }
+    break;
+  case USER_CACHE_NEGATIVE:
+    log_message(LOG_ERROR, "User %s not found", req->username);
+    handle_response(client_socket, HTTP_404_NOT_FOUND);
+    free(req);
+    return REQUEST_DONE;
+  case USER_CACHE_MISS:
+    req->job.run = run_login;
+    if (!db_executor_submit(&req->job))
+    {
+      log_message(LOG_WARNING, "Database executor queue is full");
+      handle_response(client_socket, HTTP_503_UNAVAILABLE);
+      free(req);
+      return REQUEST_DONE;
     }
+    break;
+  }
+
+  return REQUEST_PENDING;
+}
+
+static cJSON *leaderboard_entry_to_json(size_t rank, const LeaderboardEntry *entry)
+{
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "rank", (double)rank);
+  cJSON_AddStringToObject(json, "username", entry->username);
+  cJSON_AddNumberToObject(json, "score", entry->score);
+  cJSON_AddNumberToObject(json, "timestamp", (double)entry->timestamp);
+  return json;
+}
 
-    char buffer[512];
-    snprintf(buffer, sizeof(buffer), "INSERT INTO User (username, password) VALUES ('%s', '%s')", username->valuestring, password->valuestring);
-    if (!sql_execute(buffer))
+// Renders the page for a "/leaderboard?limit=L&offset=O" cache key
+static HttpStatusCode render_leaderboard(const char *key, char **body)
+{
+  size_t limit, offset;
+  if (sscanf(key, "/leaderboard?limit=%zu&offset=%zu", &limit, &offset) != 2)
+    return HTTP_400_BAD_REQUEST;
+
+  LeaderboardEntry entries[LEADERBOARD_PAGE_MAX];
+  size_t count = leaderboard_range(offset, limit, entries);
+
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "total", (double)leaderboard_size());
+  cJSON_AddNumberToObject(json, "offset", (double)offset);
+  cJSON *items = cJSON_AddArrayToObject(json, "entries");
+  for (size_t i = 0; i < count; i++)
+    cJSON_AddItemToArray(items, leaderboard_entry_to_json(offset + i + 1, &entries[i]));
+
+  *body = json_arena_print(json);
+  cJSON_Delete(json);
+  return *body ? HTTP_200_OK : HTTP_500_INTERNAL_ERROR;
+}
+
+// GET /leaderboard?limit=&offset=
+RequestStatus handle_leaderboard(int client_socket, const char *query)
+{
+  // As large as the whole request (see server.c), so a value is never cut
+  // short and mistaken for a missing one
+  char limit_value[1024], offset_value[1024];
+  bool has_limit = get_query_param(query, "limit", limit_value, sizeof(limit_value));
+  bool has_offset = get_query_param(query, "offset", offset_value, sizeof(offset_value));
+
+  size_t limit, offset;
+  if (!leaderboard_parse_page(has_limit ? limit_value : NULL, has_offset ? offset_value : NULL, &limit, &offset))
+  {
+    handle_response(client_socket, HTTP_400_BAD_REQUEST);
+    return REQUEST_DONE;
+  }
+
+  // Equivalent queries share one cache entry
+  char key[64];
+  snprintf(key, sizeof(key), "/leaderboard?limit=%zu&offset=%zu", limit, offset);
+  return response_cache_serve(client_socket, key, render_leaderboard);
+}
+
+typedef struct
+{
+  WorkJob job;
+  int client_socket;
+  JsonWriter writer;
+} ExportRequest;
+
+// Runs on the executor. A score submitted meanwhile can shift the ranks
+// below it, so each page starts from where the last entry of the previous
+// one is now rather than from a fixed offset. That way nobody is written
+// twice because somebody else moved past them.
+static bool run_leaderboard_export(WorkJob *job)
+{
+  ExportRequest *req = (ExportRequest *)job;
+  JsonWriter *w = &req->writer;
+  LeaderboardEntry entries[LEADERBOARD_EXPORT_PAGE];
+  size_t total = leaderboard_size();
+
+  // Bounds each blocking send, and the deadline the whole export, so a
+  // client that stops reading can't hold the executor thread
+  struct timeval timeout = {.tv_sec = LEADERBOARD_EXPORT_SEND_TIMEOUT_S};
+  setsockopt(req->client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  uint64_t deadline_ns = monotonic_ns() + LEADERBOARD_EXPORT_DEADLINE_S * 1000000000ULL;
+
+  json_writer_begin(w, req->client_socket, HTTP_200_OK, deadline_ns);
+  json_object_begin(w);
+  json_key(w, "total");
+  json_int(w, (long long)total);
+  json_key(w, "entries");
+  json_array_begin(w);
+
+  size_t offset = 0;
+  size_t count;
+  while (!w->failed && offset < total &&
+         (count = leaderboard_range(offset, LEADERBOARD_EXPORT_PAGE, entries)) > 0)
+  {
+    for (size_t i = 0; i < count; i++)
     {
-      log_message(LOG_ERROR, "Failed to insert user");
-      handle_response(client_socket, HTTP_500_INTERNAL_ERROR);
-      return;
-    } 
-    log_message(LOG_INFO, "User %s inserted", username->valuestring);
+      json_object_begin(w);
+      json_key(w, "rank");
+      json_int(w, (long long)(offset + i + 1));
+      json_key(w, "username");
+      json_string(w, entries[i].username);
+      json_key(w, "score");
+      json_int(w, entries[i].score);
+      json_key(w, "timestamp");
+      json_int(w, entries[i].timestamp);
+      json_object_end(w);
+    }
+
+    // Unless the last entry itself improved, in which case it moved up
+    size_t rank;
+    LeaderboardEntry last;
+    if (leaderboard_rank(entries[count - 1].username, &rank, &last) && last.score == entries[count - 1].score &&
+        last.timestamp == entries[count - 1].timestamp)
+      offset = rank;
+    else
+      offset += count;
+  }
+
+  json_array_end(w);
+  json_object_end(w);
+  json_writer_end(w);
+  return true;
+}
+
+static void finish_leaderboard_export(WorkJob *job)
+{
+  ExportRequest *req = (ExportRequest *)job;
+  JsonWriter *w = &req->writer;
+  request_trace_resumed(req->client_socket);
+  request_trace_status(req->client_socket, get_status_number(HTTP_200_OK));
+  // The trace only adds up time since started_ns, so pass the send time as
+  // if it had just been spent
+  request_trace_sent(req->client_socket, w->bytes_sent, monotonic_ns() - w->write_ns);
+  if (w->failed)
+    log_message(LOG_WARNING, "Leaderboard export aborted after %zu bytes", w->bytes_sent);
+
+  close_connection(req->client_socket);
+  free(req);
+}
+
+// GET /leaderboard/export streams every entry with the JSON writer, a page
+// at a time, so memory stays flat however large the leaderboard is. The
+// sends block, so the export runs on the executor and the I/O loop carries
+// on serving everyone else.
+static RequestStatus handle_leaderboard_export(int client_socket)
+{
+  ExportRequest *req = calloc(1, sizeof(ExportRequest));
+  assert(req != NULL && "Buy more RAM lol");
+  req->client_socket = client_socket;
+  req->job.run = run_leaderboard_export;
+  req->job.done = finish_leaderboard_export;
+
+  if (!db_executor_submit(&req->job))
+  {
+    log_message(LOG_WARNING, "Database executor queue is full");
+    handle_response(client_socket, HTTP_503_UNAVAILABLE);
+    free(req);
+    return REQUEST_DONE;
+  }
+
+  return REQUEST_PENDING;
+}
+
+// Renders the entry for a "/rank/{user}" cache key
+static HttpStatusCode render_rank(const char *key, char **body)
+{
+  size_t rank;
+  LeaderboardEntry entry;
+
+  if (!leaderboard_rank(key + strlen("/rank/"), &rank, &entry))
+    return HTTP_404_NOT_FOUND;
+
+  cJSON *json = leaderboard_entry_to_json(rank, &entry);
+  cJSON_AddNumberToObject(json, "total", (double)leaderboard_size());
+
+  *body = json_arena_print(json);
+  cJSON_Delete(json);
+  return *body ? HTTP_200_OK : HTTP_500_INTERNAL_ERROR;
+}
+
+// GET /rank/{user}
+RequestStatus handle_rank(int client_socket, const char *username)
+{
+  if (username[0] == '\0' || strlen(username) >= DB_USERNAME_MAX)
+  {
+    handle_response(client_socket, HTTP_404_NOT_FOUND);
+    return REQUEST_DONE;
+  }
+
+  char key[DB_USERNAME_MAX + 8];
+  snprintf(key, sizeof(key), "/rank/%s", username);
+  return response_cache_serve(client_socket, key, render_rank);
+}
+
+static void send_username_available(int client_socket, const char *username, bool available)
+{
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddStringToObject(json, "username", username);
+  cJSON_AddBoolToObject(json, "available", available);
+  handle_json_response(client_socket, HTTP_200_OK, json);
+  cJSON_Delete(json);
+}
+
+static bool run_username_check(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+  req->user_id = storage->get_user_id(req->username);
+  if (req->user_id < 0)
+    user_cache_put_negative(req->username);
+  return true;
+}
+
+static void finish_username_check(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+  request_trace_resumed(req->client_socket);
+  if (job->expired)
+    handle_response(req->client_socket, HTTP_503_UNAVAILABLE);
+  else
+    send_username_available(req->client_socket, req->username, req->user_id < 0);
+
+  close_connection(req->client_socket);
+  free(req);
+}
+
+// GET /username-available?username=
+RequestStatus handle_username_available(int client_socket, const char *query)
+{
+  char username[DB_USERNAME_MAX];
+  if (!get_query_param(query, "username", username, sizeof(username)) || username[0] == '\0')
+  {
+    handle_response(client_socket, HTTP_400_BAD_REQUEST);
+    return REQUEST_DONE;
+  }
+
+  if (!username_maybe_taken(username))
+  {
+    send_username_available(client_socket, username, true);
+    return REQUEST_DONE;
+  }
+
+  // Probably taken, confirm with the cache or an indexed lookup
+  int user_id;
+  char password[DB_PASSWORD_MAX];
+  switch (user_cache_get(username, &user_id, password, sizeof(password)))
+  {
+  case USER_CACHE_HIT:
+    send_username_available(client_socket, username, false);
+    return REQUEST_DONE;
+  case USER_CACHE_NEGATIVE:
+    send_username_available(client_socket, username, true);
+    return REQUEST_DONE;
+  case USER_CACHE_MISS:
+    break;
+  }
+
+  DbRequest *req = create_db_request(client_socket, HTTP_200_OK, username, NULL);
+  req->job.run = run_username_check;
+  req->job.done = finish_username_check;
+
+  if (!db_executor_submit(&req->job))
+  {
+    log_message(LOG_WARNING, "Database executor queue is full");
+    handle_response(client_socket, HTTP_503_UNAVAILABLE);
+    free(req);
+    return REQUEST_DONE;
+  }
+
+  return REQUEST_PENDING;
+}
 
-    handle_response(client_socket, http_sc);
+// GET /metrics in the Prometheus text format. The counters kept by the
+// caches and queues themselves are read here rather than duplicated.
+void handle_metrics(int client_socket)
+{
+  char *body = NULL;
+  size_t body_len = 0;
+  FILE *out = open_memstream(&body, &body_len);
+  if (!out)
+  {
+    handle_response(client_socket, HTTP_500_INTERNAL_ERROR);
+    return;
   }
+
+  metrics_write(out);
+
+  ResponseCacheStats responses = response_cache_stats();
+  metrics_write_value(out, "response_cache_hits_total", "counter", "Responses served fresh from the cache.",
+                      (double)responses.hits);
+  metrics_write_value(out, "response_cache_stale_hits_total", "counter",
+                      "Responses served stale while a render replaced them.", (double)responses.stale_hits);
+  metrics_write_value(out, "response_cache_misses_total", "counter", "Responses that had to wait for a render.",
+                      (double)responses.misses);
+
+  UserCacheStats users = user_cache_stats();
+  metrics_write_value(out, "user_cache_hits_total", "counter", "Credentials found in the cache.",
+                      (double)(users.hits + users.negative_hits));
+  metrics_write_value(out, "user_cache_misses_total", "counter", "Credentials looked up in the database.",
+                      (double)users.misses);
+
+  metrics_write_value(out, "sessions_active", "gauge", "Sessions issued and not expired.", (double)session_count());
+  metrics_write_value(out, "leaderboard_players", "gauge", "Players on the leaderboard.",
+                      (double)leaderboard_size());
+
+  LoggerStats logs = logger_stats();
+  metrics_write_value(out, "log_messages_dropped_total", "counter", "Log messages that found their ring full.",
+                      (double)logs.dropped);
+  AccessLogStats access = access_log_stats();
+  metrics_write_value(out, "access_log_records_dropped_total", "counter",
+                      "Access log records that found the queue full.", (double)access.dropped);
+
+  fclose(out);
+  handle_body(client_socket, HTTP_200_OK, "text/plain; version=0.0.4", body, body_len);
+  free(body);
 }
 
-void process_request(HttpRequest *hr, int client_socket)
+// Percentiles in microseconds per route and phase, for routes that have seen
+// requests
+static void add_latency(cJSON *json)
 {
+  cJSON *latency = cJSON_AddObjectToObject(json, "latency");
+  for (int route = 0; route < ROUTE_COUNT; route++)
+  {
+    if (latency_summary(route, LATENCY_TOTAL).count == 0)
+      continue;
+    cJSON *phases = cJSON_AddObjectToObject(latency, route_name(route));
+    for (int phase = 0; phase < LATENCY_PHASE_COUNT; phase++)
+    {
+      LatencySummary s = latency_summary(route, phase);
+      if (s.count == 0)
+        continue;
+      cJSON *summary = cJSON_AddObjectToObject(phases, latency_phase_name(phase));
+      cJSON_AddNumberToObject(summary, "count", (double)s.count);
+      cJSON_AddNumberToObject(summary, "p50_us", (double)s.p50 / 1e3);
+      cJSON_AddNumberToObject(summary, "p90_us", (double)s.p90 / 1e3);
+      cJSON_AddNumberToObject(summary, "p99_us", (double)s.p99 / 1e3);
+      cJSON_AddNumberToObject(summary, "p99.9_us", (double)s.p999 / 1e3);
+      cJSON_AddNumberToObject(summary, "max_us", (double)s.max / 1e3);
+    }
+  }
+}
+
+// Runtime level of each log subsystem, by name
+static void add_log_levels(cJSON *json)
+{
+  cJSON *levels = cJSON_AddObjectToObject(json, "levels");
+  for (int i = 0; i < LOG_SUBSYSTEM_COUNT; i++)
+    cJSON_AddStringToObject(levels, log_subsystem_name(i), log_level_name(log_thresholds[i]));
+}
+
+// GET /stats
+void handle_stats(int client_socket)
+{
+  cJSON *json = cJSON_CreateObject();
+
+  UserCacheStats users = user_cache_stats();
+  cJSON *user_cache = cJSON_AddObjectToObject(json, "user_cache");
+  cJSON_AddNumberToObject(user_cache, "hits", (double)users.hits);
+  cJSON_AddNumberToObject(user_cache, "negative_hits", (double)users.negative_hits);
+  cJSON_AddNumberToObject(user_cache, "misses", (double)users.misses);
+  cJSON_AddNumberToObject(user_cache, "evictions", (double)users.evictions);
+  cJSON_AddNumberToObject(user_cache, "invalidations", (double)users.invalidations);
+  cJSON_AddNumberToObject(user_cache, "size", (double)users.size);
+  cJSON_AddNumberToObject(user_cache, "capacity", (double)users.capacity);
+  uint64_t lookups = users.hits + users.negative_hits + users.misses;
+  cJSON_AddNumberToObject(user_cache, "hit_rate",
+                          lookups ? (double)(users.hits + users.negative_hits) / (double)lookups : 0.0);
+
+  ResponseCacheStats responses = response_cache_stats();
+  cJSON *response_cache = cJSON_AddObjectToObject(json, "response_cache");
+  cJSON_AddNumberToObject(response_cache, "hits", (double)responses.hits);
+  cJSON_AddNumberToObject(response_cache, "stale_hits", (double)responses.stale_hits);
+  cJSON_AddNumberToObject(response_cache, "misses", (double)responses.misses);
+  cJSON_AddNumberToObject(response_cache, "coalesced", (double)responses.coalesced);
+  cJSON_AddNumberToObject(response_cache, "renders", (double)responses.renders);
+  cJSON_AddNumberToObject(response_cache, "invalidations", (double)responses.invalidations);
+  cJSON_AddNumberToObject(response_cache, "size", (double)responses.size);
+  cJSON_AddNumberToObject(response_cache, "capacity", (double)responses.capacity);
+
+  JsonArenaStats arenas = json_arena_stats();
+  cJSON *json_arena = cJSON_AddObjectToObject(json, "json_arena");
+  cJSON_AddNumberToObject(json_arena, "scopes", (double)arenas.scopes);
+  cJSON_AddNumberToObject(json_arena, "arena_allocations", (double)arenas.arena_allocations);
+  cJSON_AddNumberToObject(json_arena, "arena_bytes", (double)arenas.arena_bytes);
+  cJSON_AddNumberToObject(json_arena, "heap_allocations", (double)arenas.heap_allocations);
+  cJSON_AddNumberToObject(json_arena, "chunk_allocations", (double)arenas.chunk_allocations);
+
+  LoggerStats logs = logger_stats();
+  cJSON *logger = cJSON_AddObjectToObject(json, "logger");
+  cJSON_AddNumberToObject(logger, "written", (double)logs.written);
+  cJSON_AddNumberToObject(logger, "dropped", (double)logs.dropped);
+  cJSON_AddNumberToObject(logger, "truncated", (double)logs.truncated);
+  cJSON_AddNumberToObject(logger, "batches", (double)logs.batches);
+  cJSON_AddNumberToObject(logger, "bytes", (double)logs.bytes);
+  cJSON_AddNumberToObject(logger, "threads", (double)logs.threads);
+  add_log_levels(logger);
+
+  AccessLogStats access = access_log_stats();
+  cJSON *access_log = cJSON_AddObjectToObject(json, "access_log");
+  cJSON_AddBoolToObject(access_log, "enabled", access_log_enabled());
+  cJSON_AddNumberToObject(access_log, "written", (double)access.written);
+  cJSON_AddNumberToObject(access_log, "dropped", (double)access.dropped);
+  cJSON_AddNumberToObject(access_log, "rotations", (double)access.rotations);
+  cJSON_AddNumberToObject(access_log, "failures", (double)access.failures);
+
+  add_latency(json);
+
+  cJSON_AddStringToObject(json, "storage", storage->name);
+
+  UsernameFilterStats filter = username_filter_stats();
+  cJSON *username_filter = cJSON_AddObjectToObject(json, "username_filter");
+  cJSON_AddNumberToObject(username_filter, "bits", (double)filter.bits);
+  cJSON_AddNumberToObject(username_filter, "hashes", filter.hashes);
+  cJSON_AddNumberToObject(username_filter, "usernames", (double)filter.usernames);
+  cJSON_AddNumberToObject(username_filter, "definitely_free", (double)filter.definitely_free);
+  cJSON_AddNumberToObject(username_filter, "maybe_taken", (double)filter.maybe_taken);
+
+  BackupStats backups = backup_stats();
+  cJSON *backup = cJSON_AddObjectToObject(json, "backup");
+  cJSON_AddBoolToObject(backup, "running", backups.running);
+  cJSON_AddNumberToObject(backup, "pages_done", backups.pages_done);
+  cJSON_AddNumberToObject(backup, "pages_total", backups.pages_total);
+  cJSON_AddNumberToObject(backup, "progress",
+                          backups.pages_total ? (double)backups.pages_done / backups.pages_total : 0.0);
+  cJSON_AddNumberToObject(backup, "completed", (double)backups.completed);
+  cJSON_AddNumberToObject(backup, "failed", (double)backups.failed);
+  cJSON_AddBoolToObject(backup, "last_ok", backups.last_ok);
+  cJSON_AddNumberToObject(backup, "last_duration_ms", backups.last_duration_ms);
+  cJSON_AddNumberToObject(backup, "last_finished_at", (double)backups.last_finished_at);
+
+  cJSON_AddNumberToObject(json, "sessions", (double)session_count());
+  cJSON_AddNumberToObject(json, "leaderboard_players", (double)leaderboard_size());
+
+  handle_json_response(client_socket, HTTP_200_OK, json);
+  cJSON_Delete(json);
+}
+
+// POST /admin/log-levels?http=debug&storage=warning, see log_set_levels()
+static void handle_log_levels(int client_socket, const char *query)
+{
+  if (!query || !log_set_levels(query))
+  {
+    handle_response(client_socket, HTTP_400_BAD_REQUEST);
+    return;
+  }
+  log_message(LOG_INFO, "Log levels set to %s", query);
+
+  cJSON *json = cJSON_CreateObject();
+  add_log_levels(json);
+  handle_json_response(client_socket, HTTP_200_OK, json);
+  cJSON_Delete(json);
+}
+
+// Admin endpoints only answer clients connecting from the server's own host
+static bool is_loopback_client(int client_socket)
+{
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  if (getpeername(client_socket, (struct sockaddr *)&addr, &len) == -1)
+    return false;
+
+  if (addr.ss_family == AF_INET)
+    return ntohl(((struct sockaddr_in *)&addr)->sin_addr.s_addr) >> 24 == 127;
+  if (addr.ss_family == AF_INET6)
+    return IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6 *)&addr)->sin6_addr);
+  return false;
+}
+
+// POST /admin/{action}
+static void handle_admin(int client_socket, const Target *target)
+{
+  const char *action = target->file_name;
+  if (!is_loopback_client(client_socket))
+  {
+    handle_response(client_socket, HTTP_403_FORBIDDEN);
+    return;
+  }
+
+  if (strcmp(action, "backup") == 0)
+  {
+    handle_response(client_socket, backup_request() ? HTTP_202_ACCEPTED : HTTP_409_CONFLICT);
+    return;
+  }
+
+  if (strcmp(action, "log-levels") == 0)
+  {
+    handle_log_levels(client_socket, target->query);
+    return;
+  }
+
+  handle_response(client_socket, HTTP_404_NOT_FOUND);
+}
+
+static void finish_score(WorkJob *job)
+{
+  DbRequest *req = (DbRequest *)job;
+  request_trace_resumed(req->client_socket);
+  if (req->status == HTTP_201_CREATED)
+  {
+    leaderboard_submit(req->username, req->score, req->timestamp);
+    response_cache_invalidate();
+  }
+
+  finish_db_request(job);
+}
+
+// POST /score, attributed to the user of the request's session
+RequestStatus handle_score(HttpRequest *hr, int client_socket)
+{
+  SessionInfo session;
+  char token[SESSION_TOKEN_LEN + 1];
+
+  if (!get_cookie(&hr->headers, SESSION_COOKIE, token, sizeof(token)) || !session_lookup(token, &session))
+  {
+    handle_response(client_socket, HTTP_401_UNAUTHORIZED);
+    return REQUEST_DONE;
+  }
+
+  ScoreBody body;
+  if (!extract_body(hr, score_fields, ARRAY_LEN(score_fields), &body))
+  {
+    handle_response(client_socket, HTTP_400_BAD_REQUEST);
+    return REQUEST_DONE;
+  }
+
+  DbRequest *req = create_db_request(client_socket, HTTP_201_CREATED, session.username, NULL);
+  req->user_id = session.user_id;
+  req->score = body.score;
+  req->timestamp = (long)time(NULL);
+  req->job.done = finish_score;
+
+  if (!db_writer_add_score(req->user_id, req->username, req->score, req->timestamp, db_request_written, req))
+  {
+    log_message(LOG_WARNING, "Database writer queue is full");
+    handle_response(client_socket, HTTP_503_UNAVAILABLE);
+    free(req);
+    return REQUEST_DONE;
+  }
+
+  return REQUEST_PENDING;
+}
+
+// Picks the handler for the request. process_request() dispatches on it, and
+// the trace, access log and metrics record it.
+RouteId request_route(const HttpRequest *hr)
+{
+  const char *method = hr->start_line.method;
+  const Target *target = &hr->start_line.target;
+  if (!method || !target->path || !target->file_name)
+    return ROUTE_UNKNOWN;
+
+  if (strcmp(method, GET) == 0)
+  {
+    if (strcmp(target->path, "/") == 0 && strcmp(target->file_name, "username-available") == 0)
+      return ROUTE_USERNAME_AVAILABLE;
+    if (strcmp(target->path, "/") == 0 && strcmp(target->file_name, "leaderboard") == 0)
+      return ROUTE_LEADERBOARD;
+    if (strcmp(target->path, "/") == 0 && strcmp(target->file_name, "stats") == 0)
+      return ROUTE_STATS;
+    if (strcmp(target->path, "/") == 0 && strcmp(target->file_name, "metrics") == 0)
+      return ROUTE_METRICS;
+    if (strcmp(target->path, "/leaderboard/") == 0 && strcmp(target->file_name, "export") == 0)
+      return ROUTE_LEADERBOARD_EXPORT;
+    if (strcmp(target->path, "/rank/") == 0)
+      return ROUTE_RANK;
+    return ROUTE_FILE;
+  }
+
+  if (strcmp(method, POST) == 0)
+  {
+    if (strcmp(target->path, "/admin/") == 0)
+      return ROUTE_ADMIN;
+    if (strcmp(target->file_name, "login") == 0)
+      return ROUTE_LOGIN;
+    if (strcmp(target->file_name, "register") == 0)
+      return ROUTE_REGISTER;
+    if (strcmp(target->file_name, "score") == 0)
+      return ROUTE_SCORE;
+  }
+
+  return ROUTE_UNKNOWN;
+}
+
+RequestStatus process_request(HttpRequest *hr, int client_socket, RouteId route)
+{
+  Target *target = &hr->start_line.target;
+
+  if (!hr->start_line.method)
+  {
+    metrics_parse_error(PARSE_ERROR_REQUEST);
+    handle_response(client_socket, HTTP_400_BAD_REQUEST);
+    return REQUEST_DONE;
+  }
+
   if (strcmp(hr->start_line.method, GET) == 0)
   {
     if (strcmp(hr->start_line.method, GET) == 0 && hr->body)
     {
       handle_response(client_socket, HTTP_400_BAD_REQUEST);
-      return;
+      return REQUEST_DONE;
     }
 
+    // Served from memory instead of the resources directory
+    switch (route)
+    {
+    case ROUTE_USERNAME_AVAILABLE:
+      return handle_username_available(client_socket, target->query);
+    case ROUTE_LEADERBOARD:
+      return handle_leaderboard(client_socket, target->query);
+    case ROUTE_STATS:
+      handle_stats(client_socket);
+      return REQUEST_DONE;
+    case ROUTE_METRICS:
+      handle_metrics(client_socket);
+      return REQUEST_DONE;
+    case ROUTE_LEADERBOARD_EXPORT:
+      return handle_leaderboard_export(client_socket);
+    case ROUTE_RANK:
+      return handle_rank(client_socket, target->file_name);
+    default:
+      break;
+    }
+
+    uint64_t mime_start = monotonic_ns();
     char *accept_header = get_header(&hr->headers, "Accept");
     const char *best_mime = determine_best_mime(accept_header);
+    request_trace_step(client_socket, STEP_MIME, mime_start);
 
     if (best_mime == NULL)
     {
       handle_response(client_socket, HTTP_415_UNSUPPORTED);
       free(accept_header);
-      return;
+      return REQUEST_DONE;
     }
 
     MimeType mime_type = get_mime_type_from_string(best_mime);
@@ -360,65 +1502,39 @@ void process_request(HttpRequest *hr, int client_socket)
   }
   else if (strcmp(hr->start_line.method, POST) == 0)
   {
-    printf("File name: %s Path: %s\n", hr->start_line.target.file_name, hr->start_line.target.path);
-    if (get_header(&hr->headers, "Content-Type") == NULL || strcmp(get_header(&hr->headers, "Content-Type"), "application/json") != 0)
+    // Admin actions take no body
+    if (route == ROUTE_ADMIN)
     {
-      log_message(LOG_ERROR, "Invalid Content-Type header \"%s\"", get_header(&hr->headers, "Content-Type"));
-      handle_response(client_socket, HTTP_400_BAD_REQUEST);
-      return;
+      handle_admin(client_socket, target);
+      return REQUEST_DONE;
     }
 
-    if (strcmp(hr->start_line.target.file_name, "login") == 0)
+    // Allow parameters such as "; charset=UTF-8"
+    char *content_type = get_header(&hr->headers, "Content-Type");
+    if (content_type == NULL || strncmp(content_type, "application/json", strlen("application/json")) != 0)
     {
-      // Check if user exists
-      cJSON *username = cJSON_GetObjectItemCaseSensitive(hr->body, "username");
-      cJSON *password = cJSON_GetObjectItemCaseSensitive(hr->body, "password");
-
-      if (!cJSON_IsString(username) || !cJSON_IsString(password))
-      {
-        log_message(LOG_ERROR, "Invalid body");
-        handle_response(client_socket, HTTP_400_BAD_REQUEST);
-        return;
-      }
-
-      if (strcmp(username->valuestring, "") == 0 || strcmp(password->valuestring, "") == 0)
-      {
-        log_message(LOG_ERROR, "Invalid body");
-        handle_response(client_socket, HTTP_400_BAD_REQUEST);
-        return;
-      }
-
-      if (!sql_search_username(username->valuestring, password->valuestring))
-      {
-        log_message(LOG_ERROR, "User %s not found", username->valuestring);
-        handle_response(client_socket, HTTP_404_NOT_FOUND);
-        return;
-      }
-      printf("User %s found\n", username->valuestring);
-      handle_response(client_socket, HTTP_200_OK);
+      log_message(LOG_ERROR, "Invalid Content-Type header \"%s\"", content_type);
+      handle_response(client_socket, HTTP_400_BAD_REQUEST);
+      free(content_type);
+      return REQUEST_DONE;
     }
-    else if (strcmp(hr->start_line.target.file_name, "register") == 0)
+    free(content_type);
+
+    switch (route)
     {
+    case ROUTE_LOGIN:
+      return handle_login(hr, client_socket);
+    case ROUTE_REGISTER:
       // Insert user
-     if (!sql_add_user(cJSON_GetObjectItemCaseSensitive(hr->body, "username")->valuestring, cJSON_GetObjectItemCaseSensitive(hr->body, "password")->valuestring)) {
-        log_message(LOG_ERROR, "Failed to insert user");
-        handle_response(client_socket, HTTP_500_INTERNAL_ERROR);
-        return;
-      }
-      handle_response(client_socket, HTTP_201_CREATED);
-    }
-    else
-    {
+      return handle_post(hr, client_socket, HTTP_201_CREATED);
+    case ROUTE_SCORE:
+      return handle_score(hr, client_socket);
+    default:
       handle_response(client_socket, HTTP_404_NOT_FOUND);
     }
   }
-}
 
-void print_http_request(HttpRequest *hr)
-{
-  print_start_line(&hr->start_line);
-  print_headers(&hr->headers);
-  print_body(hr->body);
+  return REQUEST_DONE;
 }
 
 void free_http_request(HttpRequest *hr)
@@ -465,7 +1581,7 @@ char *get_header(Headers *hs, const char *key)
 
   for (size_t i = 0; i < hs->count; i++)
   {
-    if (strcmp(hs->items[i].key, key) == 0)
+    if (strcasecmp(hs->items[i].key, key) == 0)
     {
       value = strdup(hs->items[i].value);
       break;
@@ -475,36 +1591,30 @@ char *get_header(Headers *hs, const char *key)
   return value;
 }
 
-void print_headers(Headers *hs)
+bool get_cookie(Headers *hs, const char *name, char *value, size_t value_size)
 {
-  printf("Headers=[");
-  for (size_t i = 0; i < hs->count; i++)
+  char *cookies = get_header(hs, "Cookie");
+  if (!cookies)
+    return false;
+
+  bool found = false;
+  size_t name_len = strlen(name);
+  char *saveptr;
+
+  for (char *cookie = strtok_r(cookies, ";", &saveptr); cookie; cookie = strtok_r(NULL, ";", &saveptr))
   {
-    Header h = hs->items[i];
-    if (i + 1 >= hs->count)
-    {
-      printf("%s: %s", h.key, h.value);
-    }
-    else
+    while (*cookie == ' ')
+      cookie++;
+
+    if (strncmp(cookie, name, name_len) == 0 && cookie[name_len] == '=')
     {
-      printf("%s: %s, ", h.key, h.value);
+      found = snprintf(value, value_size, "%s", cookie + name_len + 1) < (int)value_size;
+      break;
     }
   }
-  printf("]\n");
-}
 
-void print_body(cJSON *body)
-{
-  if (body)
-  {
-    char *body_str = cJSON_Print(body);
-    printf("Body=%s\n", body_str);
-    free(body_str);
-  }
-  else
-  {
-    printf("Body=NULL\n");
-  }
+  free(cookies);
+  return found;
 }
 
 void free_headers(Headers *hs)
@@ -525,18 +1635,10 @@ void free_start_line(StartLine *sl)
   free(sl->method);
   free(sl->target.path);
   free(sl->target.file_name);
+  free(sl->target.query);
   free(sl->version);
 }
 
-void print_start_line(StartLine *sl)
-{
-  printf("StartLine=[");
-  printf("Method: %s, ", sl->method);
-  printf("Target=[Path: %s, Filename: %s] ", sl->target.path, sl->target.file_name);
-  printf("Version: %s", sl->version);
-  printf("]\n");
-}
-
 const char *get_mime_type(MimeType type)
 {
   switch (type)
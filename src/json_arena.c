@@ -0,0 +1,200 @@
+#include "json_arena.h"
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGN alignof(max_align_t)
+#define CHUNK_MIN (16 * 1024)
+// A scope that needed more than this goes back to the minimum afterwards
+// rather than pinning a huge chunk to the thread
+#define CHUNK_RETAIN_MAX (1024 * 1024)
+
+typedef struct Chunk
+{
+  struct Chunk *next;
+  size_t size;
+  size_t used;
+  alignas(ARENA_ALIGN) unsigned char data[];
+} Chunk;
+
+typedef struct
+{
+  Chunk *chunks; // Newest first
+  int depth;
+  // Bytes handed out in the current scope, sizes the chunk kept for the next
+  size_t scope_bytes;
+  size_t next_chunk_size;
+  uint64_t allocations;
+  uint64_t bytes;
+} Arena;
+
+static __thread Arena arena;
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+static struct
+{
+  atomic_uint_fast64_t scopes;
+  atomic_uint_fast64_t arena_allocations;
+  atomic_uint_fast64_t arena_bytes;
+  atomic_uint_fast64_t heap_allocations;
+  atomic_uint_fast64_t chunk_allocations;
+} stats;
+
+static void free_chunks()
+{
+  Chunk *chunk = arena.chunks;
+  while (chunk)
+  {
+    Chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  arena.chunks = NULL;
+}
+
+static void arena_thread_exit(void *unused)
+{
+  (void)unused;
+  free_chunks();
+}
+
+static void make_arena_key()
+{
+  pthread_key_create(&arena_key, arena_thread_exit);
+}
+
+static Chunk *chunk_new(size_t min_size)
+{
+  size_t size = arena.next_chunk_size > CHUNK_MIN ? arena.next_chunk_size : CHUNK_MIN;
+  if (arena.chunks && arena.chunks->size * 2 > size)
+    size = arena.chunks->size * 2;
+  if (size < min_size)
+    size = min_size;
+
+  Chunk *chunk = malloc(sizeof(Chunk) + size);
+  if (!chunk)
+    return NULL;
+
+  // First chunk on this thread, have it freed when the thread exits
+  if (!arena.chunks)
+  {
+    pthread_once(&arena_key_once, make_arena_key);
+    pthread_setspecific(arena_key, &arena);
+  }
+
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->next = arena.chunks;
+  arena.chunks = chunk;
+  atomic_fetch_add_explicit(&stats.chunk_allocations, 1, memory_order_relaxed);
+  return chunk;
+}
+
+static void *arena_malloc(size_t size)
+{
+  if (arena.depth == 0)
+  {
+    atomic_fetch_add_explicit(&stats.heap_allocations, 1, memory_order_relaxed);
+    return malloc(size);
+  }
+
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  Chunk *chunk = arena.chunks;
+  if (!chunk || chunk->size - chunk->used < size)
+  {
+    chunk = chunk_new(size);
+    if (!chunk)
+      return NULL;
+  }
+
+  void *ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  arena.scope_bytes += size;
+  arena.allocations++;
+  arena.bytes += size;
+  return ptr;
+}
+
+static cJSON_bool arena_owns(const void *ptr)
+{
+  const unsigned char *p = ptr;
+  for (const Chunk *chunk = arena.chunks; chunk; chunk = chunk->next)
+    if (p >= chunk->data && p < chunk->data + chunk->size)
+      return 1;
+  return 0;
+}
+
+static void arena_free(void *ptr)
+{
+  // Arena memory goes when the scope ends, anything else came from malloc
+  if (ptr && !arena_owns(ptr))
+    free(ptr);
+}
+
+void json_arena_init()
+{
+  cJSON_Hooks hooks = {.malloc_fn = arena_malloc, .free_fn = arena_free};
+  cJSON_InitHooks(&hooks);
+  cJSON_InitBulkFreeCheck(arena_owns);
+}
+
+void json_arena_begin()
+{
+  arena.depth++;
+}
+
+void json_arena_end()
+{
+  if (arena.depth == 0 || --arena.depth > 0)
+    return;
+
+  // One chunk means the scope fit, keep it. Otherwise swap the lot for a
+  // single chunk big enough for next time.
+  if (arena.chunks && arena.chunks->next)
+  {
+    free_chunks();
+    arena.next_chunk_size = arena.scope_bytes <= CHUNK_RETAIN_MAX ? arena.scope_bytes : 0;
+  }
+  else if (arena.chunks)
+  {
+    arena.chunks->used = 0;
+  }
+
+  atomic_fetch_add_explicit(&stats.scopes, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&stats.arena_allocations, arena.allocations, memory_order_relaxed);
+  atomic_fetch_add_explicit(&stats.arena_bytes, arena.bytes, memory_order_relaxed);
+  arena.scope_bytes = 0;
+  arena.allocations = 0;
+  arena.bytes = 0;
+}
+
+char *json_arena_print(const cJSON *json)
+{
+  int depth = arena.depth;
+  arena.depth = 0;
+  char *text = cJSON_PrintUnformatted(json);
+  arena.depth = depth;
+  return text;
+}
+
+void json_arena_thread_free()
+{
+  free_chunks();
+  arena.next_chunk_size = 0;
+}
+
+JsonArenaStats json_arena_stats()
+{
+  return (JsonArenaStats){
+      .scopes = atomic_load_explicit(&stats.scopes, memory_order_relaxed),
+      .arena_allocations = atomic_load_explicit(&stats.arena_allocations, memory_order_relaxed),
+      .arena_bytes = atomic_load_explicit(&stats.arena_bytes, memory_order_relaxed),
+      .heap_allocations = atomic_load_explicit(&stats.heap_allocations, memory_order_relaxed),
+      .chunk_allocations = atomic_load_explicit(&stats.chunk_allocations, memory_order_relaxed),
+  };
+}
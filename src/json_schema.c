@@ -0,0 +1,427 @@
+#include "json_schema.h"
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+// Nesting allowed in members that are skipped
+#define JSON_SKIP_MAX_DEPTH 32
+// Longer keys can't be declared fields, they are compared by prefix only
+#define JSON_KEY_MAX 64
+
+typedef struct
+{
+  const char *p;
+  const char *end;
+} Cursor;
+
+static void skip_ws(Cursor *c)
+{
+  while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r'))
+    c->p++;
+}
+
+static bool consume(Cursor *c, char expected)
+{
+  skip_ws(c);
+  if (c->p < c->end && *c->p == expected)
+  {
+    c->p++;
+    return true;
+  }
+  return false;
+}
+
+static int hex_digit(char h)
+{
+  if (h >= '0' && h <= '9')
+    return h - '0';
+  if (h >= 'a' && h <= 'f')
+    return h - 'a' + 10;
+  if (h >= 'A' && h <= 'F')
+    return h - 'A' + 10;
+  return -1;
+}
+
+static bool read_hex4(Cursor *c, uint32_t *out)
+{
+  if (c->end - c->p < 4)
+    return false;
+
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    int d = hex_digit(c->p[i]);
+    if (d < 0)
+      return false;
+    v = (v << 4) | (uint32_t)d;
+  }
+  c->p += 4;
+  *out = v;
+  return true;
+}
+
+static size_t encode_utf8(uint32_t cp, char *out)
+{
+  if (cp < 0x80)
+  {
+    out[0] = (char)cp;
+    return 1;
+  }
+  if (cp < 0x800)
+  {
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+  }
+  if (cp < 0x10000)
+  {
+    out[0] = (char)(0xE0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (cp >> 18));
+  out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+// Reads a string whose opening quote has been consumed. The unescaped value
+// goes to out (when not NULL) truncated to out_size - 1 bytes, its full
+// length to *len. Returns false on malformed input.
+static bool read_string(Cursor *c, char *out, size_t out_size, size_t *len)
+{
+  size_t n = 0;
+
+  while (c->p < c->end)
+  {
+    char ch = *c->p++;
+    char utf8[4];
+    size_t utf8_len = 1;
+
+    if (ch == '"')
+    {
+      if (out)
+        out[n < out_size ? n : out_size - 1] = '\0';
+      *len = n;
+      return true;
+    }
+
+    if ((unsigned char)ch < 0x20)
+      return false;
+
+    if (ch != '\\')
+    {
+      utf8[0] = ch;
+    }
+    else
+    {
+      if (c->p >= c->end)
+        return false;
+
+      switch (*c->p++)
+      {
+      case '"':
+        utf8[0] = '"';
+        break;
+      case '\\':
+        utf8[0] = '\\';
+        break;
+      case '/':
+        utf8[0] = '/';
+        break;
+      case 'b':
+        utf8[0] = '\b';
+        break;
+      case 'f':
+        utf8[0] = '\f';
+        break;
+      case 'n':
+        utf8[0] = '\n';
+        break;
+      case 'r':
+        utf8[0] = '\r';
+        break;
+      case 't':
+        utf8[0] = '\t';
+        break;
+      case 'u':
+      {
+        uint32_t cp;
+        if (!read_hex4(c, &cp))
+          return false;
+
+        if (cp >= 0xD800 && cp <= 0xDBFF)
+        {
+          uint32_t low;
+          if (c->end - c->p < 2 || c->p[0] != '\\' || c->p[1] != 'u')
+            return false;
+          c->p += 2;
+          if (!read_hex4(c, &low) || low < 0xDC00 || low > 0xDFFF)
+            return false;
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        }
+        else if ((cp >= 0xDC00 && cp <= 0xDFFF) || cp == 0)
+        {
+          // Lone low surrogate, or a NUL that would cut the C string short
+          return false;
+        }
+
+        utf8_len = encode_utf8(cp, utf8);
+      }
+      break;
+      default:
+        return false;
+      }
+    }
+
+    for (size_t i = 0; i < utf8_len; i++, n++)
+    {
+      if (out && n + 1 < out_size)
+        out[n] = utf8[i];
+    }
+  }
+
+  return false;
+}
+
+// Reads a number, returning false if it isn't valid JSON. *integral tells
+// whether it had no fraction or exponent and fit in a long long.
+static bool read_number(Cursor *c, long long *value, bool *integral)
+{
+  const char *start = c->p;
+  bool negative = false;
+  unsigned long long v = 0;
+  bool overflow = false;
+
+  if (c->p < c->end && *c->p == '-')
+  {
+    negative = true;
+    c->p++;
+  }
+
+  if (c->p >= c->end || *c->p < '0' || *c->p > '9')
+    return false;
+
+  if (*c->p == '0')
+  {
+    c->p++;
+  }
+  else
+  {
+    while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+    {
+      unsigned d = (unsigned)(*c->p++ - '0');
+      if (v > (ULLONG_MAX - d) / 10)
+        overflow = true;
+      v = v * 10 + d;
+    }
+  }
+
+  *integral = !overflow;
+
+  if (c->p < c->end && *c->p == '.')
+  {
+    c->p++;
+    if (c->p >= c->end || *c->p < '0' || *c->p > '9')
+      return false;
+    while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+      c->p++;
+    *integral = false;
+  }
+
+  if (c->p < c->end && (*c->p == 'e' || *c->p == 'E'))
+  {
+    c->p++;
+    if (c->p < c->end && (*c->p == '+' || *c->p == '-'))
+      c->p++;
+    if (c->p >= c->end || *c->p < '0' || *c->p > '9')
+      return false;
+    while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+      c->p++;
+    *integral = false;
+  }
+
+  if (*integral && v > (unsigned long long)INT64_MAX + negative)
+    *integral = false;
+
+  *value = negative ? (long long)(0 - v) : (long long)v;
+  return c->p > start;
+}
+
+static bool read_literal(Cursor *c, const char *literal)
+{
+  size_t len = strlen(literal);
+  if ((size_t)(c->end - c->p) < len || memcmp(c->p, literal, len) != 0)
+    return false;
+  c->p += len;
+  return true;
+}
+
+// Skips any value, validating it on the way
+static bool skip_value(Cursor *c, int depth)
+{
+  skip_ws(c);
+  if (c->p >= c->end || depth > JSON_SKIP_MAX_DEPTH)
+    return false;
+
+  size_t len;
+  long long number;
+  bool integral;
+
+  switch (*c->p)
+  {
+  case '"':
+    c->p++;
+    return read_string(c, NULL, 0, &len);
+  case 't':
+    return read_literal(c, "true");
+  case 'f':
+    return read_literal(c, "false");
+  case 'n':
+    return read_literal(c, "null");
+  case '[':
+    c->p++;
+    if (consume(c, ']'))
+      return true;
+    do
+    {
+      if (!skip_value(c, depth + 1))
+        return false;
+    } while (consume(c, ','));
+    return consume(c, ']');
+  case '{':
+    c->p++;
+    if (consume(c, '}'))
+      return true;
+    do
+    {
+      if (!consume(c, '"') || !read_string(c, NULL, 0, &len) || !consume(c, ':') || !skip_value(c, depth + 1))
+        return false;
+    } while (consume(c, ','));
+    return consume(c, '}');
+  default:
+    return read_number(c, &number, &integral);
+  }
+}
+
+static JsonExtractResult read_field(Cursor *c, const JsonField *field, char *out)
+{
+  skip_ws(c);
+  if (c->p >= c->end)
+    return JSON_EXTRACT_MALFORMED;
+
+  switch (field->type)
+  {
+  case JSON_FIELD_STRING:
+  {
+    if (*c->p != '"')
+      return skip_value(c, 0) ? JSON_EXTRACT_WRONG_TYPE : JSON_EXTRACT_MALFORMED;
+    c->p++;
+
+    size_t len;
+    if (!read_string(c, out + field->offset, field->size, &len))
+      return JSON_EXTRACT_MALFORMED;
+    if ((long long)len < field->min || (long long)len > field->max)
+      return JSON_EXTRACT_OUT_OF_RANGE;
+    return JSON_EXTRACT_OK;
+  }
+  case JSON_FIELD_INT:
+  {
+    if (*c->p != '-' && (*c->p < '0' || *c->p > '9'))
+      return skip_value(c, 0) ? JSON_EXTRACT_WRONG_TYPE : JSON_EXTRACT_MALFORMED;
+
+    long long value;
+    bool integral;
+    if (!read_number(c, &value, &integral))
+      return JSON_EXTRACT_MALFORMED;
+    if (!integral)
+      return JSON_EXTRACT_WRONG_TYPE;
+    if (value < field->min || value > field->max)
+      return JSON_EXTRACT_OUT_OF_RANGE;
+
+    if (field->size == sizeof(int))
+      *(int *)(out + field->offset) = (int)value;
+    else
+      *(long long *)(out + field->offset) = value;
+    return JSON_EXTRACT_OK;
+  }
+  }
+
+  return JSON_EXTRACT_MALFORMED;
+}
+
+JsonExtractResult json_extract(const JsonField *fields, size_t field_count, const char *json, size_t len, void *out)
+{
+  Cursor c = {json, json + len};
+  uint64_t seen = 0;
+
+  if (!json || field_count > 64 || !consume(&c, '{'))
+    return JSON_EXTRACT_MALFORMED;
+
+  if (!consume(&c, '}'))
+  {
+    do
+    {
+      char key[JSON_KEY_MAX];
+      size_t key_len;
+      if (!consume(&c, '"') || !read_string(&c, key, sizeof(key), &key_len) || !consume(&c, ':'))
+        return JSON_EXTRACT_MALFORMED;
+
+      size_t i = 0;
+      while (i < field_count && (key_len >= sizeof(key) || strcmp(fields[i].name, key) != 0))
+        i++;
+
+      if (i == field_count)
+      {
+        if (!skip_value(&c, 0))
+          return JSON_EXTRACT_MALFORMED;
+        continue;
+      }
+
+      if (seen & (1ULL << i))
+        return JSON_EXTRACT_DUPLICATE;
+      seen |= 1ULL << i;
+
+      JsonExtractResult result = read_field(&c, &fields[i], out);
+      if (result != JSON_EXTRACT_OK)
+        return result;
+    } while (consume(&c, ','));
+
+    if (!consume(&c, '}'))
+      return JSON_EXTRACT_MALFORMED;
+  }
+
+  skip_ws(&c);
+  if (c.p != c.end)
+    return JSON_EXTRACT_MALFORMED;
+
+  for (size_t i = 0; i < field_count; i++)
+  {
+    if (!(seen & (1ULL << i)))
+      return JSON_EXTRACT_MISSING;
+  }
+
+  return JSON_EXTRACT_OK;
+}
+
+const char *json_extract_error(JsonExtractResult result)
+{
+  switch (result)
+  {
+  case JSON_EXTRACT_OK:
+    return "ok";
+  case JSON_EXTRACT_MALFORMED:
+    return "malformed JSON object";
+  case JSON_EXTRACT_WRONG_TYPE:
+    return "field has the wrong type";
+  case JSON_EXTRACT_OUT_OF_RANGE:
+    return "field is out of range";
+  case JSON_EXTRACT_DUPLICATE:
+    return "duplicate field";
+  case JSON_EXTRACT_MISSING:
+    return "missing field";
+  }
+  return "unknown error";
+}
@@ -0,0 +1,258 @@
+#include "json_writer.h"
+#include "utils.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static void send_all(JsonWriter *w, const char *data, size_t len)
+{
+  while (!w->failed && len > 0)
+  {
+    uint64_t start = monotonic_ns();
+    if (w->deadline_ns != 0 && start >= w->deadline_ns)
+    {
+      w->failed = true;
+      return;
+    }
+
+    // Also fails on a socket send timeout (SO_SNDTIMEO)
+    ssize_t sent = send(w->client_socket, data, len, MSG_NOSIGNAL);
+    w->write_ns += monotonic_ns() - start;
+    if (sent <= 0)
+    {
+      w->failed = true;
+      return;
+    }
+    data += sent;
+    len -= (size_t)sent;
+    w->bytes_sent += (size_t)sent;
+  }
+}
+
+static void flush_chunk(JsonWriter *w)
+{
+  if (w->len == 0 || w->failed)
+  {
+    w->len = 0;
+    return;
+  }
+
+  char size_line[32];
+  int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", w->len);
+  send_all(w, size_line, (size_t)n);
+  send_all(w, w->buffer, w->len);
+  send_all(w, "\r\n", 2);
+  w->len = 0;
+}
+
+static void put(JsonWriter *w, const char *data, size_t len)
+{
+  while (len > 0)
+  {
+    if (w->len == sizeof(w->buffer))
+      flush_chunk(w);
+
+    size_t n = sizeof(w->buffer) - w->len;
+    if (n > len)
+      n = len;
+    memcpy(w->buffer + w->len, data, n);
+    w->len += n;
+    data += n;
+    len -= n;
+  }
+}
+
+static void put_char(JsonWriter *w, char c)
+{
+  if (w->len == sizeof(w->buffer))
+    flush_chunk(w);
+  w->buffer[w->len++] = c;
+}
+
+// Writes the comma separating this value from the previous member, if any
+static void begin_value(JsonWriter *w)
+{
+  if (w->after_key)
+  {
+    w->after_key = false;
+    return;
+  }
+
+  uint64_t bit = 1ULL << w->depth;
+  if (w->has_member & bit)
+    put_char(w, ',');
+  w->has_member |= bit;
+}
+
+static void put_escaped(JsonWriter *w, const char *s)
+{
+  put_char(w, '"');
+
+  const char *run = s;
+  for (; *s; s++)
+  {
+    unsigned char c = (unsigned char)*s;
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+
+    put(w, run, (size_t)(s - run));
+    run = s + 1;
+
+    char escape[8];
+    switch (c)
+    {
+    case '"':
+      put(w, "\\\"", 2);
+      break;
+    case '\\':
+      put(w, "\\\\", 2);
+      break;
+    case '\b':
+      put(w, "\\b", 2);
+      break;
+    case '\f':
+      put(w, "\\f", 2);
+      break;
+    case '\n':
+      put(w, "\\n", 2);
+      break;
+    case '\r':
+      put(w, "\\r", 2);
+      break;
+    case '\t':
+      put(w, "\\t", 2);
+      break;
+    default:
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      put(w, escape, 6);
+    }
+  }
+  put(w, run, (size_t)(s - run));
+
+  put_char(w, '"');
+}
+
+static void open_container(JsonWriter *w, char c)
+{
+  begin_value(w);
+  put_char(w, c);
+  assert(w->depth + 1 < JSON_WRITER_MAX_DEPTH && "JSON nested too deep");
+  w->depth++;
+  w->has_member &= ~(1ULL << w->depth);
+}
+
+static void close_container(JsonWriter *w, char c)
+{
+  assert(w->depth > 0 && "Unbalanced JSON container");
+  w->depth--;
+  put_char(w, c);
+}
+
+void json_writer_begin(JsonWriter *w, int client_socket, HttpStatusCode http_sc, uint64_t deadline_ns)
+{
+  w->client_socket = client_socket;
+  w->len = 0;
+  w->has_member = 0;
+  w->depth = 0;
+  w->after_key = false;
+  w->failed = false;
+  w->bytes_sent = 0;
+  w->write_ns = 0;
+  w->deadline_ns = deadline_ns;
+
+  char header[256];
+  int n = snprintf(header, sizeof(header),
+                   "HTTP/1.1 %s\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Transfer-Encoding: chunked\r\n"
+                   "\r\n",
+                   get_status_text(http_sc));
+  send_all(w, header, (size_t)n);
+}
+
+bool json_writer_end(JsonWriter *w)
+{
+  flush_chunk(w);
+  send_all(w, "0\r\n\r\n", 5);
+  return !w->failed;
+}
+
+void json_object_begin(JsonWriter *w)
+{
+  open_container(w, '{');
+}
+
+void json_object_end(JsonWriter *w)
+{
+  close_container(w, '}');
+}
+
+void json_array_begin(JsonWriter *w)
+{
+  open_container(w, '[');
+}
+
+void json_array_end(JsonWriter *w)
+{
+  close_container(w, ']');
+}
+
+void json_key(JsonWriter *w, const char *key)
+{
+  begin_value(w);
+  put_escaped(w, key);
+  put_char(w, ':');
+  w->after_key = true;
+}
+
+void json_string(JsonWriter *w, const char *value)
+{
+  begin_value(w);
+  put_escaped(w, value);
+}
+
+void json_int(JsonWriter *w, long long value)
+{
+  char number[24];
+  int n = snprintf(number, sizeof(number), "%lld", value);
+  begin_value(w);
+  put(w, number, (size_t)n);
+}
+
+void json_double(JsonWriter *w, double value)
+{
+  // Same formatting as cJSON: shortest of 15 or 17 digits that round trips
+  char number[32];
+  int n;
+  if (isnan(value) || isinf(value))
+  {
+    n = snprintf(number, sizeof(number), "null");
+  }
+  else
+  {
+    n = snprintf(number, sizeof(number), "%1.15g", value);
+    if (strtod(number, NULL) != value)
+      n = snprintf(number, sizeof(number), "%1.17g", value);
+  }
+
+  begin_value(w);
+  put(w, number, (size_t)n);
+}
+
+void json_bool(JsonWriter *w, bool value)
+{
+  begin_value(w);
+  if (value)
+    put(w, "true", 4);
+  else
+    put(w, "false", 5);
+}
+
+void json_null(JsonWriter *w)
+{
+  begin_value(w);
+  put(w, "null", 4);
+}
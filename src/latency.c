@@ -0,0 +1,259 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_HTTP
+#include "latency.h"
+#include "config.h"
+#include "utils.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// 64 buckets per power of two, values below 2^LATENCY_MAX_EXP ns
+#define LATENCY_SUB_BITS 6
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_LINEAR (2 * LATENCY_SUB)
+#define LATENCY_MAX_EXP 37
+#define LATENCY_BUCKETS (LATENCY_LINEAR + (LATENCY_MAX_EXP - LATENCY_SUB_BITS - 1) * LATENCY_SUB)
+
+typedef uint64_t Buckets[LATENCY_BUCKETS];
+
+// 16KB per route and phase, only touched where requests are recorded
+static Buckets histograms[ROUTE_COUNT][LATENCY_PHASE_COUNT];
+
+static struct
+{
+  pthread_t thread;
+  pthread_mutex_t lock; // Guards stopping
+  pthread_cond_t wake;
+  bool enabled;
+  bool stopping;
+
+  // Owned by the snapshot thread once started
+  FILE *file;
+  Buckets *previous; // Counts at the last snapshot, laid out like histograms
+  uint64_t previous_ns;
+} latency = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static size_t bucket_of(uint64_t ns)
+{
+  if (ns < LATENCY_LINEAR)
+    return (size_t)ns;
+  if (ns >> LATENCY_MAX_EXP)
+    return LATENCY_BUCKETS - 1;
+  int exp = 63 - __builtin_clzll(ns);
+  int shift = exp - LATENCY_SUB_BITS;
+  return LATENCY_LINEAR + (size_t)(shift - 1) * LATENCY_SUB + (size_t)((ns >> shift) - LATENCY_SUB);
+}
+
+// Highest value that lands in bucket
+static uint64_t bucket_highest(size_t bucket)
+{
+  if (bucket < LATENCY_LINEAR)
+    return bucket;
+  size_t i = bucket - LATENCY_LINEAR;
+  int shift = (int)(i / LATENCY_SUB) + 1;
+  uint64_t sub = LATENCY_SUB + i % LATENCY_SUB;
+  return ((sub + 1) << shift) - 1;
+}
+
+void latency_record(RouteId route, LatencyPhase phase, uint64_t ns)
+{
+  if ((unsigned)route >= ROUTE_COUNT || (unsigned)phase >= LATENCY_PHASE_COUNT)
+    return;
+  // Single writer, readers only need whole values
+  uint64_t *slot = &histograms[route][phase][bucket_of(ns)];
+  __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+static LatencySummary summarize(const uint64_t *counts)
+{
+  LatencySummary s = {0};
+  size_t highest = 0;
+  for (size_t b = 0; b < LATENCY_BUCKETS; b++)
+  {
+    if (counts[b] == 0)
+      continue;
+    s.count += counts[b];
+    highest = b;
+  }
+  if (s.count == 0)
+    return s;
+  s.max = bucket_highest(highest);
+
+  // Per mille, smallest value with at least that share of the counts at or below it
+  static const unsigned quantiles[] = {500, 900, 990, 999};
+  uint64_t *values[] = {&s.p50, &s.p90, &s.p99, &s.p999};
+  size_t q = 0;
+  uint64_t cumulative = 0;
+  for (size_t b = 0; b <= highest && q < ARRAY_LEN(quantiles); b++)
+  {
+    cumulative += counts[b];
+    while (q < ARRAY_LEN(quantiles) && cumulative * 1000 >= s.count * quantiles[q])
+      *values[q++] = bucket_highest(b);
+  }
+  return s;
+}
+
+static void load(uint64_t *out, const uint64_t *counts)
+{
+  for (size_t b = 0; b < LATENCY_BUCKETS; b++)
+    out[b] = __atomic_load_n(&counts[b], __ATOMIC_RELAXED);
+}
+
+LatencySummary latency_summary(RouteId route, LatencyPhase phase)
+{
+  if ((unsigned)route >= ROUTE_COUNT || (unsigned)phase >= LATENCY_PHASE_COUNT)
+    return (LatencySummary){0};
+  Buckets counts;
+  load(counts, histograms[route][phase]);
+  return summarize(counts);
+}
+
+static void write_summary(FILE *out, const char *name, const LatencySummary *s)
+{
+  fprintf(out,
+          "\"%s\":{\"count\":%llu,\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"p99.9_us\":%.3f,"
+          "\"max_us\":%.3f}",
+          name, (unsigned long long)s->count, (double)s->p50 / 1e3, (double)s->p90 / 1e3, (double)s->p99 / 1e3,
+          (double)s->p999 / 1e3, (double)s->max / 1e3);
+}
+
+// One line with what was recorded since the previous snapshot
+static void snapshot()
+{
+  uint64_t now_ns = monotonic_ns();
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  fprintf(latency.file, "{\"time_ms\":%llu,\"interval_ms\":%llu,\"routes\":{",
+          (unsigned long long)now.tv_sec * 1000ULL + (unsigned long long)now.tv_nsec / 1000000ULL,
+          (unsigned long long)(now_ns - latency.previous_ns) / 1000000ULL);
+  latency.previous_ns = now_ns;
+
+  bool first_route = true;
+  for (int route = 0; route < ROUTE_COUNT; route++)
+  {
+    bool first_phase = true;
+    for (int phase = 0; phase < LATENCY_PHASE_COUNT; phase++)
+    {
+      Buckets counts;
+      uint64_t *previous = latency.previous[route * LATENCY_PHASE_COUNT + phase];
+      load(counts, histograms[route][phase]);
+      for (size_t b = 0; b < LATENCY_BUCKETS; b++)
+      {
+        uint64_t current = counts[b];
+        counts[b] -= previous[b];
+        previous[b] = current;
+      }
+
+      LatencySummary s = summarize(counts);
+      if (s.count == 0)
+        continue;
+      if (first_phase)
+        fprintf(latency.file, "%s\"%s\":{", first_route ? "" : ",", route_name(route));
+      else
+        fputc(',', latency.file);
+      write_summary(latency.file, latency_phase_name(phase), &s);
+      first_route = false;
+      first_phase = false;
+    }
+    if (!first_phase)
+      fputc('}', latency.file);
+  }
+  fputs("}}\n", latency.file);
+  fflush(latency.file);
+}
+
+static void *latency_main(void *arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&latency.lock);
+  while (!latency.stopping)
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += server_config.latency_snapshot_interval_ms / 1000;
+    deadline.tv_nsec += (long)(server_config.latency_snapshot_interval_ms % 1000) * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    int rc = 0;
+    while (!latency.stopping && rc != ETIMEDOUT)
+      rc = pthread_cond_timedwait(&latency.wake, &latency.lock, &deadline);
+    if (latency.stopping)
+      break;
+
+    pthread_mutex_unlock(&latency.lock);
+    snapshot();
+    pthread_mutex_lock(&latency.lock);
+  }
+  pthread_mutex_unlock(&latency.lock);
+
+  // The I/O loop has stopped, so this is the rest
+  snapshot();
+  return NULL;
+}
+
+bool latency_start()
+{
+  if (server_config.latency_snapshot_path[0] == '\0')
+    return true;
+  if (server_config.latency_snapshot_interval_ms <= 0)
+  {
+    log_message(LOG_ERROR, "latency.snapshot_interval_ms must be positive");
+    return false;
+  }
+
+  latency.file = fopen(server_config.latency_snapshot_path, "a");
+  if (!latency.file)
+  {
+    log_message(LOG_ERROR, "Can't open %s: %s", server_config.latency_snapshot_path, strerror(errno));
+    return false;
+  }
+
+  // Counts from before the start belong to no interval
+  latency.previous = malloc(sizeof(histograms));
+  assert(latency.previous != NULL && "Buy more RAM lol");
+  for (int route = 0; route < ROUTE_COUNT; route++)
+    for (int phase = 0; phase < LATENCY_PHASE_COUNT; phase++)
+      load(latency.previous[route * LATENCY_PHASE_COUNT + phase], histograms[route][phase]);
+  latency.previous_ns = monotonic_ns();
+
+  latency.stopping = false;
+  if (pthread_create(&latency.thread, NULL, latency_main, NULL) != 0)
+  {
+    log_message(LOG_ERROR, "Failed to start latency snapshot thread");
+    fclose(latency.file);
+    free(latency.previous);
+    latency.previous = NULL;
+    return false;
+  }
+
+  latency.enabled = true;
+  log_message(LOG_INFO, "Writing latency snapshots to %s every %dms", server_config.latency_snapshot_path,
+              server_config.latency_snapshot_interval_ms);
+  return true;
+}
+
+void latency_stop()
+{
+  if (!latency.enabled)
+    return;
+
+  pthread_mutex_lock(&latency.lock);
+  latency.stopping = true;
+  pthread_cond_signal(&latency.wake);
+  pthread_mutex_unlock(&latency.lock);
+  pthread_join(latency.thread, NULL);
+
+  fclose(latency.file);
+  latency.file = NULL;
+  free(latency.previous);
+  latency.previous = NULL;
+  latency.enabled = false;
+}
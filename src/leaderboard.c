@@ -0,0 +1,396 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_STORAGE
+#include "leaderboard.h"
+#include "storage.h"
+#include "utils.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SKIPLIST_MAX_LEVEL 32
+#define LEADERBOARD_INITIAL_BUCKETS 1024
+
+typedef struct SkipNode SkipNode;
+
+typedef struct
+{
+  SkipNode *next;
+  // Number of level 0 steps this link skips over
+  size_t span;
+} SkipLink;
+
+struct SkipNode
+{
+  LeaderboardEntry entry;
+  SkipNode *hash_next;
+  int level;
+  SkipLink links[];
+};
+
+typedef struct
+{
+  pthread_rwlock_t lock;
+  SkipNode *header;
+  int level;
+  size_t length;
+  uint64_t random_state;
+
+  // username -> node, chained
+  SkipNode **buckets;
+  size_t bucket_count;
+} Leaderboard;
+
+static Leaderboard leaderboard = {
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+};
+
+static bool entry_before(const LeaderboardEntry *a, const LeaderboardEntry *b)
+{
+  if (a->score != b->score)
+    return a->score > b->score;
+  if (a->timestamp != b->timestamp)
+    return a->timestamp < b->timestamp;
+  return strcmp(a->username, b->username) < 0;
+}
+
+static uint64_t hash_username(const char *username)
+{
+  // FNV-1a
+  uint64_t hash = 1469598103934665603ULL;
+  for (const unsigned char *c = (const unsigned char *)username; *c; c++)
+  {
+    hash ^= *c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static int random_level()
+{
+  // xorshift64, only called with the write lock held
+  int level = 1;
+  while (level < SKIPLIST_MAX_LEVEL)
+  {
+    uint64_t x = leaderboard.random_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    leaderboard.random_state = x;
+
+    // Promote with probability 1/4
+    if ((x & 3) != 0)
+      break;
+    level++;
+  }
+  return level;
+}
+
+static SkipNode *create_node(int level)
+{
+  SkipNode *node = calloc(1, sizeof(SkipNode) + level * sizeof(SkipLink));
+  assert(node != NULL && "Buy more RAM lol");
+  node->level = level;
+  return node;
+}
+
+static SkipNode *find_user(const char *username)
+{
+  size_t bucket = hash_username(username) & (leaderboard.bucket_count - 1);
+  for (SkipNode *node = leaderboard.buckets[bucket]; node; node = node->hash_next)
+  {
+    if (strcmp(node->entry.username, username) == 0)
+      return node;
+  }
+  return NULL;
+}
+
+static void hash_insert(SkipNode *node)
+{
+  if (leaderboard.length + 1 > leaderboard.bucket_count)
+  {
+    size_t new_count = leaderboard.bucket_count * 2;
+    SkipNode **new_buckets = calloc(new_count, sizeof(SkipNode *));
+    assert(new_buckets != NULL && "Buy more RAM lol");
+
+    for (size_t i = 0; i < leaderboard.bucket_count; i++)
+    {
+      SkipNode *n = leaderboard.buckets[i];
+      while (n)
+      {
+        SkipNode *next = n->hash_next;
+        size_t bucket = hash_username(n->entry.username) & (new_count - 1);
+        n->hash_next = new_buckets[bucket];
+        new_buckets[bucket] = n;
+        n = next;
+      }
+    }
+
+    free(leaderboard.buckets);
+    leaderboard.buckets = new_buckets;
+    leaderboard.bucket_count = new_count;
+  }
+
+  size_t bucket = hash_username(node->entry.username) & (leaderboard.bucket_count - 1);
+  node->hash_next = leaderboard.buckets[bucket];
+  leaderboard.buckets[bucket] = node;
+}
+
+static void skiplist_insert(SkipNode *node)
+{
+  SkipNode *update[SKIPLIST_MAX_LEVEL];
+  size_t rank[SKIPLIST_MAX_LEVEL];
+  SkipNode *x = leaderboard.header;
+
+  for (int i = leaderboard.level - 1; i >= 0; i--)
+  {
+    rank[i] = i == leaderboard.level - 1 ? 0 : rank[i + 1];
+    while (x->links[i].next && entry_before(&x->links[i].next->entry, &node->entry))
+    {
+      rank[i] += x->links[i].span;
+      x = x->links[i].next;
+    }
+    update[i] = x;
+  }
+
+  if (node->level > leaderboard.level)
+  {
+    for (int i = leaderboard.level; i < node->level; i++)
+    {
+      rank[i] = 0;
+      update[i] = leaderboard.header;
+      update[i]->links[i].span = leaderboard.length;
+    }
+    leaderboard.level = node->level;
+  }
+
+  for (int i = 0; i < node->level; i++)
+  {
+    node->links[i].next = update[i]->links[i].next;
+    update[i]->links[i].next = node;
+    node->links[i].span = update[i]->links[i].span - (rank[0] - rank[i]);
+    update[i]->links[i].span = (rank[0] - rank[i]) + 1;
+  }
+
+  for (int i = node->level; i < leaderboard.level; i++)
+    update[i]->links[i].span++;
+
+  leaderboard.length++;
+}
+
+static void skiplist_remove(SkipNode *node)
+{
+  SkipNode *update[SKIPLIST_MAX_LEVEL];
+  SkipNode *x = leaderboard.header;
+
+  for (int i = leaderboard.level - 1; i >= 0; i--)
+  {
+    while (x->links[i].next && entry_before(&x->links[i].next->entry, &node->entry))
+      x = x->links[i].next;
+    update[i] = x;
+  }
+
+  for (int i = 0; i < leaderboard.level; i++)
+  {
+    if (update[i]->links[i].next == node)
+    {
+      update[i]->links[i].span += node->links[i].span - 1;
+      update[i]->links[i].next = node->links[i].next;
+    }
+    else
+    {
+      update[i]->links[i].span--;
+    }
+  }
+
+  while (leaderboard.level > 1 && leaderboard.header->links[leaderboard.level - 1].next == NULL)
+    leaderboard.level--;
+
+  leaderboard.length--;
+}
+
+// 1 based rank, 0 if not found
+static size_t skiplist_rank(const SkipNode *node)
+{
+  size_t rank = 0;
+  SkipNode *x = leaderboard.header;
+
+  for (int i = leaderboard.level - 1; i >= 0; i--)
+  {
+    while (x->links[i].next &&
+           (x->links[i].next == node || entry_before(&x->links[i].next->entry, &node->entry)))
+    {
+      rank += x->links[i].span;
+      x = x->links[i].next;
+    }
+    if (x == node)
+      return rank;
+  }
+  return 0;
+}
+
+static SkipNode *skiplist_at_rank(size_t rank)
+{
+  size_t traversed = 0;
+  SkipNode *x = leaderboard.header;
+
+  for (int i = leaderboard.level - 1; i >= 0; i--)
+  {
+    while (x->links[i].next && traversed + x->links[i].span <= rank)
+    {
+      traversed += x->links[i].span;
+      x = x->links[i].next;
+    }
+    if (traversed == rank)
+      return x;
+  }
+  return NULL;
+}
+
+// Called with the write lock held
+static bool submit_locked(const char *username, int score, long timestamp)
+{
+  SkipNode *node = find_user(username);
+  if (node)
+  {
+    if (score <= node->entry.score)
+      return false;
+
+    skiplist_remove(node);
+    node->entry.score = score;
+    node->entry.timestamp = timestamp;
+    skiplist_insert(node);
+    return true;
+  }
+
+  node = create_node(random_level());
+  snprintf(node->entry.username, sizeof(node->entry.username), "%s", username);
+  node->entry.score = score;
+  node->entry.timestamp = timestamp;
+
+  hash_insert(node);
+  skiplist_insert(node);
+  return true;
+}
+
+static void load_score(void *ctx, const char *username, int score, long timestamp)
+{
+  (void)ctx;
+  submit_locked(username, score, timestamp);
+}
+
+bool leaderboard_init()
+{
+  pthread_rwlock_wrlock(&leaderboard.lock);
+
+  leaderboard.header = create_node(SKIPLIST_MAX_LEVEL);
+  leaderboard.level = 1;
+  leaderboard.length = 0;
+  leaderboard.random_state = 0x9E3779B97F4A7C15ULL;
+  leaderboard.bucket_count = LEADERBOARD_INITIAL_BUCKETS;
+  leaderboard.buckets = calloc(leaderboard.bucket_count, sizeof(SkipNode *));
+  assert(leaderboard.buckets != NULL && "Buy more RAM lol");
+
+  bool ok = storage->for_each_score(load_score, NULL);
+
+  pthread_rwlock_unlock(&leaderboard.lock);
+
+  log_message(LOG_INFO, "Leaderboard loaded with %zu players", leaderboard.length);
+  return ok;
+}
+
+void leaderboard_free()
+{
+  pthread_rwlock_wrlock(&leaderboard.lock);
+
+  SkipNode *node = leaderboard.header ? leaderboard.header->links[0].next : NULL;
+  while (node)
+  {
+    SkipNode *next = node->links[0].next;
+    free(node);
+    node = next;
+  }
+  free(leaderboard.header);
+  free(leaderboard.buckets);
+  leaderboard.header = NULL;
+  leaderboard.buckets = NULL;
+  leaderboard.length = 0;
+
+  pthread_rwlock_unlock(&leaderboard.lock);
+}
+
+bool leaderboard_submit(const char *username, int score, long timestamp)
+{
+  pthread_rwlock_wrlock(&leaderboard.lock);
+  bool improved = submit_locked(username, score, timestamp);
+  pthread_rwlock_unlock(&leaderboard.lock);
+  return improved;
+}
+
+size_t leaderboard_range(size_t offset, size_t limit, LeaderboardEntry *out)
+{
+  pthread_rwlock_rdlock(&leaderboard.lock);
+
+  size_t count = 0;
+  if (offset < leaderboard.length)
+  {
+    SkipNode *node = skiplist_at_rank(offset + 1);
+    while (node && count < limit)
+    {
+      out[count++] = node->entry;
+      node = node->links[0].next;
+    }
+  }
+
+  pthread_rwlock_unlock(&leaderboard.lock);
+  return count;
+}
+
+bool leaderboard_rank(const char *username, size_t *rank, LeaderboardEntry *entry)
+{
+  pthread_rwlock_rdlock(&leaderboard.lock);
+
+  SkipNode *node = find_user(username);
+  if (node)
+  {
+    *rank = skiplist_rank(node);
+    *entry = node->entry;
+  }
+
+  pthread_rwlock_unlock(&leaderboard.lock);
+  return node != NULL;
+}
+
+size_t leaderboard_size()
+{
+  pthread_rwlock_rdlock(&leaderboard.lock);
+  size_t length = leaderboard.length;
+  pthread_rwlock_unlock(&leaderboard.lock);
+  return length;
+}
+
+static bool parse_bounded(const char *value, size_t max, size_t *out)
+{
+  // strtoul would take a sign or leading blanks
+  if (*value < '0' || *value > '9')
+    return false;
+
+  errno = 0;
+  char *end = NULL;
+  unsigned long long v = strtoull(value, &end, 10);
+  if (errno == ERANGE || *end != '\0' || v > max)
+    return false;
+
+  *out = (size_t)v;
+  return true;
+}
+
+bool leaderboard_parse_page(const char *limit, const char *offset, size_t *limit_out, size_t *offset_out)
+{
+  *limit_out = LEADERBOARD_PAGE_DEFAULT;
+  *offset_out = 0;
+  return (!limit || parse_bounded(limit, LEADERBOARD_PAGE_MAX, limit_out)) &&
+         (!offset || parse_bounded(offset, LEADERBOARD_OFFSET_MAX, offset_out));
+}
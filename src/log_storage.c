@@ -0,0 +1,779 @@
+#define _GNU_SOURCE
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_STORAGE
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "config.h"
+#include "storage.h"
+#include "utils.h"
+
+// Append-only log storage engine.
+//
+// The file is a header followed by 8-byte aligned records. Every record
+// carries a CRC-32 of its contents, and a batch of writes only counts once
+// the COMMIT record after it is on disk: on open, the log is replayed up to
+// the last valid COMMIT and anything after it (a torn or uncommitted batch)
+// is discarded.
+//
+// The file is memory mapped. The writer appends by copying into the map and
+// flushes it with msync() on commit. Readers never touch the file directly,
+// they look usernames up in an in-memory index (username -> offset of the
+// user record and of their best score) rebuilt from the log on open. The
+// index only ever reflects committed records.
+//
+// Compaction rewrites the log with just the user records and each player's
+// best score (all the leaderboard needs) once it is mostly garbage.
+
+#define LOG_STORE_MAGIC "SLG1"
+#define LOG_STORE_VERSION 1
+#define LOG_STORE_MIN_MAP (1024 * 1024)
+#define LOG_INDEX_INITIAL_CAPACITY 1024
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t reserved;
+} LogFileHeader;
+
+typedef enum
+{
+    LOG_RECORD_END = 0, // Zeroed space past the tail
+    LOG_RECORD_USER,
+    LOG_RECORD_SCORE,
+    LOG_RECORD_COMMIT,
+} LogRecordType;
+
+// Followed by username_len bytes of username and password_len bytes of
+// password (no terminators), then zero padding up to 8 bytes
+typedef struct
+{
+    uint32_t crc; // Of everything after this field up to the padding
+    uint8_t type;
+    uint8_t username_len;
+    uint16_t password_len;
+    int32_t user_id;
+    int32_t score;
+    int64_t timestamp;
+} LogRecord;
+
+typedef struct
+{
+    char username[DB_USERNAME_MAX]; // Empty for a free slot
+    size_t user_offset;             // 0 if there is no user record
+    size_t score_offset;            // Best score, 0 if there is none
+    int32_t best_score;
+} LogIndexEntry;
+
+static struct
+{
+    pthread_rwlock_t lock; // Guards the mapping and the index
+    int fd;
+    uint8_t *map;
+    size_t mapped;
+    size_t tail;      // End of the last appended record
+    size_t committed; // End of the last COMMIT record
+    size_t synced;    // Everything before this is on disk
+
+    // Writer state
+    bool in_transaction;
+    size_t transaction_start;
+    int transaction_user_id;
+    int next_user_id;
+
+    LogIndexEntry *entries;
+    size_t capacity;
+    size_t count;
+    long users;
+    size_t live_bytes; // Size of what a compaction would keep
+} store = {.lock = PTHREAD_RWLOCK_INITIALIZER, .fd = -1};
+
+static uint32_t crc_table[256];
+
+static void crc_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++)
+        c = crc_table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+static size_t record_size(size_t username_len, size_t password_len)
+{
+    return (sizeof(LogRecord) + username_len + password_len + 7) & ~(size_t)7;
+}
+
+static const LogRecord *record_at(size_t offset)
+{
+    return (const LogRecord *)(store.map + offset);
+}
+
+static const char *record_username(const LogRecord *rec)
+{
+    return (const char *)(rec + 1);
+}
+
+static const char *record_password(const LogRecord *rec)
+{
+    return (const char *)(rec + 1) + rec->username_len;
+}
+
+// Returns the size of the valid record at offset, 0 at the end of the log or
+// at the first torn/corrupt record
+static size_t record_check(size_t offset, size_t limit)
+{
+    if (offset + sizeof(LogRecord) > limit)
+        return 0;
+
+    const LogRecord *rec = record_at(offset);
+    if (rec->type == LOG_RECORD_END || rec->type > LOG_RECORD_COMMIT)
+        return 0;
+
+    size_t size = record_size(rec->username_len, rec->password_len);
+    if (offset + size > limit)
+        return 0;
+
+    size_t covered = sizeof(LogRecord) - sizeof(rec->crc) + rec->username_len + rec->password_len;
+    if (crc32((const uint8_t *)rec + sizeof(rec->crc), covered) != rec->crc)
+        return 0;
+
+    return size;
+}
+
+static uint64_t hash_username(const char *s, size_t len)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static LogIndexEntry *index_slot(LogIndexEntry *entries, size_t capacity, const char *username, size_t len)
+{
+    size_t i = hash_username(username, len) & (capacity - 1);
+    while (entries[i].username[0] != '\0' &&
+           (strncmp(entries[i].username, username, len) != 0 || entries[i].username[len] != '\0'))
+        i = (i + 1) & (capacity - 1);
+    return &entries[i];
+}
+
+static LogIndexEntry *index_find(const char *username, size_t len)
+{
+    if (!store.entries || len == 0 || len >= DB_USERNAME_MAX)
+        return NULL;
+
+    LogIndexEntry *entry = index_slot(store.entries, store.capacity, username, len);
+    return entry->username[0] ? entry : NULL;
+}
+
+static void index_grow(void)
+{
+    size_t capacity = store.capacity ? store.capacity * 2 : LOG_INDEX_INITIAL_CAPACITY;
+    LogIndexEntry *entries = calloc(capacity, sizeof(LogIndexEntry));
+    assert(entries != NULL && "Buy more RAM lol");
+
+    for (size_t i = 0; i < store.capacity; i++)
+    {
+        if (store.entries[i].username[0] == '\0')
+            continue;
+        const char *username = store.entries[i].username;
+        *index_slot(entries, capacity, username, strlen(username)) = store.entries[i];
+    }
+
+    free(store.entries);
+    store.entries = entries;
+    store.capacity = capacity;
+}
+
+static LogIndexEntry *index_upsert(const char *username, size_t len)
+{
+    if ((store.count + 1) * 10 > store.capacity * 7)
+        index_grow();
+
+    LogIndexEntry *entry = index_slot(store.entries, store.capacity, username, len);
+    if (entry->username[0] == '\0')
+    {
+        memcpy(entry->username, username, len);
+        entry->username[len] = '\0';
+        store.count++;
+    }
+    return entry;
+}
+
+static void index_clear(void)
+{
+    free(store.entries);
+    store.entries = NULL;
+    store.capacity = 0;
+    store.count = 0;
+    store.users = 0;
+    store.live_bytes = 0;
+    store.next_user_id = 1;
+}
+
+// Makes a committed record visible to readers. Caller holds the write lock.
+static void index_apply(size_t offset)
+{
+    const LogRecord *rec = record_at(offset);
+    if (rec->type == LOG_RECORD_COMMIT || rec->username_len == 0 || rec->username_len >= DB_USERNAME_MAX)
+        return;
+
+    LogIndexEntry *entry = index_upsert(record_username(rec), rec->username_len);
+    size_t size = record_size(rec->username_len, rec->password_len);
+
+    if (rec->type == LOG_RECORD_USER)
+    {
+        if (entry->user_offset == 0)
+        {
+            store.users++;
+            store.live_bytes += size;
+        }
+        entry->user_offset = offset;
+        if (rec->user_id >= store.next_user_id)
+            store.next_user_id = rec->user_id + 1;
+    }
+    else if (entry->score_offset == 0 || rec->score > entry->best_score)
+    {
+        if (entry->score_offset == 0)
+            store.live_bytes += size;
+        entry->score_offset = offset;
+        entry->best_score = rec->score;
+    }
+}
+
+static void index_apply_range(size_t start, size_t end)
+{
+    for (size_t offset = start; offset < end;)
+    {
+        index_apply(offset);
+        offset += record_size(record_at(offset)->username_len, record_at(offset)->password_len);
+    }
+}
+
+// Rebuilds the index from the log and returns the end of the last committed
+// batch. Caller holds the write lock.
+static size_t replay(size_t limit)
+{
+    index_clear();
+
+    size_t committed = sizeof(LogFileHeader);
+    size_t offset = committed;
+    size_t size;
+    while ((size = record_check(offset, limit)) > 0)
+    {
+        bool is_commit = record_at(offset)->type == LOG_RECORD_COMMIT;
+        offset += size;
+        if (is_commit)
+        {
+            index_apply_range(committed, offset);
+            committed = offset;
+        }
+    }
+
+    if (committed < limit && record_at(committed)->type != LOG_RECORD_END)
+    {
+        log_message(LOG_WARNING, "Discarding uncommitted or corrupt log records after byte %zu", committed);
+        // So a later, shorter batch can't end up followed by a stale record
+        memset(store.map + committed, 0, limit - committed);
+    }
+
+    return committed;
+}
+
+// Grows the file and the mapping so `needed` more bytes fit after the tail
+static bool ensure_capacity(size_t needed)
+{
+    if (store.tail + needed <= store.mapped)
+        return true;
+
+    size_t size = store.mapped * 2;
+    while (size < store.tail + needed)
+        size *= 2;
+
+    if (ftruncate(store.fd, (off_t)size) == -1)
+    {
+        log_message(LOG_ERROR, "Failed to grow log: %s", strerror(errno));
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&store.lock);
+    void *map = mremap(store.map, store.mapped, size, MREMAP_MAYMOVE);
+    if (map != MAP_FAILED)
+    {
+        store.map = map;
+        store.mapped = size;
+    }
+    pthread_rwlock_unlock(&store.lock);
+
+    if (map == MAP_FAILED)
+    {
+        log_message(LOG_ERROR, "Failed to remap log: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+// Appends a record past the tail, invisible to readers until committed. Only
+// called by the writer.
+static bool append(LogRecordType type, int user_id, int score, long timestamp,
+                   const char *username, const char *password)
+{
+    size_t username_len = username ? strlen(username) : 0;
+    size_t password_len = password ? strlen(password) : 0;
+    if (username_len >= DB_USERNAME_MAX || password_len >= DB_PASSWORD_MAX)
+        return false;
+
+    size_t size = record_size(username_len, password_len);
+    if (!ensure_capacity(size))
+        return false;
+
+    LogRecord *rec = (LogRecord *)(store.map + store.tail);
+    *rec = (LogRecord){
+        .type = (uint8_t)type,
+        .username_len = (uint8_t)username_len,
+        .password_len = (uint16_t)password_len,
+        .user_id = user_id,
+        .score = score,
+        .timestamp = timestamp,
+    };
+    memcpy((char *)(rec + 1), username, username_len);
+    memcpy((char *)(rec + 1) + username_len, password, password_len);
+    memset((char *)(rec + 1) + username_len + password_len, 0,
+           size - sizeof(LogRecord) - username_len - password_len);
+    rec->crc = crc32((const uint8_t *)rec + sizeof(rec->crc),
+                     sizeof(LogRecord) - sizeof(rec->crc) + username_len + password_len);
+
+    store.tail += size;
+    return true;
+}
+
+static bool flush(void)
+{
+    if (strcmp(server_config.db_synchronous, "OFF") == 0)
+        return true;
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start = store.synced & ~(size_t)(page - 1);
+    if (msync(store.map + start, store.tail - start, MS_SYNC) == -1)
+    {
+        log_message(LOG_ERROR, "Failed to flush log: %s", strerror(errno));
+        return false;
+    }
+
+    store.synced = store.tail;
+    return true;
+}
+
+static bool map_file(const char *path)
+{
+    store.fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (store.fd == -1)
+    {
+        log_message(LOG_ERROR, "Can't open log %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(store.fd, &st) == -1)
+    {
+        log_message(LOG_ERROR, "Can't stat log %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    bool fresh = size == 0;
+    if (size < sizeof(LogFileHeader) && !fresh)
+    {
+        log_message(LOG_ERROR, "Log %s is truncated", path);
+        return false;
+    }
+
+    store.mapped = LOG_STORE_MIN_MAP;
+    while (store.mapped < size)
+        store.mapped *= 2;
+
+    if (ftruncate(store.fd, (off_t)store.mapped) == -1)
+    {
+        log_message(LOG_ERROR, "Failed to size log: %s", strerror(errno));
+        return false;
+    }
+
+    store.map = mmap(NULL, store.mapped, PROT_READ | PROT_WRITE, MAP_SHARED, store.fd, 0);
+    if (store.map == MAP_FAILED)
+    {
+        store.map = NULL;
+        log_message(LOG_ERROR, "Failed to map log: %s", strerror(errno));
+        return false;
+    }
+
+    LogFileHeader *header = (LogFileHeader *)store.map;
+    if (fresh)
+    {
+        memcpy(header->magic, LOG_STORE_MAGIC, sizeof(header->magic));
+        header->version = LOG_STORE_VERSION;
+        header->reserved = 0;
+    }
+    else if (memcmp(header->magic, LOG_STORE_MAGIC, sizeof(header->magic)) != 0 ||
+             header->version != LOG_STORE_VERSION)
+    {
+        log_message(LOG_ERROR, "%s is not a score log", path);
+        return false;
+    }
+
+    store.committed = store.tail = replay(size > 0 ? size : store.mapped);
+    store.synced = fresh ? 0 : store.committed;
+    return fresh ? flush() : true;
+}
+
+static void unmap_file(bool truncate)
+{
+    if (store.map)
+    {
+        munmap(store.map, store.mapped);
+        store.map = NULL;
+    }
+
+    if (store.fd != -1)
+    {
+        // Give back the space reserved past the tail
+        if (truncate && ftruncate(store.fd, (off_t)store.committed) == -1)
+            log_message(LOG_WARNING, "Failed to trim log: %s", strerror(errno));
+        close(store.fd);
+        store.fd = -1;
+    }
+}
+
+static bool log_open(void)
+{
+    crc_init();
+    store.in_transaction = false;
+    if (!map_file(server_config.db_log_path))
+    {
+        unmap_file(false);
+        return false;
+    }
+
+    log_message(LOG_INFO, "Log %s: %ld users, %zu bytes", server_config.db_log_path, store.users, store.committed);
+    return true;
+}
+
+static void log_close(void)
+{
+    unmap_file(true);
+    index_clear();
+}
+
+static void log_close_thread(void)
+{
+    // Readers hold nothing between calls
+}
+
+static bool log_begin(void)
+{
+    store.in_transaction = true;
+    store.transaction_start = store.tail;
+    store.transaction_user_id = store.next_user_id;
+    return true;
+}
+
+static bool log_commit(void)
+{
+    if (!store.in_transaction)
+        return false;
+
+    if (store.tail == store.transaction_start)
+    {
+        store.in_transaction = false;
+        return true;
+    }
+
+    if (!append(LOG_RECORD_COMMIT, 0, 0, 0, NULL, NULL) || !flush())
+        return false;
+
+    pthread_rwlock_wrlock(&store.lock);
+    index_apply_range(store.transaction_start, store.tail);
+    store.committed = store.tail;
+    pthread_rwlock_unlock(&store.lock);
+
+    store.in_transaction = false;
+    return true;
+}
+
+static bool log_rollback(void)
+{
+    if (!store.in_transaction)
+        return false;
+
+    memset(store.map + store.transaction_start, 0, store.tail - store.transaction_start);
+    store.tail = store.transaction_start;
+    if (store.synced > store.tail)
+        store.synced = store.tail;
+    store.next_user_id = store.transaction_user_id;
+    store.in_transaction = false;
+    return true;
+}
+
+// Wraps a write made outside begin/commit in its own transaction
+static bool autocommit(bool ok, bool implicit)
+{
+    if (!implicit)
+        return ok;
+    if (!ok)
+    {
+        log_rollback();
+        return false;
+    }
+    return log_commit();
+}
+
+// A username is taken if it is committed or added earlier in this batch
+static bool username_taken(const char *username)
+{
+    size_t len = strlen(username);
+    pthread_rwlock_rdlock(&store.lock);
+    LogIndexEntry *entry = index_find(username, len);
+    bool taken = entry && entry->user_offset != 0;
+    pthread_rwlock_unlock(&store.lock);
+
+    for (size_t offset = store.transaction_start; !taken && offset < store.tail;)
+    {
+        const LogRecord *rec = record_at(offset);
+        taken = rec->type == LOG_RECORD_USER && rec->username_len == len &&
+                memcmp(record_username(rec), username, len) == 0;
+        offset += record_size(rec->username_len, rec->password_len);
+    }
+
+    return taken;
+}
+
+static bool log_add_user(const char *username, const char *password, int64_t *row_id)
+{
+    bool implicit = !store.in_transaction && log_begin();
+
+    if (username[0] == '\0' || username_taken(username))
+    {
+        log_message(LOG_ERROR, "Username %s is taken", username);
+        return autocommit(false, implicit);
+    }
+
+    int user_id = store.next_user_id;
+    bool ok = append(LOG_RECORD_USER, user_id, 0, 0, username, password);
+    if (ok)
+    {
+        store.next_user_id++;
+        *row_id = user_id;
+    }
+
+    return autocommit(ok, implicit);
+}
+
+static bool log_add_score(int user_id, const char *username, int score, long timestamp, int64_t *row_id)
+{
+    bool implicit = !store.in_transaction && log_begin();
+    size_t offset = store.tail;
+
+    bool ok = append(LOG_RECORD_SCORE, user_id, score, timestamp, username, NULL);
+    if (ok)
+        *row_id = (int64_t)offset;
+
+    return autocommit(ok, implicit);
+}
+
+static bool log_get_credentials(const char *username, int *user_id, char *password, size_t password_size)
+{
+    bool found = false;
+
+    pthread_rwlock_rdlock(&store.lock);
+    LogIndexEntry *entry = index_find(username, strlen(username));
+    if (entry && entry->user_offset != 0)
+    {
+        const LogRecord *rec = record_at(entry->user_offset);
+        *user_id = rec->user_id;
+        found = rec->password_len < password_size;
+        if (found)
+        {
+            memcpy(password, record_password(rec), rec->password_len);
+            password[rec->password_len] = '\0';
+        }
+    }
+    pthread_rwlock_unlock(&store.lock);
+
+    return found;
+}
+
+static int log_get_user_id(const char *username)
+{
+    int id = -1;
+
+    pthread_rwlock_rdlock(&store.lock);
+    LogIndexEntry *entry = index_find(username, strlen(username));
+    if (entry && entry->user_offset != 0)
+        id = record_at(entry->user_offset)->user_id;
+    pthread_rwlock_unlock(&store.lock);
+
+    return id;
+}
+
+static long log_count_users(void)
+{
+    pthread_rwlock_rdlock(&store.lock);
+    long users = store.users;
+    pthread_rwlock_unlock(&store.lock);
+    return users;
+}
+
+static long log_for_each_username(UsernameRowFn fn, void *ctx)
+{
+    long count = 0;
+
+    pthread_rwlock_rdlock(&store.lock);
+    for (size_t i = 0; i < store.capacity; i++)
+    {
+        if (store.entries[i].username[0] == '\0' || store.entries[i].user_offset == 0)
+            continue;
+        fn(ctx, store.entries[i].username);
+        count++;
+    }
+    pthread_rwlock_unlock(&store.lock);
+
+    return count;
+}
+
+static bool log_for_each_score(ScoreRowFn fn, void *ctx)
+{
+    char username[DB_USERNAME_MAX];
+
+    pthread_rwlock_rdlock(&store.lock);
+    for (size_t offset = sizeof(LogFileHeader); offset < store.committed;)
+    {
+        const LogRecord *rec = record_at(offset);
+        if (rec->type == LOG_RECORD_SCORE)
+        {
+            memcpy(username, record_username(rec), rec->username_len);
+            username[rec->username_len] = '\0';
+            fn(ctx, username, rec->score, (long)rec->timestamp);
+        }
+        offset += record_size(rec->username_len, rec->password_len);
+    }
+    pthread_rwlock_unlock(&store.lock);
+
+    return true;
+}
+
+static void copy_record(uint8_t *dst, size_t *used, size_t offset)
+{
+    const LogRecord *rec = record_at(offset);
+    size_t size = record_size(rec->username_len, rec->password_len);
+    memcpy(dst + *used, rec, size);
+    *used += size;
+}
+
+// Writes every user and their best score to a new file and swaps it in.
+// Readers are blocked while the new file is mapped and replayed.
+static bool compact(void)
+{
+    char path[sizeof(server_config.db_log_path) + 16];
+    snprintf(path, sizeof(path), "%s.compact", server_config.db_log_path);
+
+    size_t size = sizeof(LogFileHeader) + store.live_bytes + record_size(0, 0);
+    uint8_t *buffer = calloc(1, size);
+    assert(buffer != NULL && "Buy more RAM lol");
+
+    // Records carry no offsets, so they can be copied as they are
+    size_t used = 0;
+    memcpy(buffer, store.map, sizeof(LogFileHeader));
+    used += sizeof(LogFileHeader);
+
+    pthread_rwlock_rdlock(&store.lock);
+    for (size_t i = 0; i < store.capacity; i++)
+    {
+        if (store.entries[i].user_offset)
+            copy_record(buffer, &used, store.entries[i].user_offset);
+        if (store.entries[i].score_offset)
+            copy_record(buffer, &used, store.entries[i].score_offset);
+    }
+    pthread_rwlock_unlock(&store.lock);
+
+    LogRecord *commit = (LogRecord *)(buffer + used);
+    commit->type = LOG_RECORD_COMMIT;
+    commit->crc = crc32((const uint8_t *)commit + sizeof(commit->crc), sizeof(LogRecord) - sizeof(commit->crc));
+    used += record_size(0, 0);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd != -1 && write(fd, buffer, used) == (ssize_t)used && fsync(fd) == 0;
+    if (fd != -1)
+        close(fd);
+    free(buffer);
+
+    if (!ok || rename(path, server_config.db_log_path) == -1)
+    {
+        log_message(LOG_ERROR, "Failed to compact log: %s", strerror(errno));
+        unlink(path);
+        return false;
+    }
+
+    size_t before = store.committed;
+
+    pthread_rwlock_wrlock(&store.lock);
+    unmap_file(false);
+    ok = map_file(server_config.db_log_path);
+    pthread_rwlock_unlock(&store.lock);
+
+    if (!ok)
+    {
+        log_message(LOG_ERROR, "Failed to reopen compacted log");
+        return false;
+    }
+
+    log_message(LOG_INFO, "Compacted log from %zu to %zu bytes", before, store.committed);
+    return true;
+}
+
+static void log_maintain(void)
+{
+    if (store.in_transaction || store.committed < (size_t)server_config.db_log_compact_min_bytes)
+        return;
+
+    // Compact once more than half of the log is superseded scores
+    if (store.committed - sizeof(LogFileHeader) > 2 * store.live_bytes)
+        compact();
+}
+
+const StorageEngine log_storage = {
+    .name = "log",
+    .open = log_open,
+    .close = log_close,
+    .close_thread = log_close_thread,
+    .begin = log_begin,
+    .commit = log_commit,
+    .rollback = log_rollback,
+    .add_user = log_add_user,
+    .add_score = log_add_score,
+    .get_credentials = log_get_credentials,
+    .get_user_id = log_get_user_id,
+    .count_users = log_count_users,
+    .for_each_username = log_for_each_username,
+    .for_each_score = log_for_each_score,
+    .maintain = log_maintain,
+};
@@ -0,0 +1,769 @@
+#include "logger.h"
+#include "config.h"
+#include "utils.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define LOG_RECORD_ARGS 12
+#define LOG_RECORD_DATA 288
+#define LOG_LINE_MAX 1024
+#define LOG_BATCH_BYTES (64 * 1024)
+
+typedef union
+{
+  long long i;
+  unsigned long long u;
+  double d;
+  long double ld;
+  const void *p;
+  struct
+  {
+    uint16_t offset;
+    uint16_t length;
+  } s; // Copied into LogRecord.data
+} LogArg;
+
+typedef struct
+{
+  struct timespec time;
+  const char *format;
+  uint8_t level;
+  uint8_t arg_count;
+  bool truncated;
+  uint16_t data_used;
+  LogArg args[LOG_RECORD_ARGS];
+  char data[LOG_RECORD_DATA];
+} LogRecord;
+
+typedef struct LogRing
+{
+  // Written by the owning thread only
+  _Alignas(64) atomic_size_t head;
+  atomic_uint_fast64_t dropped;
+  atomic_uint_fast64_t truncated;
+  // Written by the logger thread only
+  _Alignas(64) atomic_size_t tail;
+  atomic_bool orphaned; // Owner has exited, free once drained
+  size_t mask;
+  LogRecord *records;
+  struct LogRing *next;
+} LogRing;
+
+typedef enum
+{
+  LENGTH_NONE,
+  LENGTH_HH,
+  LENGTH_H,
+  LENGTH_L,
+  LENGTH_LL,
+  LENGTH_J,
+  LENGTH_Z,
+  LENGTH_T,
+  LENGTH_LONG_DOUBLE,
+} LengthModifier;
+
+// One conversion of a printf format
+typedef struct
+{
+  char flags[8];
+  bool width_star;
+  int width; // -1 if none
+  bool precision_star;
+  int precision; // -1 if none
+  LengthModifier length;
+  char conversion;
+} FormatSpec;
+
+static __thread LogRing *thread_ring;
+
+static struct
+{
+  pthread_t thread;
+  pthread_mutex_t lock; // Guards rings and stopping
+  pthread_cond_t wake;
+  pthread_key_t ring_key;
+  LogRing *rings;
+  bool started;
+  bool stopping;
+  atomic_uint_fast64_t written;
+  atomic_uint_fast64_t dropped_gone; // Drops of rings that were freed
+  atomic_uint_fast64_t truncated_gone;
+  atomic_uint_fast64_t batches;
+  atomic_uint_fast64_t bytes;
+  atomic_size_t threads;
+} logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+// Parses the conversion after a '%', returns the character after it or NULL
+// for one that isn't supported
+static const char *parse_spec(const char *f, FormatSpec *spec)
+{
+  memset(spec, 0, sizeof(*spec));
+  spec->width = -1;
+  spec->precision = -1;
+
+  size_t flags = 0;
+  while (*f && strchr("-+ #0", *f) && flags < sizeof(spec->flags) - 1)
+    spec->flags[flags++] = *f++;
+
+  if (*f == '*')
+  {
+    spec->width_star = true;
+    f++;
+  }
+  else if (*f >= '0' && *f <= '9')
+  {
+    spec->width = 0;
+    while (*f >= '0' && *f <= '9')
+      spec->width = spec->width * 10 + (*f++ - '0');
+  }
+
+  if (*f == '.')
+  {
+    f++;
+    spec->precision = 0;
+    if (*f == '*')
+    {
+      spec->precision_star = true;
+      f++;
+    }
+    else
+    {
+      while (*f >= '0' && *f <= '9')
+        spec->precision = spec->precision * 10 + (*f++ - '0');
+    }
+  }
+
+  switch (*f)
+  {
+  case 'h':
+    spec->length = f[1] == 'h' ? LENGTH_HH : LENGTH_H;
+    f += spec->length == LENGTH_HH ? 2 : 1;
+    break;
+  case 'l':
+    spec->length = f[1] == 'l' ? LENGTH_LL : LENGTH_L;
+    f += spec->length == LENGTH_LL ? 2 : 1;
+    break;
+  case 'j':
+    spec->length = LENGTH_J;
+    f++;
+    break;
+  case 'z':
+    spec->length = LENGTH_Z;
+    f++;
+    break;
+  case 't':
+    spec->length = LENGTH_T;
+    f++;
+    break;
+  case 'L':
+    spec->length = LENGTH_LONG_DOUBLE;
+    f++;
+    break;
+  }
+
+  if (!*f || !strchr("diouxXcsfFeEgGaAp", *f))
+    return NULL;
+  spec->conversion = *f;
+  return f + 1;
+}
+
+static long long signed_arg(LengthModifier length, va_list *args)
+{
+  switch (length)
+  {
+  case LENGTH_HH:
+    return (signed char)va_arg(*args, int);
+  case LENGTH_H:
+    return (short)va_arg(*args, int);
+  case LENGTH_L:
+    return va_arg(*args, long);
+  case LENGTH_LL:
+    return va_arg(*args, long long);
+  case LENGTH_J:
+    return va_arg(*args, intmax_t);
+  case LENGTH_Z:
+    return va_arg(*args, ssize_t);
+  case LENGTH_T:
+    return va_arg(*args, ptrdiff_t);
+  default:
+    return va_arg(*args, int);
+  }
+}
+
+static unsigned long long unsigned_arg(LengthModifier length, va_list *args)
+{
+  switch (length)
+  {
+  case LENGTH_HH:
+    return (unsigned char)va_arg(*args, unsigned);
+  case LENGTH_H:
+    return (unsigned short)va_arg(*args, unsigned);
+  case LENGTH_L:
+    return va_arg(*args, unsigned long);
+  case LENGTH_LL:
+    return va_arg(*args, unsigned long long);
+  case LENGTH_J:
+    return va_arg(*args, uintmax_t);
+  case LENGTH_Z:
+    return va_arg(*args, size_t);
+  case LENGTH_T:
+    return (unsigned long long)va_arg(*args, ptrdiff_t);
+  default:
+    return va_arg(*args, unsigned);
+  }
+}
+
+static bool push_arg(LogRecord *record, const LogArg *arg)
+{
+  if (record->arg_count == LOG_RECORD_ARGS)
+  {
+    record->truncated = true;
+    return false;
+  }
+  record->args[record->arg_count++] = *arg;
+  return true;
+}
+
+// Copies the arguments of format into record without formatting anything
+static void capture(LogRecord *record, const char *format, va_list args)
+{
+  va_list ap;
+  va_copy(ap, args);
+
+  for (const char *f = format; (f = strchr(f, '%'));)
+  {
+    if (f[1] == '%')
+    {
+      f += 2;
+      continue;
+    }
+
+    FormatSpec spec;
+    f = parse_spec(f + 1, &spec);
+    if (!f)
+    {
+      record->truncated = true;
+      break;
+    }
+
+    int precision = spec.precision;
+    if (spec.width_star && !push_arg(record, &(LogArg){.i = va_arg(ap, int)}))
+      break;
+    if (spec.precision_star)
+    {
+      precision = va_arg(ap, int);
+      if (!push_arg(record, &(LogArg){.i = precision}))
+        break;
+    }
+
+    LogArg arg = {0};
+    switch (spec.conversion)
+    {
+    case 'd':
+    case 'i':
+      arg.i = signed_arg(spec.length, &ap);
+      break;
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+      arg.u = unsigned_arg(spec.length, &ap);
+      break;
+    case 'c':
+      arg.i = va_arg(ap, int);
+      break;
+    case 'p':
+      arg.p = va_arg(ap, void *);
+      break;
+    case 's':
+    {
+      const char *s = va_arg(ap, const char *);
+      if (!s)
+        s = "(null)";
+      if (record->data_used >= LOG_RECORD_DATA)
+      {
+        // Out of room, point at the terminator of the last string
+        arg.s.offset = LOG_RECORD_DATA - 1;
+        record->truncated = true;
+        break;
+      }
+      size_t room = LOG_RECORD_DATA - record->data_used - 1;
+      size_t len = precision >= 0 ? strnlen(s, (size_t)precision) : strnlen(s, room + 1);
+      if (len > room)
+      {
+        len = room;
+        record->truncated = true;
+      }
+      memcpy(record->data + record->data_used, s, len);
+      arg.s.offset = record->data_used;
+      arg.s.length = (uint16_t)len;
+      record->data_used += (uint16_t)len;
+      record->data[record->data_used++] = '\0';
+      break;
+    }
+    default:
+      if (spec.length == LENGTH_LONG_DOUBLE)
+        arg.ld = va_arg(ap, long double);
+      else
+        arg.d = va_arg(ap, double);
+      break;
+    }
+
+    if (!push_arg(record, &arg))
+      break;
+  }
+
+  va_end(ap);
+}
+
+// Formats a captured record the way printf would have formatted the
+// original call, returns the length written to out
+static size_t format_record(const LogRecord *record, char *out, size_t size)
+{
+  size_t len = 0;
+  uint8_t next = 0;
+
+#define APPEND(...)                                         \
+  do                                                        \
+  {                                                         \
+    int n = snprintf(out + len, size - len, __VA_ARGS__);   \
+    if (n > 0)                                              \
+      len = len + (size_t)n < size ? len + (size_t)n : size - 1; \
+  } while (0)
+
+  for (const char *f = record->format; *f && len < size - 1;)
+  {
+    const char *percent = strchr(f, '%');
+    size_t literal = percent ? (size_t)(percent - f) : strlen(f);
+    if (literal > size - 1 - len)
+      literal = size - 1 - len;
+    memcpy(out + len, f, literal);
+    len += literal;
+    out[len] = '\0';
+    if (!percent)
+      break;
+
+    if (percent[1] == '%')
+    {
+      APPEND("%%");
+      f = percent + 2;
+      continue;
+    }
+
+    FormatSpec spec;
+    const char *after = parse_spec(percent + 1, &spec);
+    if (!after)
+      break;
+    f = after;
+
+    // Rebuild the conversion with stars resolved and integers widened to
+    // what was captured
+    int width = spec.width;
+    int precision = spec.precision;
+    if (spec.width_star)
+    {
+      if (next >= record->arg_count)
+        break;
+      width = (int)record->args[next++].i;
+    }
+    if (spec.precision_star)
+    {
+      if (next >= record->arg_count)
+        break;
+      precision = (int)record->args[next++].i;
+    }
+    if (next >= record->arg_count)
+      break;
+    LogArg arg = record->args[next++];
+
+    char conversion[48];
+    int n = snprintf(conversion, sizeof(conversion), "%%%s", spec.flags);
+    if (width >= 0 || spec.width_star)
+      n += snprintf(conversion + n, sizeof(conversion) - n, "%d", width);
+    if (precision >= 0)
+      n += snprintf(conversion + n, sizeof(conversion) - n, ".%d", precision);
+
+    switch (spec.conversion)
+    {
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+      snprintf(conversion + n, sizeof(conversion) - n, "ll%c", spec.conversion);
+      if (spec.conversion == 'd' || spec.conversion == 'i')
+        APPEND(conversion, arg.i);
+      else
+        APPEND(conversion, arg.u);
+      break;
+    case 'c':
+      snprintf(conversion + n, sizeof(conversion) - n, "c");
+      APPEND(conversion, (int)arg.i);
+      break;
+    case 'p':
+      snprintf(conversion + n, sizeof(conversion) - n, "p");
+      APPEND(conversion, arg.p);
+      break;
+    case 's':
+      snprintf(conversion + n, sizeof(conversion) - n, "s");
+      APPEND(conversion, record->data + arg.s.offset);
+      break;
+    default:
+      if (spec.length == LENGTH_LONG_DOUBLE)
+      {
+        snprintf(conversion + n, sizeof(conversion) - n, "L%c", spec.conversion);
+        APPEND(conversion, arg.ld);
+      }
+      else
+      {
+        snprintf(conversion + n, sizeof(conversion) - n, "%c", spec.conversion);
+        APPEND(conversion, arg.d);
+      }
+      break;
+    }
+  }
+
+  if (record->truncated)
+    APPEND(" [truncated]");
+
+#undef APPEND
+  return len;
+}
+
+static void ring_orphan(void *ring)
+{
+  atomic_store_explicit(&((LogRing *)ring)->orphaned, true, memory_order_release);
+}
+
+static LogRing *ring_register()
+{
+  size_t capacity = 1;
+  while (capacity < (size_t)server_config.log_ring_records)
+    capacity *= 2;
+
+  LogRing *ring = calloc(1, sizeof(*ring));
+  if (!ring)
+    return NULL;
+  ring->records = malloc(capacity * sizeof(LogRecord));
+  if (!ring->records)
+  {
+    free(ring);
+    return NULL;
+  }
+  ring->mask = capacity - 1;
+  // Fault the pages in now rather than on the logging path
+  memset(ring->records, 0, capacity * sizeof(LogRecord));
+
+  pthread_mutex_lock(&logger.lock);
+  ring->next = logger.rings;
+  logger.rings = ring;
+  pthread_mutex_unlock(&logger.lock);
+
+  pthread_setspecific(logger.ring_key, ring);
+  atomic_fetch_add_explicit(&logger.threads, 1, memory_order_relaxed);
+  thread_ring = ring;
+  return ring;
+}
+
+static void logger_sink(int level, const char *format, va_list args)
+{
+  LogRing *ring = thread_ring ? thread_ring : ring_register();
+  if (!ring)
+  {
+    log_vwrite(level, format, args);
+    return;
+  }
+
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail > ring->mask)
+  {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  LogRecord *record = &ring->records[head & ring->mask];
+  clock_gettime(CLOCK_REALTIME, &record->time);
+  record->level = (uint8_t)level;
+  record->format = format;
+  record->arg_count = 0;
+  record->truncated = false;
+  record->data_used = 0;
+  capture(record, format, args);
+  if (record->truncated)
+    atomic_fetch_add_explicit(&ring->truncated, 1, memory_order_relaxed);
+
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+typedef struct
+{
+  char *data;
+  size_t len;
+  time_t second; // Of the cached timestamp
+  char timestamp[16];
+} Batch;
+
+static void batch_flush(Batch *batch)
+{
+  if (batch->len == 0)
+    return;
+  fwrite(batch->data, 1, batch->len, stdout);
+  fflush(stdout);
+  atomic_fetch_add_explicit(&logger.batches, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&logger.bytes, batch->len, memory_order_relaxed);
+  batch->len = 0;
+}
+
+static void batch_line_start(Batch *batch, const struct timespec *time, int level)
+{
+  if (LOG_BATCH_BYTES - batch->len < LOG_LINE_MAX)
+    batch_flush(batch);
+
+  if (time->tv_sec != batch->second)
+  {
+    struct tm t;
+    localtime_r(&time->tv_sec, &t);
+    strftime(batch->timestamp, sizeof(batch->timestamp), "%H:%M:%S", &t);
+    batch->second = time->tv_sec;
+  }
+  batch->len += (size_t)snprintf(batch->data + batch->len, LOG_LINE_MAX, "[%s] [%s] ", batch->timestamp,
+                                 log_level_name(level));
+}
+
+static void batch_append(Batch *batch, const LogRecord *record)
+{
+  batch_line_start(batch, &record->time, record->level);
+  // Leave room for the newline
+  batch->len += format_record(record, batch->data + batch->len, LOG_LINE_MAX - 64);
+  batch->data[batch->len++] = '\n';
+  atomic_fetch_add_explicit(&logger.written, 1, memory_order_relaxed);
+}
+
+static uint64_t total_dropped()
+{
+  uint64_t dropped = atomic_load_explicit(&logger.dropped_gone, memory_order_relaxed);
+  pthread_mutex_lock(&logger.lock);
+  for (LogRing *ring = logger.rings; ring; ring = ring->next)
+    dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+  pthread_mutex_unlock(&logger.lock);
+  return dropped;
+}
+
+// Writes out everything in the rings, or as much as fits before deadline_ns
+// if that isn't 0. Returns how many records that was.
+static size_t drain(Batch *batch, uint64_t deadline_ns)
+{
+  size_t drained = 0;
+
+  pthread_mutex_lock(&logger.lock);
+  LogRing *rings = logger.rings;
+  pthread_mutex_unlock(&logger.lock);
+
+  // New rings go in at the head, so the list from here on is stable and
+  // only this thread ever unlinks from it
+  LogRing *prev = NULL;
+  for (LogRing *ring = rings; ring;)
+  {
+    bool orphaned = atomic_load_explicit(&ring->orphaned, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    for (; tail != head; tail++, drained++)
+    {
+      if (deadline_ns && drained % 64 == 0 && monotonic_ns() >= deadline_ns)
+        break;
+      batch_append(batch, &ring->records[tail & ring->mask]);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    // Only free a ring once all of it has been written
+    orphaned = orphaned && tail == head;
+
+    LogRing *next = ring->next;
+    if (orphaned)
+    {
+      pthread_mutex_lock(&logger.lock);
+      if (prev)
+        prev->next = next;
+      else if (logger.rings == ring)
+        logger.rings = next;
+      else
+      {
+        // Rings were added in front of it since the snapshot
+        LogRing *before = logger.rings;
+        while (before->next != ring)
+          before = before->next;
+        before->next = next;
+      }
+      pthread_mutex_unlock(&logger.lock);
+
+      atomic_fetch_add_explicit(&logger.dropped_gone, atomic_load(&ring->dropped), memory_order_relaxed);
+      atomic_fetch_add_explicit(&logger.truncated_gone, atomic_load(&ring->truncated), memory_order_relaxed);
+      atomic_fetch_sub_explicit(&logger.threads, 1, memory_order_relaxed);
+      free(ring->records);
+      free(ring);
+    }
+    else
+    {
+      prev = ring;
+    }
+    ring = next;
+  }
+
+  return drained;
+}
+
+static void report_drops(Batch *batch, uint64_t *reported, const char *why)
+{
+  uint64_t dropped = total_dropped();
+  if (dropped == *reported)
+    return;
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  batch_line_start(batch, &now, LOG_WARNING);
+  batch->len += (size_t)snprintf(batch->data + batch->len, LOG_LINE_MAX - 64, "Dropped %llu log messages (%s)\n",
+                                 (unsigned long long)(dropped - *reported), why);
+  *reported = dropped;
+}
+
+static void *logger_main(void *arg)
+{
+  (void)arg;
+  Batch batch = {.data = malloc(LOG_BATCH_BYTES), .second = -1};
+  assert(batch.data != NULL && "Buy more RAM lol");
+  uint64_t reported = 0;
+
+  pthread_mutex_lock(&logger.lock);
+  while (!logger.stopping)
+  {
+    pthread_mutex_unlock(&logger.lock);
+    drain(&batch, 0);
+    report_drops(&batch, &reported, "ring full");
+    batch_flush(&batch);
+    pthread_mutex_lock(&logger.lock);
+
+    if (logger.stopping)
+      break;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)server_config.log_flush_interval_ms * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&logger.wake, &logger.lock, &deadline);
+  }
+  pthread_mutex_unlock(&logger.lock);
+
+  // Bounded final flush, anything still queued after the deadline is lost
+  uint64_t deadline = monotonic_ns() + (uint64_t)server_config.log_shutdown_flush_ms * 1000000ULL;
+  while (drain(&batch, deadline) > 0 && monotonic_ns() < deadline)
+    ;
+  report_drops(&batch, &reported, "ring full");
+
+  size_t left = 0;
+  pthread_mutex_lock(&logger.lock);
+  for (LogRing *ring = logger.rings; ring; ring = ring->next)
+  {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    left += head - tail;
+    atomic_fetch_add_explicit(&ring->dropped, head - tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+  }
+  pthread_mutex_unlock(&logger.lock);
+  if (left > 0)
+    report_drops(&batch, &reported, "shutdown flush timed out");
+
+  batch_flush(&batch);
+  free(batch.data);
+  return NULL;
+}
+
+bool logger_start()
+{
+  if (!server_config.log_async)
+    return true;
+
+  if (pthread_key_create(&logger.ring_key, ring_orphan) != 0)
+  {
+    log_message(LOG_ERROR, "Failed to create logger thread key");
+    return false;
+  }
+
+  logger.stopping = false;
+  if (pthread_create(&logger.thread, NULL, logger_main, NULL) != 0)
+  {
+    log_message(LOG_ERROR, "Failed to start logger thread");
+    pthread_key_delete(logger.ring_key);
+    return false;
+  }
+  logger.started = true;
+
+  // Whatever was printed synchronously so far goes out before the batches
+  fflush(stdout);
+  log_set_sink(logger_sink);
+  return true;
+}
+
+void logger_stop()
+{
+  if (!logger.started)
+    return;
+
+  pthread_mutex_lock(&logger.lock);
+  logger.stopping = true;
+  pthread_cond_signal(&logger.wake);
+  pthread_mutex_unlock(&logger.lock);
+  pthread_join(logger.thread, NULL);
+
+  log_set_sink(NULL);
+  logger.started = false;
+
+  LogRing *ring = logger.rings;
+  while (ring)
+  {
+    LogRing *next = ring->next;
+    atomic_fetch_add_explicit(&logger.dropped_gone, atomic_load(&ring->dropped), memory_order_relaxed);
+    atomic_fetch_add_explicit(&logger.truncated_gone, atomic_load(&ring->truncated), memory_order_relaxed);
+    free(ring->records);
+    free(ring);
+    ring = next;
+  }
+  logger.rings = NULL;
+  atomic_store(&logger.threads, 0);
+  thread_ring = NULL;
+  pthread_setspecific(logger.ring_key, NULL);
+  pthread_key_delete(logger.ring_key);
+}
+
+LoggerStats logger_stats()
+{
+  LoggerStats stats = {
+      .written = atomic_load_explicit(&logger.written, memory_order_relaxed),
+      .dropped = atomic_load_explicit(&logger.dropped_gone, memory_order_relaxed),
+      .truncated = atomic_load_explicit(&logger.truncated_gone, memory_order_relaxed),
+      .batches = atomic_load_explicit(&logger.batches, memory_order_relaxed),
+      .bytes = atomic_load_explicit(&logger.bytes, memory_order_relaxed),
+      .threads = atomic_load_explicit(&logger.threads, memory_order_relaxed),
+  };
+
+  pthread_mutex_lock(&logger.lock);
+  for (LogRing *ring = logger.rings; ring; ring = ring->next)
+  {
+    stats.dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    stats.truncated += atomic_load_explicit(&ring->truncated, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&logger.lock);
+  return stats;
+}
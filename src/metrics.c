@@ -0,0 +1,284 @@
+#include "metrics.h"
+#include "utils.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Upper bounds of the histogram buckets in nanoseconds, 10us to 2.5s, plus
+// one for everything slower (+Inf)
+static const uint64_t bucket_bounds_ns[] = {
+    10000,     25000,     50000,     100000,     250000,     500000,
+    1000000,   2500000,   5000000,   10000000,   25000000,   50000000,
+    100000000, 250000000, 500000000, 1000000000, 2500000000,
+};
+#define METRICS_BUCKETS (ARRAY_LEN(bucket_bounds_ns) + 1)
+
+// Statuses the server sends, anything else is counted as "other"
+static const int statuses[] = {200, 201, 202, 400, 401, 403, 404, 409, 415, 500, 503};
+#define METRICS_STATUSES (ARRAY_LEN(statuses) + 1)
+
+static const char *const db_op_names[] = {
+    "begin",           "commit",      "rollback",    "add_user",          "add_score",
+    "get_credentials", "get_user_id", "count_users", "for_each_username", "for_each_score",
+};
+
+static const char *const parse_error_names[] = {"request", "body"};
+
+typedef struct
+{
+  uint64_t buckets[METRICS_BUCKETS];
+  uint64_t count;
+  uint64_t sum_ns;
+} Histogram;
+
+// Only uint64_t fields, so blocks can be summed word by word
+typedef struct
+{
+  uint64_t requests[ROUTE_COUNT][METRICS_STATUSES];
+  Histogram request_duration[ROUTE_COUNT];
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t connections_opened;
+  uint64_t connections_closed;
+  uint64_t parse_errors[PARSE_ERROR_COUNT];
+  Histogram db_duration[DB_OP_COUNT];
+} MetricValues;
+
+typedef struct MetricsShard
+{
+  _Alignas(64) MetricValues values;
+  struct MetricsShard *next;
+} MetricsShard;
+
+static struct
+{
+  pthread_mutex_t lock; // Guards shards and retired
+  pthread_once_t once;
+  pthread_key_t key;
+  MetricsShard *shards;
+  MetricValues retired; // Of threads that have exited
+} metrics = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+};
+
+static __thread MetricsShard *thread_shard;
+
+static void add_values(MetricValues *to, const MetricValues *from)
+{
+  uint64_t *t = (uint64_t *)to;
+  const uint64_t *f = (const uint64_t *)from;
+  for (size_t i = 0; i < sizeof(MetricValues) / sizeof(uint64_t); i++)
+    t[i] += __atomic_load_n(&f[i], __ATOMIC_RELAXED);
+}
+
+// Runs when a thread that recorded metrics exits
+static void shard_retire(void *arg)
+{
+  MetricsShard *shard = arg;
+  pthread_mutex_lock(&metrics.lock);
+  add_values(&metrics.retired, &shard->values);
+  for (MetricsShard **link = &metrics.shards; *link; link = &(*link)->next)
+  {
+    if (*link == shard)
+    {
+      *link = shard->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&metrics.lock);
+  free(shard);
+}
+
+static void create_key()
+{
+  pthread_key_create(&metrics.key, shard_retire);
+}
+
+static MetricsShard *shard_register()
+{
+  pthread_once(&metrics.once, create_key);
+
+  size_t size = (sizeof(MetricsShard) + 63) & ~(size_t)63;
+  MetricsShard *shard = aligned_alloc(64, size);
+  assert(shard != NULL && "Buy more RAM lol");
+  memset(shard, 0, sizeof(*shard));
+
+  pthread_mutex_lock(&metrics.lock);
+  shard->next = metrics.shards;
+  metrics.shards = shard;
+  pthread_mutex_unlock(&metrics.lock);
+
+  pthread_setspecific(metrics.key, shard);
+  thread_shard = shard;
+  return shard;
+}
+
+static inline MetricValues *values()
+{
+  MetricsShard *shard = thread_shard ? thread_shard : shard_register();
+  return &shard->values;
+}
+
+// Only the owning thread writes a slot, readers just need whole values
+static inline void add(uint64_t *slot, uint64_t n)
+{
+  __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static void observe(Histogram *h, uint64_t ns)
+{
+  size_t bucket = 0;
+  while (bucket < ARRAY_LEN(bucket_bounds_ns) && ns > bucket_bounds_ns[bucket])
+    bucket++;
+  add(&h->buckets[bucket], 1);
+  add(&h->count, 1);
+  add(&h->sum_ns, ns);
+}
+
+void metrics_connection_opened()
+{
+  add(&values()->connections_opened, 1);
+}
+
+void metrics_connection_closed()
+{
+  add(&values()->connections_closed, 1);
+}
+
+void metrics_request(RouteId route, int status, uint64_t duration_ns, uint64_t bytes_in, uint64_t bytes_out)
+{
+  if ((unsigned)route >= ROUTE_COUNT)
+    route = ROUTE_UNKNOWN;
+
+  size_t s = 0;
+  while (s < ARRAY_LEN(statuses) && statuses[s] != status)
+    s++;
+
+  MetricValues *v = values();
+  add(&v->requests[route][s], 1);
+  observe(&v->request_duration[route], duration_ns);
+  add(&v->bytes_in, bytes_in);
+  add(&v->bytes_out, bytes_out);
+}
+
+void metrics_parse_error(ParseErrorKind kind)
+{
+  if ((unsigned)kind < PARSE_ERROR_COUNT)
+    add(&values()->parse_errors[kind], 1);
+}
+
+void metrics_db_query(DbOp op, uint64_t duration_ns)
+{
+  if ((unsigned)op < DB_OP_COUNT)
+    observe(&values()->db_duration[op], duration_ns);
+}
+
+static void write_header(FILE *out, const char *name, const char *type, const char *help)
+{
+  fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_write_value(FILE *out, const char *name, const char *type, const char *help, double value)
+{
+  write_header(out, name, type, help);
+  fprintf(out, "%s %.17g\n", name, value);
+}
+
+static void write_histogram(FILE *out, const char *name, const char *label, const char *value, const Histogram *h)
+{
+  uint64_t cumulative = 0;
+  for (size_t b = 0; b < METRICS_BUCKETS; b++)
+  {
+    cumulative += h->buckets[b];
+    if (b < ARRAY_LEN(bucket_bounds_ns))
+      fprintf(out, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n", name, label, value, (double)bucket_bounds_ns[b] / 1e9,
+              (unsigned long long)cumulative);
+    else
+      fprintf(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", name, label, value, (unsigned long long)cumulative);
+  }
+  fprintf(out, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value, (double)h->sum_ns / 1e9);
+  fprintf(out, "%s_count{%s=\"%s\"} %llu\n", name, label, value, (unsigned long long)h->count);
+}
+
+void metrics_write(FILE *out)
+{
+  // Summed into a scratch copy, the threads keep recording meanwhile
+  MetricValues *total = calloc(1, sizeof(MetricValues));
+  assert(total != NULL && "Buy more RAM lol");
+  pthread_mutex_lock(&metrics.lock);
+  add_values(total, &metrics.retired);
+  for (MetricsShard *shard = metrics.shards; shard; shard = shard->next)
+    add_values(total, &shard->values);
+  pthread_mutex_unlock(&metrics.lock);
+
+  write_header(out, "http_requests_total", "counter", "Requests answered, by route and status.");
+  for (int route = 0; route < ROUTE_COUNT; route++)
+  {
+    for (size_t s = 0; s < METRICS_STATUSES; s++)
+    {
+      if (total->requests[route][s] == 0)
+        continue;
+      if (s < ARRAY_LEN(statuses))
+        fprintf(out, "http_requests_total{route=\"%s\",status=\"%d\"} %llu\n", route_name(route), statuses[s],
+                (unsigned long long)total->requests[route][s]);
+      else
+        fprintf(out, "http_requests_total{route=\"%s\",status=\"other\"} %llu\n", route_name(route),
+                (unsigned long long)total->requests[route][s]);
+    }
+  }
+
+  write_header(out, "http_request_duration_seconds", "histogram", "Time from accept to close, by route.");
+  for (int route = 0; route < ROUTE_COUNT; route++)
+  {
+    if (total->request_duration[route].count > 0)
+      write_histogram(out, "http_request_duration_seconds", "route", route_name(route),
+                      &total->request_duration[route]);
+  }
+
+  write_header(out, "http_request_bytes_total", "counter", "Request bytes read.");
+  fprintf(out, "http_request_bytes_total %llu\n", (unsigned long long)total->bytes_in);
+  write_header(out, "http_response_bytes_total", "counter", "Response bytes sent.");
+  fprintf(out, "http_response_bytes_total %llu\n", (unsigned long long)total->bytes_out);
+
+  write_header(out, "http_connections_total", "counter", "Connections accepted.");
+  fprintf(out, "http_connections_total %llu\n", (unsigned long long)total->connections_opened);
+  write_header(out, "http_connections_active", "gauge", "Connections accepted and not yet closed.");
+  fprintf(out, "http_connections_active %lld\n",
+          (long long)(total->connections_opened - total->connections_closed));
+
+  write_header(out, "http_parse_errors_total", "counter", "Requests rejected as malformed, by what was wrong.");
+  for (int kind = 0; kind < PARSE_ERROR_COUNT; kind++)
+    fprintf(out, "http_parse_errors_total{kind=\"%s\"} %llu\n", parse_error_names[kind],
+            (unsigned long long)total->parse_errors[kind]);
+
+  write_header(out, "db_query_duration_seconds", "histogram", "Storage engine calls, by operation.");
+  for (int op = 0; op < DB_OP_COUNT; op++)
+  {
+    if (total->db_duration[op].count > 0)
+      write_histogram(out, "db_query_duration_seconds", "op", db_op_names[op], &total->db_duration[op]);
+  }
+
+  free(total);
+}
+
+void metrics_free()
+{
+  pthread_mutex_lock(&metrics.lock);
+  MetricsShard *shard = metrics.shards;
+  while (shard)
+  {
+    MetricsShard *next = shard->next;
+    free(shard);
+    shard = next;
+  }
+  metrics.shards = NULL;
+  pthread_mutex_unlock(&metrics.lock);
+
+  if (thread_shard)
+  {
+    pthread_setspecific(metrics.key, NULL);
+    thread_shard = NULL;
+  }
+}
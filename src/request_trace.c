@@ -0,0 +1,305 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_HTTP
+#include "request_trace.h"
+#include "access_log.h"
+#include "alloc_count.h"
+#include "config.h"
+#include "latency.h"
+#include "metrics.h"
+#include "probes.h"
+#include "utils.h"
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Indexed by fd, grown as higher fds show up
+static RequestTrace *traces = NULL;
+static size_t trace_capacity = 0;
+
+static RequestTrace *trace_for(int fd)
+{
+  if (fd < 0 || (size_t)fd >= trace_capacity || !traces[fd].active)
+    return NULL;
+  return &traces[fd];
+}
+
+void request_trace_begin(int fd, const struct sockaddr *peer)
+{
+  if (fd < 0)
+    return;
+  PROBE1(accept, fd);
+
+  if ((size_t)fd >= trace_capacity)
+  {
+    size_t capacity = trace_capacity == 0 ? 256 : trace_capacity;
+    while (capacity <= (size_t)fd)
+      capacity *= 2;
+    traces = realloc(traces, capacity * sizeof(RequestTrace));
+    assert(traces != NULL && "Buy more RAM lol");
+    memset(traces + trace_capacity, 0, (capacity - trace_capacity) * sizeof(RequestTrace));
+    trace_capacity = capacity;
+  }
+
+  RequestTrace *trace = &traces[fd];
+  // A connection closed without request_trace_end()
+  if (trace->active)
+    metrics_connection_closed();
+  metrics_connection_opened();
+  memset(trace, 0, sizeof(*trace));
+  trace->active = true;
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  trace->wall_us = (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000;
+  trace->accepted_ns = monotonic_ns();
+
+  if (peer && peer->sa_family == AF_INET)
+  {
+    const struct sockaddr_in *in = (const struct sockaddr_in *)peer;
+    trace->family = 4;
+    memcpy(trace->addr, &in->sin_addr, 4);
+    trace->port = ntohs(in->sin_port);
+  }
+  else if (peer && peer->sa_family == AF_INET6)
+  {
+    const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)peer;
+    trace->family = 6;
+    memcpy(trace->addr, &in6->sin6_addr, 16);
+    trace->port = ntohs(in6->sin6_port);
+  }
+}
+
+void request_trace_read(int fd, uint64_t started_ns, size_t bytes)
+{
+  RequestTrace *trace = trace_for(fd);
+  if (!trace)
+    return;
+  if (trace->read_start_ns == 0)
+  {
+    trace->read_start_ns = started_ns;
+    trace->allocations_since = alloc_count();
+  }
+  trace->phase_end_ns[PHASE_READ] = monotonic_ns();
+  trace->bytes_in += (uint32_t)bytes;
+}
+
+void request_trace_parsed(int fd, const char *method, RouteId route)
+{
+  RequestTrace *trace = trace_for(fd);
+  if (!trace)
+    return;
+  trace->phase_end_ns[PHASE_PARSE] = monotonic_ns();
+  trace->route = (uint16_t)route;
+  PROBE3(request__parsed, fd, trace->bytes_in, method ? method : "");
+  if (method && strcmp(method, "GET") == 0)
+    trace->method = METHOD_GET;
+  else if (method && strcmp(method, "POST") == 0)
+    trace->method = METHOD_POST;
+}
+
+void request_trace_step(int fd, TraceStep step, uint64_t started_ns)
+{
+  RequestTrace *trace = trace_for(fd);
+  if (trace && (unsigned)step < STEP_COUNT)
+    trace->step_ns[step] += monotonic_ns() - started_ns;
+}
+
+void request_trace_handled(int fd, bool parked)
+{
+  RequestTrace *trace = trace_for(fd);
+  if (!trace)
+    return;
+  trace->phase_end_ns[PHASE_HANDLE] = monotonic_ns();
+  trace->handler_write_ns = trace->write_ns;
+  trace->parked = parked;
+  trace->allocations += alloc_count() - trace->allocations_since;
+}
+
+void request_trace_resumed(int fd)
+{
+  RequestTrace *trace = trace_for(fd);
+  // Continuations can chain, the first one ends the wait
+  if (!trace || trace->resumed_ns != 0)
+    return;
+  trace->resumed_ns = monotonic_ns();
+  trace->allocations_since = alloc_count();
+}
+
+void request_trace_status(int fd, int status)
+{
+  RequestTrace *trace = trace_for(fd);
+  // The first status line sent is the one the client sees
+  if (trace && trace->status == 0)
+    trace->status = (uint16_t)status;
+}
+
+void request_trace_sent(int fd, size_t bytes, uint64_t started_ns)
+{
+  RequestTrace *trace = trace_for(fd);
+  if (!trace)
+    return;
+  trace->bytes_out += bytes;
+  trace->write_ns += monotonic_ns() - started_ns;
+  PROBE3(response__written, fd, trace->status, bytes);
+}
+
+static uint32_t elapsed_us(uint64_t from_ns, uint64_t to_ns)
+{
+  if (from_ns == 0 || to_ns <= from_ns)
+    return 0;
+  uint64_t us = (to_ns - from_ns) / 1000;
+  return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static uint64_t span_ns(uint64_t from_ns, uint64_t to_ns, uint64_t excluded_ns)
+{
+  if (from_ns == 0 || to_ns <= from_ns + excluded_ns)
+    return 0;
+  return to_ns - from_ns - excluded_ns;
+}
+
+// Where a finished request's time went. The parts add up to the total:
+// handler is whatever the I/O loop spent on it outside the steps and writes,
+// including a parked request's continuation.
+typedef struct
+{
+  uint64_t total;
+  uint64_t first_byte;
+  uint64_t read;
+  uint64_t parse;
+  uint64_t steps[STEP_COUNT];
+  uint64_t handler;
+  uint64_t db_wait;
+  uint64_t write;
+} Breakdown;
+
+static Breakdown breakdown(const RequestTrace *trace)
+{
+  const uint64_t *end = trace->phase_end_ns;
+  Breakdown b = {
+      .total = span_ns(trace->accepted_ns, end[PHASE_WAIT], 0),
+      .first_byte = span_ns(trace->accepted_ns, trace->read_start_ns, 0),
+      .read = span_ns(trace->read_start_ns, end[PHASE_READ], 0),
+      .parse = span_ns(end[PHASE_READ], end[PHASE_PARSE], 0),
+      .write = trace->write_ns,
+  };
+
+  uint64_t steps = 0;
+  for (int step = 0; step < STEP_COUNT; step++)
+  {
+    b.steps[step] = trace->step_ns[step];
+    steps += trace->step_ns[step];
+  }
+  b.handler = span_ns(end[PHASE_PARSE], end[PHASE_HANDLE], trace->handler_write_ns + steps);
+
+  if (trace->parked)
+  {
+    uint64_t later_writes = trace->write_ns - trace->handler_write_ns;
+    if (trace->resumed_ns != 0)
+    {
+      b.db_wait = span_ns(end[PHASE_HANDLE], trace->resumed_ns, 0);
+      b.handler += span_ns(trace->resumed_ns, end[PHASE_WAIT], later_writes);
+    }
+    else
+    {
+      b.db_wait = span_ns(end[PHASE_HANDLE], end[PHASE_WAIT], later_writes);
+    }
+  }
+  return b;
+}
+
+static void record_latency(const RequestTrace *trace, const Breakdown *b)
+{
+  RouteId route = trace->route;
+  latency_record(route, LATENCY_TOTAL, b->total);
+  latency_record(route, LATENCY_FIRST_BYTE, b->first_byte);
+  latency_record(route, LATENCY_READ, b->read);
+  // A request that failed early skips the rest
+  if (trace->phase_end_ns[PHASE_PARSE] != 0)
+    latency_record(route, LATENCY_PARSE, b->parse);
+  if (trace->phase_end_ns[PHASE_HANDLE] != 0)
+    latency_record(route, LATENCY_HANDLER, b->handler + b->steps[STEP_MIME] + b->steps[STEP_FILE]);
+  if (trace->parked)
+    latency_record(route, LATENCY_DB_WAIT, b->db_wait);
+  if (trace->bytes_out > 0)
+    latency_record(route, LATENCY_WRITE, b->write);
+}
+
+// One key=value line, so it can be grepped and split without a parser.
+// Formatted here since it has more arguments than a log record holds.
+static void log_slow(const RequestTrace *trace, const Breakdown *b)
+{
+  char line[512];
+  snprintf(line, sizeof(line),
+           "route=%s method=%s status=%u bytes_in=%u bytes_out=%llu total_us=%llu "
+           "first_byte_us=%llu read_us=%llu parse_us=%llu mime_us=%llu file_us=%llu handler_us=%llu "
+           "db_us=%llu write_us=%llu allocs=%llu",
+           route_name(trace->route), method_name(trace->method), trace->status, trace->bytes_in,
+           (unsigned long long)trace->bytes_out, (unsigned long long)(b->total / 1000),
+           (unsigned long long)(b->first_byte / 1000), (unsigned long long)(b->read / 1000),
+           (unsigned long long)(b->parse / 1000), (unsigned long long)(b->steps[STEP_MIME] / 1000),
+           (unsigned long long)(b->steps[STEP_FILE] / 1000), (unsigned long long)(b->handler / 1000),
+           (unsigned long long)(b->db_wait / 1000), (unsigned long long)(b->write / 1000),
+           (unsigned long long)trace->allocations);
+  log_message(LOG_WARNING, "Slow request %s", line);
+}
+
+void request_trace_end(int fd)
+{
+  RequestTrace *trace = trace_for(fd);
+  if (!trace)
+    return;
+  trace->active = false;
+  trace->phase_end_ns[PHASE_WAIT] = monotonic_ns();
+
+  if (trace->resumed_ns != 0)
+    trace->allocations += alloc_count() - trace->allocations_since;
+
+  metrics_connection_closed();
+  if (trace->bytes_in > 0)
+  {
+    Breakdown b = breakdown(trace);
+    metrics_request(trace->route, trace->status, b.total, trace->bytes_in, trace->bytes_out);
+    record_latency(trace, &b);
+    uint64_t slow_ns = (uint64_t)server_config.log_slow_request_ms * 1000000ULL;
+    if (slow_ns > 0 && b.total >= slow_ns)
+      log_slow(trace, &b);
+  }
+  PROBE6(connection__closed, fd, trace->route, trace->status, trace->bytes_in, trace->bytes_out,
+         span_ns(trace->accepted_ns, trace->phase_end_ns[PHASE_WAIT], 0));
+
+  if (!access_log_enabled())
+    return;
+
+  AccessLogRecord record = {
+      .timestamp_us = trace->wall_us,
+      .port = trace->port,
+      .family = trace->family,
+      .method = trace->method,
+      .route = trace->route,
+      .status = trace->status,
+      .bytes_in = trace->bytes_in,
+      .bytes_out = trace->bytes_out,
+  };
+  memcpy(record.addr, trace->addr, sizeof(record.addr));
+
+  // A phase that was skipped, e.g. parse after a failed read, takes nothing
+  uint64_t start = trace->accepted_ns;
+  for (int phase = 0; phase < PHASE_COUNT; phase++)
+  {
+    if (trace->phase_end_ns[phase] == 0)
+      continue;
+    record.phase_us[phase] = elapsed_us(start, trace->phase_end_ns[phase]);
+    start = trace->phase_end_ns[phase];
+  }
+
+  access_log_write(&record);
+}
+
+void request_trace_free()
+{
+  free(traces);
+  traces = NULL;
+  trace_capacity = 0;
+}
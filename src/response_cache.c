@@ -0,0 +1,297 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_HTTP
+#include "response_cache.h"
+#include "config.h"
+#include "db_executor.h"
+#include "json_arena.h"
+#include "request_trace.h"
+#include "utils.h"
+#include "work_pool.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RESPONSE_KEY_MAX 128
+
+typedef struct Waiter
+{
+  int client_socket;
+  struct Waiter *next;
+} Waiter;
+
+typedef struct CacheEntry
+{
+  char key[RESPONSE_KEY_MAX];
+  char *body; // Last good body, NULL until the first render
+  size_t body_len;
+  uint64_t fresh_until_ns;
+  uint64_t stale_until_ns;
+  // cache.generation when the body was rendered, it is only fresh while
+  // that is still current
+  uint64_t generation;
+  bool rendering;
+  Waiter *waiters;
+  struct CacheEntry *next;
+} CacheEntry;
+
+typedef struct
+{
+  WorkJob job;
+  CacheEntry *entry;
+  ResponseRenderFn render;
+  uint64_t generation;
+  HttpStatusCode status;
+  char *body;
+} RenderJob;
+
+static struct
+{
+  CacheEntry **buckets;
+  size_t bucket_count;
+  uint64_t generation;
+  ResponseCacheStats stats;
+} cache;
+
+static size_t bucket_for(const char *key)
+{
+  // FNV-1a
+  uint64_t hash = 1469598103934665603ULL;
+  for (const unsigned char *c = (const unsigned char *)key; *c; c++)
+  {
+    hash ^= *c;
+    hash *= 1099511628211ULL;
+  }
+  return hash & (cache.bucket_count - 1);
+}
+
+// Frees entries past their stale window to make room, returns whether any was
+static bool evict_expired(uint64_t now)
+{
+  bool evicted = false;
+  for (size_t b = 0; b < cache.bucket_count; b++)
+  {
+    for (CacheEntry **link = &cache.buckets[b]; *link;)
+    {
+      CacheEntry *entry = *link;
+      if (!entry->rendering && now >= entry->stale_until_ns)
+      {
+        *link = entry->next;
+        free(entry->body);
+        free(entry);
+        cache.stats.size--;
+        evicted = true;
+      }
+      else
+      {
+        link = &entry->next;
+      }
+    }
+  }
+  return evicted;
+}
+
+// Returns NULL if the key is too long or the cache is full of live entries
+static CacheEntry *find_or_create(const char *key, uint64_t now)
+{
+  if (strlen(key) >= RESPONSE_KEY_MAX)
+    return NULL;
+
+  size_t b = bucket_for(key);
+  for (CacheEntry *entry = cache.buckets[b]; entry; entry = entry->next)
+  {
+    if (strcmp(entry->key, key) == 0)
+      return entry;
+  }
+
+  if (cache.stats.size >= cache.stats.capacity && !evict_expired(now))
+    return NULL;
+
+  CacheEntry *entry = calloc(1, sizeof(CacheEntry));
+  assert(entry != NULL && "Buy more RAM lol");
+  snprintf(entry->key, sizeof(entry->key), "%s", key);
+  entry->next = cache.buckets[b];
+  cache.buckets[b] = entry;
+  cache.stats.size++;
+  return entry;
+}
+
+static bool run_render(WorkJob *job)
+{
+  RenderJob *render = (RenderJob *)job;
+  json_arena_begin();
+  render->status = render->render(render->entry->key, &render->body);
+  json_arena_end();
+  return true;
+}
+
+// Installs the new body and answers everyone who was waiting for it
+static void finish_render(WorkJob *job)
+{
+  RenderJob *render = (RenderJob *)job;
+  CacheEntry *entry = render->entry;
+  entry->rendering = false;
+
+  if (render->status == HTTP_200_OK && render->body)
+  {
+    uint64_t now = monotonic_ns();
+    free(entry->body);
+    entry->body = render->body;
+    entry->body_len = strlen(render->body);
+    // Still worth serving to whoever is waiting, but if a score came in
+    // meanwhile the generation is already behind and the next request
+    // renders again
+    entry->generation = render->generation;
+    entry->fresh_until_ns = now + (uint64_t)server_config.cache_responses_ttl_ms * 1000000ULL;
+    entry->stale_until_ns = now + (uint64_t)(server_config.cache_responses_ttl_ms +
+                                             server_config.cache_responses_stale_ms) * 1000000ULL;
+    render->body = NULL;
+  }
+
+  Waiter *waiter = entry->waiters;
+  entry->waiters = NULL;
+  while (waiter)
+  {
+    Waiter *next = waiter->next;
+    request_trace_resumed(waiter->client_socket);
+    if (render->status == HTTP_200_OK && entry->body)
+      handle_json_body(waiter->client_socket, HTTP_200_OK, entry->body, entry->body_len);
+    else
+      handle_response(waiter->client_socket, render->status);
+    close_connection(waiter->client_socket);
+    free(waiter);
+    waiter = next;
+  }
+
+  free(render->body);
+  free(render);
+}
+
+static bool start_render(CacheEntry *entry, ResponseRenderFn render)
+{
+  RenderJob *job = calloc(1, sizeof(RenderJob));
+  assert(job != NULL && "Buy more RAM lol");
+  job->job.run = run_render;
+  job->job.done = finish_render;
+  job->entry = entry;
+  job->render = render;
+  job->generation = cache.generation;
+
+  if (!db_executor_submit(&job->job))
+  {
+    free(job);
+    return false;
+  }
+
+  entry->rendering = true;
+  cache.stats.renders++;
+  return true;
+}
+
+bool response_cache_init()
+{
+  if (server_config.cache_responses_capacity <= 0)
+  {
+    log_message(LOG_ERROR, "cache.responses_capacity must be positive");
+    return false;
+  }
+
+  cache.stats.capacity = (size_t)server_config.cache_responses_capacity;
+  cache.bucket_count = 1;
+  while (cache.bucket_count < cache.stats.capacity)
+    cache.bucket_count <<= 1;
+
+  cache.buckets = calloc(cache.bucket_count, sizeof(CacheEntry *));
+  return cache.buckets != NULL;
+}
+
+void response_cache_free()
+{
+  for (size_t b = 0; b < cache.bucket_count; b++)
+  {
+    CacheEntry *entry = cache.buckets[b];
+    while (entry)
+    {
+      CacheEntry *next = entry->next;
+      free(entry->body);
+      free(entry);
+      entry = next;
+    }
+  }
+
+  free(cache.buckets);
+  cache.buckets = NULL;
+  cache.bucket_count = 0;
+  cache.stats.size = 0;
+}
+
+RequestStatus response_cache_serve(int client_socket, const char *key, ResponseRenderFn render)
+{
+  uint64_t now = monotonic_ns();
+  CacheEntry *entry = find_or_create(key, now);
+
+  if (!entry)
+  {
+    // Nowhere to keep it, render on the spot
+    char *body = NULL;
+    HttpStatusCode status = render(key, &body);
+    if (status == HTTP_200_OK && body)
+      handle_json_body(client_socket, status, body, strlen(body));
+    else
+      handle_response(client_socket, status);
+    free(body);
+    cache.stats.misses++;
+    return REQUEST_DONE;
+  }
+
+  if (entry->body && entry->generation == cache.generation && now < entry->fresh_until_ns)
+  {
+    cache.stats.hits++;
+    handle_json_body(client_socket, HTTP_200_OK, entry->body, entry->body_len);
+    return REQUEST_DONE;
+  }
+
+  if (entry->body && now < entry->stale_until_ns)
+  {
+    // Serve what we have and refresh it in the background. If the executor
+    // is busy the next request tries again.
+    cache.stats.stale_hits++;
+    if (!entry->rendering)
+      start_render(entry, render);
+    handle_json_body(client_socket, HTTP_200_OK, entry->body, entry->body_len);
+    return REQUEST_DONE;
+  }
+
+  if (entry->rendering)
+  {
+    cache.stats.coalesced++;
+  }
+  else
+  {
+    cache.stats.misses++;
+    if (!start_render(entry, render))
+    {
+      log_message(LOG_WARNING, "Database executor queue is full");
+      handle_response(client_socket, HTTP_503_UNAVAILABLE);
+      return REQUEST_DONE;
+    }
+  }
+
+  Waiter *waiter = malloc(sizeof(Waiter));
+  assert(waiter != NULL && "Buy more RAM lol");
+  waiter->client_socket = client_socket;
+  waiter->next = entry->waiters;
+  entry->waiters = waiter;
+  return REQUEST_PENDING;
+}
+
+void response_cache_invalidate()
+{
+  // Entries compare their generation on lookup, so this is O(1)
+  cache.generation++;
+  cache.stats.invalidations++;
+}
+
+ResponseCacheStats response_cache_stats()
+{
+  return cache.stats;
+}
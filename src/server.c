@@ -3,21 +3,45 @@
 #include "cJSON.h"
 #include "http_request.h"
 #include "utils.h"
-#include "database.h"
+#include "storage.h"
+#include "config.h"
+#include "db_writer.h"
+#include "leaderboard.h"
+#include "db_executor.h"
+#include "auth.h"
+#include "session.h"
+#include "user_cache.h"
+#include "username_filter.h"
+#include "backup.h"
+#include "response_cache.h"
+#include "json_arena.h"
+#include "logger.h"
+#include "access_log.h"
+#include "latency.h"
+#include "metrics.h"
+#include "probes.h"
+#include "request_trace.h"
+#include "work_pool.h"
 #include <asm-generic/socket.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <stdbool.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-static int PORT = 8080;
+#define MAX_EVENTS 64
 
 int initialize_socket() {
   // 1. Create socket
   log_message(LOG_INFO, "Creating server socket");
-  int socketfd = socket(AF_INET, SOCK_STREAM, 0);
+  int socketfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
 
   if (socketfd == -1)
     log_message(LOG_ERROR, "Socket error");
@@ -36,7 +60,7 @@ int initialize_socket() {
   struct sockaddr_in addr = {0};
   addr.sin_family = AF_INET;
   addr.sin_addr.s_addr = INADDR_ANY;
-  addr.sin_port = htons(PORT);
+  addr.sin_port = htons(server_config.port);
 
   // 4. Bind socket
   log_message(LOG_INFO, "Binding socket");
@@ -44,74 +68,281 @@ int initialize_socket() {
     log_message(LOG_ERROR, "Bind error");
 
   // 5. Listen for conexions
-  log_message(LOG_INFO, "Listening on http://localhost:%d", PORT);
-  if (listen(socketfd, 5) == -1)
+  log_message(LOG_INFO, "Listening on http://localhost:%d", server_config.port);
+  if (listen(socketfd, SOMAXCONN) == -1)
     log_message(LOG_ERROR, "Listen error");
 
   return socketfd;
 }
 
 void initialize_database() {
-  if (!create_database())
-    log_message(LOG_ERROR, "Failed to create database");
+  if (!storage_open()) {
+    log_message(LOG_ERROR, "Failed to open storage");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!leaderboard_init())
+    log_message(LOG_ERROR, "Failed to load leaderboard");
 
-  create_table("User", "id INTEGER PRIMARY KEY AUTOINCREMENT, username TEXT UNIQUE, password TEXT");
-  create_table("UserScore", "user_id INTEGER, username TEXT, score INTEGER, timestamp INTEGER");
+  if (!username_filter_init())
+    log_message(LOG_ERROR, "Failed to build username filter, every username will be looked up");
 }
 
 void read_cli(int *argc, char ***argv) {
-  char* program = shift_args(argc, argv);
-  if (*argc != 1) {
-    log_message(LOG_WARNING, "No port specified, using default port %d", PORT);
+  shift_args(argc, argv);
+  char *port = shift_args(argc, argv);
+  char *config_path = shift_args(argc, argv);
+
+  if (config_path) {
+    if (!config_load(config_path))
+      exit(EXIT_FAILURE);
+  } else if (access(CONFIG_PATH, R_OK) == 0) {
+    if (!config_load(CONFIG_PATH))
+      exit(EXIT_FAILURE);
+  }
+
+  if (port) {
+    server_config.port = atoi(port);
   } else {
-    PORT = atoi((*argv)[0]);
+    log_message(LOG_WARNING, "No port specified, using port %d", server_config.port);
   }
-}
 
-int main(int argc, char *argv[]) {
-  read_cli(&argc, &argv);
+  config_print();
+}
 
-  initialize_database();
-  int socketfd = initialize_socket();
+void handle_client(int client_socket) {
   char buffer[1024] = {0};
 
-  int new_socket;
-  struct sockaddr peer_addr = {0};
-  socklen_t peer_addr_len = sizeof(peer_addr);
+  // Read request
+  uint64_t read_start = monotonic_ns();
+  ssize_t bytes_read = read(client_socket, buffer, 1024 - 1);
+  if (bytes_read <= 0) {
+    if (bytes_read < 0)
+      log_message(LOG_ERROR, "Read error");
+    request_trace_end(client_socket);
+    close(client_socket);
+    return;
+  }
+  buffer[bytes_read] = '\0';
+  request_trace_read(client_socket, read_start, (size_t)bytes_read);
+
+  HttpRequest hr = {0};
+  init_http_request(&hr);
+
+  // Parse request
+  parse_request(&hr, buffer);
+  RouteId route = request_route(&hr);
+  request_trace_parsed(client_socket, hr.start_line.method, route);
+
+  // Process request, parked requests are answered and closed by their
+  // continuation. Any JSON built on the way is dropped in one go at the end.
+  json_arena_begin();
+  PROBE2(route__dispatched, client_socket, route);
+  RequestStatus status = process_request(&hr, client_socket, route);
+  json_arena_end();
+  request_trace_handled(client_socket, status != REQUEST_DONE);
+  // Method and target only, the headers and body can carry credentials
+  if (hr.start_line.method)
+    log_message(LOG_DEBUG, "%s %s%s", hr.start_line.method, hr.start_line.target.path,
+                hr.start_line.target.file_name);
+
+  // Close connection
+  if (status == REQUEST_DONE)
+    close_connection(client_socket);
+
+  free_http_request(&hr);
+}
+
+void accept_clients(int epollfd, int socketfd) {
+  struct sockaddr_storage peer_addr;
 
   while (true) {
-    if ((new_socket = accept(socketfd, &peer_addr, &peer_addr_len)) < 0) {
-      log_message(LOG_ERROR, "Peer error");
+    socklen_t peer_addr_len = sizeof(peer_addr);
+    int new_socket = accept(socketfd, (struct sockaddr *)&peer_addr, &peer_addr_len);
+    if (new_socket < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        log_message(LOG_ERROR, "Peer error");
+      return;
     }
+    request_trace_begin(new_socket, (struct sockaddr *)&peer_addr);
 
-    // Read request
-    ssize_t bytes_read = read(new_socket, buffer, 1024 - 1);
-    if (bytes_read < 0) {
-      log_message(LOG_ERROR, "Read error");
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = new_socket};
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, new_socket, &event) < 0) {
+      log_message(LOG_ERROR, "Could not watch client socket");
       close(new_socket);
-      continue;
     }
-    buffer[bytes_read] = '\0';
+  }
+}
 
-    HttpRequest hr = {0};
-    init_http_request(&hr);
+// SIGINT and SIGTERM are read from a signalfd so the loop can shut down
+// cleanly instead of being killed mid-request. SIGHUP reloads the log levels.
+int initialize_signals() {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGHUP);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  signal(SIGPIPE, SIG_IGN);
 
-    // Parse request
-    parse_request(&hr, buffer);
+  return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
 
-    // Process request
-    process_request(&hr, new_socket);
-    print_http_request(&hr);
-    printf("\n%s\n", buffer);
+// Fires once a second to drive periodic work
+int initialize_housekeeping_timer() {
+  int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct itimerspec interval = {
+      .it_interval = {.tv_sec = 1},
+      .it_value = {.tv_sec = 1},
+  };
+  timerfd_settime(timerfd, 0, &interval, NULL);
+  return timerfd;
+}
 
-    // Close connection
-    shutdown(new_socket, SHUT_WR);
-    close(new_socket);
+static bool run_session_snapshot(WorkJob *job) {
+  (void)job;
+  session_snapshot(server_config.session_snapshot_path);
+  return true;
+}
+
+static bool snapshot_in_flight = false;
+
+static void finish_session_snapshot(WorkJob *job) {
+  (void)job;
+  snapshot_in_flight = false;
+}
 
-    free_http_request(&hr);
+// The file is written on the database executor, one snapshot at a time
+static void start_session_snapshot() {
+  static WorkJob job = {.run = run_session_snapshot, .done = finish_session_snapshot};
+  if (snapshot_in_flight)
+    return;
+  job.expired = false;
+  snapshot_in_flight = db_executor_submit(&job);
+}
+
+void housekeeping(int timerfd) {
+  static unsigned long ticks = 0;
+  uint64_t expirations;
+  if (read(timerfd, &expirations, sizeof(expirations)) < 0)
+    return;
+
+  ticks += expirations;
+  session_tick();
+
+  if (server_config.session_snapshot_path[0] != '\0' && server_config.session_snapshot_interval_s > 0 &&
+      ticks % server_config.session_snapshot_interval_s == 0)
+    start_session_snapshot();
+}
+
+// Returns false once the server should shut down
+bool handle_signals(int signalfd) {
+  struct signalfd_siginfo info;
+  while (read(signalfd, &info, sizeof(info)) == sizeof(info)) {
+    if (info.ssi_signo != SIGHUP) {
+      log_message(LOG_INFO, "Shutting down");
+      return false;
+    }
+
+    if (config_reload())
+      log_message(LOG_INFO, "Reloaded log levels");
+  }
+  return true;
+}
+
+void watch_fd(int epollfd, int fd) {
+  struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) < 0)
+    log_message(LOG_ERROR, "Could not watch fd %d", fd);
+}
+
+int main(int argc, char *argv[]) {
+  read_cli(&argc, &argv);
+  json_arena_init();
+
+  // Before any thread starts, so they all inherit the blocked signals
+  int signalfd = initialize_signals();
+  if (!logger_start())
+    return EXIT_FAILURE;
+
+  if (!completion_queue_init(&io_completions))
+    return EXIT_FAILURE;
+
+  initialize_database();
+  if (!session_init() || !user_cache_init() || !response_cache_init())
+    return EXIT_FAILURE;
+  if (!db_writer_start() || !db_executor_start(&io_completions) || !auth_start(&io_completions))
+    return EXIT_FAILURE;
+  if (!backup_start() || !access_log_start() || !latency_start())
+    return EXIT_FAILURE;
+
+  int socketfd = initialize_socket();
+  int timerfd = initialize_housekeeping_timer();
+
+  // The I/O loop: new connections, readable clients, the continuations of
+  // requests that were waiting on the database, signals and the timer
+  int epollfd = epoll_create1(EPOLL_CLOEXEC);
+  watch_fd(epollfd, socketfd);
+  watch_fd(epollfd, io_completions.eventfd);
+  watch_fd(epollfd, signalfd);
+  watch_fd(epollfd, timerfd);
+
+  struct epoll_event events[MAX_EVENTS];
+  bool running = true;
+
+  while (running) {
+    int n = epoll_wait(epollfd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      log_message(LOG_ERROR, "Wait error");
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+
+      if (fd == socketfd) {
+        accept_clients(epollfd, socketfd);
+      } else if (fd == io_completions.eventfd) {
+        json_arena_begin();
+        completion_queue_drain(&io_completions);
+        json_arena_end();
+      } else if (fd == timerfd) {
+        housekeeping(timerfd);
+      } else if (fd == signalfd) {
+        running = handle_signals(signalfd);
+      } else {
+        // One request per connection, so stop watching it
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+        handle_client(fd);
+      }
+    }
   }
 
+  close(epollfd);
+  close(timerfd);
+  close(signalfd);
   close(socketfd);
+  backup_stop();
+  auth_stop();
+  db_executor_stop();
+  db_writer_stop();
+  completion_queue_drain(&io_completions);
+  completion_queue_free(&io_completions);
+  // After the last continuations have answered their requests
+  access_log_stop();
+  latency_stop();
+  request_trace_free();
+  session_free();
+  user_cache_free();
+  response_cache_free();
+  json_arena_thread_free();
+  username_filter_free();
+  leaderboard_free();
+  storage_close();
+  metrics_free();
+  logger_stop();
 
   return 0;
 }
@@ -0,0 +1,496 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_AUTH
+#include "session.h"
+#include "config.h"
+#include "utils.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+#define SESSION_SHARDS 16
+#define SESSION_INITIAL_BUCKETS 64
+#define SESSION_WHEEL_SLOTS 256
+#define SESSION_SNAPSHOT_MAGIC 0x53455332 // "SES2"
+
+typedef struct Session Session;
+
+struct Session
+{
+  char token[SESSION_TOKEN_LEN + 1];
+  SessionInfo info;
+  Session *hash_next;
+  // Timer wheel slot list
+  Session *wheel_prev;
+  Session *wheel_next;
+};
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  Session **buckets;
+  size_t bucket_count;
+  size_t count;
+
+  // Slot i holds the sessions expiring at a second s with s % SLOTS == i.
+  // Sessions further than one revolution away just stay in their slot.
+  Session *wheel[SESSION_WHEEL_SLOTS];
+  time_t wheel_time;
+} SessionShard;
+
+typedef struct
+{
+  char token[SESSION_TOKEN_LEN + 1];
+  int32_t user_id;
+  char username[DB_USERNAME_MAX];
+  int64_t expires_at;
+} SessionRecord;
+
+static SessionShard shards[SESSION_SHARDS];
+
+static uint64_t hash_token(const char *token)
+{
+  // FNV-1a
+  uint64_t hash = 1469598103934665603ULL;
+  for (const unsigned char *c = (const unsigned char *)token; *c; c++)
+  {
+    hash ^= *c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static SessionShard *shard_for(uint64_t hash)
+{
+  return &shards[hash % SESSION_SHARDS];
+}
+
+static size_t bucket_for(const SessionShard *shard, uint64_t hash)
+{
+  return (hash / SESSION_SHARDS) & (shard->bucket_count - 1);
+}
+
+static void wheel_insert(SessionShard *shard, Session *session)
+{
+  size_t slot = (size_t)(session->info.expires_at % SESSION_WHEEL_SLOTS);
+  session->wheel_prev = NULL;
+  session->wheel_next = shard->wheel[slot];
+  if (session->wheel_next)
+    session->wheel_next->wheel_prev = session;
+  shard->wheel[slot] = session;
+}
+
+static void wheel_remove(SessionShard *shard, Session *session)
+{
+  if (session->wheel_prev)
+    session->wheel_prev->wheel_next = session->wheel_next;
+  else
+    shard->wheel[session->info.expires_at % SESSION_WHEEL_SLOTS] = session->wheel_next;
+
+  if (session->wheel_next)
+    session->wheel_next->wheel_prev = session->wheel_prev;
+}
+
+static void hash_insert(SessionShard *shard, Session *session, uint64_t hash)
+{
+  if (shard->count + 1 > shard->bucket_count)
+  {
+    size_t new_count = shard->bucket_count * 2;
+    Session **new_buckets = calloc(new_count, sizeof(Session *));
+    assert(new_buckets != NULL && "Buy more RAM lol");
+
+    for (size_t i = 0; i < shard->bucket_count; i++)
+    {
+      Session *s = shard->buckets[i];
+      while (s)
+      {
+        Session *next = s->hash_next;
+        size_t bucket = (hash_token(s->token) / SESSION_SHARDS) & (new_count - 1);
+        s->hash_next = new_buckets[bucket];
+        new_buckets[bucket] = s;
+        s = next;
+      }
+    }
+
+    free(shard->buckets);
+    shard->buckets = new_buckets;
+    shard->bucket_count = new_count;
+  }
+
+  size_t bucket = bucket_for(shard, hash);
+  session->hash_next = shard->buckets[bucket];
+  shard->buckets[bucket] = session;
+  shard->count++;
+}
+
+// Unlinks the session from both the hash table and the wheel, and frees it
+static void remove_session(SessionShard *shard, Session *session, uint64_t hash)
+{
+  Session **link = &shard->buckets[bucket_for(shard, hash)];
+  while (*link && *link != session)
+    link = &(*link)->hash_next;
+  if (*link)
+    *link = session->hash_next;
+
+  wheel_remove(shard, session);
+  shard->count--;
+  free(session);
+}
+
+static Session *find_session(SessionShard *shard, const char *token, uint64_t hash)
+{
+  for (Session *s = shard->buckets[bucket_for(shard, hash)]; s; s = s->hash_next)
+  {
+    if (strcmp(s->token, token) == 0)
+      return s;
+  }
+  return NULL;
+}
+
+static bool insert_session(const char *token, const SessionInfo *info)
+{
+  uint64_t hash = hash_token(token);
+  SessionShard *shard = shard_for(hash);
+
+  Session *session = calloc(1, sizeof(Session));
+  if (!session)
+    return false;
+  snprintf(session->token, sizeof(session->token), "%s", token);
+  session->info = *info;
+
+  pthread_mutex_lock(&shard->lock);
+  hash_insert(shard, session, hash);
+  wheel_insert(shard, session);
+  pthread_mutex_unlock(&shard->lock);
+  return true;
+}
+
+static bool generate_token(char *token)
+{
+  static const char hex[] = "0123456789abcdef";
+  unsigned char bytes[SESSION_TOKEN_LEN / 2];
+
+  if (getrandom(bytes, sizeof(bytes), 0) != (ssize_t)sizeof(bytes))
+  {
+    log_message(LOG_ERROR, "Could not generate session token");
+    return false;
+  }
+
+  for (size_t i = 0; i < sizeof(bytes); i++)
+  {
+    token[i * 2] = hex[bytes[i] >> 4];
+    token[i * 2 + 1] = hex[bytes[i] & 0xf];
+  }
+  token[SESSION_TOKEN_LEN] = '\0';
+  return true;
+}
+
+// Snapshot layout: the header, `count` records and the FNV-1a hash of the
+// records' bytes, so a cut off or damaged file is rejected as a whole
+typedef struct
+{
+  uint32_t magic;
+  uint32_t count;
+} SnapshotHeader;
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+  for (const unsigned char *c = data; len > 0; c++, len--)
+  {
+    hash ^= *c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static bool read_snapshot(FILE *f, SessionRecord **records, uint32_t *count)
+{
+  SnapshotHeader header;
+  if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != SESSION_SNAPSHOT_MAGIC)
+    return false;
+
+  // The size must match exactly before anything is allocated
+  long size = 0;
+  if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+      (uint64_t)size != sizeof(header) + (uint64_t)header.count * sizeof(SessionRecord) + sizeof(uint64_t) ||
+      fseek(f, sizeof(header), SEEK_SET) != 0)
+    return false;
+
+  SessionRecord *read = calloc(header.count ? header.count : 1, sizeof(SessionRecord));
+  uint64_t expected = 0;
+  if (!read || fread(read, sizeof(SessionRecord), header.count, f) != header.count ||
+      fread(&expected, sizeof(expected), 1, f) != 1 ||
+      hash_bytes(1469598103934665603ULL, read, header.count * sizeof(SessionRecord)) != expected)
+  {
+    free(read);
+    return false;
+  }
+
+  *records = read;
+  *count = header.count;
+  return true;
+}
+
+static bool session_restore(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return true;
+
+  SessionRecord *records = NULL;
+  uint32_t count = 0;
+  bool ok = read_snapshot(f, &records, &count);
+  fclose(f);
+  if (!ok)
+  {
+    // Only a cache of logins, not worth refusing to start over. Kept aside
+    // for a look and so the next snapshot doesn't overwrite it.
+    char bad_path[sizeof(server_config.session_snapshot_path) + 8];
+    snprintf(bad_path, sizeof(bad_path), "%s.bad", path);
+    if (rename(path, bad_path) != 0)
+    {
+      log_message(LOG_ERROR, "Invalid session snapshot %s, and can't move it aside", path);
+      return false;
+    }
+    log_message(LOG_WARNING, "Invalid session snapshot %s moved to %s, starting without sessions", path, bad_path);
+    return true;
+  }
+
+  time_t now = time(NULL);
+  size_t restored = 0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    SessionRecord *record = &records[i];
+    record->token[SESSION_TOKEN_LEN] = '\0';
+    record->username[DB_USERNAME_MAX - 1] = '\0';
+    if (record->expires_at <= now)
+      continue;
+
+    SessionInfo info = {.user_id = record->user_id, .expires_at = (time_t)record->expires_at};
+    strcpy(info.username, record->username);
+    if (insert_session(record->token, &info))
+      restored++;
+  }
+
+  free(records);
+  log_message(LOG_INFO, "Restored %zu sessions from %s", restored, path);
+  return true;
+}
+
+bool session_init()
+{
+  time_t now = time(NULL);
+  for (size_t i = 0; i < SESSION_SHARDS; i++)
+  {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    shards[i].bucket_count = SESSION_INITIAL_BUCKETS;
+    shards[i].buckets = calloc(SESSION_INITIAL_BUCKETS, sizeof(Session *));
+    shards[i].count = 0;
+    shards[i].wheel_time = now;
+    memset(shards[i].wheel, 0, sizeof(shards[i].wheel));
+    if (!shards[i].buckets)
+      return false;
+  }
+
+  if (server_config.session_snapshot_path[0] != '\0')
+    return session_restore(server_config.session_snapshot_path);
+
+  return true;
+}
+
+void session_free()
+{
+  if (server_config.session_snapshot_path[0] != '\0')
+    session_snapshot(server_config.session_snapshot_path);
+
+  for (size_t i = 0; i < SESSION_SHARDS; i++)
+  {
+    SessionShard *shard = &shards[i];
+    pthread_mutex_lock(&shard->lock);
+    for (size_t b = 0; b < shard->bucket_count; b++)
+    {
+      Session *s = shard->buckets[b];
+      while (s)
+      {
+        Session *next = s->hash_next;
+        free(s);
+        s = next;
+      }
+    }
+    free(shard->buckets);
+    shard->buckets = NULL;
+    shard->count = 0;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+bool session_create(int user_id, const char *username, char *token)
+{
+  if (!generate_token(token))
+    return false;
+
+  SessionInfo info = {.user_id = user_id, .expires_at = time(NULL) + server_config.session_ttl_s};
+  snprintf(info.username, sizeof(info.username), "%s", username);
+
+  return insert_session(token, &info);
+}
+
+bool session_lookup(const char *token, SessionInfo *info)
+{
+  if (strlen(token) != SESSION_TOKEN_LEN)
+    return false;
+
+  uint64_t hash = hash_token(token);
+  SessionShard *shard = shard_for(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  Session *session = find_session(shard, token, hash);
+  // The wheel may lag behind by up to a tick
+  bool found = session && session->info.expires_at > time(NULL);
+  if (found)
+    *info = session->info;
+  pthread_mutex_unlock(&shard->lock);
+
+  return found;
+}
+
+void session_destroy(const char *token)
+{
+  uint64_t hash = hash_token(token);
+  SessionShard *shard = shard_for(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  Session *session = find_session(shard, token, hash);
+  if (session)
+    remove_session(shard, session, hash);
+  pthread_mutex_unlock(&shard->lock);
+}
+
+void session_tick()
+{
+  time_t now = time(NULL);
+
+  for (size_t i = 0; i < SESSION_SHARDS; i++)
+  {
+    SessionShard *shard = &shards[i];
+    pthread_mutex_lock(&shard->lock);
+
+    // Visit every slot passed since the last tick, at most one revolution
+    time_t from = shard->wheel_time + 1;
+    if (now - from >= SESSION_WHEEL_SLOTS)
+      from = now - SESSION_WHEEL_SLOTS + 1;
+
+    for (time_t t = from; t <= now; t++)
+    {
+      Session *s = shard->wheel[t % SESSION_WHEEL_SLOTS];
+      while (s)
+      {
+        Session *next = s->wheel_next;
+        if (s->info.expires_at <= now)
+          remove_session(shard, s, hash_token(s->token));
+        s = next;
+      }
+    }
+
+    shard->wheel_time = now;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+// Copies the shard's sessions into *records, growing it as needed
+static bool copy_shard(SessionShard *shard, SessionRecord **records, size_t *count, size_t *capacity)
+{
+  pthread_mutex_lock(&shard->lock);
+  if (*count + shard->count > *capacity)
+  {
+    size_t new_capacity = (*count + shard->count) * 2;
+    SessionRecord *grown = realloc(*records, new_capacity * sizeof(SessionRecord));
+    if (!grown)
+    {
+      pthread_mutex_unlock(&shard->lock);
+      return false;
+    }
+    *records = grown;
+    *capacity = new_capacity;
+  }
+
+  for (size_t b = 0; b < shard->bucket_count; b++)
+  {
+    for (Session *s = shard->buckets[b]; s; s = s->hash_next)
+    {
+      // Zeroed so the padding hashes the same on every run
+      SessionRecord *record = &(*records)[(*count)++];
+      memset(record, 0, sizeof(*record));
+      strcpy(record->token, s->token);
+      record->user_id = s->info.user_id;
+      strcpy(record->username, s->info.username);
+      record->expires_at = s->info.expires_at;
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return true;
+}
+
+bool session_snapshot(const char *path)
+{
+  // The shards are only locked to copy their sessions, the file is written
+  // without holding any of them
+  SessionRecord *records = NULL;
+  size_t count = 0, capacity = 0;
+  for (size_t i = 0; i < SESSION_SHARDS; i++)
+  {
+    if (!copy_shard(&shards[i], &records, &count, &capacity))
+    {
+      log_message(LOG_ERROR, "Out of memory copying sessions for %s", path);
+      free(records);
+      return false;
+    }
+  }
+
+  char tmp_path[512];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  FILE *f = fopen(tmp_path, "wb");
+  if (!f)
+  {
+    log_message(LOG_ERROR, "Could not write session snapshot %s", tmp_path);
+    free(records);
+    return false;
+  }
+
+  SnapshotHeader header = {.magic = SESSION_SNAPSHOT_MAGIC, .count = (uint32_t)count};
+  uint64_t hash = hash_bytes(1469598103934665603ULL, records, count * sizeof(SessionRecord));
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(records, sizeof(SessionRecord), count, f) == count &&
+            fwrite(&hash, sizeof(hash), 1, f) == 1;
+  free(records);
+
+  // On disk before the rename, so a crash leaves the old snapshot or the
+  // new one and never a torn file
+  ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp_path, path) != 0)
+  {
+    log_message(LOG_ERROR, "Could not write session snapshot %s", path);
+    remove(tmp_path);
+    return false;
+  }
+
+  log_message(LOG_INFO, "Saved %zu sessions to %s", count, path);
+  return true;
+}
+
+size_t session_count()
+{
+  size_t count = 0;
+  for (size_t i = 0; i < SESSION_SHARDS; i++)
+  {
+    pthread_mutex_lock(&shards[i].lock);
+    count += shards[i].count;
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  return count;
+}
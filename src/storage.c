@@ -0,0 +1,127 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_STORAGE
+#include <stddef.h>
+#include <string.h>
+#include "config.h"
+#include "metrics.h"
+#include "probes.h"
+#include "storage.h"
+#include "utils.h"
+
+static const StorageEngine *const engines[] = {
+    &sqlite_storage,
+    &log_storage,
+};
+
+const StorageEngine *storage = &sqlite_storage;
+
+// What storage_open() picked. `storage` points at a copy of it whose reads
+// and writes are timed for the metrics.
+static const StorageEngine *engine = &sqlite_storage;
+static StorageEngine timed_engine;
+
+// Times one call into the engine and returns what it returned
+#define TIMED(op, call)                                  \
+    PROBE1(db__query__start, op);                        \
+    uint64_t start = monotonic_ns();                     \
+    __typeof__(call) result = call;                      \
+    uint64_t duration = monotonic_ns() - start;          \
+    metrics_db_query(op, duration);                      \
+    PROBE2(db__query__end, op, duration);                \
+    return result
+
+static bool timed_begin(void)
+{
+    TIMED(DB_OP_BEGIN, engine->begin());
+}
+
+static bool timed_commit(void)
+{
+    TIMED(DB_OP_COMMIT, engine->commit());
+}
+
+static bool timed_rollback(void)
+{
+    TIMED(DB_OP_ROLLBACK, engine->rollback());
+}
+
+static bool timed_add_user(const char *username, const char *password, int64_t *row_id)
+{
+    TIMED(DB_OP_ADD_USER, engine->add_user(username, password, row_id));
+}
+
+static bool timed_add_score(int user_id, const char *username, int score, long timestamp, int64_t *row_id)
+{
+    TIMED(DB_OP_ADD_SCORE, engine->add_score(user_id, username, score, timestamp, row_id));
+}
+
+static bool timed_get_credentials(const char *username, int *user_id, char *password, size_t password_size)
+{
+    TIMED(DB_OP_GET_CREDENTIALS, engine->get_credentials(username, user_id, password, password_size));
+}
+
+static int timed_get_user_id(const char *username)
+{
+    TIMED(DB_OP_GET_USER_ID, engine->get_user_id(username));
+}
+
+static long timed_count_users(void)
+{
+    TIMED(DB_OP_COUNT_USERS, engine->count_users());
+}
+
+static long timed_for_each_username(UsernameRowFn fn, void *ctx)
+{
+    TIMED(DB_OP_FOR_EACH_USERNAME, engine->for_each_username(fn, ctx));
+}
+
+static bool timed_for_each_score(ScoreRowFn fn, void *ctx)
+{
+    TIMED(DB_OP_FOR_EACH_SCORE, engine->for_each_score(fn, ctx));
+}
+
+const StorageEngine *storage_find(const char *name)
+{
+    for (size_t i = 0; i < ARRAY_LEN(engines); i++)
+    {
+        if (strcmp(engines[i]->name, name) == 0)
+            return engines[i];
+    }
+    return NULL;
+}
+
+bool storage_open(void)
+{
+    const StorageEngine *found = storage_find(server_config.db_engine);
+    if (!found)
+    {
+        log_message(LOG_ERROR, "Unknown storage engine %s", server_config.db_engine);
+        return false;
+    }
+
+    engine = found;
+    timed_engine = *found;
+    timed_engine.begin = timed_begin;
+    timed_engine.commit = timed_commit;
+    timed_engine.rollback = timed_rollback;
+    timed_engine.add_user = timed_add_user;
+    timed_engine.add_score = timed_add_score;
+    timed_engine.get_credentials = timed_get_credentials;
+    timed_engine.get_user_id = timed_get_user_id;
+    timed_engine.count_users = timed_count_users;
+    timed_engine.for_each_username = timed_for_each_username;
+    timed_engine.for_each_score = timed_for_each_score;
+    storage = &timed_engine;
+
+    log_message(LOG_INFO, "Using %s storage engine", storage->name);
+    return storage->open();
+}
+
+void storage_close(void)
+{
+    storage->close();
+}
+
+void storage_close_thread(void)
+{
+    storage->close_thread();
+}
@@ -0,0 +1,246 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_AUTH
+#include "user_cache.h"
+#include "config.h"
+#include "storage.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct
+{
+  char username[DB_USERNAME_MAX];
+  char password[DB_PASSWORD_MAX];
+  int user_id;
+  bool used;
+  bool negative;
+  // CLOCK reference bit, set on every hit
+  bool referenced;
+  time_t expires_at;
+  // Next entry index in the same bucket, -1 for none
+  int hash_next;
+} UserCacheEntry;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  UserCacheEntry *entries;
+  size_t capacity;
+  size_t size;
+  size_t hand;
+
+  int *buckets;
+  size_t bucket_count;
+
+  UserCacheStats stats;
+} UserCache;
+
+static UserCache cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static size_t bucket_for(const char *username)
+{
+  // FNV-1a
+  uint64_t hash = 1469598103934665603ULL;
+  for (const unsigned char *c = (const unsigned char *)username; *c; c++)
+  {
+    hash ^= *c;
+    hash *= 1099511628211ULL;
+  }
+  return hash & (cache.bucket_count - 1);
+}
+
+static int find_entry(const char *username)
+{
+  for (int i = cache.buckets[bucket_for(username)]; i >= 0; i = cache.entries[i].hash_next)
+  {
+    if (strcmp(cache.entries[i].username, username) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static void unlink_entry(int index)
+{
+  int *link = &cache.buckets[bucket_for(cache.entries[index].username)];
+  while (*link >= 0 && *link != index)
+    link = &cache.entries[*link].hash_next;
+  if (*link >= 0)
+    *link = cache.entries[index].hash_next;
+
+  cache.entries[index].used = false;
+  cache.size--;
+}
+
+// Returns a free slot, evicting with CLOCK if the cache is full
+static int claim_entry()
+{
+  while (true)
+  {
+    UserCacheEntry *entry = &cache.entries[cache.hand];
+    int index = (int)cache.hand;
+    cache.hand = (cache.hand + 1) % cache.capacity;
+
+    if (!entry->used)
+      return index;
+
+    if (entry->referenced)
+    {
+      entry->referenced = false;
+      continue;
+    }
+
+    unlink_entry(index);
+    cache.stats.evictions++;
+    return index;
+  }
+}
+
+static void put_locked(const char *username, int user_id, const char *password, bool negative)
+{
+  if (strlen(username) >= DB_USERNAME_MAX || (password && strlen(password) >= DB_PASSWORD_MAX))
+    return;
+
+  int index = find_entry(username);
+  if (index < 0)
+  {
+    index = claim_entry();
+    size_t bucket = bucket_for(username);
+    cache.entries[index].hash_next = cache.buckets[bucket];
+    cache.buckets[bucket] = index;
+    cache.size++;
+  }
+
+  UserCacheEntry *entry = &cache.entries[index];
+  strcpy(entry->username, username);
+  strcpy(entry->password, password ? password : "");
+  entry->user_id = user_id;
+  entry->used = true;
+  entry->negative = negative;
+  entry->referenced = false;
+  entry->expires_at = negative ? time(NULL) + server_config.cache_users_negative_ttl_s : 0;
+}
+
+bool user_cache_init()
+{
+  if (server_config.cache_users_capacity <= 0)
+    return false;
+
+  cache.capacity = (size_t)server_config.cache_users_capacity;
+  cache.bucket_count = 1;
+  while (cache.bucket_count < cache.capacity)
+    cache.bucket_count *= 2;
+
+  cache.entries = calloc(cache.capacity, sizeof(UserCacheEntry));
+  cache.buckets = malloc(cache.bucket_count * sizeof(int));
+  if (!cache.entries || !cache.buckets)
+    return false;
+
+  for (size_t i = 0; i < cache.bucket_count; i++)
+    cache.buckets[i] = -1;
+
+  cache.size = 0;
+  cache.hand = 0;
+  memset(&cache.stats, 0, sizeof(cache.stats));
+  return true;
+}
+
+void user_cache_free()
+{
+  pthread_mutex_lock(&cache.lock);
+  free(cache.entries);
+  free(cache.buckets);
+  cache.entries = NULL;
+  cache.buckets = NULL;
+  cache.size = 0;
+  pthread_mutex_unlock(&cache.lock);
+}
+
+UserCacheResult user_cache_get(const char *username, int *user_id, char *password, size_t password_size)
+{
+  UserCacheResult result = USER_CACHE_MISS;
+
+  pthread_mutex_lock(&cache.lock);
+
+  int index = find_entry(username);
+  if (index >= 0)
+  {
+    UserCacheEntry *entry = &cache.entries[index];
+    if (entry->negative && entry->expires_at <= time(NULL))
+    {
+      unlink_entry(index);
+    }
+    else if (entry->negative)
+    {
+      entry->referenced = true;
+      result = USER_CACHE_NEGATIVE;
+    }
+    else if (snprintf(password, password_size, "%s", entry->password) < (int)password_size)
+    {
+      entry->referenced = true;
+      *user_id = entry->user_id;
+      result = USER_CACHE_HIT;
+    }
+  }
+
+  switch (result)
+  {
+  case USER_CACHE_HIT:
+    cache.stats.hits++;
+    break;
+  case USER_CACHE_NEGATIVE:
+    cache.stats.negative_hits++;
+    break;
+  case USER_CACHE_MISS:
+    cache.stats.misses++;
+    break;
+  }
+
+  pthread_mutex_unlock(&cache.lock);
+  return result;
+}
+
+void user_cache_put(const char *username, int user_id, const char *password)
+{
+  pthread_mutex_lock(&cache.lock);
+  put_locked(username, user_id, password, false);
+  pthread_mutex_unlock(&cache.lock);
+}
+
+void user_cache_put_negative(const char *username)
+{
+  if (server_config.cache_users_negative_ttl_s <= 0)
+    return;
+
+  pthread_mutex_lock(&cache.lock);
+  // Never let a stale negative replace a known user
+  int index = find_entry(username);
+  if (index < 0 || cache.entries[index].negative)
+    put_locked(username, -1, NULL, true);
+  pthread_mutex_unlock(&cache.lock);
+}
+
+void user_cache_invalidate(const char *username)
+{
+  pthread_mutex_lock(&cache.lock);
+  int index = find_entry(username);
+  if (index >= 0)
+  {
+    unlink_entry(index);
+    cache.stats.invalidations++;
+  }
+  pthread_mutex_unlock(&cache.lock);
+}
+
+UserCacheStats user_cache_stats()
+{
+  pthread_mutex_lock(&cache.lock);
+  UserCacheStats stats = cache.stats;
+  stats.size = cache.size;
+  stats.capacity = cache.capacity;
+  pthread_mutex_unlock(&cache.lock);
+  return stats;
+}
@@ -0,0 +1,71 @@
+#define LOG_SUBSYSTEM LOG_SUBSYSTEM_AUTH
+#include "username_filter.h"
+#include "bloom.h"
+#include "config.h"
+#include "storage.h"
+#include "utils.h"
+
+static BloomFilter username_filter;
+static uint64_t filter_definitely_free = 0;
+static uint64_t filter_maybe_taken = 0;
+
+static void add_username(void *ctx, const char *username)
+{
+  (void)ctx;
+  bloom_add(&username_filter, username);
+}
+
+bool username_filter_init()
+{
+  long users = storage->count_users();
+  if (users < 0)
+    return false;
+
+  // Leave room to double before the false positive rate degrades
+  size_t capacity = (size_t)users * 2;
+  if (capacity < (size_t)server_config.cache_username_filter_min_capacity)
+    capacity = (size_t)server_config.cache_username_filter_min_capacity;
+
+  if (!bloom_init(&username_filter, capacity, (unsigned int)server_config.cache_username_filter_bits))
+    return false;
+
+  // Names that were never added would read as definitely free, so a
+  // partial filter is dropped and every name is maybe taken
+  if (storage->for_each_username(add_username, NULL) < 0)
+  {
+    bloom_free(&username_filter);
+    return false;
+  }
+
+  log_message(LOG_INFO, "Username filter built with %ld users (%zu bits)", users, username_filter.bit_count);
+  return true;
+}
+
+void username_filter_free()
+{
+  bloom_free(&username_filter);
+}
+
+void username_filter_add(const char *username)
+{
+  bloom_add(&username_filter, username);
+}
+
+bool username_maybe_taken(const char *username)
+{
+  bool maybe = bloom_maybe_contains(&username_filter, username);
+  __atomic_fetch_add(maybe ? &filter_maybe_taken : &filter_definitely_free, 1, __ATOMIC_RELAXED);
+  return maybe;
+}
+
+UsernameFilterStats username_filter_stats()
+{
+  UsernameFilterStats stats = {
+      .bits = username_filter.bit_count,
+      .hashes = username_filter.hash_count,
+      .usernames = __atomic_load_n(&username_filter.inserted, __ATOMIC_RELAXED),
+      .definitely_free = __atomic_load_n(&filter_definitely_free, __ATOMIC_RELAXED),
+      .maybe_taken = __atomic_load_n(&filter_maybe_taken, __ATOMIC_RELAXED),
+  };
+  return stats;
+}
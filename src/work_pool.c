@@ -0,0 +1,180 @@
+#include "work_pool.h"
+#include "utils.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+bool completion_queue_init(CompletionQueue *cq)
+{
+  cq->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (cq->eventfd < 0)
+  {
+    log_message(LOG_ERROR, "Could not create eventfd: %s", strerror(errno));
+    return false;
+  }
+
+  pthread_mutex_init(&cq->lock, NULL);
+  cq->head = NULL;
+  cq->tail = NULL;
+  return true;
+}
+
+void completion_queue_free(CompletionQueue *cq)
+{
+  close(cq->eventfd);
+  pthread_mutex_destroy(&cq->lock);
+}
+
+void completion_queue_push(CompletionQueue *cq, WorkJob *job)
+{
+  job->next = NULL;
+
+  pthread_mutex_lock(&cq->lock);
+  bool was_empty = cq->head == NULL;
+  if (cq->tail)
+    cq->tail->next = job;
+  else
+    cq->head = job;
+  cq->tail = job;
+  pthread_mutex_unlock(&cq->lock);
+
+  // The loop drains the whole list per wakeup, so only the first push needs
+  // to signal
+  if (was_empty)
+  {
+    uint64_t one = 1;
+    if (write(cq->eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      log_message(LOG_ERROR, "Could not signal completion: %s", strerror(errno));
+  }
+}
+
+void completion_queue_drain(CompletionQueue *cq)
+{
+  uint64_t value;
+  if (read(cq->eventfd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    log_message(LOG_ERROR, "Could not read completion eventfd: %s", strerror(errno));
+
+  pthread_mutex_lock(&cq->lock);
+  WorkJob *job = cq->head;
+  cq->head = NULL;
+  cq->tail = NULL;
+  pthread_mutex_unlock(&cq->lock);
+
+  while (job)
+  {
+    WorkJob *next = job->next;
+    job->done(job);
+    job = next;
+  }
+}
+
+static void *work_pool_main(void *arg)
+{
+  WorkPool *pool = arg;
+
+  while (true)
+  {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == 0 && !pool->stopping)
+      pthread_cond_wait(&pool->not_empty, &pool->lock);
+
+    if (pool->count == 0 && pool->stopping)
+    {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+
+    WorkJob *job = pool->queue[pool->head];
+    pool->head = (pool->head + 1) % pool->capacity;
+    pool->count--;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (job->deadline_ns != 0 && monotonic_ns() > job->deadline_ns)
+    {
+      job->expired = true;
+      completion_queue_push(pool->completions, job);
+      continue;
+    }
+
+    if (job->run(job))
+      completion_queue_push(pool->completions, job);
+  }
+
+  if (pool->thread_exit)
+    pool->thread_exit();
+  return NULL;
+}
+
+bool work_pool_start(WorkPool *pool, const char *name, size_t thread_count, size_t capacity,
+                     CompletionQueue *completions, void (*thread_exit)(void))
+{
+  memset(pool, 0, sizeof(*pool));
+  pool->name = name;
+  pool->capacity = capacity;
+  pool->completions = completions;
+  pool->thread_exit = thread_exit;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->not_empty, NULL);
+
+  pool->queue = malloc(capacity * sizeof(WorkJob *));
+  pool->threads = malloc(thread_count * sizeof(pthread_t));
+  if (!pool->queue || !pool->threads || capacity == 0 || thread_count == 0)
+  {
+    log_message(LOG_ERROR, "Invalid %s pool size", name);
+    free(pool->queue);
+    free(pool->threads);
+    return false;
+  }
+
+  for (size_t i = 0; i < thread_count; i++)
+  {
+    if (pthread_create(&pool->threads[i], NULL, work_pool_main, pool) != 0)
+    {
+      log_message(LOG_ERROR, "Could not start %s pool thread: %s", name, strerror(errno));
+      work_pool_stop(pool);
+      return false;
+    }
+    pool->thread_count++;
+  }
+
+  log_message(LOG_INFO, "Started %s pool with %zu threads", name, thread_count);
+  return true;
+}
+
+void work_pool_stop(WorkPool *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->not_empty);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->thread_count; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  free(pool->queue);
+  free(pool->threads);
+  pool->queue = NULL;
+  pool->threads = NULL;
+  pool->thread_count = 0;
+}
+
+bool work_pool_submit(WorkPool *pool, WorkJob *job)
+{
+  pthread_mutex_lock(&pool->lock);
+
+  if (pool->stopping || pool->count == pool->capacity)
+  {
+    pthread_mutex_unlock(&pool->lock);
+    return false;
+  }
+
+  pool->queue[(pool->head + pool->count) % pool->capacity] = job;
+  pool->count++;
+  pthread_cond_signal(&pool->not_empty);
+
+  pthread_mutex_unlock(&pool->lock);
+  return true;
+}
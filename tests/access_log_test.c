@@ -0,0 +1,172 @@
+// Checks that access log records come out of the mapped files in order,
+// that full files rotate and the oldest is dropped, and that a restart keeps
+// the previous file. Build and run with `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "access_log.h"
+#include "config.h"
+#include "utils.h"
+
+#define RECORDS_PER_FILE (4096 / sizeof(AccessLogRecord) - 1)
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+static char dir[] = "/tmp/access_log_test_XXXXXX";
+
+static void file_path(char *out, size_t size, int n)
+{
+  if (n == 0)
+    snprintf(out, size, "%s/access.bin", dir);
+  else
+    snprintf(out, size, "%s/access.bin.%d", dir, n);
+}
+
+// Checks the header and that the file holds exactly timestamps first..last
+static void check_file(int n, uint64_t first, uint64_t last)
+{
+  char path[512];
+  file_path(path, sizeof(path), n);
+  FILE *f = fopen(path, "rb");
+  CHECK(f != NULL);
+  if (!f)
+    return;
+
+  AccessLogHeader header;
+  CHECK(fread(&header, sizeof(header), 1, f) == 1);
+  CHECK(memcmp(header.magic, ACCESS_LOG_MAGIC, sizeof(ACCESS_LOG_MAGIC)) == 0);
+  CHECK(header.version == ACCESS_LOG_VERSION);
+  CHECK(header.record_size == sizeof(AccessLogRecord));
+  CHECK(header.byte_order == ACCESS_LOG_BYTE_ORDER);
+
+  AccessLogRecord record;
+  uint64_t expected = first;
+  while (fread(&record, sizeof(record), 1, f) == 1)
+  {
+    CHECK(record.timestamp_us == expected);
+    CHECK(record.route == expected % ROUTE_COUNT);
+    CHECK(record.bytes_out == expected * 1000);
+    expected++;
+  }
+  CHECK(expected == last + 1);
+  fclose(f);
+}
+
+static void wait_written(uint64_t written)
+{
+  for (int i = 0; i < 1000 && access_log_stats().written < written; i++)
+  {
+    struct timespec ts = {.tv_nsec = 1000000};
+    nanosleep(&ts, NULL);
+  }
+}
+
+static void test_rotation()
+{
+  CHECK(access_log_start());
+  CHECK(access_log_enabled());
+
+  uint64_t total = RECORDS_PER_FILE * 3 + 11;
+  for (uint64_t i = 1; i <= total; i++)
+  {
+    AccessLogRecord record = {
+        .timestamp_us = i,
+        .family = 4,
+        .method = METHOD_GET,
+        .route = (uint16_t)(i % ROUTE_COUNT),
+        .status = 200,
+        .bytes_out = i * 1000,
+    };
+    access_log_write(&record);
+    // Keep the ring from overflowing, this checks the files not the drops
+    if (i % 32 == 0)
+      wait_written(i);
+  }
+  access_log_stop();
+
+  AccessLogStats stats = access_log_stats();
+  CHECK(stats.written == total);
+  CHECK(stats.dropped == 0);
+  CHECK(stats.rotations == 3);
+  CHECK(stats.failures == 0);
+
+  // Three files kept, the first one was rotated out
+  char path[512];
+  file_path(path, sizeof(path), 3);
+  CHECK(access(path, F_OK) != 0);
+  check_file(2, RECORDS_PER_FILE + 1, RECORDS_PER_FILE * 2);
+  check_file(1, RECORDS_PER_FILE * 2 + 1, RECORDS_PER_FILE * 3);
+  check_file(0, RECORDS_PER_FILE * 3 + 1, total);
+
+  // Cut to what was written
+  struct stat st;
+  file_path(path, sizeof(path), 0);
+  CHECK(stat(path, &st) == 0 && st.st_size == (off_t)(sizeof(AccessLogHeader) + 11 * sizeof(AccessLogRecord)));
+}
+
+static void test_restart()
+{
+  CHECK(access_log_start());
+  access_log_stop();
+
+  // The last run's file moved aside instead of being truncated
+  check_file(1, RECORDS_PER_FILE * 3 + 1, RECORDS_PER_FILE * 3 + 11);
+  check_file(0, 1, 0);
+}
+
+static void test_disabled()
+{
+  server_config.access_log_path[0] = '\0';
+  CHECK(access_log_start());
+  CHECK(!access_log_enabled());
+  access_log_stop();
+}
+
+static void cleanup()
+{
+  char path[512];
+  for (int n = 0; n < 4; n++)
+  {
+    file_path(path, sizeof(path), n);
+    unlink(path);
+  }
+  rmdir(dir);
+}
+
+int main(void)
+{
+  if (!mkdtemp(dir))
+  {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+
+  printf("access_log\n");
+  file_path(server_config.access_log_path, sizeof(server_config.access_log_path), 0);
+  server_config.access_log_max_bytes = 4096;
+  server_config.access_log_max_files = 3;
+  server_config.access_log_queue_records = 64;
+  server_config.access_log_flush_interval_ms = 1;
+
+  test_rotation();
+  test_restart();
+  test_disabled();
+
+  cleanup();
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,186 @@
+// Checks that an online backup of a WAL database taken while another thread
+// keeps writing is a whole, consistent database, renamed into place once
+// complete. Build and run with `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "backup.h"
+#include "config.h"
+#include "storage.h"
+#include "utils.h"
+
+#define SEED_SCORES 20000
+
+static int failures = 0;
+
+#define CHECK(cond)                                                           \
+    do                                                                        \
+    {                                                                         \
+        if (!(cond))                                                          \
+        {                                                                     \
+            fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                       \
+        }                                                                     \
+    } while (0)
+
+static struct
+{
+    volatile bool stop;
+    // Commits made while the backup was copying pages
+    int during_backup;
+    int total;
+} writer;
+
+static void *write_scores(void *arg)
+{
+    (void)arg;
+    int64_t row_id;
+    while (!writer.stop)
+    {
+        bool running = backup_stats().running;
+        bool ok = storage->begin();
+        for (int i = 0; ok && i < 10; i++)
+            ok = storage->add_score(1, "writer", writer.total + i, time(NULL), &row_id);
+        if (ok && storage->commit())
+        {
+            writer.total += 10;
+            if (running && backup_stats().running)
+                writer.during_backup++;
+        }
+        else
+        {
+            storage->rollback();
+        }
+    }
+    storage_close_thread();
+    return NULL;
+}
+
+static bool wait_completed(uint64_t completed)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        BackupStats stats = backup_stats();
+        if (stats.completed + stats.failed >= completed && !stats.running)
+            return true;
+        struct timespec ts = {.tv_nsec = 10000000L};
+        nanosleep(&ts, NULL);
+    }
+    return false;
+}
+
+// Runs a query returning one value on the backup, NULL if it can't
+static char *query_backup(const char *sql, char *out, size_t out_size)
+{
+    sqlite3 *db;
+    sqlite3_stmt *stmt = NULL;
+    char *result = NULL;
+    if (sqlite3_open_v2(server_config.db_backup_path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        snprintf(out, out_size, "%s", (const char *)sqlite3_column_text(stmt, 0));
+        result = out;
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return result;
+}
+
+static void test_backup_under_writes()
+{
+    int64_t row_id;
+    CHECK(storage->begin());
+    CHECK(storage->add_user("writer", "hash", &row_id));
+    for (int i = 0; i < SEED_SCORES; i++)
+        CHECK(storage->add_score(1, "seed", i, 1000 + i, &row_id));
+    CHECK(storage->commit());
+
+    CHECK(backup_start());
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, write_scores, NULL) == 0);
+
+    CHECK(backup_request());
+    // One at a time
+    CHECK(!backup_request());
+    CHECK(wait_completed(1));
+
+    writer.stop = true;
+    pthread_join(thread, NULL);
+    CHECK(writer.during_backup > 0);
+
+    BackupStats stats = backup_stats();
+    CHECK(stats.completed == 1 && stats.failed == 0);
+    CHECK(stats.last_ok && !stats.running);
+    CHECK(stats.pages_total > 0 && stats.pages_done == stats.pages_total);
+    CHECK(stats.last_duration_ms > 0 && stats.last_finished_at > 0);
+
+    // Renamed into place, nothing left behind
+    char tmp_path[sizeof(server_config.db_backup_path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", server_config.db_backup_path);
+    CHECK(access(server_config.db_backup_path, F_OK) == 0);
+    CHECK(access(tmp_path, F_OK) != 0);
+
+    // A whole database, with at least every row committed before it began
+    char value[64];
+    CHECK(query_backup("PRAGMA integrity_check;", value, sizeof(value)) && strcmp(value, "ok") == 0);
+    CHECK(query_backup("SELECT COUNT(*) FROM UserScore WHERE username = 'seed';", value, sizeof(value)) &&
+          atoi(value) == SEED_SCORES);
+    CHECK(query_backup("SELECT COUNT(*) FROM UserScore WHERE username = 'writer';", value, sizeof(value)) &&
+          atoi(value) % 10 == 0 && atoi(value) <= writer.total);
+
+    // A second one replaces the first
+    CHECK(backup_request());
+    CHECK(wait_completed(2));
+    stats = backup_stats();
+    CHECK(stats.completed == 2 && stats.failed == 0);
+    CHECK(query_backup("SELECT COUNT(*) FROM UserScore WHERE username = 'writer';", value, sizeof(value)) &&
+          atoi(value) == writer.total);
+
+    backup_stop();
+    CHECK(!backup_request());
+}
+
+int main(void)
+{
+    printf("backup\n");
+
+    char dir[] = "/tmp/backup_test_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    snprintf(server_config.db_path, sizeof(server_config.db_path), "%s/test.db", dir);
+    snprintf(server_config.db_backup_path, sizeof(server_config.db_backup_path), "%s/backup.db", dir);
+    snprintf(server_config.db_engine, sizeof(server_config.db_engine), "sqlite");
+    snprintf(server_config.db_journal_mode, sizeof(server_config.db_journal_mode), "WAL");
+    // Small steps so the copy is still running while the writer commits
+    server_config.db_backup_interval_s = 0;
+    server_config.db_backup_step_pages = 4;
+    server_config.db_backup_step_sleep_ms = 1;
+
+    if (!storage_open())
+    {
+        fprintf(stderr, "  failed to open\n");
+        failures++;
+    }
+    else
+    {
+        test_backup_under_writes();
+        storage_close();
+    }
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0)
+        fprintf(stderr, "Failed to remove %s\n", dir);
+
+    printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,189 @@
+// Checks that the Bloom filter never forgets a key and that its false
+// positive rate stays close to the theoretical one, and that the username
+// filter never calls a name free when it could not be built. Build and run
+// with `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bloom.h"
+#include "config.h"
+#include "storage.h"
+#include "username_filter.h"
+#include "utils.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+#define ITEMS 20000
+#define PROBES 200000
+
+// The User table, which fails after `fail_after` names when that is set
+static const char *usernames[] = {"alice", "bob", "carol", "dave"};
+static long fail_after = -1;
+
+static long stub_count_users(void)
+{
+  return (long)ARRAY_LEN(usernames);
+}
+
+static long stub_for_each_username(UsernameRowFn fn, void *ctx)
+{
+  for (long i = 0; i < (long)ARRAY_LEN(usernames); i++)
+  {
+    if (i == fail_after)
+      return -1;
+    fn(ctx, usernames[i]);
+  }
+  return (long)ARRAY_LEN(usernames);
+}
+
+static const StorageEngine stub_storage = {
+    .name = "stub",
+    .count_users = stub_count_users,
+    .for_each_username = stub_for_each_username,
+};
+const StorageEngine *storage = &stub_storage;
+
+// Added keys and probes never share a prefix, so every hit on a probe is a
+// false positive
+static void test_rate(unsigned int bits_per_item)
+{
+  BloomFilter filter;
+  CHECK(bloom_init(&filter, ITEMS, bits_per_item));
+
+  char key[32];
+  for (int i = 0; i < ITEMS; i++)
+  {
+    snprintf(key, sizeof(key), "user-%d", i);
+    bloom_add(&filter, key);
+  }
+  CHECK(filter.inserted == ITEMS);
+
+  int missing = 0;
+  for (int i = 0; i < ITEMS; i++)
+  {
+    snprintf(key, sizeof(key), "user-%d", i);
+    if (!bloom_maybe_contains(&filter, key))
+      missing++;
+  }
+  CHECK(missing == 0);
+
+  int false_positives = 0;
+  for (int i = 0; i < PROBES; i++)
+  {
+    snprintf(key, sizeof(key), "probe-%d", i);
+    if (bloom_maybe_contains(&filter, key))
+      false_positives++;
+  }
+
+  // (1 - e^(-kn/m))^k
+  double k = filter.hash_count;
+  double expected = pow(1.0 - exp(-k * ITEMS / (double)filter.bit_count), k);
+  double rate = (double)false_positives / PROBES;
+  printf("  %2u bits/item, %u hashes: %.3f%% false positives, %.3f%% expected\n", bits_per_item,
+         filter.hash_count, rate * 100, expected * 100);
+  CHECK(rate < expected * 1.5 + 0.001);
+  CHECK(rate > expected * 0.5);
+
+  bloom_free(&filter);
+}
+
+static void test_edges()
+{
+  BloomFilter filter;
+  CHECK(!bloom_init(&filter, 0, 10));
+  CHECK(!bloom_init(&filter, 10, 0));
+
+  // Nothing added, nothing there
+  CHECK(bloom_init(&filter, 100, 10));
+  CHECK(!bloom_maybe_contains(&filter, "alice"));
+  CHECK(!bloom_maybe_contains(&filter, ""));
+  bloom_add(&filter, "");
+  CHECK(bloom_maybe_contains(&filter, ""));
+
+  // Far past capacity it degrades to yes for everything, still never no
+  char key[32];
+  for (int i = 0; i < 10000; i++)
+  {
+    snprintf(key, sizeof(key), "user-%d", i);
+    bloom_add(&filter, key);
+  }
+  int missing = 0;
+  for (int i = 0; i < 10000; i++)
+  {
+    snprintf(key, sizeof(key), "user-%d", i);
+    if (!bloom_maybe_contains(&filter, key))
+      missing++;
+  }
+  CHECK(missing == 0);
+  bloom_free(&filter);
+  CHECK(filter.bits == NULL);
+}
+
+static void test_empty()
+{
+  // Nothing is known, so nothing is definitely absent
+  BloomFilter filter = {0};
+  CHECK(bloom_maybe_contains(&filter, "alice"));
+  bloom_add(&filter, "alice");
+  CHECK(filter.inserted == 0);
+
+  CHECK(bloom_init(&filter, 100, 10));
+  CHECK(!bloom_maybe_contains(&filter, "alice"));
+  bloom_free(&filter);
+  CHECK(bloom_maybe_contains(&filter, "alice"));
+}
+
+static void test_username_filter()
+{
+  server_config.cache_username_filter_bits = 10;
+  server_config.cache_username_filter_min_capacity = 1024;
+
+  // Not built yet
+  CHECK(username_maybe_taken("alice"));
+  CHECK(username_maybe_taken("zed"));
+  username_filter_add("zed");
+  CHECK(username_filter_stats().bits == 0);
+
+  CHECK(username_filter_init());
+  for (size_t i = 0; i < ARRAY_LEN(usernames); i++)
+    CHECK(username_maybe_taken(usernames[i]));
+  CHECK(!username_maybe_taken("zed"));
+  username_filter_add("zed");
+  CHECK(username_maybe_taken("zed"));
+  CHECK(username_filter_stats().usernames == ARRAY_LEN(usernames) + 1);
+  username_filter_free();
+
+  // Failed halfway: carol and dave were never added, but aren't free
+  fail_after = 2;
+  CHECK(!username_filter_init());
+  CHECK(username_maybe_taken("carol"));
+  CHECK(username_maybe_taken("dave"));
+  CHECK(username_maybe_taken("zed"));
+  CHECK(username_filter_stats().bits == 0);
+  fail_after = -1;
+  username_filter_free();
+}
+
+int main(void)
+{
+  printf("bloom\n");
+  test_rate(10);
+  test_rate(6);
+  test_rate(16);
+  test_edges();
+  test_empty();
+  test_username_filter();
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,153 @@
+// Checks that object lookups answer the same with and without the key index,
+// including duplicate and differently cased keys, and after every kind of
+// change to the object. Build and run with `make test`.
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "cJSON.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+// What cJSON's list walk returns
+static cJSON *walk(const cJSON *object, const char *name, bool case_sensitive)
+{
+  for (cJSON *item = object->child; item; item = item->next)
+  {
+    // The case sensitive walk stops at an unkeyed item, the other skips it
+    if (!item->string)
+    {
+      if (case_sensitive)
+        return NULL;
+      continue;
+    }
+    if (case_sensitive ? strcmp(name, item->string) == 0 : strcasecmp(name, item->string) == 0)
+      return item;
+  }
+  return NULL;
+}
+
+static void check_lookups(const cJSON *object, int keys)
+{
+  char name[32];
+  for (int i = -2; i < keys + 2; i++)
+  {
+    snprintf(name, sizeof(name), i % 3 == 0 ? "KEY%d" : "key%d", i);
+    CHECK(cJSON_GetObjectItemCaseSensitive(object, name) == walk(object, name, true));
+    CHECK(cJSON_GetObjectItem(object, name) == walk(object, name, false));
+  }
+}
+
+static cJSON *make_object(int keys)
+{
+  char name[32];
+  cJSON *object = cJSON_CreateObject();
+  for (int i = 0; i < keys; i++)
+  {
+    // Every 7th key repeats an earlier one, every 5th is upper case
+    int id = i % 7 == 6 ? i / 2 : i;
+    snprintf(name, sizeof(name), i % 5 == 0 ? "KEY%d" : "key%d", id);
+    cJSON_AddNumberToObject(object, name, i);
+  }
+  return object;
+}
+
+static void test_sizes()
+{
+  int sizes[] = {0, 1, CJSON_INDEX_MIN_KEYS - 1, CJSON_INDEX_MIN_KEYS, CJSON_INDEX_MIN_KEYS + 1, 500};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    cJSON *object = make_object(sizes[i]);
+    check_lookups(object, sizes[i]);
+    CHECK((object->index != NULL) == (sizes[i] > CJSON_INDEX_MIN_KEYS));
+    check_lookups(object, sizes[i]);
+    cJSON_Delete(object);
+  }
+}
+
+static void test_mutations()
+{
+  cJSON *object = make_object(200);
+  CHECK(cJSON_GetObjectItem(object, "key150") != NULL);
+  CHECK(object->index != NULL);
+
+  cJSON_AddStringToObject(object, "late", "x");
+  CHECK(object->index == NULL);
+  CHECK(cJSON_GetObjectItemCaseSensitive(object, "late") != NULL);
+
+  cJSON_DeleteItemFromObjectCaseSensitive(object, "key150");
+  CHECK(cJSON_GetObjectItemCaseSensitive(object, "key150") == NULL);
+
+  cJSON_ReplaceItemInObjectCaseSensitive(object, "key151", cJSON_CreateString("replaced"));
+  cJSON *replaced = cJSON_GetObjectItemCaseSensitive(object, "key151");
+  CHECK(replaced && cJSON_IsString(replaced) && strcmp(replaced->valuestring, "replaced") == 0);
+
+  cJSON *detached = cJSON_DetachItemFromObject(object, "KEY100");
+  CHECK(detached != NULL);
+  CHECK(cJSON_GetObjectItemCaseSensitive(object, "KEY100") == NULL);
+  cJSON_Delete(detached);
+
+  cJSON *first = cJSON_CreateNumber(-1);
+  first->string = strdup("inserted");
+  cJSON_InsertItemInArray(object, 0, first);
+  CHECK(cJSON_GetObjectItemCaseSensitive(object, "inserted") == first);
+
+  check_lookups(object, 200);
+  cJSON_Delete(object);
+}
+
+static void test_parsed_and_special()
+{
+  // A large parsed object, and one with an unkeyed item that stops the walk
+  cJSON *built = make_object(300);
+  char *text = cJSON_PrintUnformatted(built);
+  cJSON_Delete(built);
+  cJSON *object = cJSON_Parse(text);
+  free(text);
+  CHECK(object != NULL);
+  check_lookups(object, 300);
+  CHECK(object->index != NULL);
+
+  cJSON *copy = cJSON_Duplicate(object, true);
+  CHECK(copy->index == NULL);
+  check_lookups(copy, 300);
+  cJSON_Delete(copy);
+
+  cJSON *reference = cJSON_CreateObjectReference(object);
+  CHECK(reference->index == NULL);
+  check_lookups(reference, 300);
+  CHECK(reference->index == NULL);
+  cJSON_Delete(reference);
+
+  cJSON *unkeyed = cJSON_CreateNull();
+  cJSON_AddItemToArray(object, unkeyed);
+  CHECK(!cJSON_BuildIndex(object));
+  check_lookups(object, 300);
+  cJSON_Delete(object);
+
+  cJSON *array = cJSON_CreateArray();
+  CHECK(!cJSON_BuildIndex(array));
+  cJSON_Delete(array);
+}
+
+int main(void)
+{
+  printf("cjson_index\n");
+  test_sizes();
+  test_mutations();
+  test_parsed_and_special();
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,257 @@
+// Differential test of the cJSON scanning backends: every document, valid or
+// broken, must parse to the same tree (or fail at the same byte) as with the
+// scalar reference.
+// Usage: cjson_parse_test [documents] [seed]. Build and run with `make test`.
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cJSON.h"
+
+#define ARRAY_LEN(arr) (sizeof(arr) / sizeof(arr[0]))
+
+typedef struct
+{
+  char *data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+static uint64_t rng_state;
+static int failures = 0;
+
+static uint64_t rng()
+{
+  // xorshift64*
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 2685821657736338717ULL;
+}
+
+static unsigned below(unsigned n)
+{
+  return (unsigned)(rng() % n);
+}
+
+static void put(Buffer *b, const char *s, size_t n)
+{
+  if (b->len + n + 1 > b->cap)
+  {
+    b->cap = (b->len + n + 1) * 2;
+    b->data = realloc(b->data, b->cap);
+    if (!b->data)
+      abort();
+  }
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+  b->data[b->len] = '\0';
+}
+
+static void put_str(Buffer *b, const char *s)
+{
+  put(b, s, strlen(s));
+}
+
+static void put_char(Buffer *b, char c)
+{
+  put(b, &c, 1);
+}
+
+static void gen_whitespace(Buffer *b)
+{
+  static const char ws[] = {' ', '\t', '\n', '\r', 0x01, 0x1f};
+  // Mostly short, sometimes long enough to cross several vector widths
+  unsigned n = below(8) == 0 ? 16 + below(80) : below(3);
+  for (unsigned i = 0; i < n; i++)
+    put_char(b, ws[below(10) == 0 ? below(ARRAY_LEN(ws)) : below(4)]);
+}
+
+static void gen_string(Buffer *b)
+{
+  static const char *escapes[] = {"\\n", "\\\"", "\\\\", "\\/", "\\t", "\\b", "\\f", "\\r",
+                                  "\\u00e9", "\\u0041", "\\ud83d\\ude00", "\\ud83d", "\\u12", "\\x"};
+  put_char(b, '"');
+  unsigned n = below(4) == 0 ? below(200) : below(12);
+  for (unsigned i = 0; i < n; i++)
+  {
+    unsigned kind = below(20);
+    if (kind == 0)
+      put_str(b, escapes[below(ARRAY_LEN(escapes))]);
+    else if (kind == 1)
+      put_char(b, (char)(1 + below(31))); // cJSON keeps raw control characters
+    else if (kind == 2)
+      put_char(b, (char)(0x80 + below(0x80)));
+    else
+      put_char(b, (char)('a' + below(26)));
+  }
+  put_char(b, '"');
+}
+
+static void gen_number(Buffer *b)
+{
+  static const char *odd[] = {"-0", "0", "007", "-", "1e", "1e5", "1E-3", "2.5", "-0.0", "1.",
+                              "12-3", "1+2", "0x10", "999999999999999", "9999999999999999",
+                              "-999999999999999", "123456789012345678901234567890", "1e400", "4.9e-324"};
+  char number[32];
+  switch (below(4))
+  {
+  case 0:
+    put_str(b, odd[below(ARRAY_LEN(odd))]);
+    break;
+  case 1:
+    snprintf(number, sizeof(number), "%lld", (long long)(rng() >> below(64)) * (below(2) ? 1 : -1));
+    put_str(b, number);
+    break;
+  case 2:
+    snprintf(number, sizeof(number), "%.*g", 1 + below(17), (double)(int64_t)rng() / (double)(1 + below(1000000)));
+    put_str(b, number);
+    break;
+  default:
+    snprintf(number, sizeof(number), "%u", below(1000000));
+    put_str(b, number);
+    break;
+  }
+}
+
+static void gen_value(Buffer *b, int depth)
+{
+  gen_whitespace(b);
+  unsigned kind = depth > 4 ? 2 + below(4) : below(6);
+  switch (kind)
+  {
+  case 0:
+  case 1:
+  {
+    bool object = kind == 0;
+    put_char(b, object ? '{' : '[');
+    unsigned n = below(6);
+    for (unsigned i = 0; i < n; i++)
+    {
+      if (i > 0)
+        put_char(b, ',');
+      if (object)
+      {
+        gen_whitespace(b);
+        gen_string(b);
+        gen_whitespace(b);
+        put_char(b, ':');
+      }
+      gen_value(b, depth + 1);
+    }
+    gen_whitespace(b);
+    put_char(b, object ? '}' : ']');
+    break;
+  }
+  case 2:
+  case 3:
+    gen_number(b);
+    break;
+  case 4:
+    gen_string(b);
+    break;
+  default:
+  {
+    static const char *literals[] = {"true", "false", "null", "tru", "nul"};
+    put_str(b, literals[below(ARRAY_LEN(literals))]);
+    break;
+  }
+  }
+  gen_whitespace(b);
+}
+
+static void mutate(Buffer *b)
+{
+  static const char noise[] = "\"\\{}[],:0-.eE \t";
+  if (b->len == 0)
+    return;
+  if (below(2) == 0)
+  {
+    b->len = below((unsigned)b->len);
+    b->data[b->len] = '\0';
+  }
+  else
+  {
+    b->data[below((unsigned)b->len)] = noise[below(sizeof(noise) - 1)];
+  }
+}
+
+static bool same_tree(const cJSON *a, const cJSON *b)
+{
+  for (; a && b; a = a->next, b = b->next)
+  {
+    if (a->type != b->type || a->valueint != b->valueint ||
+        memcmp(&a->valuedouble, &b->valuedouble, sizeof(double)) != 0)
+      return false;
+    if ((a->string == NULL) != (b->string == NULL) || (a->string && strcmp(a->string, b->string) != 0))
+      return false;
+    if ((a->valuestring == NULL) != (b->valuestring == NULL) ||
+        (a->valuestring && strcmp(a->valuestring, b->valuestring) != 0))
+      return false;
+    if (!same_tree(a->child, b->child))
+      return false;
+  }
+  return a == b;
+}
+
+static void check(const Buffer *doc, const cJSON_ScanBackend *backends, size_t count)
+{
+  const char *reference_end = NULL;
+  cJSON_SetScanBackend(cJSON_ScanScalar);
+  cJSON *reference = cJSON_ParseWithLengthOpts(doc->data, doc->len, &reference_end, false);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const char *end = NULL;
+    cJSON_SetScanBackend(backends[i]);
+    cJSON *parsed = cJSON_ParseWithLengthOpts(doc->data, doc->len, &end, false);
+
+    if ((parsed == NULL) != (reference == NULL) || end != reference_end || !same_tree(parsed, reference))
+    {
+      if (failures++ < 5)
+        fprintf(stderr, "  %s differs from scalar (%s, stopped at %td vs %td) on:\n  %.*s\n",
+                cJSON_GetScanBackend(), parsed ? "parsed" : "failed", end - doc->data,
+                reference_end - doc->data, (int)doc->len, doc->data);
+    }
+    cJSON_Delete(parsed);
+  }
+  cJSON_Delete(reference);
+}
+
+int main(int argc, char **argv)
+{
+  long documents = argc > 1 ? atol(argv[1]) : 20000;
+  rng_state = argc > 2 ? strtoull(argv[2], NULL, 10) : 0x9e3779b97f4a7c15ULL;
+  if (rng_state == 0)
+    rng_state = 1;
+
+  const cJSON_ScanBackend all[] = {cJSON_ScanWord, cJSON_ScanSSE2, cJSON_ScanAVX2};
+  cJSON_ScanBackend backends[ARRAY_LEN(all)];
+  size_t count = 0;
+
+  printf("cjson_parse\n");
+  for (size_t i = 0; i < ARRAY_LEN(all); i++)
+  {
+    if (cJSON_SetScanBackend(all[i]))
+    {
+      backends[count++] = all[i];
+      printf("  %s\n", cJSON_GetScanBackend());
+    }
+  }
+
+  Buffer doc = {0};
+  for (long i = 0; i < documents; i++)
+  {
+    doc.len = 0;
+    gen_value(&doc, 0);
+    check(&doc, backends, count);
+
+    mutate(&doc);
+    check(&doc, backends, count);
+  }
+  free(doc.data);
+
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,271 @@
+// Checks the group-commit writer's batching against a stub storage engine
+// that records every commit. Build and run with `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "db_writer.h"
+#include "storage.h"
+#include "utils.h"
+
+#define MAX_COMMITS 64
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  // Rows in each committed batch
+  int commits[MAX_COMMITS];
+  int commit_count;
+  int rows; // In the open transaction
+  int64_t next_row_id;
+  // While closed, commit() waits for the test to open it
+  bool gate_closed;
+  int acked;
+  int failed;
+} stub = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+};
+
+static bool stub_begin(void)
+{
+  pthread_mutex_lock(&stub.lock);
+  stub.rows = 0;
+  pthread_mutex_unlock(&stub.lock);
+  return true;
+}
+
+static bool stub_commit(void)
+{
+  pthread_mutex_lock(&stub.lock);
+  while (stub.gate_closed)
+    pthread_cond_wait(&stub.changed, &stub.lock);
+  if (stub.commit_count < MAX_COMMITS)
+    stub.commits[stub.commit_count] = stub.rows;
+  stub.commit_count++;
+  pthread_cond_broadcast(&stub.changed);
+  pthread_mutex_unlock(&stub.lock);
+  return true;
+}
+
+static bool stub_rollback(void)
+{
+  return true;
+}
+
+static bool stub_add_row(int64_t *row_id)
+{
+  pthread_mutex_lock(&stub.lock);
+  stub.rows++;
+  *row_id = ++stub.next_row_id;
+  pthread_mutex_unlock(&stub.lock);
+  return true;
+}
+
+static bool stub_add_user(const char *username, const char *password, int64_t *row_id)
+{
+  (void)username;
+  (void)password;
+  return stub_add_row(row_id);
+}
+
+static bool stub_add_score(int user_id, const char *username, int score, long timestamp, int64_t *row_id)
+{
+  (void)user_id;
+  (void)username;
+  (void)score;
+  (void)timestamp;
+  return stub_add_row(row_id);
+}
+
+static void stub_noop(void)
+{
+}
+
+static const StorageEngine stub_storage = {
+    .name = "stub",
+    .close_thread = stub_noop,
+    .begin = stub_begin,
+    .commit = stub_commit,
+    .rollback = stub_rollback,
+    .add_user = stub_add_user,
+    .add_score = stub_add_score,
+    .maintain = stub_noop,
+};
+const StorageEngine *storage = &stub_storage;
+
+#ifdef __GLIBC__
+// Lets a test make the writer's batch allocation fail
+extern void *__libc_malloc(size_t size);
+static volatile bool fail_batches = false;
+
+void *malloc(size_t size)
+{
+  if (fail_batches && size >= 1024 * 1024)
+    return NULL;
+  return __libc_malloc(size);
+}
+#endif
+
+static void written(void *ctx, bool ok, int64_t row_id)
+{
+  (void)ctx;
+  pthread_mutex_lock(&stub.lock);
+  if (ok && row_id > 0)
+    stub.acked++;
+  else if (!ok)
+    stub.failed++;
+  pthread_cond_broadcast(&stub.changed);
+  pthread_mutex_unlock(&stub.lock);
+}
+
+static void acked_early(void *ctx, bool ok, int64_t row_id)
+{
+  (void)ctx;
+  (void)row_id;
+  pthread_mutex_lock(&stub.lock);
+  if (ok)
+    stub.acked++;
+  pthread_mutex_unlock(&stub.lock);
+}
+
+// Waits until `count` writes have been answered, false after 5s
+static bool wait_answered(int count)
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 5;
+
+  pthread_mutex_lock(&stub.lock);
+  int rc = 0;
+  while (stub.acked + stub.failed < count && rc == 0)
+    rc = pthread_cond_timedwait(&stub.changed, &stub.lock, &deadline);
+  bool done = stub.acked + stub.failed >= count;
+  pthread_mutex_unlock(&stub.lock);
+  return done;
+}
+
+static void start(int batch_size, int flush_ms, bool ack_before_durable)
+{
+  pthread_mutex_lock(&stub.lock);
+  stub.commit_count = 0;
+  stub.acked = 0;
+  stub.failed = 0;
+  pthread_mutex_unlock(&stub.lock);
+
+  server_config.db_writer_queue_size = 64;
+  server_config.db_writer_batch_size = batch_size;
+  server_config.db_writer_flush_ms = flush_ms;
+  server_config.db_writer_ack_before_durable = ack_before_durable;
+  CHECK(db_writer_start());
+}
+
+static void test_full_batches()
+{
+  // Flushing on time alone would take 10s, so only full batches are quick
+  start(8, 10000, false);
+  uint64_t started = monotonic_ns();
+
+  char name[16];
+  for (int i = 0; i < 16; i++)
+  {
+    snprintf(name, sizeof(name), "user-%d", i);
+    CHECK(db_writer_add_user(name, "hash", written, NULL));
+  }
+  CHECK(wait_answered(16));
+  CHECK(monotonic_ns() - started < 2000000000ULL);
+
+  // One transaction per full batch
+  CHECK(stub.commit_count == 2);
+  CHECK(stub.commits[0] == 8 && stub.commits[1] == 8);
+  CHECK(stub.failed == 0);
+  db_writer_stop();
+}
+
+static void test_flush_timer()
+{
+  start(8, 100, false);
+  uint64_t started = monotonic_ns();
+
+  // Two full batches and a partial one, which waits for db.writer_flush_ms
+  for (int i = 0; i < 19; i++)
+    CHECK(db_writer_add_score(1, "alice", i, 1000 + i, written, NULL));
+  CHECK(wait_answered(19));
+  uint64_t elapsed = monotonic_ns() - started;
+
+  CHECK(stub.commit_count == 3);
+  CHECK(stub.commits[0] == 8 && stub.commits[1] == 8 && stub.commits[2] == 3);
+  CHECK(elapsed >= 100000000ULL);
+  CHECK(elapsed < 2000000000ULL);
+  db_writer_stop();
+}
+
+static void test_ack_before_durable()
+{
+  start(8, 1, true);
+
+  pthread_mutex_lock(&stub.lock);
+  stub.gate_closed = true;
+  pthread_mutex_unlock(&stub.lock);
+
+  // Acknowledged on return, while the commit is still held back
+  CHECK(db_writer_add_score(1, "alice", 10, 1000, acked_early, NULL));
+  pthread_mutex_lock(&stub.lock);
+  CHECK(stub.acked == 1);
+  CHECK(stub.commit_count == 0);
+  stub.gate_closed = false;
+  pthread_cond_broadcast(&stub.changed);
+  pthread_mutex_unlock(&stub.lock);
+
+  // Users are always acknowledged after their commit
+  CHECK(db_writer_add_user("bob", "hash", written, NULL));
+  CHECK(wait_answered(2));
+  CHECK(stub.commit_count >= 1);
+  db_writer_stop();
+  CHECK(stub.acked == 2);
+}
+
+#ifdef __GLIBC__
+static void test_no_batch()
+{
+  // Without a batch every write is refused or failed, never lost
+  fail_batches = true;
+  start(1 << 16, 1, false);
+  int queued = 0;
+  for (int i = 0; i < 4; i++)
+    queued += db_writer_add_user("carol", "hash", written, NULL);
+  CHECK(wait_answered(queued));
+  CHECK(stub.acked == 0 && stub.failed == queued);
+  CHECK(stub.commit_count == 0);
+  db_writer_stop();
+  fail_batches = false;
+}
+#endif
+
+int main(void)
+{
+  printf("db_writer\n");
+  test_full_batches();
+  test_flush_timer();
+  test_ack_before_durable();
+#ifdef __GLIBC__
+  test_no_batch();
+#endif
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,144 @@
+// Builds, prints and deletes leaderboard pages with cJSON, once straight on
+// malloc and once inside a JSON arena scope the way a request does, and
+// reports time and malloc calls per page. Then parses a pretty-printed page
+// with each cJSON scanning backend the CPU supports.
+// Usage: json_bench [pages] [entries per page] (defaults 20000 and 100).
+// Build and run with `make bench`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cJSON.h"
+#include "json_arena.h"
+#include "utils.h"
+
+typedef struct
+{
+    double ns_per_page;
+    double mallocs_per_page;
+    double allocations_per_page;
+} PageCost;
+
+static cJSON *make_page(int entries)
+{
+    char username[32];
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "total", 100000);
+    cJSON_AddNumberToObject(json, "offset", 0);
+    cJSON *items = cJSON_AddArrayToObject(json, "entries");
+    for (int i = 0; i < entries; i++)
+    {
+        snprintf(username, sizeof(username), "player%d", i);
+        cJSON *entry = cJSON_CreateObject();
+        cJSON_AddNumberToObject(entry, "rank", i + 1);
+        cJSON_AddStringToObject(entry, "username", username);
+        cJSON_AddNumberToObject(entry, "score", 100000 - i);
+        cJSON_AddNumberToObject(entry, "timestamp", 1700000000 + i);
+        cJSON_AddItemToArray(items, entry);
+    }
+    return json;
+}
+
+static size_t build_page(int entries)
+{
+    cJSON *json = make_page(entries);
+    char *body = cJSON_PrintUnformatted(json);
+    size_t len = body ? strlen(body) : 0;
+    cJSON_free(body);
+    cJSON_Delete(json);
+    return len;
+}
+
+static PageCost run(long pages, int entries, bool use_arena)
+{
+    JsonArenaStats before = json_arena_stats();
+    size_t bytes = 0;
+
+    uint64_t start = monotonic_ns();
+    for (long i = 0; i < pages; i++)
+    {
+        if (use_arena)
+            json_arena_begin();
+        bytes += build_page(entries);
+        if (use_arena)
+            json_arena_end();
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+
+    JsonArenaStats after = json_arena_stats();
+    uint64_t mallocs = (after.heap_allocations - before.heap_allocations) +
+                       (after.chunk_allocations - before.chunk_allocations);
+    uint64_t allocations = (after.heap_allocations - before.heap_allocations) +
+                           (after.arena_allocations - before.arena_allocations);
+    if (bytes == 0)
+        fprintf(stderr, "Printing failed\n");
+
+    return (PageCost){
+        .ns_per_page = (double)elapsed / (double)pages,
+        .mallocs_per_page = (double)mallocs / (double)pages,
+        .allocations_per_page = (double)allocations / (double)pages,
+    };
+}
+
+static double parse_ns_per_page(const char *text, long pages)
+{
+    size_t len = strlen(text);
+    uint64_t start = monotonic_ns();
+    for (long i = 0; i < pages; i++)
+    {
+        json_arena_begin();
+        if (!cJSON_ParseWithLength(text, len))
+            fprintf(stderr, "Parsing failed\n");
+        json_arena_end();
+    }
+    return (double)(monotonic_ns() - start) / (double)pages;
+}
+
+int main(int argc, char **argv)
+{
+    long pages = argc > 1 ? atol(argv[1]) : 20000;
+    int entries = argc > 2 ? atoi(argv[2]) : 100;
+    if (pages <= 0 || entries < 0)
+    {
+        fprintf(stderr, "Usage: %s [pages] [entries per page]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    json_arena_init();
+
+    // Warm up both paths so the arena has settled on its chunk size
+    run(pages / 10 + 1, entries, false);
+    run(pages / 10 + 1, entries, true);
+
+    PageCost heap = run(pages, entries, false);
+    PageCost arena = run(pages, entries, true);
+
+    printf("%ld pages of %d entries\n", pages, entries);
+    printf("%-8s %10s %14s %12s\n", "", "ns/page", "cJSON allocs", "mallocs");
+    printf("%-8s %10.0f %14.1f %12.1f\n", "malloc", heap.ns_per_page,
+           heap.allocations_per_page, heap.mallocs_per_page);
+    printf("%-8s %10.0f %14.1f %12.1f\n", "arena", arena.ns_per_page,
+           arena.allocations_per_page, arena.mallocs_per_page);
+
+    cJSON *page = make_page(entries);
+    char *text = cJSON_Print(page);
+    cJSON_Delete(page);
+    if (!text)
+        return EXIT_FAILURE;
+
+    const cJSON_ScanBackend backends[] = {cJSON_ScanScalar, cJSON_ScanWord, cJSON_ScanSSE2, cJSON_ScanAVX2};
+    printf("\nparse, %zu bytes\n", strlen(text));
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        if (!cJSON_SetScanBackend(backends[i]))
+            continue;
+        parse_ns_per_page(text, pages / 10 + 1);
+        printf("%-8s %10.0f ns/page\n", cJSON_GetScanBackend(), parse_ns_per_page(text, pages));
+    }
+    cJSON_SetScanBackend(cJSON_ScanAuto);
+    cJSON_free(text);
+
+    json_arena_thread_free();
+    return EXIT_SUCCESS;
+}
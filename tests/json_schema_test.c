@@ -0,0 +1,75 @@
+// Checks the schema-driven body extractor against valid and malformed bodies.
+// Build and run with `make test`.
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json_schema.h"
+
+#define ARRAY_LEN(arr) (sizeof(arr) / sizeof(arr[0]))
+
+typedef struct
+{
+  char username[8];
+  int score;
+} Body;
+
+static const JsonField body_fields[] = {
+    JSON_STRING_FIELD(Body, username, 1),
+    JSON_INT_FIELD(Body, score, 0, INT_MAX),
+};
+
+static int failures = 0;
+
+static void expect(const char *json, JsonExtractResult expected, const char *username, int score)
+{
+  Body body = {0};
+  JsonExtractResult result = json_extract(body_fields, ARRAY_LEN(body_fields), json, strlen(json), &body);
+
+  bool ok = result == expected;
+  if (ok && expected == JSON_EXTRACT_OK)
+    ok = strcmp(body.username, username) == 0 && body.score == score;
+
+  if (!ok)
+  {
+    fprintf(stderr, "  %s: got \"%s\" (%s, %d)\n", json, json_extract_error(result), body.username, body.score);
+    failures++;
+  }
+}
+
+int main(void)
+{
+  printf("json_schema\n");
+
+  expect("{\"username\":\"alice\",\"score\":42}", JSON_EXTRACT_OK, "alice", 42);
+  expect(" {\n \"score\" : 0 , \"username\" : \"bob\" } \n", JSON_EXTRACT_OK, "bob", 0);
+  expect("{\"username\":\"a\\\"b\\\\c\",\"score\":1}", JSON_EXTRACT_OK, "a\"b\\c", 1);
+  expect("{\"username\":\"\\u00e9t\\u00e9\",\"score\":1}", JSON_EXTRACT_OK, "\xc3\xa9t\xc3\xa9", 1);
+  expect("{\"username\":\"\\ud83d\\ude00\",\"score\":1}", JSON_EXTRACT_OK, "\xf0\x9f\x98\x80", 1);
+  expect("{\"extra\":{\"a\":[1,2,{\"b\":null}],\"c\":\"}\"},\"username\":\"x\",\"score\":2147483647,\"z\":true}",
+         JSON_EXTRACT_OK, "x", INT_MAX);
+
+  expect("", JSON_EXTRACT_MALFORMED, NULL, 0);
+  expect("[]", JSON_EXTRACT_MALFORMED, NULL, 0);
+  expect("{\"username\":\"alice\",\"score\":42", JSON_EXTRACT_MALFORMED, NULL, 0);
+  expect("{\"username\":\"alice\",\"score\":42,}", JSON_EXTRACT_MALFORMED, NULL, 0);
+  expect("{\"username\":\"alice\",\"score\":42} x", JSON_EXTRACT_MALFORMED, NULL, 0);
+  expect("{\"username\":\"al\nice\",\"score\":42}", JSON_EXTRACT_MALFORMED, NULL, 0);
+  expect("{\"username\":\"a\\u0000\",\"score\":42}", JSON_EXTRACT_MALFORMED, NULL, 0);
+  expect("{\"username\":\"a\",\"score\":01}", JSON_EXTRACT_MALFORMED, NULL, 0);
+  expect("{\"x\":tru,\"username\":\"a\",\"score\":1}", JSON_EXTRACT_MALFORMED, NULL, 0);
+
+  expect("{\"username\":\"alice\"}", JSON_EXTRACT_MISSING, NULL, 0);
+  expect("{\"username\":\"a\",\"username\":\"b\",\"score\":1}", JSON_EXTRACT_DUPLICATE, NULL, 0);
+  expect("{\"username\":1,\"score\":1}", JSON_EXTRACT_WRONG_TYPE, NULL, 0);
+  expect("{\"username\":\"a\",\"score\":\"1\"}", JSON_EXTRACT_WRONG_TYPE, NULL, 0);
+  expect("{\"username\":\"a\",\"score\":1.5}", JSON_EXTRACT_WRONG_TYPE, NULL, 0);
+  expect("{\"username\":\"\",\"score\":1}", JSON_EXTRACT_OUT_OF_RANGE, NULL, 0);
+  expect("{\"username\":\"12345678\",\"score\":1}", JSON_EXTRACT_OUT_OF_RANGE, NULL, 0);
+  expect("{\"username\":\"a\",\"score\":-1}", JSON_EXTRACT_OUT_OF_RANGE, NULL, 0);
+  expect("{\"username\":\"a\",\"score\":2147483648}", JSON_EXTRACT_OUT_OF_RANGE, NULL, 0);
+  expect("{\"username\":\"a\",\"score\":99999999999999999999}", JSON_EXTRACT_WRONG_TYPE, NULL, 0);
+
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,121 @@
+// Checks the latency histograms' percentiles against known distributions and
+// that a snapshot only covers its own interval. Build and run with
+// `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "latency.h"
+#include "utils.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+// Reported values are the top of their bucket, so never below the true one
+// and less than 1/64 above it
+static bool close_to(uint64_t reported, uint64_t expected)
+{
+  return reported >= expected && reported - expected <= expected / 64 + 1;
+}
+
+static void test_uniform()
+{
+  // 1us to 100ms
+  for (uint64_t i = 1; i <= 100000; i++)
+    latency_record(ROUTE_LEADERBOARD, LATENCY_TOTAL, i * 1000);
+
+  LatencySummary s = latency_summary(ROUTE_LEADERBOARD, LATENCY_TOTAL);
+  CHECK(s.count == 100000);
+  CHECK(close_to(s.p50, 50000 * 1000));
+  CHECK(close_to(s.p90, 90000 * 1000));
+  CHECK(close_to(s.p99, 99000 * 1000));
+  CHECK(close_to(s.p999, 99900 * 1000));
+  CHECK(close_to(s.max, 100000 * 1000));
+}
+
+static void test_small_and_huge()
+{
+  // Exact below 128ns
+  for (uint64_t ns = 0; ns < 128; ns++)
+    latency_record(ROUTE_RANK, LATENCY_PARSE, ns);
+  LatencySummary s = latency_summary(ROUTE_RANK, LATENCY_PARSE);
+  CHECK(s.count == 128);
+  CHECK(s.p50 == 63);
+  CHECK(s.max == 127);
+
+  // A stall outside the range lands in the last bucket instead of being lost
+  latency_record(ROUTE_RANK, LATENCY_DB_WAIT, 1000ULL * 1000000000ULL);
+  s = latency_summary(ROUTE_RANK, LATENCY_DB_WAIT);
+  CHECK(s.count == 1);
+  CHECK(s.max >= 100ULL * 1000000000ULL);
+
+  // One slow request in a thousand shows in p99.9 but not in p99
+  for (int i = 0; i < 999; i++)
+    latency_record(ROUTE_SCORE, LATENCY_DB_WAIT, 200000);
+  latency_record(ROUTE_SCORE, LATENCY_DB_WAIT, 400000000);
+  s = latency_summary(ROUTE_SCORE, LATENCY_DB_WAIT);
+  CHECK(close_to(s.p99, 200000));
+  CHECK(close_to(s.p999, 200000));
+  CHECK(close_to(s.max, 400000000));
+
+  CHECK(latency_summary(ROUTE_LOGIN, LATENCY_TOTAL).count == 0);
+}
+
+static void test_snapshot()
+{
+  char path[] = "/tmp/latency_test_XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  close(fd);
+
+  snprintf(server_config.latency_snapshot_path, sizeof(server_config.latency_snapshot_path), "%s", path);
+  server_config.latency_snapshot_interval_ms = 60000;
+
+  // Recorded before the start, so in no interval
+  latency_record(ROUTE_LOGIN, LATENCY_TOTAL, 5000);
+
+  CHECK(latency_start());
+  for (int i = 0; i < 10; i++)
+    latency_record(ROUTE_REGISTER, LATENCY_TOTAL, 1000000);
+  latency_stop();
+
+  char line[4096] = {0};
+  FILE *f = fopen(path, "r");
+  CHECK(f != NULL);
+  if (f)
+  {
+    CHECK(fgets(line, sizeof(line), f) != NULL);
+    char extra[16];
+    CHECK(fgets(extra, sizeof(extra), f) == NULL);
+    fclose(f);
+  }
+  unlink(path);
+
+  CHECK(strstr(line, "\"routes\":{\"register\":{\"total\":{\"count\":10,") != NULL);
+  // 1ms is counted in the bucket up to 1007615ns
+  CHECK(strstr(line, "\"p99.9_us\":1007.615,") != NULL);
+  CHECK(strstr(line, "login") == NULL);
+  CHECK(strstr(line, "leaderboard") == NULL);
+  CHECK(strcmp(line + strlen(line) - 4, "}}}\n") == 0);
+}
+
+int main(void)
+{
+  printf("latency\n");
+  test_uniform();
+  test_small_and_huge();
+  test_snapshot();
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
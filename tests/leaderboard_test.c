@@ -0,0 +1,234 @@
+// Checks the leaderboard's skip list against a plain sorted array over random
+// submissions, with many equal scores and timestamps. Build and run with
+// `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "leaderboard.h"
+#include "storage.h"
+#include "utils.h"
+
+#define PLAYERS 300
+#define ROUNDS 20
+#define SUBMITS_PER_ROUND 500
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+// Best score of every player, what the skip list should hold
+static struct
+{
+  LeaderboardEntry entries[PLAYERS];
+  bool present[PLAYERS];
+} model;
+
+static LeaderboardEntry seed[] = {
+    {"seed-a", 10, 5},
+    {"seed-b", 10, 5},
+    {"seed-a", 7, 1},
+    {"seed-c", 3, 9},
+};
+
+// Only the scores are read by the leaderboard, so no database is needed
+static bool seed_scores(ScoreRowFn fn, void *ctx)
+{
+  for (size_t i = 0; i < ARRAY_LEN(seed); i++)
+    fn(ctx, seed[i].username, seed[i].score, seed[i].timestamp);
+  return true;
+}
+
+static const StorageEngine stub_storage = {
+    .name = "stub",
+    .for_each_score = seed_scores,
+};
+const StorageEngine *storage = &stub_storage;
+
+static bool no_scores(ScoreRowFn fn, void *ctx)
+{
+  (void)fn;
+  (void)ctx;
+  return true;
+}
+
+static const StorageEngine empty_storage = {
+    .name = "empty",
+    .for_each_score = no_scores,
+};
+
+static uint64_t random_state = 0x2545F4914F6CDD1DULL;
+
+static unsigned next_random(unsigned bound)
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return (unsigned)(random_state % bound);
+}
+
+// Same order as the leaderboard: highest score, earliest, then by name
+static int compare_entries(const void *pa, const void *pb)
+{
+  const LeaderboardEntry *a = pa, *b = pb;
+  if (a->score != b->score)
+    return a->score > b->score ? -1 : 1;
+  if (a->timestamp != b->timestamp)
+    return a->timestamp < b->timestamp ? -1 : 1;
+  return strcmp(a->username, b->username);
+}
+
+static size_t sorted_model(LeaderboardEntry *out)
+{
+  size_t count = 0;
+  for (int i = 0; i < PLAYERS; i++)
+    if (model.present[i])
+      out[count++] = model.entries[i];
+  qsort(out, count, sizeof(*out), compare_entries);
+  return count;
+}
+
+static bool same_entry(const LeaderboardEntry *a, const LeaderboardEntry *b)
+{
+  return strcmp(a->username, b->username) == 0 && a->score == b->score && a->timestamp == b->timestamp;
+}
+
+static void check_against_model()
+{
+  static LeaderboardEntry expected[PLAYERS];
+  static LeaderboardEntry got[PLAYERS + 1];
+  size_t count = sorted_model(expected);
+
+  CHECK(leaderboard_size() == count);
+  CHECK(leaderboard_range(0, PLAYERS + 1, got) == count);
+  for (size_t i = 0; i < count; i++)
+    CHECK(same_entry(&got[i], &expected[i]));
+
+  // Every rank, which walks the spans from the top
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t rank = 0;
+    LeaderboardEntry entry;
+    CHECK(leaderboard_rank(expected[i].username, &rank, &entry));
+    CHECK(rank == i + 1);
+    CHECK(same_entry(&entry, &expected[i]));
+  }
+
+  // Pages starting anywhere, which seek by rank, including past the end
+  for (int i = 0; i < 20; i++)
+  {
+    size_t offset = next_random((unsigned)count + 10);
+    size_t limit = 1 + next_random(25);
+    size_t want = offset < count ? (count - offset < limit ? count - offset : limit) : 0;
+    CHECK(leaderboard_range(offset, limit, got) == want);
+    for (size_t j = 0; j < want; j++)
+      CHECK(same_entry(&got[j], &expected[offset + j]));
+  }
+  CHECK(leaderboard_range(count, 10, got) == 0);
+  CHECK(leaderboard_range((size_t)-1, 10, got) == 0);
+  CHECK(leaderboard_range(0, 0, got) == 0);
+}
+
+static void test_seeded()
+{
+  size_t rank = 0;
+  LeaderboardEntry entry;
+
+  // seed-a's best only, tied with seed-b on score and time, so by name
+  CHECK(leaderboard_size() == 3);
+  CHECK(leaderboard_rank("seed-a", &rank, &entry) && rank == 1 && entry.score == 10);
+  CHECK(leaderboard_rank("seed-b", &rank, &entry) && rank == 2);
+  CHECK(leaderboard_rank("seed-c", &rank, &entry) && rank == 3);
+  CHECK(!leaderboard_rank("nobody", &rank, &entry));
+
+  // Not an improvement, nothing moves
+  CHECK(!leaderboard_submit("seed-c", 3, 0));
+  CHECK(leaderboard_rank("seed-c", &rank, &entry) && entry.timestamp == 9);
+}
+
+static void test_random()
+{
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    for (int i = 0; i < SUBMITS_PER_ROUND; i++)
+    {
+      // Few distinct scores and times so ties are the common case
+      int player = (int)next_random(PLAYERS);
+      int score = (int)next_random(40);
+      long timestamp = (long)next_random(8);
+
+      LeaderboardEntry *best = &model.entries[player];
+      bool improves = !model.present[player] || score > best->score;
+      // An improvement takes the node out of the list and puts it back
+      CHECK(leaderboard_submit(best->username, score, timestamp) == improves);
+      if (improves)
+      {
+        model.present[player] = true;
+        best->score = score;
+        best->timestamp = timestamp;
+      }
+    }
+    check_against_model();
+  }
+}
+
+static void test_page_params()
+{
+  size_t limit = 0, offset = 0;
+
+  CHECK(leaderboard_parse_page(NULL, NULL, &limit, &offset));
+  CHECK(limit == LEADERBOARD_PAGE_DEFAULT && offset == 0);
+  CHECK(leaderboard_parse_page("0", "0", &limit, &offset));
+  CHECK(limit == 0 && offset == 0);
+  CHECK(leaderboard_parse_page("100", "1000000000", &limit, &offset));
+  CHECK(limit == LEADERBOARD_PAGE_MAX && offset == LEADERBOARD_OFFSET_MAX);
+  CHECK(leaderboard_parse_page(NULL, "25", &limit, &offset));
+  CHECK(limit == LEADERBOARD_PAGE_DEFAULT && offset == 25);
+
+  // Above the maximum, out of range, negative or not a plain number
+  const char *bad_limits[] = {"101", "99999999999999999999", "18446744073709551615", "-1", "+5", " 5", "5 ",
+                              "", "1e2", "0x10", "ten"};
+  for (size_t i = 0; i < ARRAY_LEN(bad_limits); i++)
+    CHECK(!leaderboard_parse_page(bad_limits[i], NULL, &limit, &offset));
+  const char *bad_offsets[] = {"1000000001", "18446744073709551615", "18446744073709551616", "-0", "-5", ""};
+  for (size_t i = 0; i < ARRAY_LEN(bad_offsets); i++)
+    CHECK(!leaderboard_parse_page("10", bad_offsets[i], &limit, &offset));
+
+  // A valid offset past the end is an empty page
+  LeaderboardEntry got[LEADERBOARD_PAGE_MAX];
+  CHECK(leaderboard_parse_page("100", "1000000000", &limit, &offset));
+  CHECK(leaderboard_range(offset, limit, got) == 0);
+  CHECK(leaderboard_parse_page("100", "2", &limit, &offset));
+  CHECK(leaderboard_range(offset, limit, got) == leaderboard_size() - 2);
+}
+
+int main(void)
+{
+  printf("leaderboard\n");
+
+  for (int i = 0; i < PLAYERS; i++)
+    snprintf(model.entries[i].username, sizeof(model.entries[i].username), "player-%03d", i);
+
+  CHECK(leaderboard_init());
+  test_seeded();
+  test_page_params();
+  leaderboard_free();
+
+  // Empty to begin with, then the same players over and over
+  storage = &empty_storage;
+  CHECK(leaderboard_init());
+  CHECK(leaderboard_size() == 0);
+  test_random();
+  leaderboard_free();
+
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
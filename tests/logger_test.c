@@ -0,0 +1,257 @@
+// Checks that the asynchronous logger writes what printf would have, that
+// overflow and the shutdown flush are accounted for, and that runtime levels
+// filter messages before their arguments are evaluated.
+// Build and run with `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "logger.h"
+#include "utils.h"
+
+#define LINE_MAX_LEN 1024
+#define CASES_MAX 32
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+static char expected[CASES_MAX][LINE_MAX_LEN];
+static int cases = 0;
+
+// Logs the message and remembers how snprintf formats it
+#define CASE(...)                                                   \
+  do                                                                \
+  {                                                                 \
+    log_message(LOG_INFO, __VA_ARGS__);                             \
+    snprintf(expected[cases++], LINE_MAX_LEN, __VA_ARGS__);         \
+  } while (0)
+
+static char log_path[] = "/tmp/logger_test_XXXXXX";
+static int saved_stdout = -1;
+
+// Points stdout at an empty log file
+static void capture_stdout()
+{
+  fflush(stdout);
+  saved_stdout = dup(STDOUT_FILENO);
+  if (!freopen(log_path, "w", stdout))
+    abort();
+}
+
+static void restore_stdout()
+{
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+}
+
+// Returns the message of line n of the log, without time and level
+static bool read_message(FILE *log, char *message)
+{
+  char line[LINE_MAX_LEN + 64];
+  if (!fgets(line, sizeof(line), log))
+    return false;
+  line[strcspn(line, "\n")] = '\0';
+
+  const char *start = strstr(line, "] [");
+  start = start ? strstr(start + 3, "] ") : NULL;
+  strcpy(message, start ? start + 2 : line);
+  return true;
+}
+
+static void test_formatting()
+{
+  char long_string[600];
+  memset(long_string, 'x', sizeof(long_string) - 1);
+  long_string[sizeof(long_string) - 1] = '\0';
+
+  capture_stdout();
+  CHECK(logger_start());
+
+  CASE("plain message");
+  CASE("%s = %d", "server.port", 8080);
+  CASE("%zu rows, %ld, %lld, %u", (size_t)7, -3L, 1LL << 40, 4000000000u);
+  CASE("%.1f%% done", 99.44);
+  CASE("[%5s|%-5s|%.2s]", "ab", "cd", "xyz");
+  CASE("[%*d|%-*d|%.*s]", 4, 7, 4, 7, 3, "abcdef");
+  CASE("%x %X %o %#x %08.3f %e %g %c", 255u, 255u, 8u, 255u, 3.14159, 12345.678, 0.0001, 'z');
+  CASE("%hhd %hu %+d % d", 300, 70000, 5, 5);
+  CASE("%p %s", (void *)0x1234, (char *)NULL);
+  CASE("%Lf", (long double)1.5);
+  CASE("escaped %% then %s", "end");
+
+  logger_stop();
+  restore_stdout();
+
+  FILE *log = fopen(log_path, "r");
+  CHECK(log != NULL);
+  if (!log)
+    return;
+  char message[LINE_MAX_LEN + 64];
+  for (int i = 0; i < cases; i++)
+  {
+    CHECK(read_message(log, message));
+    if (strcmp(message, expected[i]) != 0)
+    {
+      fprintf(stderr, "  got \"%s\", expected \"%s\"\n", message, expected[i]);
+      failures++;
+    }
+  }
+  CHECK(!read_message(log, message));
+  fclose(log);
+
+  // Too long for a record, cut short and marked
+  capture_stdout();
+  CHECK(logger_start());
+  log_message(LOG_ERROR, "%s", long_string);
+  logger_stop();
+  restore_stdout();
+
+  log = fopen(log_path, "r");
+  CHECK(log != NULL);
+  if (!log)
+    return;
+  CHECK(read_message(log, message));
+  CHECK(strncmp(message, "xxxx", 4) == 0);
+  CHECK(strstr(message, " [truncated]") != NULL);
+  CHECK(strlen(message) < strlen(long_string));
+  fclose(log);
+}
+
+static void test_overflow()
+{
+  int ring_records = server_config.log_ring_records;
+  int flush_interval = server_config.log_flush_interval_ms;
+  server_config.log_ring_records = 8;
+  server_config.log_flush_interval_ms = 10000;
+
+  LoggerStats before = logger_stats();
+  capture_stdout();
+  CHECK(logger_start());
+  for (int i = 0; i < 100; i++)
+    log_message(LOG_INFO, "message %d", i);
+  LoggerStats during = logger_stats();
+  logger_stop();
+  restore_stdout();
+
+  // Every message is either written or counted as dropped
+  LoggerStats after = logger_stats();
+  CHECK(during.dropped > before.dropped);
+  CHECK((after.written - before.written) + (after.dropped - before.dropped) == 100);
+
+  FILE *log = fopen(log_path, "r");
+  char message[LINE_MAX_LEN + 64];
+  bool reported = false;
+  while (log && read_message(log, message))
+    reported |= strstr(message, "Dropped") != NULL;
+  if (log)
+    fclose(log);
+  CHECK(reported);
+
+  server_config.log_ring_records = ring_records;
+  server_config.log_flush_interval_ms = flush_interval;
+}
+
+static void test_bounded_shutdown()
+{
+  int ring_records = server_config.log_ring_records;
+  int flush_interval = server_config.log_flush_interval_ms;
+  int shutdown_flush = server_config.log_shutdown_flush_ms;
+  server_config.log_ring_records = 1 << 16;
+  server_config.log_flush_interval_ms = 10000;
+  server_config.log_shutdown_flush_ms = 1;
+
+  LoggerStats before = logger_stats();
+  capture_stdout();
+  CHECK(logger_start());
+  for (int i = 0; i < 60000; i++)
+    log_message(LOG_INFO, "message %d of %s", i, "a long run of messages");
+
+  uint64_t start = monotonic_ns();
+  logger_stop();
+  uint64_t elapsed_ms = (monotonic_ns() - start) / 1000000;
+  restore_stdout();
+
+  LoggerStats after = logger_stats();
+  CHECK(elapsed_ms < 1000);
+  CHECK(after.dropped > before.dropped);
+  CHECK((after.written - before.written) + (after.dropped - before.dropped) == 60000);
+
+  server_config.log_ring_records = ring_records;
+  server_config.log_flush_interval_ms = flush_interval;
+  server_config.log_shutdown_flush_ms = shutdown_flush;
+}
+
+static int evaluated = 0;
+
+static int count_evaluation()
+{
+  return ++evaluated;
+}
+
+static void test_levels()
+{
+  CHECK(log_set_levels("info"));
+  CHECK(log_set_levels("warning,http=debug&storage=OFF"));
+  CHECK(log_thresholds[LOG_SUBSYSTEM_SERVER] == LOG_WARNING);
+  CHECK(log_thresholds[LOG_SUBSYSTEM_HTTP] == LOG_DEBUG);
+  CHECK(log_thresholds[LOG_SUBSYSTEM_STORAGE] == LOG_OFF);
+  CHECK(log_thresholds[LOG_SUBSYSTEM_AUTH] == LOG_WARNING);
+
+  // A bad entry leaves every level as it was
+  CHECK(!log_set_levels("debug,nosuch=info"));
+  CHECK(!log_set_levels("http=loud"));
+  CHECK(!log_set_levels("verbose"));
+  CHECK(log_thresholds[LOG_SUBSYSTEM_SERVER] == LOG_WARNING);
+  CHECK(log_thresholds[LOG_SUBSYSTEM_HTTP] == LOG_DEBUG);
+
+  // Disabled messages don't evaluate their arguments, this file logs as server
+  capture_stdout();
+  log_message(LOG_INFO, "hidden %d", count_evaluation());
+  log_message(LOG_WARNING, "shown %d", count_evaluation());
+  restore_stdout();
+  CHECK(evaluated == 1);
+
+  FILE *log = fopen(log_path, "r");
+  char message[LINE_MAX_LEN + 64];
+  CHECK(log && read_message(log, message) && strcmp(message, "shown 1") == 0);
+  CHECK(log && !read_message(log, message));
+  if (log)
+    fclose(log);
+
+  CHECK(log_set_levels("info"));
+}
+
+int main(void)
+{
+  int fd = mkstemp(log_path);
+  if (fd < 0)
+  {
+    perror("mkstemp");
+    return EXIT_FAILURE;
+  }
+  close(fd);
+
+  printf("logger\n");
+
+  test_formatting();
+  test_overflow();
+  test_bounded_shutdown();
+  test_levels();
+
+  unlink(log_path);
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,104 @@
+// Checks that counts recorded on several threads, including threads that
+// have exited, all show up in the exposition. Build and run with
+// `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+#include "utils.h"
+
+#define THREADS 4
+#define REQUESTS_PER_THREAD 10000
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+static void *record(void *arg)
+{
+  (void)arg;
+  for (int i = 0; i < REQUESTS_PER_THREAD; i++)
+  {
+    metrics_connection_opened();
+    // 20us, 20ms or an unlisted status
+    metrics_request(ROUTE_SCORE, i % 2 == 0 ? 201 : 418, i % 2 == 0 ? 20000 : 20000000, 100, 10);
+    metrics_connection_closed();
+  }
+  metrics_db_query(DB_OP_ADD_SCORE, 3000000);
+  return NULL;
+}
+
+static char *scrape()
+{
+  char *body = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&body, &len);
+  CHECK(out != NULL);
+  metrics_write(out);
+  fclose(out);
+  return body;
+}
+
+static void check_line(const char *body, const char *line)
+{
+  char needle[256];
+  snprintf(needle, sizeof(needle), "\n%s\n", line);
+  if (!strstr(body, needle))
+  {
+    fprintf(stderr, "  missing: %s\n", line);
+    failures++;
+  }
+}
+
+int main(void)
+{
+  printf("metrics\n");
+
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++)
+    pthread_create(&threads[i], NULL, record, NULL);
+  for (int i = 0; i < THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  // And one thread that is still alive
+  metrics_connection_opened();
+  metrics_parse_error(PARSE_ERROR_BODY);
+
+  char *body = scrape();
+  check_line(body, "http_requests_total{route=\"score\",status=\"201\"} 20000");
+  check_line(body, "http_requests_total{route=\"score\",status=\"other\"} 20000");
+  check_line(body, "http_request_duration_seconds_bucket{route=\"score\",le=\"1e-05\"} 0");
+  check_line(body, "http_request_duration_seconds_bucket{route=\"score\",le=\"2.5e-05\"} 20000");
+  check_line(body, "http_request_duration_seconds_bucket{route=\"score\",le=\"0.01\"} 20000");
+  check_line(body, "http_request_duration_seconds_bucket{route=\"score\",le=\"0.025\"} 40000");
+  check_line(body, "http_request_duration_seconds_bucket{route=\"score\",le=\"+Inf\"} 40000");
+  check_line(body, "http_request_duration_seconds_count{route=\"score\"} 40000");
+  check_line(body, "http_request_bytes_total 4000000");
+  check_line(body, "http_response_bytes_total 400000");
+  check_line(body, "http_connections_total 40001");
+  check_line(body, "http_connections_active 1");
+  check_line(body, "http_parse_errors_total{kind=\"request\"} 0");
+  check_line(body, "http_parse_errors_total{kind=\"body\"} 1");
+  check_line(body, "db_query_duration_seconds_bucket{op=\"add_score\",le=\"0.0025\"} 0");
+  check_line(body, "db_query_duration_seconds_bucket{op=\"add_score\",le=\"0.005\"} 4");
+  check_line(body, "db_query_duration_seconds_count{op=\"add_score\"} 4");
+  // Routes and operations never seen stay out
+  CHECK(strstr(body, "route=\"login\"") == NULL);
+  CHECK(strstr(body, "op=\"begin\"") == NULL);
+  CHECK(strstr(body, "# TYPE http_request_duration_seconds histogram\n") != NULL);
+  free(body);
+
+  metrics_free();
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,288 @@
+// Checks the response cache's single-flight renders, stale-while-revalidate,
+// invalidation by generation and eviction, with the executor and the socket
+// writes stubbed out. Build and run with `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "db_executor.h"
+#include "json_arena.h"
+#include "request_trace.h"
+#include "response_cache.h"
+#include "utils.h"
+
+#define MAX_SOCKETS 64
+#define MAX_JOBS 16
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+// What each socket was answered
+static struct
+{
+  HttpStatusCode status;
+  char body[64];
+  bool answered;
+  bool closed;
+} sockets[MAX_SOCKETS];
+
+void handle_json_body(int client_socket, HttpStatusCode http_sc, const char *body, size_t body_len)
+{
+  sockets[client_socket].status = http_sc;
+  snprintf(sockets[client_socket].body, sizeof(sockets[client_socket].body), "%.*s", (int)body_len, body);
+  sockets[client_socket].answered = true;
+}
+
+void handle_response(int client_socket, HttpStatusCode http_sc)
+{
+  sockets[client_socket].status = http_sc;
+  sockets[client_socket].body[0] = '\0';
+  sockets[client_socket].answered = true;
+}
+
+void close_connection(int client_socket)
+{
+  sockets[client_socket].closed = true;
+}
+
+void request_trace_resumed(int fd)
+{
+  (void)fd;
+}
+
+void json_arena_begin()
+{
+}
+
+void json_arena_end()
+{
+}
+
+// Jobs wait here until run_executor(), like on a busy executor
+static WorkJob *jobs[MAX_JOBS];
+static size_t job_count = 0;
+static bool executor_full = false;
+
+bool db_executor_submit(WorkJob *job)
+{
+  if (executor_full || job_count == MAX_JOBS)
+    return false;
+  jobs[job_count++] = job;
+  return true;
+}
+
+static void run_executor()
+{
+  size_t count = job_count;
+  job_count = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    jobs[i]->run(jobs[i]);
+    jobs[i]->done(jobs[i]);
+  }
+}
+
+static int renders = 0;
+
+static HttpStatusCode count_render(const char *key, char **body)
+{
+  renders++;
+  *body = malloc(64);
+  snprintf(*body, 64, "%s#%d", key, renders);
+  return HTTP_200_OK;
+}
+
+static HttpStatusCode failing_render(const char *key, char **body)
+{
+  (void)key;
+  (void)body;
+  renders++;
+  return HTTP_500_INTERNAL_ERROR;
+}
+
+static void reset(int capacity, int ttl_ms, int stale_ms)
+{
+  response_cache_free();
+  memset(sockets, 0, sizeof(sockets));
+  renders = 0;
+  server_config.cache_responses_capacity = capacity;
+  server_config.cache_responses_ttl_ms = ttl_ms;
+  server_config.cache_responses_stale_ms = stale_ms;
+  CHECK(response_cache_init());
+}
+
+static bool answered_with(int fd, const char *body)
+{
+  return sockets[fd].answered && sockets[fd].status == HTTP_200_OK && strcmp(sockets[fd].body, body) == 0;
+}
+
+static void test_single_flight()
+{
+  reset(8, 60000, 0);
+  ResponseCacheStats before = response_cache_stats();
+
+  // Everyone who misses parks on the one render
+  for (int fd = 1; fd <= 5; fd++)
+    CHECK(response_cache_serve(fd, "/leaderboard", count_render) == REQUEST_PENDING);
+  CHECK(job_count == 1);
+  CHECK(!sockets[1].answered);
+
+  run_executor();
+  CHECK(renders == 1);
+  for (int fd = 1; fd <= 5; fd++)
+  {
+    CHECK(answered_with(fd, "/leaderboard#1"));
+    CHECK(sockets[fd].closed);
+  }
+
+  // Fresh now, answered on the spot without rendering
+  CHECK(response_cache_serve(6, "/leaderboard", count_render) == REQUEST_DONE);
+  CHECK(answered_with(6, "/leaderboard#1"));
+  CHECK(!sockets[6].closed);
+  CHECK(renders == 1 && job_count == 0);
+
+  ResponseCacheStats after = response_cache_stats();
+  CHECK(after.misses - before.misses == 1);
+  CHECK(after.coalesced - before.coalesced == 4);
+  CHECK(after.renders - before.renders == 1);
+  CHECK(after.hits - before.hits == 1);
+
+  // A failed render answers its waiters with the error and caches nothing
+  for (int fd = 7; fd <= 8; fd++)
+    CHECK(response_cache_serve(fd, "/rank/nobody", failing_render) == REQUEST_PENDING);
+  run_executor();
+  CHECK(sockets[7].status == HTTP_500_INTERNAL_ERROR && sockets[8].status == HTTP_500_INTERNAL_ERROR);
+  CHECK(response_cache_serve(9, "/rank/nobody", failing_render) == REQUEST_PENDING);
+  run_executor();
+  CHECK(renders == 3);
+
+  // Nowhere to render, nobody parks
+  executor_full = true;
+  CHECK(response_cache_serve(10, "/stats", count_render) == REQUEST_DONE);
+  CHECK(sockets[10].status == HTTP_503_UNAVAILABLE);
+  executor_full = false;
+}
+
+static void test_stale_while_revalidate()
+{
+  // Never fresh, but usable for a minute
+  reset(8, 0, 60000);
+
+  CHECK(response_cache_serve(1, "/leaderboard", count_render) == REQUEST_PENDING);
+  run_executor();
+  CHECK(answered_with(1, "/leaderboard#1"));
+
+  // The old body is served right away while one render refreshes it
+  for (int fd = 2; fd <= 4; fd++)
+  {
+    CHECK(response_cache_serve(fd, "/leaderboard", count_render) == REQUEST_DONE);
+    CHECK(answered_with(fd, "/leaderboard#1"));
+  }
+  CHECK(job_count == 1);
+  CHECK(response_cache_stats().stale_hits == 3);
+
+  run_executor();
+  CHECK(renders == 2);
+  CHECK(response_cache_serve(5, "/leaderboard", count_render) == REQUEST_DONE);
+  CHECK(answered_with(5, "/leaderboard#2"));
+  run_executor();
+
+  // Past the stale window the body is not served anymore
+  server_config.cache_responses_stale_ms = 0;
+  CHECK(response_cache_serve(6, "/leaderboard", count_render) == REQUEST_DONE);
+  run_executor();
+  CHECK(response_cache_serve(7, "/leaderboard", count_render) == REQUEST_PENDING);
+  CHECK(!sockets[7].answered);
+  run_executor();
+  CHECK(sockets[7].answered);
+}
+
+static void test_generation()
+{
+  reset(8, 60000, 0);
+
+  CHECK(response_cache_serve(1, "/leaderboard", count_render) == REQUEST_PENDING);
+  run_executor();
+  CHECK(response_cache_serve(2, "/leaderboard", count_render) == REQUEST_DONE);
+  CHECK(answered_with(2, "/leaderboard#1"));
+
+  // A new score: the body is no longer fresh, the next request renders
+  response_cache_invalidate();
+  CHECK(response_cache_stats().invalidations == 1);
+  response_cache_serve(3, "/leaderboard", count_render);
+  run_executor();
+  CHECK(renders == 2);
+  CHECK(response_cache_serve(4, "/leaderboard", count_render) == REQUEST_DONE);
+  CHECK(answered_with(4, "/leaderboard#2"));
+  CHECK(renders == 2);
+
+  // A score that comes in during a render: its waiters get the body, but
+  // it was rendered before the score, so it isn't fresh afterwards
+  CHECK(response_cache_serve(5, "/rank/alice", count_render) == REQUEST_PENDING);
+  response_cache_invalidate();
+  run_executor();
+  CHECK(answered_with(5, "/rank/alice#3"));
+  response_cache_serve(6, "/rank/alice", count_render);
+  CHECK(job_count == 1);
+  run_executor();
+  CHECK(renders == 4);
+}
+
+static void test_eviction()
+{
+  reset(2, 60000, 0);
+
+  CHECK(response_cache_serve(1, "/a", count_render) == REQUEST_PENDING);
+  CHECK(response_cache_serve(2, "/b", count_render) == REQUEST_PENDING);
+  run_executor();
+  CHECK(response_cache_stats().size == 2);
+
+  // Full of live entries, so /c is rendered inline and not kept
+  CHECK(response_cache_serve(3, "/c", count_render) == REQUEST_DONE);
+  CHECK(answered_with(3, "/c#3"));
+  CHECK(job_count == 0);
+  CHECK(response_cache_stats().size == 2);
+  CHECK(response_cache_serve(4, "/a", count_render) == REQUEST_DONE);
+  CHECK(answered_with(4, "/a#1"));
+
+  // Once past their stale window they make room, except one still rendering
+  reset(2, 0, 0);
+  CHECK(response_cache_serve(1, "/a", count_render) == REQUEST_PENDING);
+  run_executor();
+  CHECK(response_cache_serve(2, "/b", count_render) == REQUEST_PENDING);
+  CHECK(response_cache_stats().size == 2);
+
+  CHECK(response_cache_serve(3, "/c", count_render) == REQUEST_PENDING);
+  CHECK(response_cache_stats().size == 2);
+  run_executor();
+  CHECK(answered_with(2, "/b#2"));
+  CHECK(answered_with(3, "/c#3"));
+
+  // /b and /c are expired too by now, /a went first
+  CHECK(response_cache_serve(4, "/a", count_render) == REQUEST_PENDING);
+  run_executor();
+  CHECK(answered_with(4, "/a#4"));
+  CHECK(response_cache_stats().size == 1);
+}
+
+int main(void)
+{
+  printf("response_cache\n");
+  test_single_flight();
+  test_stale_while_revalidate();
+  test_generation();
+  test_eviction();
+  response_cache_free();
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
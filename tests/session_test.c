@@ -0,0 +1,181 @@
+// Checks that sessions expire with their TTL, survive a snapshot and restore,
+// and that a damaged snapshot is set aside. Build and run with `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "session.h"
+#include "utils.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+static char snapshot_path[] = "/tmp/session_test_XXXXXX";
+static char damaged_path[] = "/tmp/session_test_damaged_XXXXXX";
+static char bad_path[sizeof(damaged_path) + 4];
+
+static char short_token[SESSION_TOKEN_LEN + 1];
+static char long_tokens[3][SESSION_TOKEN_LEN + 1];
+
+// Restarts the store from path, "" for an empty one
+static bool restart(const char *path)
+{
+  server_config.session_snapshot_path[0] = '\0';
+  session_free();
+  snprintf(server_config.session_snapshot_path, sizeof(server_config.session_snapshot_path), "%s", path);
+  bool ok = session_init();
+  server_config.session_snapshot_path[0] = '\0';
+  return ok;
+}
+
+static void test_ttl()
+{
+  SessionInfo info;
+
+  server_config.session_ttl_s = 2;
+  CHECK(session_create(1, "short", short_token));
+  server_config.session_ttl_s = 3600;
+  for (int i = 0; i < 3; i++)
+    CHECK(session_create(10 + i, "long", long_tokens[i]));
+  CHECK(session_count() == 4);
+
+  CHECK(session_lookup(short_token, &info));
+  CHECK(info.user_id == 1 && strcmp(info.username, "short") == 0);
+  CHECK(!session_lookup("not-a-token", &info));
+
+  // Taken while the short session is still live, restored further down
+  CHECK(session_snapshot(snapshot_path));
+
+  sleep(3);
+  // Past its TTL it no longer resolves, even before the wheel reaches it
+  CHECK(!session_lookup(short_token, &info));
+  CHECK(session_count() == 4);
+  session_tick();
+  CHECK(session_count() == 3);
+  CHECK(session_lookup(long_tokens[0], &info) && info.user_id == 10);
+
+  session_destroy(long_tokens[2]);
+  CHECK(!session_lookup(long_tokens[2], &info));
+  CHECK(session_count() == 2);
+}
+
+static void test_round_trip()
+{
+  SessionInfo info;
+
+  // The snapshot has all four, the short one has expired since
+  CHECK(restart(snapshot_path));
+  CHECK(session_count() == 3);
+  CHECK(!session_lookup(short_token, &info));
+  for (int i = 0; i < 3; i++)
+  {
+    CHECK(session_lookup(long_tokens[i], &info));
+    CHECK(info.user_id == 10 + i && strcmp(info.username, "long") == 0);
+  }
+
+  // Written to a temporary file and renamed into place
+  char tmp_path[sizeof(snapshot_path) + 4];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", snapshot_path);
+  CHECK(session_snapshot(snapshot_path));
+  CHECK(access(tmp_path, F_OK) != 0);
+
+  // An empty store snapshots and restores as empty
+  CHECK(restart(""));
+  CHECK(session_snapshot(snapshot_path));
+  CHECK(restart(snapshot_path));
+  CHECK(session_count() == 0);
+}
+
+// Starting from a damaged snapshot gives an empty store and moves the file
+// to "<path>.bad"
+static void check_set_aside()
+{
+  unlink(bad_path);
+  CHECK(restart(damaged_path));
+  CHECK(session_count() == 0);
+  CHECK(access(damaged_path, F_OK) != 0);
+  CHECK(access(bad_path, F_OK) == 0);
+}
+
+static void test_damaged()
+{
+  static unsigned char bad[64 * 1024];
+
+  CHECK(restart(""));
+  server_config.session_ttl_s = 3600;
+  for (int i = 0; i < 3; i++)
+    CHECK(session_create(10 + i, "long", long_tokens[i]));
+  CHECK(session_snapshot(snapshot_path));
+  long len = 0;
+  unsigned char *good = read_entire_file("/", snapshot_path, &len);
+  CHECK(good != NULL && len > 0 && (size_t)len < sizeof(bad));
+  if (!good)
+    return;
+  CHECK(restart(snapshot_path));
+  CHECK(session_count() == 3);
+
+  // Cut anywhere, including inside the header and the trailing hash
+  long cuts[] = {0, 3, 8, len / 2, len - 9, len - 1};
+  for (size_t i = 0; i < ARRAY_LEN(cuts); i++)
+  {
+    CHECK(write_file(damaged_path, good, cuts[i]));
+    check_set_aside();
+  }
+
+  // Trailing garbage
+  memcpy(bad, good, len);
+  bad[len] = 'x';
+  CHECK(write_file(damaged_path, bad, len + 1));
+  check_set_aside();
+
+  // One flipped byte in a record, in the magic and in the record count
+  long flips[] = {len / 2, 0, 4};
+  for (size_t i = 0; i < ARRAY_LEN(flips); i++)
+  {
+    memcpy(bad, good, len);
+    bad[flips[i]] ^= 0x20;
+    CHECK(write_file(damaged_path, bad, len));
+    check_set_aside();
+  }
+
+  // The original is still fine
+  CHECK(restart(snapshot_path));
+  CHECK(session_count() == 3);
+  free(good);
+}
+
+int main(void)
+{
+  printf("session\n");
+
+  int fd = mkstemp(snapshot_path);
+  CHECK(fd >= 0);
+  close(fd);
+  fd = mkstemp(damaged_path);
+  CHECK(fd >= 0);
+  close(fd);
+  snprintf(bad_path, sizeof(bad_path), "%s.bad", damaged_path);
+
+  CHECK(session_init());
+  test_ttl();
+  test_round_trip();
+  test_damaged();
+  session_free();
+
+  unlink(snapshot_path);
+  unlink(damaged_path);
+  unlink(bad_path);
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
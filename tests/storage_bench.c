@@ -0,0 +1,92 @@
+// Compares score ingest rates of the storage engines, committing in batches
+// the way the group-commit writer does.
+// Usage: storage_bench [rows] [batch size] (defaults 200000 and
+// db.writer_batch_size). Build and run with `make bench`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "storage.h"
+#include "utils.h"
+
+static double ingest(long rows, long batch)
+{
+    char username[DB_USERNAME_MAX];
+    int64_t row_id;
+    int user_id = 0;
+
+    storage->begin();
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(username, sizeof(username), "player%d", i);
+        storage->add_user(username, "$y$j9T$bench", &row_id);
+        user_id = (int)row_id;
+    }
+    storage->commit();
+
+    uint64_t start = monotonic_ns();
+    for (long done = 0; done < rows;)
+    {
+        storage->begin();
+        for (long i = 0; i < batch && done < rows; i++, done++)
+        {
+            snprintf(username, sizeof(username), "player%ld", done % 1000);
+            storage->add_score(user_id, username, (int)(done * 7919 % 100000), 1700000000 + done, &row_id);
+        }
+        if (!storage->commit())
+        {
+            fprintf(stderr, "Commit failed\n");
+            return 0;
+        }
+        storage->maintain();
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+
+    return (double)rows / ((double)elapsed / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+    long rows = argc > 1 ? atol(argv[1]) : 200000;
+    long batch = argc > 2 ? atol(argv[2]) : server_config.db_writer_batch_size;
+    if (rows <= 0 || batch <= 0)
+    {
+        fprintf(stderr, "Usage: %s [rows] [batch size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char dir[] = "/tmp/storage_bench_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    snprintf(server_config.db_path, sizeof(server_config.db_path), "%s/bench.db", dir);
+    snprintf(server_config.db_log_path, sizeof(server_config.db_log_path), "%s/bench.log", dir);
+
+    const char *engines[] = {"sqlite", "log"};
+    double rates[ARRAY_LEN(engines)] = {0};
+    for (size_t i = 0; i < ARRAY_LEN(engines); i++)
+    {
+        snprintf(server_config.db_engine, sizeof(server_config.db_engine), "%s", engines[i]);
+        if (!storage_open())
+            return EXIT_FAILURE;
+
+        rates[i] = ingest(rows, batch);
+        storage_close();
+    }
+
+    printf("%ld scores, batches of %ld, synchronous=%s\n", rows, batch, server_config.db_synchronous);
+    for (size_t i = 0; i < ARRAY_LEN(engines); i++)
+        printf("%-8s %12.0f scores/s\n", engines[i], rates[i]);
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0)
+        fprintf(stderr, "Failed to remove %s\n", dir);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+// Runs the same checks against every storage engine.
+// Build and run with `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "storage.h"
+#include "utils.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                           \
+    do                                                                        \
+    {                                                                         \
+        if (!(cond))                                                          \
+        {                                                                     \
+            fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                       \
+        }                                                                     \
+    } while (0)
+
+typedef struct
+{
+    int rows;
+    int best;
+    long last_timestamp;
+} ScoreTally;
+
+static void tally_score(void *ctx, const char *username, int score, long timestamp)
+{
+    ScoreTally *tally = ctx;
+    if (strcmp(username, "alice") != 0)
+        return;
+    tally->rows++;
+    if (score > tally->best)
+        tally->best = score;
+    tally->last_timestamp = timestamp;
+}
+
+static void count_username(void *ctx, const char *username)
+{
+    (void)username;
+    (*(int *)ctx)++;
+}
+
+static bool reopen(void)
+{
+    storage_close();
+    return storage_open();
+}
+
+static void test_users(void)
+{
+    int64_t alice = 0, bob = 0, dup = 0;
+    CHECK(storage->begin());
+    CHECK(storage->add_user("alice", "hash-a", &alice));
+    CHECK(storage->add_user("bob", "hash-b", &bob));
+    CHECK(!storage->add_user("alice", "other", &dup));
+    CHECK(storage->commit());
+    CHECK(alice > 0 && bob > 0 && alice != bob);
+
+    // Committed in a batch of its own
+    CHECK(!storage->add_user("bob", "other", &dup));
+
+    int user_id = 0;
+    char password[DB_PASSWORD_MAX];
+    CHECK(storage->get_credentials("alice", &user_id, password, sizeof(password)));
+    CHECK(user_id == alice);
+    CHECK(strcmp(password, "hash-a") == 0);
+    CHECK(!storage->get_credentials("carol", &user_id, password, sizeof(password)));
+
+    CHECK(storage->get_user_id("bob") == bob);
+    CHECK(storage->get_user_id("carol") == -1);
+    CHECK(storage->count_users() == 2);
+
+    int usernames = 0;
+    CHECK(storage->for_each_username(count_username, &usernames) == 2);
+    CHECK(usernames == 2);
+}
+
+static void test_scores(void)
+{
+    int alice = storage->get_user_id("alice");
+    int64_t row_id;
+
+    CHECK(storage->begin());
+    CHECK(storage->add_score(alice, "alice", 10, 1000, &row_id));
+    CHECK(storage->add_score(alice, "alice", 30, 1001, &row_id));
+    CHECK(storage->add_score(alice, "alice", 20, 1002, &row_id));
+    CHECK(storage->commit());
+
+    ScoreTally tally = {0};
+    CHECK(storage->for_each_score(tally_score, &tally));
+    CHECK(tally.rows == 3);
+    CHECK(tally.best == 30);
+}
+
+static void test_rollback(void)
+{
+    int64_t row_id;
+    CHECK(storage->begin());
+    CHECK(storage->add_user("carol", "hash-c", &row_id));
+    CHECK(storage->add_score(storage->get_user_id("alice"), "alice", 99, 2000, &row_id));
+    CHECK(storage->rollback());
+
+    CHECK(storage->get_user_id("carol") == -1);
+    CHECK(storage->count_users() == 2);
+
+    ScoreTally tally = {0};
+    CHECK(storage->for_each_score(tally_score, &tally));
+    CHECK(tally.best == 30);
+
+    CHECK(storage->begin());
+    CHECK(storage->add_user("dave", "hash-d", &row_id));
+    CHECK(storage->commit());
+    CHECK(storage->get_user_id("dave") == row_id);
+}
+
+static void test_reopen(void)
+{
+    int bob = storage->get_user_id("bob");
+    CHECK(reopen());
+
+    CHECK(storage->get_user_id("bob") == bob);
+    CHECK(storage->count_users() == 3);
+
+    ScoreTally tally = {0};
+    CHECK(storage->for_each_score(tally_score, &tally));
+    CHECK(tally.best == 30);
+
+    // Ids keep growing after a restart
+    int64_t erin;
+    CHECK(storage->begin());
+    CHECK(storage->add_user("erin", "hash-e", &erin));
+    CHECK(storage->commit());
+    CHECK(erin > storage->get_user_id("dave"));
+}
+
+// Log engine only: a torn batch at the tail is dropped on open, and
+// compaction keeps users and best scores
+static void test_log_recovery(void)
+{
+    int64_t row_id;
+    CHECK(storage->begin());
+    CHECK(storage->add_user("frank", "hash-f", &row_id));
+    CHECK(storage->add_score(storage->get_user_id("alice"), "alice", 50, 3000, &row_id));
+    CHECK(storage->commit());
+
+    // A batch that never commits
+    CHECK(storage->begin());
+    CHECK(storage->add_user("ghost", "hash-g", &row_id));
+    CHECK(reopen());
+
+    CHECK(storage->get_user_id("frank") > 0);
+    CHECK(storage->get_user_id("ghost") == -1);
+
+    // Corrupt the last committed batch while the log is closed
+    storage_close();
+    FILE *log = fopen(server_config.db_log_path, "r+b");
+    CHECK(log != NULL);
+    if (log)
+    {
+        fseek(log, -40, SEEK_END);
+        fputc('x', log);
+        fclose(log);
+    }
+    CHECK(storage_open());
+    CHECK(storage->get_user_id("frank") == -1);
+    CHECK(storage->get_user_id("erin") > 0);
+
+    long long min_bytes = server_config.db_log_compact_min_bytes;
+    server_config.db_log_compact_min_bytes = 0;
+    int alice = storage->get_user_id("alice");
+    for (int i = 0; i < 200; i++)
+    {
+        CHECK(storage->begin());
+        CHECK(storage->add_score(alice, "alice", i % 7, 4000 + i, &row_id));
+        CHECK(storage->commit());
+    }
+    storage->maintain();
+    server_config.db_log_compact_min_bytes = min_bytes;
+
+    ScoreTally tally = {0};
+    CHECK(storage->for_each_score(tally_score, &tally));
+    CHECK(tally.rows == 1);
+    CHECK(tally.best == 30);
+    CHECK(storage->count_users() == 4);
+
+    CHECK(reopen());
+    CHECK(storage->count_users() == 4);
+    CHECK(storage->get_user_id("alice") == alice);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/storage_test_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    snprintf(server_config.db_path, sizeof(server_config.db_path), "%s/test.db", dir);
+    snprintf(server_config.db_log_path, sizeof(server_config.db_log_path), "%s/test.log", dir);
+
+    const char *engines[] = {"sqlite", "log"};
+    for (size_t i = 0; i < ARRAY_LEN(engines); i++)
+    {
+        int before = failures;
+        snprintf(server_config.db_engine, sizeof(server_config.db_engine), "%s", engines[i]);
+        printf("%s\n", engines[i]);
+
+        if (!storage_open())
+        {
+            fprintf(stderr, "  failed to open\n");
+            failures++;
+            continue;
+        }
+
+        test_users();
+        test_scores();
+        test_rollback();
+        test_reopen();
+        if (strcmp(engines[i], "log") == 0)
+            test_log_recovery();
+
+        storage_close();
+        printf("  %s\n", failures == before ? "ok" : "FAILED");
+    }
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0)
+        fprintf(stderr, "Failed to remove %s\n", dir);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,132 @@
+// Checks the credentials cache's CLOCK eviction order, the expiry of unknown
+// usernames and how known and unknown entries replace each other. Build and
+// run with `make test`.
+#define UTILS_LOG_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "user_cache.h"
+#include "utils.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+static void reset(int capacity, int negative_ttl_s)
+{
+  user_cache_free();
+  server_config.cache_users_capacity = capacity;
+  server_config.cache_users_negative_ttl_s = negative_ttl_s;
+  CHECK(user_cache_init());
+}
+
+static UserCacheResult get(const char *username, int *user_id)
+{
+  char password[64];
+  return user_cache_get(username, user_id, password, sizeof(password));
+}
+
+static bool cached(const char *username)
+{
+  int user_id = 0;
+  return get(username, &user_id) == USER_CACHE_HIT;
+}
+
+static void test_clock()
+{
+  reset(4, 60);
+  int user_id = 0;
+
+  const char *names[] = {"a", "b", "c", "d"};
+  for (int i = 0; i < 4; i++)
+    user_cache_put(names[i], i + 1, "hash");
+  CHECK(user_cache_stats().size == 4);
+
+  // a and c are referenced, so the hand skips them once and takes b, then d
+  CHECK(get("a", &user_id) == USER_CACHE_HIT && user_id == 1);
+  CHECK(get("c", &user_id) == USER_CACHE_HIT && user_id == 3);
+  user_cache_put("e", 5, "hash");
+  CHECK(!cached("b"));
+  user_cache_put("f", 6, "hash");
+  CHECK(!cached("d"));
+  CHECK(user_cache_stats().evictions == 2);
+
+  // Their second chance is used up, a goes next while c is hit again
+  CHECK(cached("c"));
+  user_cache_put("g", 7, "hash");
+  CHECK(!cached("a"));
+  CHECK(cached("c") && cached("e") && cached("f") && cached("g"));
+
+  UserCacheStats stats = user_cache_stats();
+  CHECK(stats.evictions == 3);
+  CHECK(stats.size == 4 && stats.capacity == 4);
+}
+
+static void test_negative()
+{
+  reset(4, 1);
+  int user_id = 0;
+
+  user_cache_put_negative("ghost");
+  CHECK(get("ghost", &user_id) == USER_CACHE_NEGATIVE);
+  CHECK(user_cache_stats().negative_hits == 1);
+
+  // Past cache.users_negative_ttl_s the name is looked up again
+  sleep(2);
+  CHECK(get("ghost", &user_id) == USER_CACHE_MISS);
+  CHECK(user_cache_stats().size == 0);
+
+  // Not cached at all without a TTL
+  server_config.cache_users_negative_ttl_s = 0;
+  user_cache_put_negative("ghost");
+  CHECK(get("ghost", &user_id) == USER_CACHE_MISS);
+}
+
+static void test_replace()
+{
+  reset(4, 60);
+  int user_id = 0;
+
+  // A user found after all takes over the negative entry's slot
+  user_cache_put_negative("dave");
+  user_cache_put("dave", 7, "hash");
+  CHECK(get("dave", &user_id) == USER_CACHE_HIT && user_id == 7);
+  CHECK(user_cache_stats().size == 1);
+
+  // A late negative never hides a known user
+  user_cache_put_negative("dave");
+  CHECK(get("dave", &user_id) == USER_CACHE_HIT && user_id == 7);
+
+  // Registering drops the negative entry, so the next login goes to the
+  // database
+  user_cache_put_negative("erin");
+  CHECK(get("erin", &user_id) == USER_CACHE_NEGATIVE);
+  user_cache_invalidate("erin");
+  user_cache_invalidate("nobody");
+  CHECK(get("erin", &user_id) == USER_CACHE_MISS);
+
+  UserCacheStats stats = user_cache_stats();
+  CHECK(stats.invalidations == 1);
+  CHECK(stats.size == 1);
+}
+
+int main(void)
+{
+  printf("user_cache\n");
+  test_clock();
+  test_negative();
+  test_replace();
+  user_cache_free();
+  printf("  %s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,153 @@
+// Turns binary access log files (see access_log.h) into text, CSV or JSON
+// lines for offline processing. Files are read in the order given, so pass
+// rotated files oldest first: access.bin.3 access.bin.2 access.bin.1 access.bin
+// Usage: access_log_decode [-f text|csv|json] file...
+// Build with `make access_log_decode`.
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "access_log.h"
+
+typedef enum
+{
+  FORMAT_TEXT,
+  FORMAT_CSV,
+  FORMAT_JSON,
+} Format;
+
+static void format_time(uint64_t timestamp_us, char *out, size_t size)
+{
+  time_t seconds = (time_t)(timestamp_us / 1000000);
+  struct tm t;
+  gmtime_r(&seconds, &t);
+  size_t n = strftime(out, size, "%Y-%m-%dT%H:%M:%S", &t);
+  snprintf(out + n, size - n, ".%06uZ", (unsigned)(timestamp_us % 1000000));
+}
+
+static void format_address(const AccessLogRecord *r, char *out, size_t size)
+{
+  if (r->family == 4)
+    inet_ntop(AF_INET, r->addr, out, (socklen_t)size);
+  else if (r->family == 6)
+    inet_ntop(AF_INET6, r->addr, out, (socklen_t)size);
+  else
+    snprintf(out, size, "-");
+}
+
+static void print_record(const AccessLogRecord *r, Format format)
+{
+  char time[40];
+  char address[INET6_ADDRSTRLEN];
+  format_time(r->timestamp_us, time, sizeof(time));
+  format_address(r, address, sizeof(address));
+  const char *method = method_name(r->method);
+  const char *route = route_name(r->route);
+
+  switch (format)
+  {
+  case FORMAT_TEXT:
+    printf("%s %s:%u %s %s %u in=%u out=%llu read=%uus parse=%uus handle=%uus wait=%uus\n", time, address,
+           r->port, method, route, r->status, r->bytes_in, (unsigned long long)r->bytes_out,
+           r->phase_us[PHASE_READ], r->phase_us[PHASE_PARSE], r->phase_us[PHASE_HANDLE], r->phase_us[PHASE_WAIT]);
+    break;
+  case FORMAT_CSV:
+    printf("%s,%s,%u,%s,%s,%u,%u,%llu,%u,%u,%u,%u\n", time, address, r->port, method, route, r->status,
+           r->bytes_in, (unsigned long long)r->bytes_out, r->phase_us[PHASE_READ], r->phase_us[PHASE_PARSE],
+           r->phase_us[PHASE_HANDLE], r->phase_us[PHASE_WAIT]);
+    break;
+  case FORMAT_JSON:
+    printf("{\"time\":\"%s\",\"timestamp_us\":%llu,\"address\":\"%s\",\"port\":%u,\"method\":\"%s\","
+           "\"route\":\"%s\",\"status\":%u,\"bytes_in\":%u,\"bytes_out\":%llu,"
+           "\"read_us\":%u,\"parse_us\":%u,\"handle_us\":%u,\"wait_us\":%u}\n",
+           time, (unsigned long long)r->timestamp_us, address, r->port, method, route, r->status, r->bytes_in,
+           (unsigned long long)r->bytes_out, r->phase_us[PHASE_READ], r->phase_us[PHASE_PARSE],
+           r->phase_us[PHASE_HANDLE], r->phase_us[PHASE_WAIT]);
+    break;
+  }
+}
+
+// Returns false if the file can't be read or isn't an access log
+static bool decode_file(const char *path, Format format, unsigned long long *records)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    perror(path);
+    return false;
+  }
+
+  AccessLogHeader header;
+  const char *error = NULL;
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, ACCESS_LOG_MAGIC, sizeof(ACCESS_LOG_MAGIC)) != 0)
+    error = "not an access log";
+  else if (header.byte_order != ACCESS_LOG_BYTE_ORDER)
+    error = "written with a different byte order";
+  else if (header.version != ACCESS_LOG_VERSION || header.record_size != sizeof(AccessLogRecord))
+    error = "unsupported version";
+  if (error)
+  {
+    fprintf(stderr, "%s: %s\n", path, error);
+    fclose(f);
+    return false;
+  }
+
+  AccessLogRecord record;
+  while (fread(&record, sizeof(record), 1, f) == 1)
+  {
+    // The unused, zeroed end of a file still being written
+    if (record.timestamp_us == 0)
+      break;
+    print_record(&record, format);
+    (*records)++;
+  }
+
+  fclose(f);
+  return true;
+}
+
+static void usage(const char *program)
+{
+  fprintf(stderr, "Usage: %s [-f text|csv|json] file...\n", program);
+}
+
+int main(int argc, char **argv)
+{
+  Format format = FORMAT_TEXT;
+  int first = 1;
+
+  if (argc > 2 && strcmp(argv[1], "-f") == 0)
+  {
+    if (strcmp(argv[2], "text") == 0)
+      format = FORMAT_TEXT;
+    else if (strcmp(argv[2], "csv") == 0)
+      format = FORMAT_CSV;
+    else if (strcmp(argv[2], "json") == 0)
+      format = FORMAT_JSON;
+    else
+    {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    first = 3;
+  }
+
+  if (first >= argc)
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (format == FORMAT_CSV)
+    printf("time,address,port,method,route,status,bytes_in,bytes_out,read_us,parse_us,handle_us,wait_us\n");
+
+  bool ok = true;
+  unsigned long long records = 0;
+  for (int i = first; i < argc; i++)
+    ok &= decode_file(argv[i], format, &records);
+
+  fprintf(stderr, "%llu records\n", records);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1028 @@
+// HTTP load generator for this server. Each thread drives its share of the
+// connections from its own epoll loop and reports latency percentiles and
+// throughput as JSON.
+//
+// Closed loop (the default) keeps every connection busy: the next request
+// goes out as soon as the previous answer is in, and latency is measured from
+// the send. Open loop (-r) sends requests at a constant rate instead, and
+// measures each one from when it was due, not from when a free connection got
+// to it, so a stalled server shows up as latency rather than as fewer samples
+// (coordinated omission).
+//
+// Requests come from scripts picked by weight (-m), a connection runs one
+// script to the end before picking the next:
+//   page   GET /, /styles/main.css and /scripts/main.js
+//   login  POST /login
+//   score  POST /score with a session
+// login and score use a user per thread, registered and logged in up front.
+//
+// Usage: loadgen [-a address] [-p port] [-t threads] [-c connections]
+//                [-d seconds] [-r rate] [-k] [-P depth] [-m mix] [-o file]
+//   -a  server address (127.0.0.1)
+//   -p  server port (8080)
+//   -t  threads (2)
+//   -c  connections in total, split across the threads (16)
+//   -d  seconds to run (10)
+//   -r  requests per second in total, open loop. 0 is closed loop (0)
+//   -k  keep connections open between requests
+//   -P  requests in flight per connection, implies -k (1)
+//   -m  weighted scripts, e.g. page:8,score:3,login:1 (page)
+//   -o  write the report here instead of stdout
+// Build with `make loadgen`.
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PIPELINE 16
+#define MAX_SCRIPTS 8
+#define HEADERS_MAX 8192
+// Time given to requests still in flight when the run ends
+#define DRAIN_NS (2 * 1000000000ULL)
+
+// Log-linear histogram of nanoseconds, 64 buckets per power of two: within
+// 1.6% from 1ns to about 137s
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_LINEAR (2 * HIST_SUB)
+#define HIST_MAX_EXP 37
+#define HIST_BUCKETS (HIST_LINEAR + (HIST_MAX_EXP - HIST_SUB_BITS - 1) * HIST_SUB)
+
+typedef struct
+{
+  uint64_t buckets[HIST_BUCKETS];
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+} Histogram;
+
+typedef enum
+{
+  SCRIPT_PAGE = 0,
+  SCRIPT_LOGIN,
+  SCRIPT_SCORE,
+  SCRIPT_COUNT
+} ScriptId;
+
+static const char *const script_names[] = {"page", "login", "score"};
+static const int script_steps[] = {3, 1, 1};
+
+typedef struct
+{
+  const char *address;
+  int port;
+  int threads;
+  int connections;
+  int seconds;
+  double rate;
+  bool keep_alive;
+  int pipeline;
+  ScriptId mix[MAX_SCRIPTS];
+  int weights[MAX_SCRIPTS];
+  int mix_count;
+  int weight_total;
+  const char *output;
+} Options;
+
+static Options options = {
+    .address = "127.0.0.1",
+    .port = 8080,
+    .threads = 2,
+    .connections = 16,
+    .seconds = 10,
+    .pipeline = 1,
+};
+
+static struct sockaddr_in server_addr;
+
+typedef struct
+{
+  uint64_t start_ns;
+  ScriptId script;
+} InFlight;
+
+typedef enum
+{
+  PARSE_HEADERS,
+  PARSE_BODY,
+  PARSE_CHUNK_SIZE,
+  PARSE_CHUNK_DATA,
+  PARSE_TRAILER,
+  PARSE_UNTIL_CLOSE,
+} ParseState;
+
+typedef struct
+{
+  int fd;
+  bool connecting;
+  bool want_out;
+
+  ScriptId script;
+  int step; // Next step of script, script_steps[script] when it's done
+
+  char out[MAX_PIPELINE * 512];
+  size_t out_len;
+  size_t out_sent;
+
+  InFlight inflight[MAX_PIPELINE];
+  int inflight_head;
+  int inflight_count;
+
+  ParseState state;
+  char headers[HEADERS_MAX];
+  size_t headers_len;
+  int status;
+  uint64_t remaining; // Of the body or chunk
+} Conn;
+
+typedef struct
+{
+  uint64_t connect;
+  uint64_t io;
+  uint64_t status_4xx;
+  uint64_t status_5xx;
+  uint64_t unanswered; // In flight when the server closed
+  uint64_t unsent;     // Due in open loop but never sent
+} Errors;
+
+typedef struct
+{
+  int index;
+  pthread_t thread;
+  int epollfd;
+  Conn *conns;
+  int conn_count;
+  uint64_t random;
+
+  char username[64];
+  char password[32];
+  char cookie[128];
+
+  uint64_t start_ns;
+  uint64_t end_ns;
+  double rate; // This thread's share, 0 for closed loop
+  uint64_t sent;
+  uint64_t completed;
+  uint64_t bytes_read;
+  Errors errors;
+  Histogram latency[SCRIPT_COUNT];
+} Worker;
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static size_t hist_bucket(uint64_t ns)
+{
+  if (ns < HIST_LINEAR)
+    return (size_t)ns;
+  if (ns >> HIST_MAX_EXP)
+    return HIST_BUCKETS - 1;
+  int shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS;
+  return HIST_LINEAR + (size_t)(shift - 1) * HIST_SUB + (size_t)((ns >> shift) - HIST_SUB);
+}
+
+static uint64_t hist_highest(size_t bucket)
+{
+  if (bucket < HIST_LINEAR)
+    return bucket;
+  size_t i = bucket - HIST_LINEAR;
+  int shift = (int)(i / HIST_SUB) + 1;
+  return ((HIST_SUB + i % HIST_SUB + 1) << shift) - 1;
+}
+
+static void hist_record(Histogram *h, uint64_t ns)
+{
+  h->buckets[hist_bucket(ns)]++;
+  h->count++;
+  h->sum_ns += ns;
+  if (ns > h->max_ns)
+    h->max_ns = ns;
+}
+
+static void hist_add(Histogram *to, const Histogram *from)
+{
+  for (size_t b = 0; b < HIST_BUCKETS; b++)
+    to->buckets[b] += from->buckets[b];
+  to->count += from->count;
+  to->sum_ns += from->sum_ns;
+  if (from->max_ns > to->max_ns)
+    to->max_ns = from->max_ns;
+}
+
+// Smallest value with at least per_million of the counts at or below it
+static uint64_t hist_percentile(const Histogram *h, uint64_t per_million)
+{
+  uint64_t cumulative = 0;
+  for (size_t b = 0; b < HIST_BUCKETS; b++)
+  {
+    cumulative += h->buckets[b];
+    if (cumulative > 0 && cumulative * 1000000 >= h->count * per_million)
+    {
+      uint64_t value = hist_highest(b);
+      return value < h->max_ns ? value : h->max_ns;
+    }
+  }
+  return h->max_ns;
+}
+
+static uint64_t next_random(Worker *w)
+{
+  w->random ^= w->random << 13;
+  w->random ^= w->random >> 7;
+  w->random ^= w->random << 17;
+  return w->random;
+}
+
+static ScriptId pick_script(Worker *w)
+{
+  int pick = (int)(next_random(w) % (uint64_t)options.weight_total);
+  for (int i = 0; i < options.mix_count; i++)
+  {
+    pick -= options.weights[i];
+    if (pick < 0)
+      return options.mix[i];
+  }
+  return options.mix[0];
+}
+
+static bool uses_session()
+{
+  for (int i = 0; i < options.mix_count; i++)
+  {
+    if (options.mix[i] != SCRIPT_PAGE)
+      return true;
+  }
+  return false;
+}
+
+// Writes the next request of the connection's script at the end of out
+static ScriptId write_request(Worker *w, Conn *c)
+{
+  if (c->step >= script_steps[c->script])
+  {
+    c->script = pick_script(w);
+    c->step = 0;
+  }
+  ScriptId script = c->script;
+  int step = c->step++;
+
+  const char *connection = options.keep_alive ? "keep-alive" : "close";
+  char *out = c->out + c->out_len;
+  size_t size = sizeof(c->out) - c->out_len;
+  char body[256];
+  int n = 0;
+
+  switch (script)
+  {
+  case SCRIPT_PAGE:
+  {
+    static const char *const paths[] = {"/", "/styles/main.css", "/scripts/main.js"};
+    static const char *const accepts[] = {"text/html,*/*;q=0.8", "text/css,*/*;q=0.1", "*/*"};
+    n = snprintf(out, size,
+                 "GET %s HTTP/1.1\r\nHost: %s\r\nAccept: %s\r\nConnection: %s\r\n\r\n",
+                 paths[step], options.address, accepts[step], connection);
+    break;
+  }
+  case SCRIPT_LOGIN:
+  {
+    int len = snprintf(body, sizeof(body), "{\"username\":\"%s\",\"password\":\"%s\"}", w->username, w->password);
+    n = snprintf(out, size,
+                 "POST /login HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n"
+                 "Connection: %s\r\n\r\n%s",
+                 options.address, len, connection, body);
+    break;
+  }
+  case SCRIPT_SCORE:
+  {
+    int len = snprintf(body, sizeof(body), "{\"score\":%d}", (int)(next_random(w) % 100000));
+    n = snprintf(out, size,
+                 "POST /score HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n"
+                 "Cookie: %s\r\nConnection: %s\r\n\r\n%s",
+                 options.address, len, w->cookie, connection, body);
+    break;
+  }
+  default:
+    break;
+  }
+
+  if (n > 0 && (size_t)n < size)
+    c->out_len += (size_t)n;
+  return script;
+}
+
+static void set_events(Worker *w, Conn *c, bool want_out)
+{
+  if (c->want_out == want_out)
+    return;
+  c->want_out = want_out;
+  struct epoll_event event = {.events = EPOLLIN | (want_out ? EPOLLOUT : 0), .data.ptr = c};
+  epoll_ctl(w->epollfd, EPOLL_CTL_MOD, c->fd, &event);
+}
+
+static void conn_close(Worker *w, Conn *c)
+{
+  if (c->fd < 0)
+    return;
+  close(c->fd);
+  c->fd = -1;
+  c->connecting = false;
+  c->want_out = false;
+  w->errors.unanswered += (uint64_t)c->inflight_count;
+  c->inflight_count = 0;
+  c->inflight_head = 0;
+  c->out_len = 0;
+  c->out_sent = 0;
+  c->state = PARSE_HEADERS;
+  c->headers_len = 0;
+}
+
+static bool conn_open(Worker *w, Conn *c)
+{
+  c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (c->fd < 0)
+  {
+    w->errors.connect++;
+    return false;
+  }
+  int one = 1;
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (connect(c->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS)
+  {
+    w->errors.connect++;
+    close(c->fd);
+    c->fd = -1;
+    return false;
+  }
+
+  c->connecting = true;
+  c->want_out = true;
+  struct epoll_event event = {.events = EPOLLIN | EPOLLOUT, .data.ptr = c};
+  epoll_ctl(w->epollfd, EPOLL_CTL_ADD, c->fd, &event);
+  return true;
+}
+
+static void conn_flush(Worker *w, Conn *c)
+{
+  while (c->out_sent < c->out_len)
+  {
+    ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      set_events(w, c, true);
+      return;
+    }
+    if (n <= 0)
+    {
+      w->errors.io++;
+      conn_close(w, c);
+      return;
+    }
+    c->out_sent += (size_t)n;
+  }
+  c->out_len = 0;
+  c->out_sent = 0;
+  set_events(w, c, false);
+}
+
+// Queues one request that was due at start_ns, opening the connection if needed
+static bool conn_send(Worker *w, Conn *c, uint64_t start_ns)
+{
+  if (c->fd < 0 && !conn_open(w, c))
+    return false;
+
+  int slot = (c->inflight_head + c->inflight_count) % MAX_PIPELINE;
+  c->inflight[slot].start_ns = start_ns;
+  c->inflight[slot].script = write_request(w, c);
+  c->inflight_count++;
+  w->sent++;
+
+  if (!c->connecting)
+    conn_flush(w, c);
+  return true;
+}
+
+static bool conn_ready(const Conn *c)
+{
+  if (c->fd < 0)
+    return true;
+  return options.keep_alive && c->inflight_count < options.pipeline;
+}
+
+static void complete(Worker *w, Conn *c)
+{
+  InFlight *done = &c->inflight[c->inflight_head];
+  c->inflight_head = (c->inflight_head + 1) % MAX_PIPELINE;
+  c->inflight_count--;
+
+  uint64_t now = now_ns();
+  hist_record(&w->latency[done->script], now > done->start_ns ? now - done->start_ns : 0);
+  w->completed++;
+  if (c->status >= 500)
+    w->errors.status_5xx++;
+  else if (c->status >= 400)
+    w->errors.status_4xx++;
+
+  c->state = PARSE_HEADERS;
+  c->headers_len = 0;
+}
+
+static const char *find_header(const char *headers, const char *name)
+{
+  size_t len = strlen(name);
+  for (const char *line = strstr(headers, "\r\n"); line; line = strstr(line + 2, "\r\n"))
+  {
+    if (strncasecmp(line + 2, name, len) == 0 && line[2 + len] == ':')
+    {
+      const char *value = line + 3 + len;
+      while (*value == ' ')
+        value++;
+      return value;
+    }
+  }
+  return NULL;
+}
+
+// Status and framing of a response once its headers are in
+static void start_body(Conn *c)
+{
+  c->headers[c->headers_len] = '\0';
+  c->status = 0;
+  sscanf(c->headers, "HTTP/%*d.%*d %d", &c->status);
+
+  const char *length = find_header(c->headers, "Content-Length");
+  const char *encoding = find_header(c->headers, "Transfer-Encoding");
+  if (encoding && strncasecmp(encoding, "chunked", 7) == 0)
+  {
+    c->state = PARSE_CHUNK_SIZE;
+    c->headers_len = 0;
+  }
+  else if (length)
+  {
+    c->state = PARSE_BODY;
+    c->remaining = strtoull(length, NULL, 10);
+  }
+  else
+  {
+    c->state = PARSE_UNTIL_CLOSE;
+  }
+}
+
+// Reads one CRLF-terminated line into headers, true once it's complete
+static bool read_line(Conn *c, const char **data, size_t *len)
+{
+  while (*len > 0)
+  {
+    char ch = **data;
+    (*data)++;
+    (*len)--;
+    if (c->headers_len < HEADERS_MAX - 1)
+      c->headers[c->headers_len++] = ch;
+    if (ch == '\n')
+    {
+      c->headers[c->headers_len] = '\0';
+      return true;
+    }
+  }
+  return false;
+}
+
+static void feed(Worker *w, Conn *c, const char *data, size_t len)
+{
+  while (len > 0 && c->inflight_count > 0)
+  {
+    switch (c->state)
+    {
+    case PARSE_HEADERS:
+      while (len > 0)
+      {
+        if (c->headers_len < HEADERS_MAX - 1)
+          c->headers[c->headers_len++] = *data;
+        data++;
+        len--;
+        if (c->headers_len >= 4 && memcmp(c->headers + c->headers_len - 4, "\r\n\r\n", 4) == 0)
+        {
+          start_body(c);
+          break;
+        }
+      }
+      if (c->state == PARSE_BODY && c->remaining == 0)
+        complete(w, c);
+      break;
+    case PARSE_BODY:
+    {
+      size_t n = len < c->remaining ? len : (size_t)c->remaining;
+      data += n;
+      len -= n;
+      c->remaining -= n;
+      if (c->remaining == 0)
+        complete(w, c);
+      break;
+    }
+    case PARSE_CHUNK_SIZE:
+      if (read_line(c, &data, &len))
+      {
+        c->remaining = strtoull(c->headers, NULL, 16);
+        c->headers_len = 0;
+        if (c->remaining == 0)
+          c->state = PARSE_TRAILER;
+        else
+        {
+          c->remaining += 2; // The CRLF after the data
+          c->state = PARSE_CHUNK_DATA;
+        }
+      }
+      break;
+    case PARSE_CHUNK_DATA:
+    {
+      size_t n = len < c->remaining ? len : (size_t)c->remaining;
+      data += n;
+      len -= n;
+      c->remaining -= n;
+      if (c->remaining == 0)
+        c->state = PARSE_CHUNK_SIZE;
+      break;
+    }
+    case PARSE_TRAILER:
+      if (read_line(c, &data, &len))
+      {
+        bool empty = c->headers_len == 2;
+        c->headers_len = 0;
+        if (empty)
+          complete(w, c);
+      }
+      break;
+    case PARSE_UNTIL_CLOSE:
+      len = 0;
+      break;
+    }
+  }
+}
+
+static void on_readable(Worker *w, Conn *c)
+{
+  char buffer[65536];
+  while (c->fd >= 0)
+  {
+    ssize_t n = recv(c->fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (n < 0)
+    {
+      w->errors.io++;
+      conn_close(w, c);
+      return;
+    }
+    if (n == 0)
+    {
+      if (c->state == PARSE_UNTIL_CLOSE && c->inflight_count > 0)
+        complete(w, c);
+      conn_close(w, c);
+      return;
+    }
+    w->bytes_read += (uint64_t)n;
+    feed(w, c, buffer, (size_t)n);
+
+    // Nothing more is expected on it
+    if (!options.keep_alive && c->inflight_count == 0)
+    {
+      conn_close(w, c);
+      return;
+    }
+  }
+}
+
+static void on_event(Worker *w, Conn *c, uint32_t events)
+{
+  if (c->connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+  {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error != 0)
+    {
+      w->errors.connect++;
+      // Those requests never reached the server
+      w->sent -= (uint64_t)c->inflight_count;
+      c->inflight_count = 0;
+      conn_close(w, c);
+      return;
+    }
+    c->connecting = false;
+  }
+
+  if (events & EPOLLOUT)
+    conn_flush(w, c);
+  if (c->fd >= 0 && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+    on_readable(w, c);
+}
+
+static int inflight(const Worker *w)
+{
+  int total = 0;
+  for (int i = 0; i < w->conn_count; i++)
+    total += w->conns[i].inflight_count;
+  return total;
+}
+
+// Hands out requests: every free slot in closed loop, what is due in open loop
+static void refill(Worker *w, uint64_t now)
+{
+  if (w->rate <= 0)
+  {
+    for (int i = 0; i < w->conn_count; i++)
+    {
+      Conn *c = &w->conns[i];
+      while (conn_ready(c) && c->inflight_count < options.pipeline)
+      {
+        if (!conn_send(w, c, now_ns()))
+          break;
+      }
+    }
+    return;
+  }
+
+  // Requests are due every 1/rate seconds from the start, whether or not a
+  // connection was free at the time
+  double interval_ns = 1e9 / w->rate;
+  uint64_t due = now < w->start_ns ? 0 : (uint64_t)((double)(now - w->start_ns) / interval_ns) + 1;
+  for (int i = 0; i < w->conn_count && w->sent < due; i++)
+  {
+    Conn *c = &w->conns[i];
+    while (w->sent < due && conn_ready(c))
+    {
+      uint64_t due_ns = w->start_ns + (uint64_t)((double)w->sent * interval_ns);
+      if (!conn_send(w, c, due_ns))
+        break;
+    }
+  }
+}
+
+static void *worker_main(void *arg)
+{
+  Worker *w = arg;
+  struct epoll_event events[64];
+
+  while (now_ns() < w->start_ns)
+    usleep(100);
+
+  bool running = true;
+  while (true)
+  {
+    uint64_t now = now_ns();
+    if (running && now >= w->end_ns)
+    {
+      running = false;
+      if (w->rate > 0)
+      {
+        uint64_t due = (uint64_t)((double)(w->end_ns - w->start_ns) * w->rate / 1e9);
+        w->errors.unsent = due > w->sent ? due - w->sent : 0;
+      }
+    }
+    if (!running && (inflight(w) == 0 || now >= w->end_ns + DRAIN_NS))
+      break;
+    if (running)
+      refill(w, now);
+
+    // Until the next request is due, or until a connection frees up when
+    // requests are already waiting for one
+    uint64_t wake_ns = running ? w->end_ns : w->end_ns + DRAIN_NS;
+    if (running && w->rate > 0)
+    {
+      uint64_t next_ns = w->start_ns + (uint64_t)((double)w->sent * 1e9 / w->rate);
+      if (next_ns > now && next_ns < wake_ns)
+        wake_ns = next_ns;
+    }
+    uint64_t wait_ns = wake_ns > now ? wake_ns - now : 0;
+    int timeout = wait_ns > 100000000ULL ? 100 : (int)((wait_ns + 999999) / 1000000);
+    int n = epoll_wait(w->epollfd, events, 64, timeout);
+    for (int i = 0; i < n; i++)
+      on_event(w, events[i].data.ptr, events[i].events);
+  }
+
+  for (int i = 0; i < w->conn_count; i++)
+    conn_close(w, &w->conns[i]);
+  return NULL;
+}
+
+// Blocking request for the setup, fills in the session cookie if one is set
+static int request_once(const char *request, char *cookie, size_t cookie_size)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+  {
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  send(fd, request, strlen(request), MSG_NOSIGNAL);
+
+  char response[4096];
+  size_t len = 0;
+  ssize_t n;
+  while (len < sizeof(response) - 1 && (n = recv(fd, response + len, sizeof(response) - 1 - len, 0)) > 0)
+    len += (size_t)n;
+  response[len] = '\0';
+  close(fd);
+
+  int status = 0;
+  sscanf(response, "HTTP/%*d.%*d %d", &status);
+  const char *set_cookie = find_header(response, "Set-Cookie");
+  if (cookie && set_cookie)
+  {
+    size_t end = strcspn(set_cookie, ";\r\n");
+    snprintf(cookie, cookie_size, "%.*s", (int)end, set_cookie);
+  }
+  return status;
+}
+
+static bool post_credentials(const char *path, Worker *w, char *cookie, size_t cookie_size, int *status)
+{
+  char body[256];
+  char request[512];
+  int len = snprintf(body, sizeof(body), "{\"username\":\"%s\",\"password\":\"%s\"}", w->username, w->password);
+  snprintf(request, sizeof(request),
+           "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n"
+           "Connection: close\r\n\r\n%s",
+           path, options.address, len, body);
+  *status = request_once(request, cookie, cookie_size);
+  return *status > 0;
+}
+
+// One user per thread, so logins and scores don't all serialize on one row
+static bool setup_session(Worker *w)
+{
+  snprintf(w->username, sizeof(w->username), "loadgen%d_%d", (int)getpid(), w->index);
+  snprintf(w->password, sizeof(w->password), "loadgen-password");
+
+  int status;
+  if (!post_credentials("/register", w, NULL, 0, &status) || (status != 201 && status != 409))
+  {
+    fprintf(stderr, "Could not register %s: status %d\n", w->username, status);
+    return false;
+  }
+  if (!post_credentials("/login", w, w->cookie, sizeof(w->cookie), &status) || status != 200 || !w->cookie[0])
+  {
+    fprintf(stderr, "Could not log in %s: status %d\n", w->username, status);
+    return false;
+  }
+  return true;
+}
+
+static bool parse_mix(char *spec)
+{
+  options.mix_count = 0;
+  options.weight_total = 0;
+  for (char *item = strtok(spec, ","); item; item = strtok(NULL, ","))
+  {
+    if (options.mix_count == MAX_SCRIPTS)
+      return false;
+    char *colon = strchr(item, ':');
+    int weight = 1;
+    if (colon)
+    {
+      *colon = '\0';
+      weight = atoi(colon + 1);
+    }
+
+    int script = -1;
+    for (int s = 0; s < SCRIPT_COUNT; s++)
+    {
+      if (strcmp(item, script_names[s]) == 0)
+        script = s;
+    }
+    if (script < 0 || weight <= 0)
+      return false;
+
+    options.mix[options.mix_count] = (ScriptId)script;
+    options.weights[options.mix_count] = weight;
+    options.mix_count++;
+    options.weight_total += weight;
+  }
+  return options.mix_count > 0;
+}
+
+static void write_latency(FILE *out, const char *name, const Histogram *h, bool last)
+{
+  fprintf(out,
+          "    \"%s\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+          "\"p99.9\": %.1f, \"p99.99\": %.1f, \"max\": %.1f}%s\n",
+          name, (unsigned long long)h->count, h->count ? (double)h->sum_ns / (double)h->count / 1e3 : 0.0,
+          (double)hist_percentile(h, 500000) / 1e3, (double)hist_percentile(h, 900000) / 1e3,
+          (double)hist_percentile(h, 990000) / 1e3, (double)hist_percentile(h, 999000) / 1e3,
+          (double)hist_percentile(h, 999900) / 1e3, (double)h->max_ns / 1e3, last ? "" : ",");
+}
+
+static void write_report(FILE *out, Worker *workers)
+{
+  Histogram *all = calloc(1, sizeof(Histogram));
+  Histogram *scripts = calloc(SCRIPT_COUNT, sizeof(Histogram));
+  if (!all || !scripts)
+  {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  uint64_t sent = 0, completed = 0, bytes = 0;
+  Errors errors = {0};
+  for (int i = 0; i < options.threads; i++)
+  {
+    Worker *w = &workers[i];
+    sent += w->sent;
+    completed += w->completed;
+    bytes += w->bytes_read;
+    errors.connect += w->errors.connect;
+    errors.io += w->errors.io;
+    errors.status_4xx += w->errors.status_4xx;
+    errors.status_5xx += w->errors.status_5xx;
+    errors.unanswered += w->errors.unanswered;
+    errors.unsent += w->errors.unsent;
+    for (int s = 0; s < SCRIPT_COUNT; s++)
+    {
+      hist_add(&scripts[s], &w->latency[s]);
+      hist_add(all, &w->latency[s]);
+    }
+  }
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"target\": \"%s:%d\",\n", options.address, options.port);
+  fprintf(out, "  \"mode\": \"%s\",\n", options.rate > 0 ? "open" : "closed");
+  fprintf(out, "  \"rate\": %.1f,\n", options.rate);
+  fprintf(out, "  \"threads\": %d,\n", options.threads);
+  fprintf(out, "  \"connections\": %d,\n", options.connections);
+  fprintf(out, "  \"keep_alive\": %s,\n", options.keep_alive ? "true" : "false");
+  fprintf(out, "  \"pipeline\": %d,\n", options.pipeline);
+  fprintf(out, "  \"mix\": {");
+  for (int i = 0; i < options.mix_count; i++)
+    fprintf(out, "%s\"%s\": %d", i ? ", " : "", script_names[options.mix[i]], options.weights[i]);
+  fprintf(out, "},\n");
+  fprintf(out, "  \"duration_s\": %d,\n", options.seconds);
+  fprintf(out, "  \"requests\": %llu,\n", (unsigned long long)sent);
+  fprintf(out, "  \"responses\": %llu,\n", (unsigned long long)completed);
+  fprintf(out, "  \"throughput_rps\": %.1f,\n", (double)completed / options.seconds);
+  fprintf(out, "  \"bytes_read\": %llu,\n", (unsigned long long)bytes);
+  fprintf(out,
+          "  \"errors\": {\"connect\": %llu, \"io\": %llu, \"status_4xx\": %llu, \"status_5xx\": %llu, "
+          "\"unanswered\": %llu, \"unsent\": %llu},\n",
+          (unsigned long long)errors.connect, (unsigned long long)errors.io, (unsigned long long)errors.status_4xx,
+          (unsigned long long)errors.status_5xx, (unsigned long long)errors.unanswered,
+          (unsigned long long)errors.unsent);
+  fprintf(out, "  \"latency_us\": {\n");
+  write_latency(out, "all", all, false);
+  for (int i = 0; i < options.mix_count; i++)
+    write_latency(out, script_names[options.mix[i]], &scripts[options.mix[i]], i == options.mix_count - 1);
+  fprintf(out, "  }\n}\n");
+
+  free(all);
+  free(scripts);
+}
+
+static void usage(const char *program)
+{
+  fprintf(stderr,
+          "Usage: %s [-a address] [-p port] [-t threads] [-c connections] [-d seconds] [-r rate] [-k] "
+          "[-P depth] [-m page:8,score:3,login:1] [-o file]\n",
+          program);
+}
+
+int main(int argc, char **argv)
+{
+  char default_mix[] = "page";
+  char *mix = default_mix;
+  int opt;
+  while ((opt = getopt(argc, argv, "a:p:t:c:d:r:kP:m:o:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'a':
+      options.address = optarg;
+      break;
+    case 'p':
+      options.port = atoi(optarg);
+      break;
+    case 't':
+      options.threads = atoi(optarg);
+      break;
+    case 'c':
+      options.connections = atoi(optarg);
+      break;
+    case 'd':
+      options.seconds = atoi(optarg);
+      break;
+    case 'r':
+      options.rate = atof(optarg);
+      break;
+    case 'k':
+      options.keep_alive = true;
+      break;
+    case 'P':
+      options.pipeline = atoi(optarg);
+      options.keep_alive = true;
+      break;
+    case 'm':
+      mix = optarg;
+      break;
+    case 'o':
+      options.output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (options.threads < 1 || options.connections < options.threads || options.seconds < 1 || options.rate < 0 ||
+      options.pipeline < 1 || options.pipeline > MAX_PIPELINE || !parse_mix(mix))
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons((uint16_t)options.port);
+  if (inet_pton(AF_INET, options.address, &server_addr.sin_addr) != 1)
+  {
+    fprintf(stderr, "Invalid address %s\n", options.address);
+    return EXIT_FAILURE;
+  }
+
+  Worker *workers = calloc((size_t)options.threads, sizeof(Worker));
+  if (!workers)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  for (int i = 0; i < options.threads; i++)
+  {
+    Worker *w = &workers[i];
+    w->index = i;
+    w->random = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+    w->conn_count = options.connections / options.threads + (i < options.connections % options.threads);
+    w->conns = calloc((size_t)w->conn_count, sizeof(Conn));
+    w->epollfd = epoll_create1(0);
+    if (!w->conns || w->epollfd < 0)
+    {
+      fprintf(stderr, "Could not set up thread %d\n", i);
+      return EXIT_FAILURE;
+    }
+    for (int c = 0; c < w->conn_count; c++)
+    {
+      w->conns[c].fd = -1;
+      w->conns[c].step = script_steps[SCRIPT_PAGE];
+    }
+    w->rate = options.rate / options.threads;
+    if (uses_session() && !setup_session(w))
+      return EXIT_FAILURE;
+  }
+
+  // Everyone starts on the same clock
+  uint64_t start_ns = now_ns() + 10000000ULL;
+  uint64_t end_ns = start_ns + (uint64_t)options.seconds * 1000000000ULL;
+  for (int i = 0; i < options.threads; i++)
+  {
+    workers[i].start_ns = start_ns;
+    workers[i].end_ns = end_ns;
+    if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+    {
+      fprintf(stderr, "Could not start thread %d\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+  for (int i = 0; i < options.threads; i++)
+    pthread_join(workers[i].thread, NULL);
+
+  FILE *out = options.output ? fopen(options.output, "w") : stdout;
+  if (!out)
+  {
+    perror(options.output);
+    return EXIT_FAILURE;
+  }
+  write_report(out, workers);
+  if (out != stdout)
+    fclose(out);
+
+  for (int i = 0; i < options.threads; i++)
+  {
+    close(workers[i].epollfd);
+    free(workers[i].conns);
+  }
+  free(workers);
+  return EXIT_SUCCESS;
+}